@@ -0,0 +1,24 @@
+/**
+ * @file command_hash.h
+ * @brief Hash function for built-in command dispatch
+ *
+ * Shared by the shell and tools/gen_command_hash.c, which searches for a
+ * seed that maps every name in commands.def to its own table slot.
+ */
+
+#ifndef COMMAND_HASH_H
+#define COMMAND_HASH_H
+
+#include <stdint.h>
+
+// Seeded FNV-1a
+static inline uint32_t command_hash(const char *name, uint32_t seed) {
+    uint32_t hash = 2166136261u ^ seed;
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 16777619u;
+    }
+    return hash ^ (hash >> 15);
+}
+
+#endif //COMMAND_HASH_H
@@ -0,0 +1,590 @@
+/**
+ * @file sdr.h
+ * @brief Declarations for the SDR command module
+ *
+ * Everything under sdr/ includes this header instead of shell.h. The
+ * SDR code is linked into myshell_sdr.so together with librtlsdr and
+ * FFTW, which the shell only dlopens when the first sdr_* command runs
+ * (see sdr_module.c), so a plain shell session never maps them.
+ */
+
+#ifndef SDR_H
+#define SDR_H
+
+#include "shell.h"
+#include <math.h>    // For log10f function
+#include <rtl-sdr.h>  // RTL-SDR library
+#include <fftw3.h>    // For FFT processing
+#include <pthread.h>
+#include "sdr_shm.h"  // Shared-memory spectrum ring
+
+// SDR Constants
+#define DEFAULT_SAMPLE_RATE 2048000
+#define DEFAULT_BUFFER_SIZE 16384
+#define DEFAULT_FREQ 100000000  // 100 MHz
+#define DATA_DIR "./data"
+#define SPECTRUM_DIR "./data/spectrum_logs"
+#define IQ_DIR "./data/iq_samples"
+#define SNR_DIR "./data/snr_logs"
+#define AUDIO_DIR "./data/audio"
+
+// SDR command functions
+int cmd_sdr_scan(char **args);
+int cmd_sdr_monitor(char **args);
+int cmd_sdr_pipeline(char **args);
+int cmd_sdr_record(char **args);
+int cmd_sdr_info(char **args);
+int cmd_sdr_snr(char **args);
+int cmd_sdr_analyze(char **args);
+int cmd_sdr_batch(char **args);
+int cmd_sdr_find(char **args);
+int cmd_sdr_view(char **args);
+int cmd_sdr_schedule(char **args);
+int cmd_sdr_remote(char **args);
+int cmd_sdr_serve(char **args);
+int cmd_sdr_pool(char **args);
+int cmd_sdr_fm(char **args);
+int cmd_sdr_adsb(char **args);
+
+// Min/max/mean pyramid over a uniformly stepped spectrum
+typedef struct {
+    float min, max;               // min > max marks an empty node
+    double sum;
+} pyramid_node_t;
+
+typedef struct {
+    double start_freq;            // Frequency of bin 0 in Hz
+    double step;                  // Bin spacing in Hz
+    uint64_t n_bins;              // Bins appended so far
+    uint64_t capacity;            // Bins allocated, a power of two
+    int n_levels;                 // Level k holds one node per 2^k bins
+    float *bins;                  // Level 0, the raw powers
+    pyramid_node_t **levels;      // Levels 1 .. n_levels-1 (levels[0] unused)
+} spectrum_pyramid_t;
+
+spectrum_pyramid_t *pyramid_create(double start_freq, double step, uint64_t expected_bins);
+int pyramid_append(spectrum_pyramid_t *p, double power);
+uint64_t pyramid_query(const spectrum_pyramid_t *p, uint64_t first, uint64_t end, pyramid_node_t *out);
+uint64_t pyramid_bin(const spectrum_pyramid_t *p, double freq);
+int pyramid_save(const spectrum_pyramid_t *p, const char *path);
+spectrum_pyramid_t *pyramid_load(const char *path);
+void pyramid_free(spectrum_pyramid_t *p);
+void pyramid_path(const char *csv_path, char *out, size_t out_len);
+
+// SDR utility functions
+int create_data_directories();
+char* get_timestamp_string();
+uint64_t sdr_monotonic_ns();
+uint64_t sdr_realtime_ns();
+void format_utc_time(uint64_t ns, char *buf, size_t len);
+int display_terminal_spectrum(const spectrum_pyramid_t *pyr, double lo_freq, double hi_freq, uint32_t current_freq);
+double compute_buffer_power(const uint8_t *buffer, int n);
+float compute_snr(const float *power_spectrum, int fft_size, float *signal_power, float *noise_power);
+
+// The shared device and the buffers and FFT plans kept warm with it
+int open_sdr_device(rtlsdr_dev_t **dev);
+void close_sdr_device(rtlsdr_dev_t *dev);
+void sdr_device_retain();
+void sdr_device_release();
+struct sample_ring *sdr_sample_ring();
+fftwf_plan sdr_plan_dft(int size, fftwf_complex *in, fftwf_complex *out);
+void sdr_destroy_plan(fftwf_plan plan);
+fftwf_plan sdr_cached_plan(int size, fftwf_complex **in, fftwf_complex **out);
+
+// Process-wide pool of aligned sample buffers (sdr_pool.c)
+void *buffer_pool_alloc(size_t size);
+void buffer_pool_free(void *p, size_t size);
+void buffer_pool_report(FILE *out);
+
+// Front-end corrections and frequency translation (sdr_dsp.c)
+#define DSP_LANES 16                  // Samples the vector loops work on at a time
+#define OFFSET_TUNE_DEFAULT 250000    // Hz the hardware is tuned away from the signal
+
+typedef struct {
+    uint32_t phase;               // Accumulator, 2^32 per cycle
+    uint32_t step;                // Phase advance per sample
+    float lane_re[DSP_LANES];     // Rotation by 0 .. DSP_LANES-1 steps
+    float lane_im[DSP_LANES];
+} nco_t;
+
+typedef struct {
+    double dc_i, dc_q;            // Running means of I and Q
+    double c_ii, c_qq, c_iq;      // Running covariances about them
+    float gain, phase;            // Q is corrected to gain * (Q - phase * I)
+    int primed;
+} iq_correct_t;
+
+typedef struct {
+    float prev_re, prev_im;       // Last sample of the previous packet
+    float gain;                   // Phase step to audio, 1.0 at full deviation
+    float deemph_alpha;           // One-pole de-emphasis, 1.0 for none
+    float deemph;                 // Its output so far
+} fm_demod_t;
+
+#define FM_DEVIATION 75000            // Hz of swing at full modulation, broadcast FM
+#define RESAMPLE_PHASE_TAPS 128       // Taps per polyphase branch, a multiple of DSP_LANES
+
+typedef struct {
+    int up, down;
+    float *taps;                  // up branches of RESAMPLE_PHASE_TAPS, time-reversed
+    float *work;                  // RESAMPLE_PHASE_TAPS - 1 samples of history, then the input
+    size_t work_samples;
+    uint64_t next;                // Next output, in upsampled samples from the start of work
+} resampler_t;
+
+void nco_init(nco_t *n, double freq_hz, double sample_rate);
+void nco_mix(nco_t *n, const float *in, float *out, size_t n_samples);
+void iq_correct_init(iq_correct_t *c);
+void iq_correct_apply(iq_correct_t *c, const float *in, float *out, size_t n_samples, double sample_rate);
+void iq_correct_report(const iq_correct_t *c, FILE *out);
+void fm_demod_init(fm_demod_t *d, double sample_rate, double deviation_hz, double deemphasis_us);
+void fm_demod_run(fm_demod_t *d, const float *iq, float *out, size_t n_samples);
+int resampler_init(resampler_t *r, int up, int down, double cutoff_hz, double in_rate);
+size_t resampler_run(resampler_t *r, const float *in, size_t n_samples, float *out);
+void resampler_free(resampler_t *r);
+void dsp_fir_complex(const float *taps, const float *x, int n_taps, float *re, float *im);
+void dsp_float_to_s16(const float *in, int16_t *out, size_t n_samples);
+
+// Lock-free single-producer/single-consumer ring of sample blocks
+#define SAMPLE_RING_BLOCKS 128        // 2 MiB of DEFAULT_BUFFER_SIZE blocks, one huge page
+#define SAMPLE_RING_HUGEPAGES 1       // sample_ring_init flag
+#define SAMPLE_RING_HUGETLB 1         // sample_ring_t.hugepages values
+#define SAMPLE_RING_THP 2
+
+typedef struct {
+    uint32_t len;                 // Valid bytes
+    uint32_t generation;          // Tuning the block was captured at
+    uint64_t first_sample;        // Samples read before this block, dropped ones included
+    uint64_t arrival_ns;          // CLOCK_MONOTONIC when the USB read returned
+    uint64_t realtime_ns;         // CLOCK_REALTIME at the same moment
+} sample_block_info_t;
+
+typedef struct sample_ring {
+    uint8_t *data;                // n_blocks blocks of block_size bytes
+    size_t map_size;
+    sample_block_info_t *info;    // Per block
+    uint32_t n_blocks;            // A power of two
+    uint32_t block_size;          // A multiple of the cache line
+    int hugepages;                // SAMPLE_RING_HUGETLB, SAMPLE_RING_THP or 0
+
+    // Producer side
+    uint64_t head __attribute__((aligned(64)));  // Blocks committed
+    uint64_t cached_tail;
+    uint64_t overruns;            // Acquires that found the ring full
+
+    // Consumer side
+    uint64_t tail __attribute__((aligned(64)));  // Blocks released
+    uint64_t cached_head;
+} sample_ring_t;
+
+int sample_ring_init(sample_ring_t *r, uint32_t n_blocks, uint32_t block_size, int flags);
+void sample_ring_destroy(sample_ring_t *r);
+void sample_ring_reset(sample_ring_t *r);
+uint8_t *sample_ring_acquire(sample_ring_t *r);
+sample_block_info_t *sample_ring_info(sample_ring_t *r);
+void sample_ring_commit(sample_ring_t *r);
+const uint8_t *sample_ring_peek(sample_ring_t *r, sample_block_info_t *info);
+void sample_ring_release(sample_ring_t *r);
+
+// Capture thread reading the device into the sample ring
+typedef struct {
+    sample_ring_t *ring;
+    rtlsdr_dev_t *dev;
+    uint8_t *scratch;             // Overrun sink while the ring is full
+    pthread_t thread;
+    pthread_mutex_t lock;         // Only for a consumer sleeping on an empty ring
+    pthread_cond_t cond;
+    int waiting;                  // Consumer is (about to be) asleep
+    int stopping;
+    int finished;
+    int failed;                   // The device stopped delivering samples
+    uint32_t generation;          // Tuning being captured (capture thread)
+    uint32_t requested_generation;
+    uint32_t requested_freq;
+    uint64_t samples_read;        // Sample counter (capture thread)
+    uint64_t blocks;              // Blocks handed to the consumer
+    uint64_t next_sample;         // Counter value the consumer expects next
+    uint32_t last_generation;
+    uint64_t dropped_samples;     // Gaps in the counter seen by the consumer
+    uint64_t overruns;            // Filled in by sample_capture_stop
+} sample_capture_t;
+
+int sample_capture_start(sample_capture_t *c, rtlsdr_dev_t *dev);
+void sample_capture_stop(sample_capture_t *c);
+uint32_t sample_capture_retune(sample_capture_t *c, uint32_t freq);
+const uint8_t *sample_capture_next(sample_capture_t *c, uint32_t min_generation, sample_block_info_t *info);
+void sample_capture_release(sample_capture_t *c);
+void sample_capture_report(sample_capture_t *c, FILE *out);
+
+// Live spectra for local readers (sdr_shm.c, include/sdr_shm.h)
+int spectrum_shm_publish(int source, uint64_t timestamp_ns, double center_freq, double first_freq,
+                         double bin_width, const float *power, uint32_t n_bins);
+
+// Listening socket for the network servers (sdr_net.c)
+int sdr_listen(const char *endpoint, const char *who, char *unix_path, size_t unix_path_len);
+
+// gqrx remote control: state published by the monitor
+void remote_publish_frequency(uint32_t freq);
+void remote_publish_power(double dbfs);
+void remote_set_active(int active);
+int remote_take_retune(uint32_t *freq);
+
+// Low-copy IQ writer backend
+#define IQ_IO_ALIGN 4096          // O_DIRECT block and buffer alignment
+#define IQ_WRITER_BUFFERS 32      // Buffers in flight between capture and disk
+#define IQ_WRITER_GAPS 64         // Gaps listed in a recording's .txt
+#define IQ_IO_AUTO 0
+#define IQ_IO_URING 1
+#define IQ_IO_PWRITEV 2
+
+typedef struct iq_io iq_io_t;
+struct iq_writer;
+
+typedef struct iq_buffer {
+    uint8_t *data;                // DEFAULT_BUFFER_SIZE bytes from the buffer pool, page aligned
+    size_t len;                   // Valid bytes
+    int refs;                     // Writes still using the buffer
+    struct iq_writer *owner;
+    struct iq_buffer *next;
+} iq_buffer_t;
+
+iq_io_t *iq_io_create(int want);
+const char *iq_io_describe(iq_io_t *io);
+int iq_io_open_file(iq_io_t *io, const char *path);
+void iq_io_write(iq_io_t *io, int fd, iq_buffer_t *buf, size_t data_off, size_t len, off_t file_off);
+void iq_io_flush(iq_io_t *io);
+void iq_io_drain(iq_io_t *io);
+int iq_io_failed(iq_io_t *io);
+void iq_io_close_file(iq_io_t *io, int fd, uint64_t length);
+void iq_io_destroy(iq_io_t *io);
+
+// Segmented IQ recording
+typedef struct {
+    iq_io_t *io;                  // Backend that performs the writes
+    char base[PATH_MAX];          // Output path without extension
+    uint64_t segment_bytes;       // Bytes per segment, 0 = single file
+    uint64_t quota_bytes;         // Disk quota for all segments, 0 = unlimited
+    uint64_t expected_bytes;      // Size hint for preallocating a single file
+    int fd;                       // Currently open segment
+    int index;                    // Index of the current segment
+    int oldest;                   // Oldest segment still on disk
+    uint64_t seg_written;         // Bytes written to the current segment
+    uint64_t seg_first_sample;    // First sample number in the current segment
+    uint64_t total_bytes;         // Bytes written over the whole recording
+    uint64_t total_samples;       // IQ samples written over the whole recording
+    FILE *manifest;               // Segment boundary log (segmented mode only)
+    uint32_t center_freq;         // Tuning, recorded in the catalog
+    uint32_t sample_rate;
+    time_t start_time;            // Wall-clock time of the first sample
+} segment_writer_t;
+
+int segment_writer_open(segment_writer_t *w, iq_io_t *io, const char *base, uint64_t segment_bytes,
+                        uint64_t quota_bytes, uint64_t expected_bytes,
+                        uint32_t center_freq, uint32_t sample_rate);
+int segment_writer_write(segment_writer_t *w, iq_buffer_t *buf);
+void segment_writer_close(segment_writer_t *w);
+
+// Writer thread feeding a segmented recording from a pool of aligned buffers
+typedef struct iq_writer {
+    segment_writer_t segments;    // Only touched by the writer thread
+    iq_io_t *io;
+    iq_buffer_t buffers[IQ_WRITER_BUFFERS];
+    iq_buffer_t *free_list;
+    iq_buffer_t *queue_head, *queue_tail;
+    int queued;                   // Buffers waiting for the writer thread
+    pthread_mutex_t lock;
+    pthread_cond_t queue_cond;    // Signalled when buffers are queued
+    pthread_cond_t free_cond;     // Signalled when buffers return to the pool
+    pthread_t thread;
+    int running, stopping;
+    volatile int failed;
+    uint64_t stalls;              // Times the capture loop waited for a buffer
+    const char *backend_name;     // Filled in by iq_writer_close
+    uint64_t syscalls;
+    uint64_t bytes_written;
+
+    // Sample timing, filled in by the iq_writer block
+    uint64_t start_ns;            // CLOCK_REALTIME of the first sample, 0 if unknown
+    uint64_t dropped_samples;     // Lost to capture overruns, not in the file
+    uint64_t gaps[IQ_WRITER_GAPS][2];  // File sample and samples dropped there, for the first gaps
+    int n_gaps;                   // All gaps, including those not kept
+} iq_writer_t;
+
+int iq_writer_open(iq_writer_t *w, const char *base, uint64_t segment_bytes,
+                   uint64_t quota_bytes, uint64_t expected_bytes, int backend,
+                   uint32_t center_freq, uint32_t sample_rate);
+iq_buffer_t *iq_writer_get_buffer(iq_writer_t *w);
+void iq_writer_submit(iq_writer_t *w, iq_buffer_t *buf);
+void iq_writer_close(iq_writer_t *w);
+
+// Recording files shared by sdr_record and sdr_pipeline
+void record_base_path(char *base, size_t len);
+void record_save_info(const char *base, uint32_t freq, const iq_writer_t *writer);
+
+// Raw IQ streamed to a pipe or file descriptor
+typedef struct {
+    int fd;
+    int splice;                   // Zero-copy asked for and fd is a pipe; buffers are vmspliced
+    size_t pipe_size;             // Pipe capacity in bytes
+    size_t chunk;                 // Bytes per buffer, IQ_IO_ALIGN aligned
+    int n_slots;                  // Buffers in the ring
+    uint8_t *ring;                // n_slots buffers followed by a bounce buffer
+    size_t ring_size;
+    uint64_t *slot_end;           // Stream offset where each slot's data ended
+    int next_slot;
+    int current;                  // Slot handed out last, -1 for the bounce buffer
+    uint64_t bytes;               // Bytes written so far
+    uint64_t syscalls;
+    uint64_t bounced;             // Chunks copied because their slot was still in the pipe
+    int failed;                   // Write error or the reader went away
+    struct sigaction old_sigpipe;
+} iq_stream_t;
+
+int iq_stream_open(iq_stream_t *s, int fd, size_t chunk, int zero_copy);
+uint8_t *iq_stream_buffer(iq_stream_t *s);
+int iq_stream_write(iq_stream_t *s, const uint8_t *data, size_t len);
+void iq_stream_close(iq_stream_t *s);
+
+// 16-bit mono audio to a WAV file, or raw to a pipe (sdr_fm.c)
+#define AUDIO_OUT_CHUNK 4096          // Samples converted per write
+
+typedef struct {
+    int fd;
+    int wav;                      // Header to complete on close
+    uint32_t sample_rate;
+    uint64_t samples;             // Written so far
+    int reader_gone;              // The pipe's reader closed it
+    int16_t *buffer;              // AUDIO_OUT_CHUNK samples, from the buffer pool
+    struct sigaction old_sigpipe;
+} audio_out_t;
+
+int audio_out_open(audio_out_t *a, const char *path, uint32_t sample_rate);
+int audio_out_write(audio_out_t *a, const float *samples, size_t n);
+void audio_out_close(audio_out_t *a);
+
+// Mode S / ADS-B receiver (sdr_adsb.c)
+#define ADSB_FREQ 1090000000
+#define ADSB_SAMPLE_RATE 2000000      // Two samples per Mode S bit
+#define ADSB_PREAMBLE_SAMPLES 16      // 8 us
+#define ADSB_LONG_BITS 112
+#define ADSB_SHORT_BITS 56
+#define ADSB_FRAME_SAMPLES (ADSB_PREAMBLE_SAMPLES + 2 * ADSB_LONG_BITS)
+#define ADSB_AIRCRAFT 512             // Aircraft tracked at once, a power of two
+
+typedef struct {
+    uint32_t icao;                // 0 marks a free slot
+    uint64_t seen_ns;
+    uint64_t messages;
+    char callsign[9];
+    int altitude;                 // Feet, INT32_MIN if unknown
+    int squawk;                   // -1 if unknown
+    int has_velocity;
+    double speed, heading;        // Knots, degrees from north
+    int vertical_rate;            // Feet per minute
+    uint32_t cpr_lat[2], cpr_lon[2];  // Last even and odd positions
+    uint64_t cpr_ns[2];           // When they came, 0 for never
+    int has_position;
+    double lat, lon;
+} adsb_aircraft_t;
+
+typedef struct {
+    FILE *out;
+    int raw;                      // AVR lines (*hex;) instead of decoded text
+    int relative_time;            // Times as seconds into a replayed file
+    uint16_t *mag;                // Carried-over magnitudes, then the new block's
+    size_t mag_capacity;          // Samples
+    size_t mag_len;
+    uint64_t mag_first;           // Stream position of mag[0]
+    uint64_t next_sample;         // Position the next block should start at
+    uint64_t mag_ns;              // Time of mag[0]
+
+    // Counters
+    uint64_t samples;
+    uint64_t preambles;           // Positions passing the correlator
+    uint64_t valid;               // Frames with a good CRC or known address
+    uint64_t corrected;           // ... of them after fixing one bit
+    uint64_t bad_crc;
+    uint64_t by_df[32];
+
+    adsb_aircraft_t aircraft[ADSB_AIRCRAFT];
+} adsb_decoder_t;
+
+adsb_decoder_t *adsb_decoder_create(FILE *out, int raw, size_t max_block);
+void adsb_decoder_free(adsb_decoder_t *d);
+void adsb_decode(adsb_decoder_t *d, const uint8_t *iq, size_t len, uint64_t first_sample, uint64_t timestamp_ns);
+void adsb_report(const adsb_decoder_t *d, FILE *out);
+
+// Work-stealing thread pool
+typedef void (*work_fn)(void *arg);
+
+typedef struct {
+    work_fn fn;
+    void *arg;
+} work_item_t;
+
+typedef struct {
+    work_item_t *items;           // Ring buffer of tasks
+    int capacity, head, count;
+    pthread_mutex_t lock;
+} work_deque_t;
+
+struct work_pool;
+
+typedef struct {
+    struct work_pool *pool;
+    int index;
+} work_worker_arg_t;
+
+typedef struct work_pool {
+    int n_workers;
+    pthread_t *threads;
+    work_worker_arg_t *args;
+    work_deque_t *deques;         // One per worker
+    int next_target;              // Round-robin target for outside submissions
+    pthread_mutex_t lock;
+    pthread_cond_t work_cond;     // Signalled when tasks are queued
+    pthread_cond_t done_cond;     // Signalled when pending reaches zero
+    uint64_t queued;              // Total tasks ever queued
+    int pending;                  // Tasks queued or running
+    int stopping;
+    uint64_t steals;
+} work_pool_t;
+
+work_pool_t *work_pool_create(int n_workers);
+int work_pool_submit(work_pool_t *pool, work_fn fn, void *arg);
+void work_pool_wait(work_pool_t *pool);
+void work_pool_destroy(work_pool_t *pool);
+
+// Dataflow block graph (sdr_graph.c) and the blocks it is built from
+// (sdr_blocks.c)
+#define SDR_PACKET_IQ8 1              // 8-bit unsigned IQ pairs, len bytes
+#define SDR_PACKET_COMPLEX 2          // Interleaved float IQ, len / 8 samples
+#define SDR_PACKET_SPECTRUM 3         // n_items power spectra of item_len floats, FFT order
+#define SDR_PACKET_POWER 4            // Mean power over the packet's samples in value
+#define SDR_PACKET_REAL 5             // Float samples, len / 4 of them
+
+#define SDR_BLOCK_CONTINUE 0          // Block work function results
+#define SDR_BLOCK_DONE 1
+
+#define SDR_GRAPH_QUEUE 8             // Packets a block may fall behind its producer
+#define SDR_GRAPH_MAX_OUTPUTS 8
+
+typedef struct sdr_packet {
+    int refs;                     // One per block still to see it
+    int type;                     // SDR_PACKET_*
+    double center_freq;           // Frequency at the middle of the band, Hz
+    double sample_rate;
+    uint32_t generation;          // Tuning generation it was captured at
+    uint64_t first_sample;        // Position of the first sample in the stream
+    uint64_t n_samples;           // Input samples the packet covers
+    uint64_t timestamp_ns;        // CLOCK_REALTIME of the first sample
+    uint64_t arrival_ns;          // CLOCK_MONOTONIC arrival of the newest USB buffer in it
+    uint32_t n_items, item_len;   // Spectra per packet and bins per spectrum
+    double value;
+    size_t len;                   // Valid bytes in data
+    size_t capacity;
+    uint8_t *data;                // capacity bytes from the buffer pool, 64-byte aligned
+    struct sdr_packet *next;      // Free list link
+} sdr_packet_t;
+
+typedef struct sdr_graph sdr_graph_t;
+typedef struct sdr_block sdr_block_t;
+
+// Called with the next input packet, or NULL once the input has ended
+// (and repeatedly with NULL for sources). Returns SDR_BLOCK_DONE to stop.
+typedef int (*sdr_block_fn)(sdr_block_t *b, sdr_packet_t *in);
+
+typedef struct {
+    sdr_packet_t *items[SDR_GRAPH_QUEUE];
+    int head, count;
+    int closed;                   // The producer has finished
+} sdr_queue_t;
+
+struct sdr_block {
+    char name[32];
+    sdr_graph_t *graph;
+    sdr_block_fn work;
+    void *state;
+    void (*cleanup)(void *state);
+    sdr_block_t *upstream;        // NULL for sources
+    sdr_queue_t input;
+    sdr_block_t *outputs[SDR_GRAPH_MAX_OUTPUTS];
+    int n_outputs;
+    int scheduled;                // Queued or running on the pool
+    int finished;
+    uint64_t runs;
+    uint64_t busy_ns;
+    uint64_t latency_count;       // Outputs made by a sink, see sdr_block_latency
+    uint64_t latency_sum_ns, latency_max_ns;
+    sdr_block_t *next;            // Graph's block list
+};
+
+struct sdr_graph {
+    work_pool_t *pool;
+    pthread_mutex_t lock;         // Queues, scheduling flags, free packets
+    pthread_cond_t cond;          // Room downstream of a source, or a block finished
+    sdr_block_t *blocks, *last;   // In creation order
+    int live;                     // Blocks not finished yet
+    int stopping;
+    int failed;
+    sdr_packet_t *free_packets;
+};
+
+sdr_graph_t *sdr_graph_create(int n_workers);
+sdr_block_t *sdr_graph_add(sdr_graph_t *g, const char *name, sdr_block_fn work,
+                           void *state, void (*cleanup)(void *state));
+int sdr_graph_connect(sdr_block_t *from, sdr_block_t *to);
+int sdr_graph_run(sdr_graph_t *g);
+void sdr_graph_stop(sdr_graph_t *g);
+int sdr_graph_stopping(sdr_graph_t *g);
+void sdr_graph_fail(sdr_graph_t *g);
+void sdr_graph_report(sdr_graph_t *g, FILE *out);
+void sdr_graph_report_latency(sdr_graph_t *g, FILE *out);
+void sdr_graph_destroy(sdr_graph_t *g);
+sdr_packet_t *sdr_packet_get(sdr_graph_t *g, size_t capacity);
+void sdr_packet_put(sdr_graph_t *g, sdr_packet_t *p);
+void sdr_block_emit(sdr_block_t *b, sdr_packet_t *p);
+void sdr_block_latency(sdr_block_t *b, const sdr_packet_t *p);
+
+sdr_block_t *block_capture(sdr_graph_t *g, sample_capture_t *c, uint32_t freq, uint64_t max_samples);
+sdr_block_t *block_sweep(sdr_graph_t *g, sample_capture_t *c, uint32_t start_freq, uint32_t end_freq,
+                         uint32_t step, int blocks_per_step);
+void block_capture_retune(sdr_block_t *source, uint32_t freq);
+sdr_block_t *block_convert(sdr_graph_t *g);
+sdr_block_t *block_correct(sdr_graph_t *g);
+void block_correct_report(sdr_block_t *b, FILE *out);
+sdr_block_t *block_mix(sdr_graph_t *g, double offset_hz);
+sdr_block_t *block_lowpass(sdr_graph_t *g, double cutoff_hz, int decimation);
+sdr_block_t *block_fm_demod(sdr_graph_t *g, double deemphasis_us);
+sdr_block_t *block_resample(sdr_graph_t *g, int up, int down, double cutoff_hz);
+sdr_block_t *block_fft(sdr_graph_t *g, int fft_size);
+sdr_block_t *block_power(sdr_graph_t *g, uint64_t samples_per_reading);
+sdr_block_t *block_detector(sdr_graph_t *g, float threshold_db);
+sdr_block_t *block_snr_log(sdr_graph_t *g, FILE *csv, int show);
+sdr_block_t *block_meter(sdr_graph_t *g, sdr_block_t *source);
+sdr_block_t *block_iq_writer(sdr_graph_t *g, iq_writer_t *w, int show_progress, uint64_t total_samples);
+sdr_block_t *block_iq_stream(sdr_graph_t *g, iq_stream_t *s);
+sdr_block_t *block_audio(sdr_graph_t *g, audio_out_t *a);
+sdr_block_t *block_adsb(sdr_graph_t *g, adsb_decoder_t *d);
+
+// Metadata catalog of the data directory
+#define CATALOG_IQ 1
+#define CATALOG_SPECTRUM 2
+#define CATALOG_SNR 3
+#define CATALOG_REPORT 4
+
+void catalog_add(int type, const char *path, uint64_t freq_lo, uint64_t freq_hi,
+                 uint32_t sample_rate, time_t time_start, time_t time_end);
+void catalog_remove(const char *path);
+int catalog_rebuild();
+
+// Ctrl+C handling for long-running SDR commands; background threads
+// watch their own cancel flag instead
+void sdr_install_stop_handler();
+void sdr_restore_stop_handler();
+int sdr_stop_requested();
+void sdr_set_thread_cancel(int *flag);
+uint64_t parse_size(const char *text);
+uint64_t parse_frequency(const char *text);
+
+#endif //SDR_H
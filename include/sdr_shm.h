@@ -0,0 +1,170 @@
+/**
+ * @file sdr_shm.h
+ * @brief Shared-memory spectrum ring and its reader
+ *
+ * sdr_scan publishes every sweep and sdr_snr every FFT frame into the
+ * POSIX shared-memory object SDR_SHM_NAME, so local dashboards and
+ * loggers can follow the live spectrum without parsing the CSV logs.
+ *
+ * The object holds a header and a ring of SDR_SHM_SLOTS fixed-size
+ * frames. Each frame is guarded by a sequence counter (a seqlock): the
+ * writer makes it odd, fills the frame, then makes it even again, and
+ * only then advances write_index. A reader maps the object read-only,
+ * looks at a frame in place and checks afterwards that the counter did
+ * not move, so reading costs no copies and no system calls.
+ *
+ * This header is all a consumer needs (link with -lrt on old glibc):
+ *
+ *     sdr_shm_reader_t r;
+ *     if (sdr_shm_open_reader(&r)) {
+ *         uint32_t seq;
+ *         const sdr_shm_frame_t *f = sdr_shm_next(&r, &seq);
+ *         if (f) {
+ *             ... use f->power[0 .. f->n_bins - 1] in place ...
+ *             if (!sdr_shm_frame_valid(f, seq)) ... overwritten, discard ...
+ *         }
+ *         sdr_shm_close_reader(&r);
+ *     }
+ */
+
+#ifndef SDR_SHM_H
+#define SDR_SHM_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SDR_SHM_NAME "/myshell_spectrum"
+#define SDR_SHM_MAGIC 0x4d524653      // "SFRM"
+#define SDR_SHM_VERSION 1
+#define SDR_SHM_SLOTS 16
+#define SDR_SHM_MAX_BINS 16384        // Wider sweeps are peak-decimated to fit
+
+#define SDR_SHM_SOURCE_SCAN 1
+#define SDR_SHM_SOURCE_SNR 2
+
+typedef struct {
+    uint32_t magic;               // SDR_SHM_MAGIC once initialised
+    uint32_t version;
+    uint32_t n_slots;
+    uint32_t max_bins;
+    uint64_t frame_size;          // Bytes per slot, a multiple of 64
+    uint64_t write_index;         // Frames published so far
+    uint32_t writer_pid;          // Publisher currently writing, 0 if none
+    uint32_t reserved[7];
+} sdr_shm_header_t;
+
+typedef struct {
+    uint32_t seq;                 // Odd while the frame is being written
+    uint32_t source;              // SDR_SHM_SOURCE_*
+    uint64_t frame;               // Index of this frame in the stream
+    uint64_t timestamp_ns;        // CLOCK_REALTIME when the first samples were taken
+    double center_freq;           // Tuning (snr) or middle of the sweep (scan), Hz
+    double first_freq;            // Frequency of power[0], Hz
+    double bin_width;             // Spacing of power[], Hz
+    uint32_t n_bins;
+    uint32_t reserved;
+    float power[];                // Linear power, as in the CSV logs, ascending frequency
+} sdr_shm_frame_t;
+
+typedef struct {
+    const sdr_shm_header_t *header;
+    size_t size;
+    uint64_t next;                // Next frame index to hand out
+    uint64_t lost;                // Frames overwritten before they were read
+} sdr_shm_reader_t;
+
+static inline size_t sdr_shm_frame_size(uint32_t max_bins) {
+    size_t size = sizeof(sdr_shm_frame_t) + sizeof(float) * max_bins;
+    return (size + 63) & ~(size_t)63;
+}
+
+static inline size_t sdr_shm_total_size(uint32_t n_slots, uint32_t max_bins) {
+    return 64 + sdr_shm_frame_size(max_bins) * n_slots;
+}
+
+static inline const sdr_shm_frame_t *sdr_shm_slot(const sdr_shm_header_t *h, uint64_t index) {
+    return (const sdr_shm_frame_t *)((const char *)h + 64 + h->frame_size * (index % h->n_slots));
+}
+
+// Map the ring read-only; returns 0 if nothing has published yet
+static inline int sdr_shm_open_reader(sdr_shm_reader_t *r) {
+    memset(r, 0, sizeof(*r));
+    int fd = shm_open(SDR_SHM_NAME, O_RDONLY | O_CLOEXEC, 0);
+    if (fd < 0) {
+        return 0;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(sdr_shm_header_t)) {
+        close(fd);
+        return 0;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return 0;
+    }
+
+    const sdr_shm_header_t *h = (const sdr_shm_header_t *)map;
+    if (__atomic_load_n(&h->magic, __ATOMIC_ACQUIRE) != SDR_SHM_MAGIC || h->version != SDR_SHM_VERSION ||
+        sdr_shm_total_size(h->n_slots, h->max_bins) > (size_t)st.st_size) {
+        munmap(map, st.st_size);
+        return 0;
+    }
+    r->header = h;
+    r->size = st.st_size;
+
+    // Start with the newest frame
+    uint64_t written = __atomic_load_n(&h->write_index, __ATOMIC_ACQUIRE);
+    r->next = written > 0 ? written - 1 : 0;
+    return 1;
+}
+
+static inline void sdr_shm_close_reader(sdr_shm_reader_t *r) {
+    if (r->header) {
+        munmap((void *)r->header, r->size);
+        r->header = NULL;
+    }
+}
+
+// The next unread frame, in place, or NULL if there is none yet. Frames
+// the writer has already reused are skipped and counted in r->lost.
+// Pass *seq to sdr_shm_frame_valid once done with the frame.
+static inline const sdr_shm_frame_t *sdr_shm_next(sdr_shm_reader_t *r, uint32_t *seq) {
+    const sdr_shm_header_t *h = r->header;
+    for (;;) {
+        uint64_t written = __atomic_load_n(&h->write_index, __ATOMIC_ACQUIRE);
+        if (r->next >= written) {
+            return NULL;
+        }
+        // The oldest slot may be mid-rewrite; stay one behind it
+        if (written - r->next >= h->n_slots) {
+            uint64_t oldest = written - h->n_slots + 1;
+            r->lost += oldest - r->next;
+            r->next = oldest;
+        }
+
+        const sdr_shm_frame_t *f = sdr_shm_slot(h, r->next);
+        uint32_t s = __atomic_load_n(&f->seq, __ATOMIC_ACQUIRE);
+        if (!(s & 1) && f->frame == r->next) {
+            r->next++;
+            *seq = s;
+            return f;
+        }
+        // Overwritten under us; catch up and try again
+        r->lost++;
+        r->next++;
+    }
+}
+
+// Whether a frame from sdr_shm_next was left untouched while it was read
+static inline int sdr_shm_frame_valid(const sdr_shm_frame_t *f, uint32_t seq) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&f->seq, __ATOMIC_RELAXED) == seq;
+}
+
+#endif //SDR_SHM_H
@@ -2,9 +2,10 @@
  * @file shell.h
  * @brief Main header file for the shell
  *
- * Defines constants, structures, and function prototypes for the entire
- * shell application. Includes declarations for both core shell functionality
- * and SDR components. This file is included by all source files.
+ * Defines constants, structures, and function prototypes for the core
+ * shell. It deliberately does not pull in the SDR libraries: the sdr/
+ * commands are declared in sdr.h and built into a module that is only
+ * loaded when one of them is first run.
  */
 
 #ifndef SHELL_H
@@ -21,21 +22,9 @@
 #include <sys/stat.h>
 #include <limits.h>  // For PATH_MAX
 #include <time.h>    // For timestamps in SDR logs
-#include <math.h>    // For log10f function
-#include <rtl-sdr.h>  // RTL-SDR library
-#include <fftw3.h>    // For FFT processing
-
-#define MAX_COMMAND_LENGTH 1024
-#define MAX_ARGS 64
-
-// SDR Constants
-#define DEFAULT_SAMPLE_RATE 2048000
-#define DEFAULT_BUFFER_SIZE 16384
-#define DEFAULT_FREQ 100000000  // 100 MHz
-#define DATA_DIR "./data"
-#define SPECTRUM_DIR "./data/spectrum_logs"
-#define IQ_DIR "./data/iq_samples"
-#define SNR_DIR "./data/snr_logs"
+#include <stdint.h>
+#include <signal.h>
+#include <ctype.h>
 
 // New command structure
 typedef int (*command_function)(char**);
@@ -47,25 +36,46 @@ typedef struct {
 } shell_command;
 
 typedef struct {
-    char *name;
+    char *name;                   // NULL once removed
     char *value;
 } alias_t;
 
-#define MAX_ALIASES 100
-extern alias_t aliases[MAX_ALIASES];
-extern int alias_count;
+// Aliases in definition order with a hash index over them
+typedef struct {
+    alias_t *entries;
+    int count;                    // Entries used, including removed ones
+    int capacity;
+    int live;                     // Entries still defined
+    int32_t *index;               // Entry index + 1; 0 empty, -1 deleted
+    int index_size;               // Power of two
+    int index_used;               // Slots not empty, including deleted
+} alias_table_t;
+
+extern alias_table_t aliases;
+
+alias_t *alias_find(const char *name);
+int alias_exists(const char *name);
+int alias_set(const char *name, const char *value);
+int alias_remove(const char *name);
+void alias_clear();
 
 // Declare the commands array as extern
 extern shell_command commands[];
+shell_command *find_command(const char *name);
 
 // Function declarations
 void print_prompt();
 char* read_command();
-char** parse_command(char* command);
+char** parse_command(const char* command);
 int execute_command(char** args);
+// Per thread, so jobs run by sdr_schedule keep their own status
+extern __thread int last_exit_status;
+void set_exit_status(int wait_status);
 void free_args(char** args);
 char** myshell_completion(const char* text, int start, int end);
 char* myshell_generator(const char* text, int state);
+void path_index_refresh();
+const char **path_index_matches(const char *prefix, int *count);
 
 // Built-in command functions
 int cmd_cd(char **args);
@@ -74,27 +84,31 @@ int cmd_help(char **args);
 int cmd_hello(char **args);
 int cmd_alias(char **args);
 int cmd_unalias(char **args);
+int cmd_hash(char **args);
+
+// SDR commands run from a module loaded on first use (sdr_module.c)
+int sdr_module_dispatch(char **args);
+
+// Operator tokens from parse_command, compared by address
+extern char shell_op_pipe[], shell_op_input[], shell_op_output[], shell_op_append[];
+int is_shell_operator(const char *token);
+int run_pipeline(char **line);
 
-// SDR command functions
-int cmd_sdr_scan(char **args);
-int cmd_sdr_monitor(char **args);
-int cmd_sdr_record(char **args);
-int cmd_sdr_info(char **args);
-int cmd_sdr_snr(char **args);
-
-// SDR utility functions
-int create_data_directories();
-char* get_timestamp_string();
-int open_sdr_device(rtlsdr_dev_t **dev);
-void close_sdr_device(rtlsdr_dev_t *dev);
-int display_terminal_spectrum(uint32_t* freqs, double* powers, int n_points, uint32_t current_freq);
-double find_max_power(double* powers, int n_points);
+// External program execution
+const char *resolve_command(const char *name, int count_hit);
+pid_t spawn_process(char **args, int in_fd, int out_fd);
+int wait_processes(const pid_t *pids, int n);
+int spawn_command(char **args);
+void path_cache_clear();
 
 // Configuration functions
 char* get_config_file_path();
 int initialize_config_file();
 int load_aliases_from_config();
 int save_aliases_to_config();
-int alias_exists(const char* name);
+int journal_alias_set(const char* name, const char* value);
+int journal_alias_remove(const char* name);
+int flush_alias_journal();
+void load_shell_config();
 
 #endif //SHELL_H
\ No newline at end of file
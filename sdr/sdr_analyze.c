@@ -0,0 +1,417 @@
+/**
+ * @file sdr_analyze.c
+ * @brief Offline analysis of recorded IQ files
+ *
+ * Implements the sdr_analyze command which runs the SNR, power-over-time
+ * and spectrum computations of the live commands over an iq_*.dat
+ * recording. The file is memory-mapped and cut into ranges of whole
+ * time intervals that are processed in parallel, one thread per core;
+ * every interval lands in its own result slot so the merged output is
+ * in file order without any sorting. With `-` the power/SNR timeline is
+ * written to stdout instead of a file so it can be piped on.
+ */
+
+#include "sdr.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define ANALYZE_DEFAULT_FFT 1024
+#define ANALYZE_DEFAULT_INTERVAL 0.1   // Seconds per power/SNR row
+
+// Results for one time interval of the recording
+typedef struct {
+    double power;          // Sum of per-frame time-domain power
+    double signal;         // Sum of per-frame signal power
+    double noise;          // Sum of per-frame noise power
+    int frames;
+} analyze_interval_t;
+
+// When the recording's samples were taken, from its metadata
+typedef struct {
+    uint64_t start_ns;             // Real time of the recording's first sample, 0 if unknown
+    uint64_t first_sample;         // Samples in the recording before this file
+    uint64_t gaps[IQ_WRITER_GAPS][2];  // Recording sample and samples dropped before it
+    int n_gaps;
+} analyze_timing_t;
+
+// Work handed to one analysis thread
+typedef struct {
+    const uint8_t *data;           // Start of the mapped recording
+    int fft_size;
+    int frames_per_interval;
+    long total_frames;
+    long first_interval, end_interval;
+    analyze_interval_t *intervals; // Shared, each thread owns its range
+    double *spectrum;              // Private accumulated power spectrum
+    fftwf_complex *fft_in, *fft_out;
+    fftwf_plan plan;
+    int failed;                    // Set if the thread could not run its range
+} analyze_job_t;
+
+// Read the metadata written next to a recording by sdr_record
+static void read_sidecar(const char *iq_path, uint32_t *sample_rate, uint32_t *center_freq,
+                         analyze_timing_t *timing) {
+    char info_path[PATH_MAX];
+    snprintf(info_path, sizeof(info_path), "%s", iq_path);
+
+    // iq_<ts>.dat and segments iq_<ts>_00042.dat both use iq_<ts>.txt
+    char *dot = strrchr(info_path, '.');
+    if (dot) *dot = '\0';
+    char *underscore = strrchr(info_path, '_');
+    int segment = -1;
+    if (underscore && strlen(underscore) == 6 && strspn(underscore + 1, "0123456789") == 5) {
+        segment = atoi(underscore + 1);
+        *underscore = '\0';
+    }
+    strncat(info_path, ".txt", sizeof(info_path) - strlen(info_path) - 1);
+
+    FILE *info = fopen(info_path, "r");
+    if (!info) {
+        fprintf(stderr, "sdr_analyze: no metadata at %s, assuming %u Hz at %u Hz\n",
+                info_path, *sample_rate, *center_freq);
+        return;
+    }
+
+    char line[256];
+    unsigned long long seconds, nanoseconds, dropped, sample, segment_bytes = 0;
+    while (fgets(line, sizeof(line), info)) {
+        sscanf(line, "Sample Rate: %u", sample_rate);
+        sscanf(line, "Center Frequency: %u", center_freq);
+        sscanf(line, "Segment Size: %llu", &segment_bytes);
+        if (sscanf(line, "Start Time: %llu.%llu", &seconds, &nanoseconds) == 2) {
+            timing->start_ns = seconds * 1000000000ull + nanoseconds;
+        }
+        if (sscanf(line, "Gap: %llu samples dropped before sample %llu", &dropped, &sample) == 2 &&
+            timing->n_gaps < IQ_WRITER_GAPS) {
+            timing->gaps[timing->n_gaps][0] = sample;
+            timing->gaps[timing->n_gaps][1] = dropped;
+            timing->n_gaps++;
+        }
+    }
+    fclose(info);
+
+    // Every segment but the last holds segment_bytes
+    if (segment > 0) {
+        timing->first_sample = (uint64_t)segment * segment_bytes / 2;
+    }
+}
+
+// Real time of sample n of the file, counting the samples dropped
+// before it
+static uint64_t analyze_timestamp(const analyze_timing_t *timing, uint64_t n, uint32_t sample_rate) {
+    uint64_t position = timing->first_sample + n;
+    for (int i = 0; i < timing->n_gaps && timing->gaps[i][0] <= timing->first_sample + n; i++) {
+        position += timing->gaps[i][1];
+    }
+    return timing->start_ns + (uint64_t)(position * 1e9 / sample_rate);
+}
+
+// Process one contiguous range of intervals
+static void *analyze_thread(void *arg) {
+    analyze_job_t *job = arg;
+    int fft_size = job->fft_size;
+    float *power_spectrum = buffer_pool_alloc(sizeof(float) * fft_size);
+    if (!power_spectrum) {
+        perror("Failed to allocate analysis buffers");
+        job->failed = 1;
+        return NULL;
+    }
+
+    // Byte-to-float table; much cheaper than the division per sample
+    float lut[256];
+    for (int i = 0; i < 256; i++) {
+        lut[i] = (i - 127.5f) / 127.5f;
+    }
+
+    for (long iv = job->first_interval; iv < job->end_interval; iv++) {
+        analyze_interval_t *out = &job->intervals[iv];
+        long frame = iv * job->frames_per_interval;
+        long end_frame = frame + job->frames_per_interval;
+        if (end_frame > job->total_frames) end_frame = job->total_frames;
+
+        for (; frame < end_frame; frame++) {
+            const uint8_t *iq = job->data + frame * fft_size * 2;
+
+            double power = 0.0;
+            for (int i = 0; i < fft_size; i++) {
+                float I = lut[iq[i * 2]];
+                float Q = lut[iq[i * 2 + 1]];
+                job->fft_in[i][0] = I;
+                job->fft_in[i][1] = Q;
+                power += I * I + Q * Q;
+            }
+
+            fftwf_execute(job->plan);
+
+            for (int i = 0; i < fft_size; i++) {
+                float re = job->fft_out[i][0];
+                float im = job->fft_out[i][1];
+                power_spectrum[i] = re*re + im*im;
+                job->spectrum[i] += power_spectrum[i];
+            }
+
+            float signal_power, noise_power;
+            compute_snr(power_spectrum, fft_size, &signal_power, &noise_power);
+
+            out->power += power / (fft_size * 2);
+            out->signal += signal_power;
+            out->noise += noise_power;
+            out->frames++;
+        }
+    }
+
+    buffer_pool_free(power_spectrum, sizeof(float) * fft_size);
+    return NULL;
+}
+
+// Command to analyse a recorded IQ file offline
+int cmd_sdr_analyze(char **args) {
+    if (args[1] == NULL) {
+        fprintf(stderr, "Usage: sdr_analyze <iq file> [--fft N] [--interval seconds] [--threads N] [-]\n");
+        last_exit_status = 1;
+        return 1;
+    }
+
+    const char *path = args[1];
+    int fft_size = ANALYZE_DEFAULT_FFT;
+    double interval = ANALYZE_DEFAULT_INTERVAL;
+    long n_threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int to_stdout = 0;
+
+    for (int i = 2; args[i] != NULL; i++) {
+        if (strcmp(args[i], "-") == 0) {
+            to_stdout = 1;
+        } else if (strcmp(args[i], "--fft") == 0 && args[i+1]) {
+            fft_size = atoi(args[++i]);
+        } else if (strcmp(args[i], "--interval") == 0 && args[i+1]) {
+            interval = atof(args[++i]);
+        } else if (strcmp(args[i], "--threads") == 0 && args[i+1]) {
+            n_threads = atoi(args[++i]);
+        } else {
+            fprintf(stderr, "sdr_analyze: unknown option %s\n", args[i]);
+            last_exit_status = 1;
+            return 1;
+        }
+    }
+
+    if (fft_size < 16 || (fft_size & (fft_size - 1)) != 0) {
+        fprintf(stderr, "sdr_analyze: FFT size must be a power of two >= 16\n");
+        last_exit_status = 1;
+        return 1;
+    }
+    if (n_threads < 1) n_threads = 1;
+
+    if (!create_data_directories()) {
+        last_exit_status = 1;
+        return 1;
+    }
+
+    uint32_t sample_rate = DEFAULT_SAMPLE_RATE;
+    uint32_t center_freq = DEFAULT_FREQ;
+    analyze_timing_t timing = {0};
+    read_sidecar(path, &sample_rate, &center_freq, &timing);
+
+    // Map the recording
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        perror("Failed to open IQ file");
+        last_exit_status = 1;
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size < fft_size * 2) {
+        fprintf(stderr, "sdr_analyze: %s is too short to analyse\n", path);
+        close(fd);
+        last_exit_status = 1;
+        return 1;
+    }
+
+    const uint8_t *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror("Failed to map IQ file");
+        last_exit_status = 1;
+        return 1;
+    }
+    madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+    madvise((void *)data, st.st_size, MADV_WILLNEED);
+
+    // Split the file into whole intervals of whole FFT frames
+    long total_frames = st.st_size / (fft_size * 2);
+    int frames_per_interval = (int)(interval * sample_rate / fft_size);
+    if (frames_per_interval < 1) frames_per_interval = 1;
+    long n_intervals = (total_frames + frames_per_interval - 1) / frames_per_interval;
+    if (n_threads > n_intervals) n_threads = n_intervals;
+
+    analyze_interval_t *intervals = calloc(n_intervals, sizeof(analyze_interval_t));
+    analyze_job_t *jobs = calloc(n_threads, sizeof(analyze_job_t));
+    pthread_t *threads = calloc(n_threads, sizeof(pthread_t));
+
+    if (!intervals || !jobs || !threads) {
+        perror("Failed to allocate analysis buffers");
+        free(intervals);
+        free(jobs);
+        free(threads);
+        munmap((void *)data, st.st_size);
+        last_exit_status = 1;
+        return 1;
+    }
+
+    // Keep stdout for the timeline when it is being piped
+    FILE *msg = to_stdout ? stderr : stdout;
+
+    fprintf(msg, "Analysing %s: %.1f s at %.2f MHz on %ld thread(s)...\n", path,
+           (double)(st.st_size / 2) / sample_rate, center_freq/1e6, n_threads);
+
+    struct timespec t_start, t_end;
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+
+    // FFTW planning is not thread safe, so every plan is made up front
+    int started = 0;
+    for (long t = 0; t < n_threads; t++) {
+        analyze_job_t *job = &jobs[t];
+        job->data = data;
+        job->fft_size = fft_size;
+        job->frames_per_interval = frames_per_interval;
+        job->total_frames = total_frames;
+        job->first_interval = n_intervals * t / n_threads;
+        job->end_interval = n_intervals * (t + 1) / n_threads;
+        job->intervals = intervals;
+        job->spectrum = buffer_pool_alloc(sizeof(double) * fft_size);
+        job->fft_in = buffer_pool_alloc(sizeof(fftwf_complex) * fft_size);
+        job->fft_out = buffer_pool_alloc(sizeof(fftwf_complex) * fft_size);
+        if (job->spectrum && job->fft_in && job->fft_out) {
+            job->plan = sdr_plan_dft(fft_size, job->fft_in, job->fft_out);
+        }
+        if (!job->plan) {
+            fprintf(stderr, "Failed to allocate FFT resources\n");
+            last_exit_status = 1;
+            break;
+        }
+        memset(job->spectrum, 0, sizeof(double) * fft_size);
+        started++;
+    }
+
+    int running = 0;
+    for (; running < started; running++) {
+        int err = pthread_create(&threads[running], NULL, analyze_thread, &jobs[running]);
+        if (err != 0) {
+            fprintf(stderr, "Failed to start analysis thread: %s\n", strerror(err));
+            break;
+        }
+    }
+    for (int t = 0; t < running; t++) {
+        pthread_join(threads[t], NULL);
+    }
+
+    // Any range left out would leave holes in the merged timeline
+    int complete = started == n_threads && running == started;
+    for (int t = 0; t < running; t++) {
+        if (jobs[t].failed) complete = 0;
+    }
+    if (!complete) {
+        fprintf(stderr, "sdr_analyze: analysis did not complete; no results written\n");
+        last_exit_status = 1;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+    double elapsed = (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) / 1e9;
+
+    // Output files are named after the recording
+    const char *name = strrchr(path, '/');
+    name = name ? name + 1 : path;
+    char stem[NAME_MAX];
+    snprintf(stem, sizeof(stem), "%s", name);
+    char *dot = strrchr(stem, '.');
+    if (dot) *dot = '\0';
+
+    char timeline_name[PATH_MAX], spectrum_name[PATH_MAX];
+    snprintf(timeline_name, sizeof(timeline_name), "%s/analysis_%s.csv", SNR_DIR, stem);
+    snprintf(spectrum_name, sizeof(spectrum_name), "%s/analysis_%s.csv", SPECTRUM_DIR, stem);
+
+    if (complete) {
+        // Power and SNR over time, already in file order
+        FILE *timeline = to_stdout ? stdout : fopen(timeline_name, "w");
+        if (timeline) {
+            // Recordings with a start time also get the real time of each interval
+            fprintf(timeline, "Time,Power,SignalPower,NoisePower,SNR%s\n", timing.start_ns ? ",Timestamp" : "");
+            for (long iv = 0; iv < n_intervals; iv++) {
+                analyze_interval_t *r = &intervals[iv];
+                if (r->frames == 0) continue;
+                uint64_t first = (uint64_t)iv * frames_per_interval * fft_size;
+                double t = (double)first / sample_rate;
+                double signal = r->signal / r->frames;
+                double noise = r->noise / r->frames;
+                fprintf(timeline, "%.3f,%.6f,%.6f,%.6f,%.2f", t, r->power / r->frames,
+                        signal, noise, 10.0 * log10(signal / noise));
+                if (timing.start_ns) {
+                    uint64_t ns = analyze_timestamp(&timing, first, sample_rate);
+                    fprintf(timeline, ",%llu.%06llu", (unsigned long long)(ns / 1000000000ull),
+                            (unsigned long long)(ns % 1000000000ull / 1000));
+                }
+                fprintf(timeline, "\n");
+            }
+            if (to_stdout) {
+                fflush(timeline);
+            } else {
+                fclose(timeline);
+            }
+        } else {
+            perror("Failed to open timeline file");
+            last_exit_status = 1;
+        }
+
+        // Average spectrum, merged across threads and shifted so DC is centred
+        FILE *spectrum = fopen(spectrum_name, "w");
+        if (spectrum) {
+            fprintf(spectrum, "Frequency,Power\n");
+            for (int i = 0; i < fft_size; i++) {
+                int bin = (i + fft_size / 2) % fft_size;
+                double sum = 0.0;
+                for (int t = 0; t < started; t++) {
+                    sum += jobs[t].spectrum[bin];
+                }
+                double bin_freq = center_freq + ((double)i - fft_size / 2) * sample_rate / fft_size;
+                fprintf(spectrum, "%.0f,%.6f\n", bin_freq, sum / total_frames);
+            }
+            fclose(spectrum);
+        } else {
+            perror("Failed to open spectrum file");
+            last_exit_status = 1;
+        }
+
+        double recorded = (double)total_frames * fft_size / sample_rate;
+        fprintf(msg, "Analysed %.1f s of IQ in %.2f s (%.0fx real time)\n", recorded, elapsed,
+               elapsed > 0 ? recorded / elapsed : 0.0);
+        // The outputs describe the recording's band and time span, which
+        // ended when the file was last written
+        time_t rec_end = st.st_mtime;
+        time_t rec_start = rec_end - (time_t)recorded;
+        if (!to_stdout) {
+            catalog_add(CATALOG_SNR, timeline_name, center_freq - sample_rate / 2, center_freq + sample_rate / 2,
+                        sample_rate, rec_start, rec_end);
+        }
+        catalog_add(CATALOG_SPECTRUM, spectrum_name, center_freq - sample_rate / 2, center_freq + sample_rate / 2,
+                    sample_rate, rec_start, rec_end);
+
+        if (!to_stdout) {
+            fprintf(msg, "Power/SNR timeline saved to %s\n", timeline_name);
+        }
+        fprintf(msg, "Average spectrum saved to %s\n", spectrum_name);
+    }
+
+    // Clean up
+    for (int t = 0; t < n_threads; t++) {
+        if (jobs[t].plan) sdr_destroy_plan(jobs[t].plan);
+        buffer_pool_free(jobs[t].fft_in, sizeof(fftwf_complex) * fft_size);
+        buffer_pool_free(jobs[t].fft_out, sizeof(fftwf_complex) * fft_size);
+        buffer_pool_free(jobs[t].spectrum, sizeof(double) * fft_size);
+    }
+    free(threads);
+    free(jobs);
+    free(intervals);
+    munmap((void *)data, st.st_size);
+
+    return 1;
+}
@@ -0,0 +1,631 @@
+/**
+ * @file sdr_batch.c
+ * @brief Parallel batch processing of the data archive
+ *
+ * Implements the sdr_batch command which walks one of the data
+ * directories, runs a reducer over every file on the work-stealing
+ * pool and folds the per-file results into a single report. Each file
+ * writes only to its own result slot, so the workers never contend and
+ * the final merge happens once on the calling thread.
+ */
+
+#include "sdr.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define BATCH_DEFAULT_TOP 10
+#define BATCH_DEFAULT_THRESHOLD -20.0   // dB, for occupancy
+#define BATCH_MAX_TOP 100
+
+typedef struct {
+    double freq;
+    double power;
+    int file;              // Index of the file the peak came from
+} batch_peak_t;
+
+typedef struct {
+    int top;
+    double threshold_db;
+} batch_options_t;
+
+// Input and result slot for one file
+typedef struct batch_file {
+    char *path;
+    const batch_options_t *opts;
+    void (*map)(struct batch_file *f);
+    int index;
+    int ok;
+    uint64_t bytes;
+
+    batch_peak_t *peaks;                 // peaks: opts->top strongest bins, descending
+    int n_peaks;
+
+    double *values;                      // snr: sorted SNR values
+    double *freqs;                       // occupancy: bin frequencies
+    uint8_t *above;                      // occupancy: bin above threshold
+    int n_values;
+
+    double mean_power, max_power;        // power: whole-file statistics
+} batch_file_t;
+
+typedef struct {
+    const char *name;
+    const char *dir;
+    const char *suffix;
+    void (*map)(batch_file_t *f);
+    int (*report)(batch_file_t *files, int n_files, const batch_options_t *opts, FILE *out);
+} batch_reducer_t;
+
+// Read a whole file into a NUL-terminated buffer
+static char *load_file(const char *path, uint64_t *len) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        close(fd);
+        return NULL;
+    }
+
+    char *data = malloc(st.st_size + 1);
+    if (!data) {
+        close(fd);
+        return NULL;
+    }
+
+    size_t got = 0;
+    while (got < (size_t)st.st_size) {
+        ssize_t n = read(fd, data + got, st.st_size - got);
+        if (n <= 0) break;
+        got += n;
+    }
+    close(fd);
+
+    data[got] = '\0';
+    *len = got;
+    return data;
+}
+
+// Position of a named column in a CSV header line, or -1
+static int csv_column(const char *header, const char *name) {
+    size_t name_len = strlen(name);
+    int column = 0;
+    const char *p = header;
+
+    while (*p && *p != '\n') {
+        const char *end = p + strcspn(p, ",\r\n");
+        if ((size_t)(end - p) == name_len && strncmp(p, name, name_len) == 0) {
+            return column;
+        }
+        if (*end != ',') break;
+        p = end + 1;
+        column++;
+    }
+    return -1;
+}
+
+// Value of column n in the CSV row starting at p
+static double csv_field(const char *p, int n) {
+    for (int i = 0; i < n && *p && *p != '\n'; i++) {
+        p = strchr(p, ',');
+        if (!p) return NAN;
+        p++;
+    }
+    return strtod(p, NULL);
+}
+
+// Iterate over data rows: calls fn for every line after the header
+static int csv_rows(const char *data, int (*fn)(const char *row, void *ctx), void *ctx) {
+    const char *line = strchr(data, '\n');
+    int rows = 0;
+    while (line && *++line) {
+        if (!fn(line, ctx)) break;
+        rows++;
+        line = strchr(line, '\n');
+    }
+    return rows;
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+static double percentile(const double *sorted, int n, double p) {
+    if (n == 0) return NAN;
+    int idx = (int)(p / 100.0 * (n - 1) + 0.5);
+    return sorted[idx];
+}
+
+// ---- peaks: strongest bins across spectrum logs ----
+
+typedef struct {
+    batch_file_t *f;
+    int freq_col, power_col;
+} spectrum_ctx_t;
+
+static int peaks_row(const char *row, void *arg) {
+    spectrum_ctx_t *ctx = arg;
+    batch_file_t *f = ctx->f;
+    double freq = csv_field(row, ctx->freq_col);
+    double power = csv_field(row, ctx->power_col);
+    int top = f->opts->top;
+
+    if (isnan(power) || (f->n_peaks == top && power <= f->peaks[top - 1].power)) {
+        return 1;
+    }
+
+    // Insertion into the small descending top-N table
+    int i = f->n_peaks < top ? f->n_peaks++ : top - 1;
+    while (i > 0 && f->peaks[i - 1].power < power) {
+        f->peaks[i] = f->peaks[i - 1];
+        i--;
+    }
+    f->peaks[i] = (batch_peak_t){freq, power, f->index};
+    return 1;
+}
+
+static void peaks_map(batch_file_t *f) {
+    f->peaks = malloc(sizeof(batch_peak_t) * f->opts->top);
+    if (!f->peaks) {
+        perror("Failed to allocate peak table");
+        return;
+    }
+    char *data = load_file(f->path, &f->bytes);
+    if (!data) return;
+
+    spectrum_ctx_t ctx = {f, csv_column(data, "Frequency"), csv_column(data, "Power")};
+    if (ctx.freq_col >= 0 && ctx.power_col >= 0) {
+        csv_rows(data, peaks_row, &ctx);
+        f->ok = 1;
+    }
+    free(data);
+}
+
+static int compare_peak(const void *a, const void *b) {
+    double x = ((const batch_peak_t *)a)->power, y = ((const batch_peak_t *)b)->power;
+    return (x < y) - (x > y);
+}
+
+static int peaks_report(batch_file_t *files, int n_files, const batch_options_t *opts, FILE *out) {
+    batch_peak_t *all = malloc(sizeof(batch_peak_t) * ((size_t)n_files * opts->top + 1));
+    if (!all) {
+        perror("Failed to allocate peak table");
+        return 0;
+    }
+    int n = 0;
+    for (int i = 0; i < n_files; i++) {
+        for (int j = 0; j < files[i].n_peaks; j++) {
+            all[n++] = files[i].peaks[j];
+        }
+    }
+    qsort(all, n, sizeof(batch_peak_t), compare_peak);
+
+    fprintf(out, "Top %d peaks:\n", opts->top);
+    fprintf(out, "  %-14s %-10s %s\n", "Frequency", "Power", "File");
+    for (int i = 0; i < n && i < opts->top; i++) {
+        const char *name = strrchr(files[all[i].file].path, '/');
+        fprintf(out, "  %10.4f MHz %7.2f dB %s\n", all[i].freq / 1e6,
+                10.0 * log10(all[i].power + 1e-10), name ? name + 1 : files[all[i].file].path);
+    }
+    free(all);
+    return 1;
+}
+
+// ---- occupancy: how often each bin is above a threshold ----
+
+typedef struct {
+    batch_file_t *f;
+    int freq_col, power_col;
+    int capacity;
+    int failed;                   // A row could not be stored
+} occupancy_ctx_t;
+
+static int occupancy_row(const char *row, void *arg) {
+    occupancy_ctx_t *ctx = arg;
+    batch_file_t *f = ctx->f;
+
+    if (f->n_values == ctx->capacity) {
+        int capacity = ctx->capacity ? ctx->capacity * 2 : 1024;
+        double *freqs = realloc(f->freqs, sizeof(double) * capacity);
+        uint8_t *above = freqs ? realloc(f->above, capacity) : NULL;
+        if (freqs) f->freqs = freqs;
+        if (above) f->above = above;
+        if (!above) {
+            ctx->failed = 1;
+            return 0;
+        }
+        ctx->capacity = capacity;
+    }
+
+    double power = csv_field(row, ctx->power_col);
+    f->freqs[f->n_values] = csv_field(row, ctx->freq_col);
+    f->above[f->n_values] = 10.0 * log10(power + 1e-10) > f->opts->threshold_db;
+    f->n_values++;
+    return 1;
+}
+
+static void occupancy_map(batch_file_t *f) {
+    char *data = load_file(f->path, &f->bytes);
+    if (!data) return;
+
+    occupancy_ctx_t ctx = {f, csv_column(data, "Frequency"), csv_column(data, "Power"), 0, 0};
+    if (ctx.freq_col >= 0 && ctx.power_col >= 0) {
+        csv_rows(data, occupancy_row, &ctx);
+        if (ctx.failed) {
+            // A truncated file would skew the merged bins; leave it out
+            fprintf(stderr, "sdr_batch: %s: out of memory reading rows\n", f->path);
+            f->n_values = 0;
+        } else {
+            f->ok = 1;
+        }
+    }
+    free(data);
+}
+
+typedef struct {
+    double freq;
+    int above, total;
+} occupancy_bin_t;
+
+static int compare_bin_freq(const void *a, const void *b) {
+    double x = ((const occupancy_bin_t *)a)->freq, y = ((const occupancy_bin_t *)b)->freq;
+    return (x > y) - (x < y);
+}
+
+static int compare_bin_occupancy(const void *a, const void *b) {
+    const occupancy_bin_t *x = a, *y = b;
+    double ox = (double)x->above / x->total, oy = (double)y->above / y->total;
+    if (ox != oy) return (ox < oy) - (ox > oy);
+    return (x->freq > y->freq) - (x->freq < y->freq);
+}
+
+static int occupancy_report(batch_file_t *files, int n_files, const batch_options_t *opts, FILE *out) {
+    long n = 0;
+    for (int i = 0; i < n_files; i++) n += files[i].n_values;
+
+    occupancy_bin_t *bins = malloc(sizeof(occupancy_bin_t) * (n + 1));
+    if (!bins) {
+        perror("Failed to allocate occupancy table");
+        return 0;
+    }
+    long k = 0;
+    for (int i = 0; i < n_files; i++) {
+        for (int j = 0; j < files[i].n_values; j++) {
+            bins[k++] = (occupancy_bin_t){files[i].freqs[j], files[i].above[j], 1};
+        }
+    }
+
+    // Merge identical frequencies from different sweeps
+    qsort(bins, n, sizeof(occupancy_bin_t), compare_bin_freq);
+    long m = 0;
+    for (long i = 0; i < n; i++) {
+        if (m > 0 && bins[m - 1].freq == bins[i].freq) {
+            bins[m - 1].above += bins[i].above;
+            bins[m - 1].total += bins[i].total;
+        } else {
+            bins[m++] = bins[i];
+        }
+    }
+    qsort(bins, m, sizeof(occupancy_bin_t), compare_bin_occupancy);
+
+    fprintf(out, "Busiest %d frequencies (power > %.1f dB):\n", opts->top, opts->threshold_db);
+    for (long i = 0; i < m && i < opts->top; i++) {
+        fprintf(out, "  %10.4f MHz %6.1f%% (%d/%d sweeps)\n", bins[i].freq / 1e6,
+                100.0 * bins[i].above / bins[i].total, bins[i].above, bins[i].total);
+    }
+    free(bins);
+    return 1;
+}
+
+// ---- snr: percentiles of logged SNR ----
+
+typedef struct {
+    batch_file_t *f;
+    int snr_col;
+    int capacity;
+    int failed;                   // A row could not be stored
+} snr_ctx_t;
+
+static int snr_row(const char *row, void *arg) {
+    snr_ctx_t *ctx = arg;
+    batch_file_t *f = ctx->f;
+
+    double snr = csv_field(row, ctx->snr_col);
+    if (isnan(snr) || isinf(snr)) return 1;
+
+    if (f->n_values == ctx->capacity) {
+        int capacity = ctx->capacity ? ctx->capacity * 2 : 1024;
+        double *values = realloc(f->values, sizeof(double) * capacity);
+        if (!values) {
+            ctx->failed = 1;
+            return 0;
+        }
+        f->values = values;
+        ctx->capacity = capacity;
+    }
+    f->values[f->n_values++] = snr;
+    return 1;
+}
+
+static void snr_map(batch_file_t *f) {
+    char *data = load_file(f->path, &f->bytes);
+    if (!data) return;
+
+    snr_ctx_t ctx = {f, csv_column(data, "SNR"), 0, 0};
+    if (ctx.snr_col >= 0) {
+        csv_rows(data, snr_row, &ctx);
+        if (ctx.failed) {
+            fprintf(stderr, "sdr_batch: %s: out of memory reading rows\n", f->path);
+            f->n_values = 0;
+        } else {
+            // Sorting here keeps the expensive part on the workers
+            qsort(f->values, f->n_values, sizeof(double), compare_double);
+            f->ok = 1;
+        }
+    }
+    free(data);
+}
+
+static int snr_report(batch_file_t *files, int n_files, const batch_options_t *opts, FILE *out) {
+    long n = 0;
+    for (int i = 0; i < n_files; i++) n += files[i].n_values;
+
+    double *all = malloc(sizeof(double) * (n + 1));
+    if (!all) {
+        perror("Failed to allocate SNR table");
+        return 0;
+    }
+    fprintf(out, "%-40s %8s %8s %8s %8s\n", "File", "p10", "p50", "p90", "max");
+    long k = 0;
+    for (int i = 0; i < n_files; i++) {
+        batch_file_t *f = &files[i];
+        if (f->n_values == 0) continue;
+        const char *name = strrchr(f->path, '/');
+        fprintf(out, "%-40s %8.2f %8.2f %8.2f %8.2f\n", name ? name + 1 : f->path,
+                percentile(f->values, f->n_values, 10), percentile(f->values, f->n_values, 50),
+                percentile(f->values, f->n_values, 90), f->values[f->n_values - 1]);
+        memcpy(all + k, f->values, sizeof(double) * f->n_values);
+        k += f->n_values;
+    }
+
+    qsort(all, n, sizeof(double), compare_double);
+    if (n > 0) {
+        fprintf(out, "%-40s %8.2f %8.2f %8.2f %8.2f\n", "ALL",
+                percentile(all, n, 10), percentile(all, n, 50), percentile(all, n, 90), all[n - 1]);
+    }
+    free(all);
+    return 1;
+}
+
+// ---- power: mean and peak power of raw IQ recordings ----
+
+static void power_map(batch_file_t *f) {
+    int fd = open(f->path, O_RDONLY);
+    if (fd == -1) return;
+
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return;
+    }
+
+    const uint8_t *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return;
+    madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+
+    // Squared-magnitude table for the 8-bit samples
+    double sq[256];
+    for (int i = 0; i < 256; i++) {
+        double v = (i - 127.5) / 127.5;
+        sq[i] = v * v;
+    }
+
+    double total = 0.0;
+    double peak = 0.0;
+    for (off_t off = 0; off < st.st_size; off += DEFAULT_BUFFER_SIZE) {
+        size_t n = st.st_size - off < DEFAULT_BUFFER_SIZE ? st.st_size - off : DEFAULT_BUFFER_SIZE;
+        double block = 0.0;
+        for (size_t i = 0; i < n; i++) {
+            block += sq[data[off + i]];
+        }
+        total += block;
+        if (block / n > peak) peak = block / n;
+    }
+
+    f->mean_power = total / st.st_size;
+    f->max_power = peak;
+    f->bytes = st.st_size;
+    f->ok = 1;
+    munmap((void *)data, st.st_size);
+}
+
+static int power_report(batch_file_t *files, int n_files, const batch_options_t *opts, FILE *out) {
+    fprintf(out, "%-40s %10s %10s %10s\n", "File", "MB", "mean dB", "peak dB");
+    for (int i = 0; i < n_files; i++) {
+        batch_file_t *f = &files[i];
+        if (!f->ok) continue;
+        const char *name = strrchr(f->path, '/');
+        fprintf(out, "%-40s %10.1f %10.2f %10.2f\n", name ? name + 1 : f->path, f->bytes / 1e6,
+                10.0 * log10(f->mean_power + 1e-10), 10.0 * log10(f->max_power + 1e-10));
+    }
+    return 1;
+}
+
+static const batch_reducer_t reducers[] = {
+    {"peaks", SPECTRUM_DIR, ".csv", peaks_map, peaks_report},
+    {"occupancy", SPECTRUM_DIR, ".csv", occupancy_map, occupancy_report},
+    {"snr", SNR_DIR, ".csv", snr_map, snr_report},
+    {"power", IQ_DIR, ".dat", power_map, power_report},
+    {NULL, NULL, NULL, NULL, NULL}
+};
+
+static void batch_task(void *arg) {
+    batch_file_t *f = arg;
+    f->map(f);
+}
+
+static void batch_free_files(batch_file_t *files, int n_files) {
+    for (int i = 0; i < n_files; i++) {
+        free(files[i].path);
+        free(files[i].peaks);
+        free(files[i].values);
+        free(files[i].freqs);
+        free(files[i].above);
+    }
+    free(files);
+}
+
+// Command to run a reducer over every file in a data directory
+int cmd_sdr_batch(char **args) {
+    const batch_reducer_t *reducer = NULL;
+    for (int i = 0; args[1] && reducers[i].name; i++) {
+        if (strcmp(args[1], reducers[i].name) == 0) {
+            reducer = &reducers[i];
+        }
+    }
+    if (!reducer) {
+        fprintf(stderr, "Usage: sdr_batch <peaks|occupancy|snr|power> [--threads N] [--top N] [--threshold dB]\n");
+        last_exit_status = 1;
+        return 1;
+    }
+
+    batch_options_t opts = {BATCH_DEFAULT_TOP, BATCH_DEFAULT_THRESHOLD};
+    int n_threads = 0;
+    for (int i = 2; args[i] != NULL; i++) {
+        if (strcmp(args[i], "--threads") == 0 && args[i+1]) {
+            n_threads = atoi(args[++i]);
+        } else if (strcmp(args[i], "--top") == 0 && args[i+1]) {
+            opts.top = atoi(args[++i]);
+        } else if (strcmp(args[i], "--threshold") == 0 && args[i+1]) {
+            opts.threshold_db = atof(args[++i]);
+        } else {
+            fprintf(stderr, "sdr_batch: unknown option %s\n", args[i]);
+            last_exit_status = 1;
+            return 1;
+        }
+    }
+    if (opts.top < 1) opts.top = 1;
+    if (opts.top > BATCH_MAX_TOP) opts.top = BATCH_MAX_TOP;
+
+    // Collect the files in name (and therefore time) order
+    struct dirent **entries;
+    int n_entries = scandir(reducer->dir, &entries, NULL, alphasort);
+    if (n_entries < 0) {
+        perror("Failed to read data directory");
+        last_exit_status = 1;
+        return 1;
+    }
+
+    batch_file_t *files = calloc(n_entries + 1, sizeof(batch_file_t));
+    if (!files) {
+        perror("Failed to allocate batch results");
+        for (int i = 0; i < n_entries; i++) free(entries[i]);
+        free(entries);
+        last_exit_status = 1;
+        return 1;
+    }
+
+    int n_files = 0;
+    int ok = 1;
+    size_t suffix_len = strlen(reducer->suffix);
+    for (int i = 0; i < n_entries; i++) {
+        size_t len = strlen(entries[i]->d_name);
+        if (ok && len > suffix_len && strcmp(entries[i]->d_name + len - suffix_len, reducer->suffix) == 0) {
+            char path[PATH_MAX];
+            snprintf(path, sizeof(path), "%s/%s", reducer->dir, entries[i]->d_name);
+            batch_file_t *f = &files[n_files];
+            f->path = strdup(path);
+            if (!f->path) {
+                perror("Failed to allocate batch results");
+                ok = 0;
+            }
+            f->opts = &opts;
+            f->map = reducer->map;
+            f->index = n_files;
+            n_files++;
+        }
+        free(entries[i]);
+    }
+    free(entries);
+
+    if (!ok) {
+        batch_free_files(files, n_files);
+        last_exit_status = 1;
+        return 1;
+    }
+    if (n_files == 0) {
+        printf("No %s files in %s\n", reducer->suffix, reducer->dir);
+        free(files);
+        return 1;
+    }
+
+    work_pool_t *pool = work_pool_create(n_threads);
+    if (!pool) {
+        batch_free_files(files, n_files);
+        last_exit_status = 1;
+        return 1;
+    }
+
+    printf("Running %s over %d file(s) on %d thread(s)...\n", reducer->name, n_files, pool->n_workers);
+
+    struct timespec t_start, t_end;
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+
+    for (int i = 0; i < n_files; i++) {
+        work_pool_submit(pool, batch_task, &files[i]);
+    }
+    work_pool_wait(pool);
+
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+    double elapsed = (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) / 1e9;
+
+    uint64_t bytes = 0;
+    int processed = 0;
+    for (int i = 0; i < n_files; i++) {
+        bytes += files[i].bytes;
+        processed += files[i].ok;
+    }
+
+    // Build the report once, then show it and save it
+    char *report = NULL;
+    size_t report_len = 0;
+    FILE *out = open_memstream(&report, &report_len);
+    if (out) {
+        fprintf(out, "sdr_batch %s: %d of %d file(s), %.1f MB in %.2f s (%.1f MB/s, %llu steals)\n",
+                reducer->name, processed, n_files, bytes / 1e6, elapsed,
+                elapsed > 0 ? bytes / 1e6 / elapsed : 0.0, (unsigned long long)pool->steals);
+        ok = reducer->report(files, n_files, &opts, out);
+        fclose(out);
+    }
+
+    if (!ok) {
+        last_exit_status = 1;
+    } else if (out) {
+        fputs(report, stdout);
+
+        char* timestamp = get_timestamp_string();
+        char filename[PATH_MAX];
+        snprintf(filename, sizeof(filename), "%s/batch_%s_%s.txt", DATA_DIR, reducer->name, timestamp);
+        free(timestamp);
+
+        FILE *file = fopen(filename, "w");
+        if (file) {
+            fputs(report, file);
+            fclose(file);
+            catalog_add(CATALOG_REPORT, filename, 0, 0, 0, time(NULL), time(NULL));
+            printf("Report saved to %s\n", filename);
+        } else {
+            perror("Failed to save report");
+        }
+    }
+    free(report);
+
+    work_pool_destroy(pool);
+    batch_free_files(files, n_files);
+
+    return 1;
+}
@@ -0,0 +1,1000 @@
+/**
+ * @file sdr_blocks.c
+ * @brief Source, processing and sink blocks for the block graph
+ *
+ * The pieces the SDR commands are assembled from (see sdr_graph.c):
+ *
+ *   capture, sweep   IQ8 from the capture ring, at one frequency or stepped
+ *   convert          IQ8 to complex float
+ *   correct          remove the DC spike and IQ imbalance (sdr_dsp.c)
+ *   mix              shift a frequency offset to the centre of the band
+ *   lowpass          windowed-sinc FIR with decimation
+ *   fm_demod         complex baseband to de-emphasised FM audio
+ *   resample         polyphase rational resampling of real samples
+ *   fft              complex to power spectra
+ *   power            IQ8 to mean power per reading
+ *   detector         report signals rising above the noise in spectra
+ *   snr_log          SNR per spectrum to CSV, the terminal and shared memory
+ *   meter            power readings as a bar, plus the remote control link
+ *   iq_writer        IQ8 to a segmented recording on disk
+ *   iq_stream        IQ8 to a pipe or file descriptor
+ *   audio            real samples to 16-bit audio (sdr_fm.c)
+ *   adsb             Mode S frames from IQ8 at 2 MS/s (sdr_adsb.c)
+ *
+ * Blocks keep their own state and are only ever run by one thread at a
+ * time, so nothing here locks.
+ *
+ * Every packet carries the capture's sample counter and the real time of
+ * its first sample, worked out from when its USB buffer arrived, so the
+ * sinks can stamp their output to the microsecond; the arrival time
+ * itself rides along too, for measuring latency end to end.
+ */
+
+#include "sdr.h"
+
+// Describe out as covering the same samples as in
+static void packet_follow(sdr_packet_t *out, const sdr_packet_t *in) {
+    out->center_freq = in->center_freq;
+    out->sample_rate = in->sample_rate;
+    out->generation = in->generation;
+    out->first_sample = in->first_sample;
+    out->n_samples = in->n_samples;
+    out->timestamp_ns = in->timestamp_ns;
+    out->arrival_ns = in->arrival_ns;
+}
+
+// Real time of the sample offset samples after p's first
+static uint64_t packet_time(const sdr_packet_t *p, uint64_t offset) {
+    return p->timestamp_ns + (uint64_t)(offset * 1e9 / p->sample_rate);
+}
+
+// Sources
+
+typedef struct {
+    sample_capture_t *capture;
+    uint32_t freq;
+    uint32_t sample_rate;         // The device's, read when the block is made
+    uint32_t generation;          // Oldest tuning generation still wanted
+    uint64_t next_sample;
+    uint64_t max_samples;         // 0 = until stopped
+    int sweep;                    // Step through start..end
+    uint32_t end_freq, step;
+    int blocks_per_step, taken;
+    uint32_t retune_freq;         // Asked for by another block
+    int retune_pending;
+} capture_state_t;
+
+// The rate the command set the device to
+static uint32_t capture_rate(sample_capture_t *c) {
+    uint32_t rate = rtlsdr_get_sample_rate(c->dev);
+    return rate > 0 ? rate : DEFAULT_SAMPLE_RATE;
+}
+
+static int capture_work(sdr_block_t *b, sdr_packet_t *in) {
+    capture_state_t *s = b->state;
+    sample_capture_t *c = s->capture;
+
+    if (__atomic_load_n(&c->failed, __ATOMIC_ACQUIRE)) {
+        sdr_graph_fail(b->graph);
+        return SDR_BLOCK_DONE;
+    }
+    if (sdr_graph_stopping(b->graph) || (s->max_samples > 0 && s->next_sample >= s->max_samples)) {
+        return SDR_BLOCK_DONE;
+    }
+
+    if (__atomic_exchange_n(&s->retune_pending, 0, __ATOMIC_ACQUIRE)) {
+        s->freq = __atomic_load_n(&s->retune_freq, __ATOMIC_RELAXED);
+        s->generation = sample_capture_retune(c, s->freq);
+    }
+    if (s->sweep && s->taken == s->blocks_per_step) {
+        if ((uint64_t)s->freq + s->step > s->end_freq) {
+            return SDR_BLOCK_DONE;
+        }
+        s->freq += s->step;
+        s->generation = sample_capture_retune(c, s->freq);
+        s->taken = 0;
+    }
+
+    sample_block_info_t info;
+    const uint8_t *block = sample_capture_next(c, s->generation, &info);
+    if (!block) {
+        return SDR_BLOCK_CONTINUE;
+    }
+    uint32_t len = info.len;
+    if (s->max_samples > 0 && s->next_sample + len / 2 > s->max_samples) {
+        len = (uint32_t)(s->max_samples - s->next_sample) * 2;
+    }
+
+    // One copy out of the ring; downstream blocks share the packet
+    sdr_packet_t *p = sdr_packet_get(b->graph, len);
+    if (!p) {
+        sample_capture_release(c);
+        sdr_graph_fail(b->graph);
+        return SDR_BLOCK_DONE;
+    }
+    memcpy(p->data, block, len);
+    sample_capture_release(c);
+
+    // The buffer's last sample had just arrived when the read returned
+    p->type = SDR_PACKET_IQ8;
+    p->center_freq = s->freq;
+    p->sample_rate = s->sample_rate;
+    p->generation = info.generation;
+    p->first_sample = info.first_sample;
+    p->n_samples = len / 2;
+    p->timestamp_ns = info.realtime_ns - (uint64_t)(info.len / 2 * 1e9 / s->sample_rate);
+    p->arrival_ns = info.arrival_ns;
+    p->len = len;
+    s->next_sample += len / 2;
+    s->taken++;
+    sdr_block_emit(b, p);
+    return SDR_BLOCK_CONTINUE;
+}
+
+// Samples from a capture started with the device tuned to freq,
+// max_samples of them (0 = until the graph is stopped)
+sdr_block_t *block_capture(sdr_graph_t *g, sample_capture_t *c, uint32_t freq, uint64_t max_samples) {
+    capture_state_t *s = calloc(1, sizeof(capture_state_t));
+    if (!s) {
+        perror("Failed to allocate capture block");
+        return NULL;
+    }
+    s->capture = c;
+    s->freq = freq;
+    s->sample_rate = capture_rate(c);
+    s->max_samples = max_samples;
+    return sdr_graph_add(g, "capture", capture_work, s, free);
+}
+
+// blocks_per_step blocks at each of start_freq, start_freq + step, ...
+// up to end_freq; the capture starts tuned to start_freq
+sdr_block_t *block_sweep(sdr_graph_t *g, sample_capture_t *c, uint32_t start_freq, uint32_t end_freq,
+                         uint32_t step, int blocks_per_step) {
+    capture_state_t *s = calloc(1, sizeof(capture_state_t));
+    if (!s) {
+        perror("Failed to allocate sweep block");
+        return NULL;
+    }
+    s->capture = c;
+    s->freq = start_freq;
+    s->sample_rate = capture_rate(c);
+    s->sweep = 1;
+    s->end_freq = end_freq;
+    s->step = step;
+    s->blocks_per_step = blocks_per_step > 0 ? blocks_per_step : 1;
+    return sdr_graph_add(g, "sweep", capture_work, s, free);
+}
+
+// Retune a capture block from any thread; it drops what is still in
+// flight from the old frequency
+void block_capture_retune(sdr_block_t *source, uint32_t freq) {
+    capture_state_t *s = source->state;
+    __atomic_store_n(&s->retune_freq, freq, __ATOMIC_RELAXED);
+    __atomic_store_n(&s->retune_pending, 1, __ATOMIC_RELEASE);
+}
+
+// Conversion and filtering
+
+static float iq8_to_float[256];
+
+__attribute__((constructor))
+static void blocks_init() {
+    for (int i = 0; i < 256; i++) {
+        iq8_to_float[i] = (i - 127.5f) / 127.5f;
+    }
+}
+
+static int convert_work(sdr_block_t *b, sdr_packet_t *in) {
+    if (!in) {
+        return SDR_BLOCK_DONE;
+    }
+    sdr_packet_t *out = sdr_packet_get(b->graph, in->len * sizeof(float));
+    if (!out) {
+        sdr_graph_fail(b->graph);
+        return SDR_BLOCK_DONE;
+    }
+    float *iq = (float *)out->data;
+    for (size_t i = 0; i < in->len; i++) {
+        iq[i] = iq8_to_float[in->data[i]];
+    }
+
+    packet_follow(out, in);
+    out->type = SDR_PACKET_COMPLEX;
+    out->len = in->len * sizeof(float);
+    sdr_block_emit(b, out);
+    return SDR_BLOCK_CONTINUE;
+}
+
+sdr_block_t *block_convert(sdr_graph_t *g) {
+    return sdr_graph_add(g, "convert", convert_work, NULL, NULL);
+}
+
+static int correct_work(sdr_block_t *b, sdr_packet_t *in) {
+    if (!in) {
+        return SDR_BLOCK_DONE;
+    }
+    sdr_packet_t *out = sdr_packet_get(b->graph, in->len);
+    if (!out) {
+        sdr_graph_fail(b->graph);
+        return SDR_BLOCK_DONE;
+    }
+    iq_correct_apply(b->state, (const float *)in->data, (float *)out->data,
+                     in->len / (2 * sizeof(float)), in->sample_rate);
+
+    packet_follow(out, in);
+    out->type = SDR_PACKET_COMPLEX;
+    out->len = in->len;
+    sdr_block_emit(b, out);
+    return SDR_BLOCK_CONTINUE;
+}
+
+// Take out the DC spike and the image from IQ imbalance. This removes
+// a carrier at the tuned frequency too, so pair it with offset tuning.
+sdr_block_t *block_correct(sdr_graph_t *g) {
+    iq_correct_t *c = malloc(sizeof(iq_correct_t));
+    if (!c) {
+        perror("Failed to allocate correct block");
+        return NULL;
+    }
+    iq_correct_init(c);
+    return sdr_graph_add(g, "correct", correct_work, c, free);
+}
+
+// The estimates a correct block has settled on, once it has stopped
+void block_correct_report(sdr_block_t *b, FILE *out) {
+    iq_correct_report(b->state, out);
+}
+
+typedef struct {
+    double offset;
+    double sample_rate;           // Rate the oscillator is set up for
+    nco_t nco;                    // Phase carried between packets
+} mix_state_t;
+
+static int mix_work(sdr_block_t *b, sdr_packet_t *in) {
+    mix_state_t *s = b->state;
+    if (!in) {
+        return SDR_BLOCK_DONE;
+    }
+    sdr_packet_t *out = sdr_packet_get(b->graph, in->len);
+    if (!out) {
+        sdr_graph_fail(b->graph);
+        return SDR_BLOCK_DONE;
+    }
+
+    if (in->sample_rate != s->sample_rate) {
+        nco_init(&s->nco, -s->offset, in->sample_rate);
+        s->sample_rate = in->sample_rate;
+    }
+    nco_mix(&s->nco, (const float *)in->data, (float *)out->data, in->len / (2 * sizeof(float)));
+
+    packet_follow(out, in);
+    out->type = SDR_PACKET_COMPLEX;
+    out->center_freq = in->center_freq + s->offset;
+    out->len = in->len;
+    sdr_block_emit(b, out);
+    return SDR_BLOCK_CONTINUE;
+}
+
+// Move the signal offset_hz from the tuning to the centre
+sdr_block_t *block_mix(sdr_graph_t *g, double offset_hz) {
+    mix_state_t *s = calloc(1, sizeof(mix_state_t));
+    if (!s) {
+        perror("Failed to allocate mix block");
+        return NULL;
+    }
+    s->offset = offset_hz;
+    return sdr_graph_add(g, "mix", mix_work, s, free);
+}
+
+typedef struct {
+    double cutoff;
+    int decimation;
+    int n_taps;
+    float *taps;                  // Designed for the first packet's rate
+    float *history;               // Last n_taps - 1 samples, interleaved IQ
+    float *work;                  // history followed by the new packet
+    size_t work_samples;
+    size_t next;                  // Where the next output starts in work
+} lowpass_state_t;
+
+static void lowpass_free(void *arg) {
+    lowpass_state_t *s = arg;
+    free(s->taps);
+    free(s->history);
+    free(s->work);
+    free(s);
+}
+
+// Hamming-windowed sinc with unity gain at DC, padded with zero taps
+// to a whole number of DSP_LANES for dsp_fir_complex
+static int lowpass_design(lowpass_state_t *s, double rate) {
+    int design_taps = 8 * s->decimation + 1;
+    s->n_taps = (design_taps + DSP_LANES - 1) / DSP_LANES * DSP_LANES;
+    s->taps = calloc(s->n_taps, sizeof(float));
+    s->history = calloc(2 * (s->n_taps - 1), sizeof(float));
+    if (!s->taps || !s->history) {
+        perror("Failed to allocate filter");
+        return 0;
+    }
+    double fc = s->cutoff / rate;
+    double sum = 0.0;
+    int mid = design_taps / 2;
+    for (int i = 0; i < design_taps; i++) {
+        int k = i - mid;
+        double sinc = k == 0 ? 2.0 * fc : sin(2.0 * M_PI * fc * k) / (M_PI * k);
+        double window = 0.54 - 0.46 * cos(2.0 * M_PI * i / (design_taps - 1));
+        s->taps[i] = (float)(sinc * window);
+        sum += s->taps[i];
+    }
+    for (int i = 0; i < design_taps; i++) {
+        s->taps[i] /= (float)sum;
+    }
+    return 1;
+}
+
+static int lowpass_work(sdr_block_t *b, sdr_packet_t *in) {
+    lowpass_state_t *s = b->state;
+    if (!in) {
+        return SDR_BLOCK_DONE;
+    }
+    if (!s->taps && !lowpass_design(s, in->sample_rate)) {
+        sdr_graph_fail(b->graph);
+        return SDR_BLOCK_DONE;
+    }
+
+    size_t keep = s->n_taps - 1;
+    size_t n = in->len / (2 * sizeof(float));
+    if (keep + n > s->work_samples) {
+        float *work = realloc(s->work, sizeof(float) * 2 * (keep + n));
+        if (!work) {
+            perror("Failed to allocate filter");
+            sdr_graph_fail(b->graph);
+            return SDR_BLOCK_DONE;
+        }
+        s->work = work;
+        s->work_samples = keep + n;
+    }
+    memcpy(s->work, s->history, sizeof(float) * 2 * keep);
+    memcpy(s->work + 2 * keep, in->data, in->len);
+
+    size_t total = keep + n;
+    size_t max_out = total >= s->next + s->n_taps ? (total - s->n_taps - s->next) / s->decimation + 1 : 0;
+    sdr_packet_t *out = sdr_packet_get(b->graph, sizeof(float) * 2 * (max_out ? max_out : 1));
+    if (!out) {
+        sdr_graph_fail(b->graph);
+        return SDR_BLOCK_DONE;
+    }
+
+    float *y = (float *)out->data;
+    size_t produced = 0;
+    size_t pos = s->next;
+    for (; pos + s->n_taps <= total; pos += s->decimation) {
+        dsp_fir_complex(s->taps, s->work + 2 * pos, s->n_taps, &y[2*produced], &y[2*produced+1]);
+        produced++;
+    }
+    s->next = pos - n;
+    memcpy(s->history, s->work + 2 * n, sizeof(float) * 2 * keep);
+
+    if (produced == 0) {
+        sdr_packet_put(b->graph, out);
+        return SDR_BLOCK_CONTINUE;
+    }
+    packet_follow(out, in);
+    out->type = SDR_PACKET_COMPLEX;
+    out->sample_rate = in->sample_rate / s->decimation;
+    out->first_sample = in->first_sample / s->decimation;    // Counted at the output rate
+    out->n_samples = produced;
+    out->len = sizeof(float) * 2 * produced;
+    sdr_block_emit(b, out);
+    return SDR_BLOCK_CONTINUE;
+}
+
+// Keep +-cutoff_hz around the centre and take every decimation'th sample
+sdr_block_t *block_lowpass(sdr_graph_t *g, double cutoff_hz, int decimation) {
+    lowpass_state_t *s = calloc(1, sizeof(lowpass_state_t));
+    if (!s) {
+        perror("Failed to allocate filter block");
+        return NULL;
+    }
+    s->cutoff = cutoff_hz;
+    s->decimation = decimation > 0 ? decimation : 1;
+    return sdr_graph_add(g, "lowpass", lowpass_work, s, lowpass_free);
+}
+
+typedef struct {
+    double deemphasis_us;
+    fm_demod_t demod;             // Set up for the first packet's rate
+    int ready;
+} fm_demod_state_t;
+
+static int fm_demod_work(sdr_block_t *b, sdr_packet_t *in) {
+    fm_demod_state_t *s = b->state;
+    if (!in) {
+        return SDR_BLOCK_DONE;
+    }
+    size_t n = in->len / (2 * sizeof(float));
+    sdr_packet_t *out = sdr_packet_get(b->graph, sizeof(float) * (n ? n : 1));
+    if (!out) {
+        sdr_graph_fail(b->graph);
+        return SDR_BLOCK_DONE;
+    }
+    if (!s->ready) {
+        fm_demod_init(&s->demod, in->sample_rate, FM_DEVIATION, s->deemphasis_us);
+        s->ready = 1;
+    }
+    fm_demod_run(&s->demod, (const float *)in->data, (float *)out->data, n);
+
+    packet_follow(out, in);
+    out->type = SDR_PACKET_REAL;
+    out->len = sizeof(float) * n;
+    sdr_block_emit(b, out);
+    return SDR_BLOCK_CONTINUE;
+}
+
+// Wideband FM discriminator, full deviation to +-1.0, with deemphasis_us
+// of de-emphasis (0 for none)
+sdr_block_t *block_fm_demod(sdr_graph_t *g, double deemphasis_us) {
+    fm_demod_state_t *s = calloc(1, sizeof(fm_demod_state_t));
+    if (!s) {
+        perror("Failed to allocate FM demodulator");
+        return NULL;
+    }
+    s->deemphasis_us = deemphasis_us;
+    return sdr_graph_add(g, "fm_demod", fm_demod_work, s, free);
+}
+
+typedef struct {
+    int up, down;
+    double cutoff;
+    resampler_t resampler;        // Set up for the first packet's rate
+    int ready;
+} resample_state_t;
+
+static void resample_free(void *arg) {
+    resample_state_t *s = arg;
+    resampler_free(&s->resampler);
+    free(s);
+}
+
+static int resample_work(sdr_block_t *b, sdr_packet_t *in) {
+    resample_state_t *s = b->state;
+    if (!in) {
+        return SDR_BLOCK_DONE;
+    }
+    if (!s->ready) {
+        if (!resampler_init(&s->resampler, s->up, s->down, s->cutoff, in->sample_rate)) {
+            sdr_graph_fail(b->graph);
+            return SDR_BLOCK_DONE;
+        }
+        s->ready = 1;
+    }
+
+    size_t n = in->len / sizeof(float);
+    sdr_packet_t *out = sdr_packet_get(b->graph, sizeof(float) * (n * s->up / s->down + 1));
+    if (!out) {
+        sdr_graph_fail(b->graph);
+        return SDR_BLOCK_DONE;
+    }
+    size_t produced = resampler_run(&s->resampler, (const float *)in->data, n, (float *)out->data);
+    if (produced == 0) {
+        sdr_packet_put(b->graph, out);
+        if (n * s->up >= (size_t)s->down) {
+            perror("Failed to allocate resampler");
+            sdr_graph_fail(b->graph);
+            return SDR_BLOCK_DONE;
+        }
+        return SDR_BLOCK_CONTINUE;
+    }
+
+    packet_follow(out, in);
+    out->type = SDR_PACKET_REAL;
+    out->sample_rate = in->sample_rate * s->up / s->down;
+    out->first_sample = in->first_sample * s->up / s->down;    // Counted at the output rate
+    out->n_samples = produced;
+    out->len = sizeof(float) * produced;
+    sdr_block_emit(b, out);
+    return SDR_BLOCK_CONTINUE;
+}
+
+// Resample real samples by up/down, keeping cutoff_hz and below
+sdr_block_t *block_resample(sdr_graph_t *g, int up, int down, double cutoff_hz) {
+    resample_state_t *s = calloc(1, sizeof(resample_state_t));
+    if (!s) {
+        perror("Failed to allocate resampler block");
+        return NULL;
+    }
+    s->up = up;
+    s->down = down;
+    s->cutoff = cutoff_hz;
+    return sdr_graph_add(g, "resample", resample_work, s, resample_free);
+}
+
+// Spectra
+
+typedef struct {
+    int fft_size;
+    fftwf_complex *in, *out;
+    fftwf_plan plan;
+    int pending;                  // Samples already in `in` from earlier packets
+    uint64_t pending_sample;      // Counter and real time of the first of them
+    uint64_t pending_ns;
+} fft_state_t;
+
+static int fft_work(sdr_block_t *b, sdr_packet_t *in) {
+    fft_state_t *s = b->state;
+    if (!in) {
+        return SDR_BLOCK_DONE;
+    }
+
+    int n = (int)(in->len / (2 * sizeof(float)));
+    int n_spectra = (s->pending + n) / s->fft_size;
+    sdr_packet_t *out = sdr_packet_get(b->graph, sizeof(float) * s->fft_size * (n_spectra ? n_spectra : 1));
+    if (!out) {
+        sdr_graph_fail(b->graph);
+        return SDR_BLOCK_DONE;
+    }
+
+    // Samples left over from one packet start the next spectrum
+    const float *x = (const float *)in->data;
+    float *power = (float *)out->data;
+    int made = 0;
+    for (int i = 0; i < n; i++) {
+        if (s->pending == 0) {
+            s->pending_sample = in->first_sample + i;
+            s->pending_ns = packet_time(in, i);
+        }
+        s->in[s->pending][0] = x[2*i];
+        s->in[s->pending][1] = x[2*i+1];
+        if (++s->pending < s->fft_size) {
+            continue;
+        }
+        fftwf_execute(s->plan);
+        for (int k = 0; k < s->fft_size; k++) {
+            float re = s->out[k][0];
+            float im = s->out[k][1];
+            power[made * s->fft_size + k] = re*re + im*im;
+        }
+        if (made == 0) {
+            out->first_sample = s->pending_sample;
+            out->timestamp_ns = s->pending_ns;
+        }
+        made++;
+        s->pending = 0;
+    }
+
+    if (made == 0) {
+        sdr_packet_put(b->graph, out);
+        return SDR_BLOCK_CONTINUE;
+    }
+    // Spectra start where their first sample was, maybe in an earlier packet
+    uint64_t first_sample = out->first_sample, timestamp_ns = out->timestamp_ns;
+    packet_follow(out, in);
+    out->first_sample = first_sample;
+    out->timestamp_ns = timestamp_ns;
+    out->type = SDR_PACKET_SPECTRUM;
+    out->n_items = made;
+    out->item_len = s->fft_size;
+    out->len = sizeof(float) * s->fft_size * made;
+    sdr_block_emit(b, out);
+    return SDR_BLOCK_CONTINUE;
+}
+
+// Power spectra of fft_size bins, in FFT order (DC first). The plan and
+// its buffers are the device's cached ones, kept warm between commands,
+// so a graph has at most one FFT block of each size.
+sdr_block_t *block_fft(sdr_graph_t *g, int fft_size) {
+    fft_state_t *s = calloc(1, sizeof(fft_state_t));
+    if (!s) {
+        perror("Failed to allocate FFT block");
+        return NULL;
+    }
+    s->fft_size = fft_size;
+    s->plan = sdr_cached_plan(fft_size, &s->in, &s->out);
+    if (!s->plan) {
+        free(s);
+        return NULL;
+    }
+    return sdr_graph_add(g, "fft", fft_work, s, free);
+}
+
+typedef struct {
+    uint64_t per_reading;         // Samples per reading
+    double sum;                   // Power times samples so far
+    uint64_t samples;
+    uint64_t first_sample;
+    uint64_t timestamp_ns;
+    uint64_t arrival_ns;          // Of the newest packet in the reading
+    uint32_t generation;
+    double center_freq;
+    double sample_rate;
+} power_state_t;
+
+static sdr_packet_t *power_reading(sdr_block_t *b, power_state_t *s) {
+    sdr_packet_t *out = sdr_packet_get(b->graph, 0);
+    if (out) {
+        out->type = SDR_PACKET_POWER;
+        out->center_freq = s->center_freq;
+        out->sample_rate = s->sample_rate;
+        out->generation = s->generation;
+        out->first_sample = s->first_sample;
+        out->n_samples = s->samples;
+        out->timestamp_ns = s->timestamp_ns;
+        out->arrival_ns = s->arrival_ns;
+        out->value = s->sum / s->samples;
+    }
+    s->sum = 0.0;
+    s->samples = 0;
+    return out;
+}
+
+static int power_work(sdr_block_t *b, sdr_packet_t *in) {
+    power_state_t *s = b->state;
+    if (!in) {
+        // Whatever was collected before the end still counts
+        if (s->samples > 0) {
+            sdr_packet_t *out = power_reading(b, s);
+            if (out) sdr_block_emit(b, out);
+        }
+        return SDR_BLOCK_DONE;
+    }
+
+    // A reading never mixes two tunings
+    if (s->samples == 0 || in->generation != s->generation) {
+        s->sum = 0.0;
+        s->samples = 0;
+        s->first_sample = in->first_sample;
+        s->timestamp_ns = in->timestamp_ns;
+        s->generation = in->generation;
+        s->center_freq = in->center_freq;
+        s->sample_rate = in->sample_rate;
+    }
+    s->sum += compute_buffer_power(in->data, (int)in->len) * in->n_samples;
+    s->samples += in->n_samples;
+    s->arrival_ns = in->arrival_ns;
+
+    if (s->samples >= s->per_reading) {
+        sdr_packet_t *out = power_reading(b, s);
+        if (!out) {
+            sdr_graph_fail(b->graph);
+            return SDR_BLOCK_DONE;
+        }
+        sdr_block_emit(b, out);
+    }
+    return SDR_BLOCK_CONTINUE;
+}
+
+// Mean power of IQ8 samples, one reading per samples_per_reading samples
+sdr_block_t *block_power(sdr_graph_t *g, uint64_t samples_per_reading) {
+    power_state_t *s = calloc(1, sizeof(power_state_t));
+    if (!s) {
+        perror("Failed to allocate power block");
+        return NULL;
+    }
+    s->per_reading = samples_per_reading > 0 ? samples_per_reading : 1;
+    return sdr_graph_add(g, "power", power_work, s, free);
+}
+
+// Sinks
+
+typedef struct {
+    float threshold;              // dB above the noise to report a signal
+    int active;
+    double active_freq;
+    uint64_t active_since;        // Sample the signal appeared at
+    double peak_snr;
+    uint64_t detections;
+} detector_state_t;
+
+static int detector_work(sdr_block_t *b, sdr_packet_t *in) {
+    detector_state_t *s = b->state;
+    if (!in) {
+        if (s->active) {
+            printf("\nDetector: %.4f MHz still up at the end, peak %.1f dB\n",
+                   s->active_freq / 1e6, s->peak_snr);
+        }
+        printf("Detector: %llu detection(s) above %.1f dB\n", (unsigned long long)s->detections, s->threshold);
+        return SDR_BLOCK_DONE;
+    }
+
+    int size = in->item_len;
+    double bin_width = in->sample_rate / size;
+    for (uint32_t item = 0; item < in->n_items; item++) {
+        const float *power = (const float *)in->data + (size_t)item * size;
+
+        // Peak bin against the mean of the bins away from it
+        int peak = 0;
+        for (int k = 1; k < size; k++) {
+            if (power[k] > power[peak]) peak = k;
+        }
+        double noise = 0.0;
+        int noise_bins = 0;
+        for (int k = 0; k < size; k++) {
+            int distance = abs(k - peak);
+            if (distance > size / 2) distance = size - distance;
+            if (distance > 2) {
+                noise += power[k];
+                noise_bins++;
+            }
+        }
+        noise = noise_bins > 0 ? noise / noise_bins : 0.0;
+        double snr = noise > 0.0 ? 10.0 * log10(power[peak] / noise) : 0.0;
+        double freq = in->center_freq + (peak < size / 2 ? peak : peak - size) * bin_width;
+        uint64_t sample = in->first_sample + (uint64_t)item * size;
+        char when[40];
+        format_utc_time(packet_time(in, (uint64_t)item * size), when, sizeof(when));
+
+        // 3 dB of hysteresis keeps a signal near the threshold from chattering
+        if (!s->active && snr >= s->threshold) {
+            s->active = 1;
+            s->active_freq = freq;
+            s->active_since = sample;
+            s->peak_snr = snr;
+            s->detections++;
+            printf("\nDetector: signal at %.4f MHz, %.1f dB above noise, %s\n", freq / 1e6, snr, when);
+        } else if (s->active && snr < s->threshold - 3.0) {
+            s->active = 0;
+            printf("\nDetector: %.4f MHz gone after %.4f s, peak %.1f dB, %s\n", s->active_freq / 1e6,
+                   (sample - s->active_since) / in->sample_rate, s->peak_snr, when);
+        } else if (s->active && snr > s->peak_snr) {
+            s->peak_snr = snr;
+        }
+    }
+    fflush(stdout);
+    sdr_block_latency(b, in);
+    return SDR_BLOCK_CONTINUE;
+}
+
+// Report signals threshold_db above the noise as they come and go
+sdr_block_t *block_detector(sdr_graph_t *g, float threshold_db) {
+    detector_state_t *s = calloc(1, sizeof(detector_state_t));
+    if (!s) {
+        perror("Failed to allocate detector block");
+        return NULL;
+    }
+    s->threshold = threshold_db;
+    return sdr_graph_add(g, "detector", detector_work, s, free);
+}
+
+typedef struct {
+    FILE *csv;
+    int show;                     // Print the running SNR
+    float *shifted;
+    int shifted_len;
+} snr_state_t;
+
+static void snr_free(void *arg) {
+    snr_state_t *s = arg;
+    buffer_pool_free(s->shifted, sizeof(float) * s->shifted_len);
+    free(s);
+}
+
+static int snr_work(sdr_block_t *b, sdr_packet_t *in) {
+    snr_state_t *s = b->state;
+    if (!in) {
+        return SDR_BLOCK_DONE;
+    }
+
+    int size = in->item_len;
+    if (size > s->shifted_len) {
+        buffer_pool_free(s->shifted, sizeof(float) * s->shifted_len);
+        s->shifted = buffer_pool_alloc(sizeof(float) * size);
+        s->shifted_len = s->shifted ? size : 0;
+        if (!s->shifted) {
+            perror("Failed to allocate spectrum");
+            sdr_graph_fail(b->graph);
+            return SDR_BLOCK_DONE;
+        }
+    }
+
+    double bin_width = in->sample_rate / size;
+    for (uint32_t item = 0; item < in->n_items; item++) {
+        const float *power = (const float *)in->data + (size_t)item * size;
+
+        // Publish in ascending frequency order: the upper half of the
+        // FFT holds the negative frequencies
+        for (int i = 0; i < size; i++) {
+            s->shifted[i] = power[(i + size / 2) % size];
+        }
+        uint64_t timestamp_ns = packet_time(in, (uint64_t)item * size);
+        spectrum_shm_publish(SDR_SHM_SOURCE_SNR, timestamp_ns, in->center_freq,
+                             in->center_freq - bin_width * (size / 2), bin_width, s->shifted, size);
+
+        // Calculate SNR
+        float signal_power, noise_power;
+        float snr_db = compute_snr(power, size, &signal_power, &noise_power);
+
+        // Time is when the samples were taken, not when they got here:
+        // seconds into the capture and Unix time, to the microsecond
+        double seconds = (in->first_sample + (uint64_t)item * size) / in->sample_rate;
+        fprintf(s->csv, "%.6f,%.6f,%.6f,%.2f,%llu.%06llu,%.3f\n", seconds, signal_power, noise_power, snr_db,
+                (unsigned long long)(timestamp_ns / 1000000000ull),
+                (unsigned long long)(timestamp_ns % 1000000000ull / 1000),
+                (sdr_monotonic_ns() - in->arrival_ns) / 1e6);
+
+        if (s->show) {
+            printf("\rSNR: %.2f dB", snr_db);
+        }
+    }
+    if (s->show) {
+        fflush(stdout);
+    }
+    sdr_block_latency(b, in);
+    return SDR_BLOCK_CONTINUE;
+}
+
+// SNR of every spectrum to csv (and the terminal if show), and every
+// spectrum to the shared-memory ring. Writes the CSV header.
+sdr_block_t *block_snr_log(sdr_graph_t *g, FILE *csv, int show) {
+    snr_state_t *s = calloc(1, sizeof(snr_state_t));
+    if (!s) {
+        perror("Failed to allocate SNR block");
+        return NULL;
+    }
+    fprintf(csv, "Time,SignalPower,NoisePower,SNR,Timestamp,LatencyMs\n");
+    s->csv = csv;
+    s->show = show;
+    return sdr_graph_add(g, "snr_log", snr_work, s, snr_free);
+}
+
+static int meter_work(sdr_block_t *b, sdr_packet_t *in) {
+    sdr_block_t *source = b->state;
+    if (!in) {
+        return SDR_BLOCK_DONE;
+    }
+
+    // A remote control client asked for another frequency
+    uint32_t retune;
+    if (remote_take_retune(&retune)) {
+        block_capture_retune(source, retune);
+        printf("\nRetuned to %.2f MHz\n", retune/1e6);
+    }
+
+    // Display power meter
+    double power = in->value;
+    int meter_width = 50;
+    int bars = (int)(power * meter_width * 10.0);
+    if (bars > meter_width) bars = meter_width;
+
+    printf("\rSignal: [");
+    for (int i = 0; i < meter_width; i++) {
+        printf("%c", i < bars ? '#' : ' ');
+    }
+    printf("] %.2f dB", 10.0 * log10(power));
+    fflush(stdout);
+    remote_publish_power(10.0 * log10(power));
+    sdr_block_latency(b, in);
+    return SDR_BLOCK_CONTINUE;
+}
+
+// Power readings as a terminal bar; remote retunes go to source
+sdr_block_t *block_meter(sdr_graph_t *g, sdr_block_t *source) {
+    return sdr_graph_add(g, "meter", meter_work, source, NULL);
+}
+
+typedef struct {
+    iq_writer_t *writer;
+    int show_progress;
+    uint64_t total_samples;       // 0 = open-ended
+    uint64_t written;
+    uint64_t next_sample;         // Capture counter the next packet should start at
+    time_t start_time;
+} iq_writer_state_t;
+
+static int iq_writer_work(sdr_block_t *b, sdr_packet_t *in) {
+    iq_writer_state_t *s = b->state;
+    if (!in) {
+        return SDR_BLOCK_DONE;
+    }
+    if (s->writer->failed) {
+        sdr_graph_fail(b->graph);
+        return SDR_BLOCK_DONE;
+    }
+
+    // Note where samples went missing so file positions map back to time
+    iq_writer_t *w = s->writer;
+    if (s->written == 0) {
+        w->start_ns = in->timestamp_ns;
+    } else if (in->first_sample > s->next_sample) {
+        uint64_t dropped = in->first_sample - s->next_sample;
+        if (w->n_gaps < IQ_WRITER_GAPS) {
+            w->gaps[w->n_gaps][0] = s->written;
+            w->gaps[w->n_gaps][1] = dropped;
+        }
+        w->n_gaps++;
+        w->dropped_samples += dropped;
+    }
+    s->next_sample = in->first_sample + in->n_samples;
+
+    iq_buffer_t *buf = iq_writer_get_buffer(w);
+    memcpy(buf->data, in->data, in->len);
+    buf->len = in->len;
+    iq_writer_submit(w, buf);
+    s->written += in->n_samples;
+    sdr_block_latency(b, in);
+
+    if (s->show_progress) {
+        if (s->total_samples > 0) {
+            printf("\rProgress: %.1f%%", (double)s->written / s->total_samples * 100.0);
+        } else {
+            printf("\rRecorded %llu samples (%ld s)",
+                   (unsigned long long)s->written, (long)(time(NULL) - s->start_time));
+        }
+        fflush(stdout);
+    }
+    return SDR_BLOCK_CONTINUE;
+}
+
+// IQ8 packets into a recording; progress against total_samples if shown
+sdr_block_t *block_iq_writer(sdr_graph_t *g, iq_writer_t *w, int show_progress, uint64_t total_samples) {
+    iq_writer_state_t *s = calloc(1, sizeof(iq_writer_state_t));
+    if (!s) {
+        perror("Failed to allocate recording block");
+        return NULL;
+    }
+    s->writer = w;
+    s->show_progress = show_progress;
+    s->total_samples = total_samples;
+    s->start_time = time(NULL);
+    return sdr_graph_add(g, "iq_writer", iq_writer_work, s, free);
+}
+
+static int iq_stream_work(sdr_block_t *b, sdr_packet_t *in) {
+    iq_stream_t *stream = b->state;
+    if (!in) {
+        return SDR_BLOCK_DONE;
+    }
+
+    // The stream's own slots are what gets spliced into the pipe
+    uint8_t *data = iq_stream_buffer(stream);
+    memcpy(data, in->data, in->len);
+    if (!iq_stream_write(stream, data, in->len)) {
+        // The reader went away; nothing more to do
+        sdr_graph_stop(b->graph);
+        return SDR_BLOCK_DONE;
+    }
+    sdr_block_latency(b, in);
+    return SDR_BLOCK_CONTINUE;
+}
+
+// IQ8 packets to a pipe or file descriptor
+sdr_block_t *block_iq_stream(sdr_graph_t *g, iq_stream_t *s) {
+    return sdr_graph_add(g, "iq_stream", iq_stream_work, s, NULL);
+}
+
+static int audio_work(sdr_block_t *b, sdr_packet_t *in) {
+    audio_out_t *a = b->state;
+    if (!in) {
+        return SDR_BLOCK_DONE;
+    }
+    if (!audio_out_write(a, (const float *)in->data, in->len / sizeof(float))) {
+        // A player reading stdout going away just ends the run
+        if (a->reader_gone) {
+            sdr_graph_stop(b->graph);
+        } else {
+            sdr_graph_fail(b->graph);
+        }
+        return SDR_BLOCK_DONE;
+    }
+    sdr_block_latency(b, in);
+    return SDR_BLOCK_CONTINUE;
+}
+
+// Real packets to a WAV file or raw 16-bit audio on a pipe
+sdr_block_t *block_audio(sdr_graph_t *g, audio_out_t *a) {
+    return sdr_graph_add(g, "audio", audio_work, a, NULL);
+}
+
+static int adsb_work(sdr_block_t *b, sdr_packet_t *in) {
+    if (!in) {
+        return SDR_BLOCK_DONE;
+    }
+    adsb_decode(b->state, in->data, in->len, in->first_sample, in->timestamp_ns);
+    sdr_block_latency(b, in);
+    return SDR_BLOCK_CONTINUE;
+}
+
+// IQ8 packets at ADSB_SAMPLE_RATE through a Mode S decoder
+sdr_block_t *block_adsb(sdr_graph_t *g, adsb_decoder_t *d) {
+    return sdr_graph_add(g, "adsb", adsb_work, d, NULL);
+}
@@ -0,0 +1,776 @@
+/**
+ * @file sdr_catalog.c
+ * @brief Metadata catalog of the data directory
+ *
+ * Keeps a compact binary index (data/catalog.idx) of every file the SDR
+ * commands write: type, covered frequency range, time range and sample
+ * rate. Writers append one fixed-size record per file, so updates are a
+ * single atomic write. The sdr_find command keeps the catalog in memory
+ * with two sorted views (by frequency and by start time) and only reads
+ * the records appended since its last query. A missing catalog is
+ * rebuilt from the directory tree and the sidecar files.
+ *
+ * Deleting a file appends a tombstone, which the in-memory copy applies
+ * by marking the entry dead where it stands, so the sorted views stay
+ * valid. Once tombstones and the records they cancel outnumber the live
+ * records, sdr_find rewrites the index without them (temporary file +
+ * rename), so a rolling recording that evicts segments forever keeps the
+ * index the size of what is on disk. Writers only ever append: the
+ * recording thread that evicts segments must not stall on a rewrite.
+ * Appenders take a shared lock and compaction or a rebuild an exclusive
+ * one, so no record lands in a file that has just been replaced.
+ */
+
+#include "sdr.h"
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/file.h>
+
+#define CATALOG_FILE DATA_DIR "/catalog.idx"
+#define CATALOG_MAGIC "SDRCAT1"
+#define CATALOG_PATH_LEN 80
+#define CATALOG_REMOVED 0x01        // Tombstone for a deleted file
+#define CATALOG_TAIL_LIMIT 1024     // Unsorted records before re-sorting
+#define CATALOG_COMPACT_MIN 256     // Records before compaction is considered
+
+// One on-disk record; 128 bytes, fixed layout
+typedef struct {
+    uint8_t type;                   // CATALOG_IQ, CATALOG_SPECTRUM, ...
+    uint8_t flags;                  // CATALOG_REMOVED on tombstones, and on dead cache entries
+    uint16_t reserved;
+    uint32_t sample_rate;           // Hz, 0 if not applicable
+    uint64_t freq_lo, freq_hi;      // Covered band in Hz, 0/0 if unknown
+    int64_t time_start, time_end;   // Unix seconds
+    uint64_t size;                  // Bytes, at the time of cataloguing
+    char path[CATALOG_PATH_LEN];    // Relative to DATA_DIR
+} catalog_entry_t;
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} catalog_header_t;
+
+// In-memory copy of the catalog, refreshed when the file grows
+static struct {
+    catalog_entry_t *entries;
+    uint32_t *by_freq;              // Indices sorted by freq_lo
+    uint32_t *by_time;              // Indices sorted by time_start
+    uint32_t *by_path;              // Hash of path -> latest entry index + 1
+    size_t path_slots;              // Power of two, at least twice capacity
+    size_t count, capacity;
+    size_t live;                    // Entries not marked removed
+    size_t sorted;                  // Entries covered by the sorted views
+    uint64_t max_span;              // Widest freq_hi - freq_lo seen
+    int64_t max_duration;           // Longest time_end - time_start seen
+    off_t file_size;
+    ino_t inode;
+} cache;
+
+static const char *type_names[] = {"?", "iq", "spectrum", "snr", "report"};
+
+// Store a path relative to DATA_DIR so the catalog survives a move;
+// returns 0 if it does not fit in a record. Names the SDR commands make
+// are far shorter; anything else is left out rather than cut short.
+static int relative_path(const char *path, char *out) {
+    const char *prefix = DATA_DIR "/";
+    size_t prefix_len = strlen(prefix);
+    if (strncmp(path, prefix, prefix_len) == 0) {
+        path += prefix_len;
+    }
+    int len = snprintf(out, CATALOG_PATH_LEN, "%s", path);
+    return len >= 0 && len < CATALOG_PATH_LEN;
+}
+
+static void catalog_header(catalog_header_t *header) {
+    memset(header, 0, sizeof(*header));
+    memcpy(header->magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC));
+    header->version = 1;
+    header->record_size = sizeof(catalog_entry_t);
+}
+
+// Open the catalog and lock it (LOCK_SH or LOCK_EX); -1 if it is missing
+static int catalog_open_locked(int flags, int operation) {
+    while (1) {
+        int fd = open(CATALOG_FILE, flags);
+        if (fd == -1) {
+            return -1;
+        }
+
+        // A compaction or rebuild may have renamed a new catalog into
+        // place while we waited for the lock; the old file is going away
+        struct stat held, current;
+        if (flock(fd, operation) == 0 && fstat(fd, &held) == 0 &&
+            (stat(CATALOG_FILE, &current) != 0 || held.st_ino != current.st_ino)) {
+            close(fd);
+            continue;
+        }
+        return fd;
+    }
+}
+
+// Append a record; skipped when there is no catalog yet, because the
+// first sdr_find rebuilds it from the tree including this file
+static void catalog_append(const catalog_entry_t *entry) {
+    int fd = catalog_open_locked(O_WRONLY | O_APPEND, LOCK_SH);
+    if (fd == -1) {
+        return;
+    }
+    if (write(fd, entry, sizeof(*entry)) != sizeof(*entry)) {
+        perror("Failed to update catalog");
+    }
+    close(fd);
+}
+
+static uint32_t path_hash(const char *path) {
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < CATALOG_PATH_LEN && path[i]; i++) {
+        h = (h ^ (uint8_t)path[i]) * 16777619u;
+    }
+    return h;
+}
+
+// Rewrite the catalog without tombstones and the records they cancel,
+// if those have come to outnumber the live records
+static void catalog_compact() {
+    int fd = catalog_open_locked(O_RDONLY, LOCK_EX);
+    if (fd == -1) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return;
+    }
+
+    catalog_header_t header;
+    size_t n = st.st_size > (off_t)sizeof(header) ? (st.st_size - sizeof(header)) / sizeof(catalog_entry_t) : 0;
+    if (n < CATALOG_COMPACT_MIN || read(fd, &header, sizeof(header)) != sizeof(header) ||
+        memcmp(header.magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC)) != 0 ||
+        header.record_size != sizeof(catalog_entry_t)) {
+        close(fd);
+        return;
+    }
+
+    // Walking backwards, a record is dead if a tombstone after it named
+    // its path; the set holds the paths tombstoned so far
+    size_t slots = 1;
+    while (slots < 2 * n) slots <<= 1;
+    catalog_entry_t *entries = malloc(n * sizeof(catalog_entry_t));
+    uint32_t *removed = calloc(slots, sizeof(uint32_t));   // Entry index + 1, 0 = empty
+    uint8_t *keep = malloc(n);
+    if (!entries || !removed || !keep ||
+        pread(fd, entries, n * sizeof(catalog_entry_t), sizeof(header)) != (ssize_t)(n * sizeof(catalog_entry_t))) {
+        free(entries);
+        free(removed);
+        free(keep);
+        close(fd);
+        return;
+    }
+
+    size_t live = 0;
+    for (size_t i = n; i-- > 0;) {
+        const catalog_entry_t *e = &entries[i];
+        uint32_t slot = path_hash(e->path) & (slots - 1);
+        while (removed[slot] && strncmp(entries[removed[slot] - 1].path, e->path, CATALOG_PATH_LEN) != 0) {
+            slot = (slot + 1) & (slots - 1);
+        }
+        if (e->flags & CATALOG_REMOVED) {
+            if (!removed[slot]) removed[slot] = i + 1;
+            keep[i] = 0;
+        } else {
+            keep[i] = !removed[slot];
+            live += keep[i];
+        }
+    }
+
+    if (n - live > live) {
+        char tmp_path[PATH_MAX];
+        snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", CATALOG_FILE);
+        FILE *out = fopen(tmp_path, "w");
+        if (out) {
+            fwrite(&header, sizeof(header), 1, out);
+            for (size_t i = 0; i < n; i++) {
+                if (keep[i]) fwrite(&entries[i], sizeof(catalog_entry_t), 1, out);
+            }
+            int ok = fflush(out) == 0 && fsync(fileno(out)) == 0;
+            if (fclose(out) != 0 || !ok || rename(tmp_path, CATALOG_FILE) != 0) {
+                perror("Failed to compact catalog");
+                unlink(tmp_path);
+            }
+        } else {
+            perror("Failed to compact catalog");
+        }
+    }
+
+    free(entries);
+    free(removed);
+    free(keep);
+    close(fd);      // Releases the lock; waiting appenders move to the new file
+}
+
+// Record a newly written file in the catalog
+void catalog_add(int type, const char *path, uint64_t freq_lo, uint64_t freq_hi,
+                 uint32_t sample_rate, time_t time_start, time_t time_end) {
+    catalog_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.type = type;
+    entry.sample_rate = sample_rate;
+    entry.freq_lo = freq_lo;
+    entry.freq_hi = freq_hi;
+    entry.time_start = time_start;
+    entry.time_end = time_end;
+    if (!relative_path(path, entry.path)) {
+        return;
+    }
+
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        entry.size = st.st_size;
+    }
+
+    catalog_append(&entry);
+}
+
+// Record that a catalogued file has been deleted
+void catalog_remove(const char *path) {
+    catalog_entry_t entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.flags = CATALOG_REMOVED;
+    if (!relative_path(path, entry.path)) {
+        return;
+    }
+    catalog_append(&entry);
+}
+
+// Parse the YYYY-MM-DD_HH-MM-SS timestamp embedded in our file names
+static time_t time_from_name(const char *name) {
+    for (const char *p = name; *p; p++) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        if (isdigit((unsigned char)*p) &&
+            sscanf(p, "%4d-%2d-%2d_%2d-%2d-%2d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                   &tm.tm_hour, &tm.tm_min, &tm.tm_sec) == 6) {
+            tm.tm_year -= 1900;
+            tm.tm_mon -= 1;
+            tm.tm_isdst = -1;
+            return mktime(&tm);
+        }
+    }
+    return 0;
+}
+
+// Build a record for an existing file while rebuilding the catalog
+static int catalog_entry_from_file(int type, const char *dir, const char *name, catalog_entry_t *entry) {
+    char path[PATH_MAX];
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+
+    struct stat st;
+    if (stat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return 0;
+    }
+
+    memset(entry, 0, sizeof(*entry));
+    entry->type = type;
+    entry->size = st.st_size;
+    entry->time_start = time_from_name(name);
+    entry->time_end = st.st_mtime;
+    if (entry->time_start == 0) entry->time_start = st.st_mtime;
+    if (!relative_path(path, entry->path)) {
+        return 0;
+    }
+
+    if (type == CATALOG_IQ) {
+        // Band and rate come from the sidecar written by sdr_record
+        char info[PATH_MAX];
+        snprintf(info, sizeof(info), "%s", path);
+        char *dot = strrchr(info, '.');
+        if (dot) *dot = '\0';
+        int segment = -1;
+        char *underscore = strrchr(info, '_');
+        if (underscore && strlen(underscore) == 6 && strspn(underscore + 1, "0123456789") == 5) {
+            segment = atoi(underscore + 1);
+            *underscore = '\0';
+        }
+        strncat(info, ".txt", sizeof(info) - strlen(info) - 1);
+
+        uint32_t rate = 0, freq = 0;
+        unsigned long long segment_bytes = 0;
+        FILE *f = fopen(info, "r");
+        if (f) {
+            char line[256];
+            while (fgets(line, sizeof(line), f)) {
+                sscanf(line, "Sample Rate: %u", &rate);
+                sscanf(line, "Center Frequency: %u", &freq);
+                sscanf(line, "Segment Size: %llu", &segment_bytes);
+            }
+            fclose(f);
+        }
+        entry->sample_rate = rate;
+        if (freq > 0) {
+            entry->freq_lo = freq - rate / 2;
+            entry->freq_hi = freq + rate / 2;
+        }
+        if (rate > 0) {
+            // Every segment before this one was full
+            if (segment > 0) {
+                entry->time_start += segment * segment_bytes / 2 / rate;
+            }
+            entry->time_end = entry->time_start + st.st_size / 2 / rate;
+        }
+    } else if (type == CATALOG_SPECTRUM) {
+        // First and last rows of a spectrum log give the swept range
+        FILE *f = fopen(path, "r");
+        if (f) {
+            char line[256];
+            double first = 0, last = 0, value;
+            int rows = 0;
+            while (fgets(line, sizeof(line), f)) {
+                if (sscanf(line, "%lf,", &value) == 1) {
+                    if (rows++ == 0) first = value;
+                    last = value;
+                }
+            }
+            fclose(f);
+            entry->freq_lo = first < last ? first : last;
+            entry->freq_hi = first < last ? last : first;
+        }
+    }
+    // SNR logs and reports don't record their frequency; they are still
+    // found by time and type
+
+    return 1;
+}
+
+// Recreate the catalog from the data directory tree
+int catalog_rebuild() {
+    static const struct { int type; const char *dir; const char *suffix; } sources[] = {
+        {CATALOG_IQ, IQ_DIR, ".dat"},
+        {CATALOG_SPECTRUM, SPECTRUM_DIR, ".csv"},
+        {CATALOG_SNR, SNR_DIR, ".csv"},
+        {CATALOG_REPORT, DATA_DIR, ".txt"},
+    };
+
+    if (!create_data_directories()) {
+        return 0;
+    }
+
+    // Hold appenders off the old file until the new one is in place; a
+    // file catalogued while the tree is scanned lands in the new one
+    int lock_fd = catalog_open_locked(O_RDONLY, LOCK_EX);
+
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", CATALOG_FILE);
+    FILE *out = fopen(tmp_path, "w");
+    if (!out) {
+        perror("Failed to create catalog");
+        if (lock_fd != -1) close(lock_fd);
+        return 0;
+    }
+
+    catalog_header_t header;
+    catalog_header(&header);
+    fwrite(&header, sizeof(header), 1, out);
+
+    int count = 0;
+    for (size_t s = 0; s < sizeof(sources) / sizeof(sources[0]); s++) {
+        DIR *dir = opendir(sources[s].dir);
+        if (!dir) continue;
+
+        struct dirent *de;
+        size_t suffix_len = strlen(sources[s].suffix);
+        while ((de = readdir(dir)) != NULL) {
+            size_t len = strlen(de->d_name);
+            if (len <= suffix_len || strcmp(de->d_name + len - suffix_len, sources[s].suffix) != 0) {
+                continue;
+            }
+            if (sources[s].type == CATALOG_REPORT && strncmp(de->d_name, "batch_", 6) != 0) {
+                continue;
+            }
+
+            catalog_entry_t entry;
+            if (catalog_entry_from_file(sources[s].type, sources[s].dir, de->d_name, &entry)) {
+                fwrite(&entry, sizeof(entry), 1, out);
+                count++;
+            }
+        }
+        closedir(dir);
+    }
+
+    if (fclose(out) != 0 || rename(tmp_path, CATALOG_FILE) != 0) {
+        perror("Failed to write catalog");
+        unlink(tmp_path);
+        if (lock_fd != -1) close(lock_fd);
+        return 0;
+    }
+    if (lock_fd != -1) close(lock_fd);
+
+    // Force the in-memory copy to reload
+    cache.inode = 0;
+    return count;
+}
+
+static int compare_by_freq(const void *a, const void *b) {
+    const catalog_entry_t *x = &cache.entries[*(const uint32_t *)a];
+    const catalog_entry_t *y = &cache.entries[*(const uint32_t *)b];
+    return (x->freq_lo > y->freq_lo) - (x->freq_lo < y->freq_lo);
+}
+
+static int compare_by_time(const void *a, const void *b) {
+    const catalog_entry_t *x = &cache.entries[*(const uint32_t *)a];
+    const catalog_entry_t *y = &cache.entries[*(const uint32_t *)b];
+    return (x->time_start > y->time_start) - (x->time_start < y->time_start);
+}
+
+// Slot of a path in the path hash: its latest entry, or the empty slot
+// where it would go
+static uint32_t *cache_path_slot(const char *path) {
+    size_t mask = cache.path_slots - 1;
+    size_t slot = path_hash(path) & mask;
+    while (cache.by_path[slot] &&
+           strncmp(cache.entries[cache.by_path[slot] - 1].path, path, CATALOG_PATH_LEN) != 0) {
+        slot = (slot + 1) & mask;
+    }
+    return &cache.by_path[slot];
+}
+
+// Bring the in-memory catalog up to date with the file
+static int catalog_refresh() {
+    int fd = open(CATALOG_FILE, O_RDONLY);
+    if (fd == -1 && errno == ENOENT) {
+        printf("Catalog missing, rebuilding from %s...\n", DATA_DIR);
+        if (!catalog_rebuild()) {
+            return 0;
+        }
+        fd = open(CATALOG_FILE, O_RDONLY);
+    }
+    if (fd == -1) {
+        perror("Failed to open catalog");
+        return 0;
+    }
+
+    struct stat st;
+    fstat(fd, &st);
+
+    // A replaced file (rebuild elsewhere) means starting over
+    if (st.st_ino != cache.inode || st.st_size < cache.file_size) {
+        cache.count = cache.sorted = cache.live = 0;
+        if (cache.by_path) {
+            memset(cache.by_path, 0, cache.path_slots * sizeof(uint32_t));
+        }
+        cache.file_size = 0;
+        cache.max_span = 0;
+        cache.max_duration = 0;
+        cache.inode = st.st_ino;
+    }
+
+    if (cache.file_size == 0) {
+        catalog_header_t header;
+        if (read(fd, &header, sizeof(header)) != sizeof(header) ||
+            memcmp(header.magic, CATALOG_MAGIC, sizeof(CATALOG_MAGIC)) != 0 ||
+            header.record_size != sizeof(catalog_entry_t)) {
+            fprintf(stderr, "Catalog %s is corrupt; run sdr_find --rebuild\n", CATALOG_FILE);
+            close(fd);
+            return 0;
+        }
+        cache.file_size = sizeof(header);
+    }
+
+    // Read only the records appended since the last refresh
+    size_t new_records = (st.st_size - cache.file_size) / sizeof(catalog_entry_t);
+    if (new_records > 0) {
+        if (cache.count + new_records > cache.capacity) {
+            size_t capacity = (cache.count + new_records) * 2;
+            size_t slots = 1;
+            while (slots < 2 * capacity) slots <<= 1;
+            catalog_entry_t *entries = realloc(cache.entries, capacity * sizeof(catalog_entry_t));
+            uint32_t *by_freq = realloc(cache.by_freq, capacity * sizeof(uint32_t));
+            uint32_t *by_time = realloc(cache.by_time, capacity * sizeof(uint32_t));
+            uint32_t *by_path = calloc(slots, sizeof(uint32_t));
+            if (entries) cache.entries = entries;
+            if (by_freq) cache.by_freq = by_freq;
+            if (by_time) cache.by_time = by_time;
+            if (!entries || !by_freq || !by_time || !by_path) {
+                perror("Failed to load catalog");
+                free(by_path);
+                close(fd);
+                return 0;
+            }
+            cache.capacity = capacity;
+
+            free(cache.by_path);
+            cache.by_path = by_path;
+            cache.path_slots = slots;
+            for (size_t i = 0; i < cache.count; i++) {
+                if (!(cache.entries[i].flags & CATALOG_REMOVED)) {
+                    *cache_path_slot(cache.entries[i].path) = i + 1;
+                }
+            }
+        }
+
+        catalog_entry_t *dst = cache.entries + cache.count;
+        ssize_t want = new_records * sizeof(catalog_entry_t);
+        ssize_t got = pread(fd, dst, want, cache.file_size);
+        if (got < 0) got = 0;
+        new_records = got / sizeof(catalog_entry_t);
+        cache.file_size += new_records * sizeof(catalog_entry_t);
+
+        for (size_t i = 0; i < new_records; i++) {
+            catalog_entry_t entry = dst[i];
+
+            // A tombstone, or a newer record of the same file, retires the
+            // entry in place; indices never move, so the views stay valid
+            uint32_t *slot = cache_path_slot(entry.path);
+            if (*slot && !(cache.entries[*slot - 1].flags & CATALOG_REMOVED)) {
+                cache.entries[*slot - 1].flags |= CATALOG_REMOVED;
+                cache.live--;
+            }
+            if (entry.flags & CATALOG_REMOVED) {
+                continue;
+            }
+
+            // Tombstones are not kept, so count never reaches the raw
+            // records still to be processed
+            cache.entries[cache.count++] = entry;
+            *slot = cache.count;
+            cache.live++;
+            if (entry.freq_hi - entry.freq_lo > cache.max_span) {
+                cache.max_span = entry.freq_hi - entry.freq_lo;
+            }
+            if (entry.time_end - entry.time_start > cache.max_duration) {
+                cache.max_duration = entry.time_end - entry.time_start;
+            }
+        }
+    }
+    close(fd);
+
+    // Mostly tombstones and what they cancelled: shrink the file. The
+    // next refresh sees the new inode and reloads it.
+    size_t records = (cache.file_size - sizeof(catalog_header_t)) / sizeof(catalog_entry_t);
+    if (records >= CATALOG_COMPACT_MIN && records - cache.live > cache.live) {
+        catalog_compact();
+    }
+
+    // New records accumulate in an unsorted tail that queries scan
+    // linearly; once it gets long the sorted views are rebuilt
+    if (cache.count - cache.sorted > CATALOG_TAIL_LIMIT || (cache.sorted == 0 && cache.count > 0)) {
+        for (size_t i = 0; i < cache.count; i++) {
+            cache.by_freq[i] = cache.by_time[i] = i;
+        }
+        qsort(cache.by_freq, cache.count, sizeof(uint32_t), compare_by_freq);
+        qsort(cache.by_time, cache.count, sizeof(uint32_t), compare_by_time);
+        cache.sorted = cache.count;
+    }
+    return 1;
+}
+
+// First position in a sorted view whose key is >= value
+static size_t lower_bound(const uint32_t *view, size_t n, int by_freq, int64_t value) {
+    size_t lo = 0, hi = n;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        const catalog_entry_t *e = &cache.entries[view[mid]];
+        int64_t key = by_freq ? (int64_t)e->freq_lo : e->time_start;
+        if (key < value) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+// Query filters; zero fields are ignored
+typedef struct {
+    uint64_t freq, tolerance;
+    int64_t since, until;
+    uint32_t sample_rate;
+    int type;
+} catalog_query_t;
+
+static int catalog_match(const catalog_entry_t *e, const catalog_query_t *q) {
+    if (e->flags & CATALOG_REMOVED) return 0;
+    if (q->type && e->type != q->type) return 0;
+    if (q->sample_rate && e->sample_rate != q->sample_rate) return 0;
+    if (q->freq && (e->freq_hi == 0 || e->freq_lo > q->freq + q->tolerance ||
+                    e->freq_hi + q->tolerance < q->freq)) return 0;
+    if (q->since && e->time_end < q->since) return 0;
+    if (q->until && e->time_start > q->until) return 0;
+    return 1;
+}
+
+static int compare_match_time(const void *a, const void *b) {
+    const catalog_entry_t *x = &cache.entries[*(const uint32_t *)a];
+    const catalog_entry_t *y = &cache.entries[*(const uint32_t *)b];
+    return (x->time_start > y->time_start) - (x->time_start < y->time_start);
+}
+
+// Collect matching entry indices in time order; returns the match count
+static size_t catalog_query(const catalog_query_t *q, uint32_t *matches) {
+    size_t n = 0;
+
+    // Candidate window in each sorted view; walk whichever is narrower
+    size_t f_lo = 0, f_hi = cache.sorted;
+    if (q->freq) {
+        uint64_t low = q->freq > q->tolerance + cache.max_span ? q->freq - q->tolerance - cache.max_span : 0;
+        f_lo = lower_bound(cache.by_freq, cache.sorted, 1, low);
+        f_hi = lower_bound(cache.by_freq, cache.sorted, 1, q->freq + q->tolerance + 1);
+    }
+    size_t t_lo = 0, t_hi = cache.sorted;
+    if (q->since) {
+        t_lo = lower_bound(cache.by_time, cache.sorted, 0, q->since - cache.max_duration);
+    }
+    if (q->until) {
+        t_hi = lower_bound(cache.by_time, cache.sorted, 0, q->until + 1);
+    }
+    if (t_hi < t_lo) t_hi = t_lo;
+
+    const uint32_t *view = cache.by_time;
+    size_t lo = t_lo, hi = t_hi;
+    if (f_hi - f_lo < t_hi - t_lo) {
+        view = cache.by_freq;
+        lo = f_lo;
+        hi = f_hi;
+    }
+
+    for (size_t i = lo; i < hi; i++) {
+        if (catalog_match(&cache.entries[view[i]], q)) {
+            matches[n++] = view[i];
+        }
+    }
+
+    // Records appended since the views were last sorted
+    for (size_t i = cache.sorted; i < cache.count; i++) {
+        if (catalog_match(&cache.entries[i], q)) {
+            matches[n++] = i;
+        }
+    }
+
+    if (view != cache.by_time || cache.sorted < cache.count) {
+        qsort(matches, n, sizeof(uint32_t), compare_match_time);
+    }
+    return n;
+}
+
+// Parse "7d", "12h", "30m" (relative to now) or YYYY-MM-DD[_HH-MM-SS]
+static time_t parse_time_arg(const char *text) {
+    char *end;
+    double amount = strtod(text, &end);
+    if (end != text && end[0] != '\0' && end[1] == '\0' && end[0] != '-') {
+        double unit = 0;
+        switch (*end) {
+            case 'd': unit = 86400; break;
+            case 'h': unit = 3600; break;
+            case 'm': unit = 60; break;
+            case 's': unit = 1; break;
+        }
+        if (unit > 0) {
+            return time(NULL) - (time_t)(amount * unit);
+        }
+    }
+
+    struct tm tm;
+    memset(&tm, 0, sizeof(tm));
+    int fields = sscanf(text, "%4d-%2d-%2d_%2d-%2d-%2d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday,
+                        &tm.tm_hour, &tm.tm_min, &tm.tm_sec);
+    if (fields != 3 && fields != 6) {
+        return -1;
+    }
+    tm.tm_year -= 1900;
+    tm.tm_mon -= 1;
+    tm.tm_isdst = -1;
+    return mktime(&tm);
+}
+
+// Command to search the data directory by frequency, time and type
+int cmd_sdr_find(char **args) {
+    catalog_query_t q;
+    memset(&q, 0, sizeof(q));
+    int rebuild = 0;
+
+    for (int i = 1; args[i] != NULL; i++) {
+        if (strcmp(args[i], "--tol") == 0 && args[i+1]) {
+            q.tolerance = parse_frequency(args[++i]);
+        } else if ((strcmp(args[i], "--since") == 0 || strcmp(args[i], "--until") == 0) && args[i+1]) {
+            int64_t *bound = args[i][2] == 's' ? &q.since : &q.until;
+            time_t t = parse_time_arg(args[++i]);
+            if (t == -1) {
+                fprintf(stderr, "sdr_find: bad time %s (use 7d, 12h or YYYY-MM-DD[_HH-MM-SS])\n", args[i]);
+                return 1;
+            }
+            *bound = t;
+        } else if (strcmp(args[i], "--rate") == 0 && args[i+1]) {
+            q.sample_rate = parse_frequency(args[++i]);
+        } else if (strcmp(args[i], "--type") == 0 && args[i+1]) {
+            i++;
+            for (int t = CATALOG_IQ; t <= CATALOG_REPORT; t++) {
+                if (strcmp(args[i], type_names[t]) == 0) q.type = t;
+            }
+            if (!q.type) {
+                fprintf(stderr, "sdr_find: unknown type %s (iq, spectrum, snr or report)\n", args[i]);
+                last_exit_status = 1;
+                return 1;
+            }
+        } else if (strcmp(args[i], "--rebuild") == 0) {
+            rebuild = 1;
+        } else if (args[i][0] != '-' && q.freq == 0) {
+            q.freq = parse_frequency(args[i]);
+        } else {
+            fprintf(stderr, "Usage: sdr_find [freq] [--tol Hz] [--since 7d|YYYY-MM-DD] "
+                            "[--until ...] [--rate R] [--type iq|spectrum|snr|report] [--rebuild]\n");
+            last_exit_status = 1;
+            return 1;
+        }
+    }
+
+    if (rebuild) {
+        int count = catalog_rebuild();
+        if (count == 0 && access(CATALOG_FILE, F_OK) != 0) {
+            return 1;
+        }
+        printf("Catalog rebuilt: %d file(s)\n", count);
+    }
+
+    struct timespec t_start, t_end;
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+
+    if (!catalog_refresh()) {
+        return 1;
+    }
+
+    uint32_t *matches = malloc(sizeof(uint32_t) * (cache.count ? cache.count : 1));
+    if (!matches) {
+        perror("Failed to allocate query results");
+        return 1;
+    }
+    size_t n = catalog_query(&q, matches);
+
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+    double elapsed_us = (t_end.tv_sec - t_start.tv_sec) * 1e6 + (t_end.tv_nsec - t_start.tv_nsec) / 1e3;
+
+    if (n > 0) {
+        printf("%-8s  %-19s  %-23s  %-9s  %-10s  %s\n", "Type", "Start", "Band (MHz)", "Rate", "Size", "File");
+    }
+    for (size_t i = 0; i < n; i++) {
+        const catalog_entry_t *e = &cache.entries[matches[i]];
+        char when[32], band[32], rate[16];
+        time_t start = e->time_start;
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&start));
+        if (e->freq_hi > 0) {
+            snprintf(band, sizeof(band), "%.3f-%.3f", e->freq_lo / 1e6, e->freq_hi / 1e6);
+        } else {
+            snprintf(band, sizeof(band), "-");
+        }
+        if (e->sample_rate > 0) {
+            snprintf(rate, sizeof(rate), "%.3f M", e->sample_rate / 1e6);
+        } else {
+            snprintf(rate, sizeof(rate), "-");
+        }
+        printf("%-8s  %-19s  %-23s  %-9s  %-10llu  %s/%s\n", type_names[e->type < 5 ? e->type : 0],
+               when, band, rate, (unsigned long long)e->size, DATA_DIR, e->path);
+    }
+    printf("%zu match(es) among %zu catalogued file(s) in %.0f us\n", n, cache.live, elapsed_us);
+
+    free(matches);
+    return 1;
+}
@@ -0,0 +1,216 @@
+/**
+ * @file sdr_device.c
+ * @brief The shared RTL-SDR device and the resources kept warm with it
+ *
+ * There is one device handle in the process. open_sdr_device takes the
+ * device lock and hands the handle out; close_sdr_device gives it back.
+ * A command typed at the prompt and a job run by sdr_schedule therefore
+ * take turns on the dongle instead of fighting over its USB interface.
+ *
+ * Normally the handle is closed again when the command finishes. While
+ * anything holds a reference (sdr_device_retain, taken by the scheduler
+ * while it has jobs) it stays open between commands, and so do the
+ * sample ring and FFT plans handed out here. Those belong to whoever
+ * holds the device, which is what makes sharing them safe.
+ */
+
+#include "sdr.h"
+
+#define PLAN_CACHE_SIZE 8
+
+typedef struct {
+    int size;
+    fftwf_plan plan;
+    fftwf_complex *in, *out;
+} cached_plan_t;
+
+static struct {
+    pthread_mutex_t lock;         // Held from open_sdr_device to close_sdr_device
+    rtlsdr_dev_t *dev;            // Open handle, or NULL
+    int refs;                     // sdr_device_retain references
+    int fork_locked;              // lock was taken by the fork handler
+    int fork_held;                // The device was in use when we forked
+    int parent_held;              // Forked child: the parent has the dongle
+    sample_ring_t ring;           // Capture ring, mapped on first use
+    int ring_ready;
+    cached_plan_t plans[PLAN_CACHE_SIZE];
+    int n_plans;
+} device = {PTHREAD_MUTEX_INITIALIZER};
+
+// FFTW's planner is not thread-safe; only fftwf_execute is
+static pthread_mutex_t planner_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Forked built-ins (pipeline stages) cannot use the parent's USB handle;
+// the child forgets it and opens the dongle itself. The parent's handle
+// stays open: a device idle with no references is already closed, and a
+// retained one is the warm handle the scheduler keeps, which a fork of
+// every pipeline stage must not throw away. While the parent has the
+// device, retained or locked by a running job, the child reports it busy
+// rather than failing to claim the USB interface.
+static void device_prepare_fork() {
+    pthread_mutex_lock(&planner_lock);
+    if (pthread_mutex_trylock(&device.lock) == 0) {
+        device.fork_locked = 1;
+        device.fork_held = device.dev != NULL || device.refs > 0;
+    } else {
+        device.fork_held = 1;
+    }
+}
+
+static void device_parent_fork() {
+    if (device.fork_locked) {
+        device.fork_locked = 0;
+        pthread_mutex_unlock(&device.lock);
+    }
+    pthread_mutex_unlock(&planner_lock);
+}
+
+static void device_child_fork() {
+    device.parent_held = device.fork_held;
+    device.fork_locked = 0;
+    device.dev = NULL;
+    device.refs = 0;
+    pthread_mutex_init(&device.lock, NULL);
+    pthread_mutex_unlock(&planner_lock);
+}
+
+__attribute__((constructor))
+static void device_init() {
+    pthread_atfork(device_prepare_fork, device_parent_fork, device_child_fork);
+}
+
+// Open SDR device with default settings; waits while another thread
+// (a scheduled job) is using it
+int open_sdr_device(rtlsdr_dev_t **dev) {
+    if (device.parent_held) {
+        fprintf(stderr, "RTL-SDR device busy (held by a scheduled job)\n");
+        last_exit_status = 1;
+        return 0;
+    }
+    if (pthread_mutex_trylock(&device.lock) != 0) {
+        fprintf(stderr, "Waiting for a scheduled job to release the device...\n");
+        pthread_mutex_lock(&device.lock);
+    }
+
+    if (!device.dev) {
+        int device_count = rtlsdr_get_device_count();
+        if (device_count == 0) {
+            fprintf(stderr, "No RTL-SDR devices found\n");
+            pthread_mutex_unlock(&device.lock);
+            last_exit_status = 1;
+            return 0;
+        }
+
+        // Open first device
+        if (rtlsdr_open(&device.dev, 0) < 0) {
+            fprintf(stderr, "Failed to open RTL-SDR device\n");
+            device.dev = NULL;
+            pthread_mutex_unlock(&device.lock);
+            last_exit_status = 1;
+            return 0;
+        }
+    }
+
+    // Set default settings; a kept-open handle may still carry the
+    // previous command's tuning
+    rtlsdr_set_sample_rate(device.dev, DEFAULT_SAMPLE_RATE);
+    rtlsdr_set_center_freq(device.dev, DEFAULT_FREQ);
+    rtlsdr_set_tuner_gain_mode(device.dev, 0); // Auto gain
+
+    *dev = device.dev;
+    return 1;
+}
+
+// Give the device back, closing it unless something retains it
+void close_sdr_device(rtlsdr_dev_t *dev) {
+    if (!dev) {
+        return;
+    }
+    if (device.refs == 0) {
+        rtlsdr_close(device.dev);
+        device.dev = NULL;
+    }
+    pthread_mutex_unlock(&device.lock);
+}
+
+// Keep the device open between commands
+void sdr_device_retain() {
+    pthread_mutex_lock(&device.lock);
+    device.refs++;
+    pthread_mutex_unlock(&device.lock);
+}
+
+// Drop a reference; the last one closes an idle device
+void sdr_device_release() {
+    pthread_mutex_lock(&device.lock);
+    if (--device.refs == 0 && device.dev) {
+        rtlsdr_close(device.dev);
+        device.dev = NULL;
+    }
+    pthread_mutex_unlock(&device.lock);
+}
+
+// The capture ring of DEFAULT_BUFFER_SIZE blocks, for the holder of the
+// device; mapped once and kept, huge pages permitting
+sample_ring_t *sdr_sample_ring() {
+    if (!device.ring_ready) {
+        if (!sample_ring_init(&device.ring, SAMPLE_RING_BLOCKS, DEFAULT_BUFFER_SIZE, SAMPLE_RING_HUGEPAGES)) {
+            return NULL;
+        }
+        device.ring_ready = 1;
+    }
+    return &device.ring;
+}
+
+// Plan a forward complex FFT, serialised against other threads planning
+fftwf_plan sdr_plan_dft(int size, fftwf_complex *in, fftwf_complex *out) {
+    pthread_mutex_lock(&planner_lock);
+    fftwf_plan plan = fftwf_plan_dft_1d(size, in, out, FFTW_FORWARD, FFTW_ESTIMATE);
+    pthread_mutex_unlock(&planner_lock);
+    return plan;
+}
+
+void sdr_destroy_plan(fftwf_plan plan) {
+    pthread_mutex_lock(&planner_lock);
+    fftwf_destroy_plan(plan);
+    pthread_mutex_unlock(&planner_lock);
+}
+
+// Forward FFT plan of the given size with its buffers, made once and
+// reused by every later holder of the device; NULL on failure
+fftwf_plan sdr_cached_plan(int size, fftwf_complex **in, fftwf_complex **out) {
+    for (int i = 0; i < device.n_plans; i++) {
+        if (device.plans[i].size == size) {
+            *in = device.plans[i].in;
+            *out = device.plans[i].out;
+            return device.plans[i].plan;
+        }
+    }
+
+    cached_plan_t entry = {size, NULL, NULL, NULL};
+    entry.in = buffer_pool_alloc(sizeof(fftwf_complex) * size);
+    entry.out = buffer_pool_alloc(sizeof(fftwf_complex) * size);
+    if (entry.in && entry.out) {
+        entry.plan = sdr_plan_dft(size, entry.in, entry.out);
+    }
+    if (!entry.plan) {
+        fprintf(stderr, "Failed to allocate FFT resources\n");
+        buffer_pool_free(entry.in, sizeof(fftwf_complex) * size);
+        buffer_pool_free(entry.out, sizeof(fftwf_complex) * size);
+        return NULL;
+    }
+
+    // A full cache evicts its oldest plan
+    if (device.n_plans == PLAN_CACHE_SIZE) {
+        sdr_destroy_plan(device.plans[0].plan);
+        buffer_pool_free(device.plans[0].in, sizeof(fftwf_complex) * device.plans[0].size);
+        buffer_pool_free(device.plans[0].out, sizeof(fftwf_complex) * device.plans[0].size);
+        memmove(device.plans, device.plans + 1, sizeof(cached_plan_t) * (PLAN_CACHE_SIZE - 1));
+        device.n_plans--;
+    }
+    device.plans[device.n_plans++] = entry;
+
+    *in = entry.in;
+    *out = entry.out;
+    return entry.plan;
+}
@@ -0,0 +1,408 @@
+/**
+ * @file sdr_dsp.c
+ * @brief Front-end corrections, the NCO and the FM demodulation chain
+ *
+ * An RTL-SDR's raw IQ has a spike at 0 Hz from LO leakage, and a mirror
+ * image of every signal from the gain and phase mismatch between its I
+ * and Q paths. iq_correct takes both out: a running DC estimate is
+ * subtracted, and Q is rotated and scaled back to orthogonal with I
+ * using covariances gathered over each packet. Removing DC would also
+ * remove a real carrier at 0 Hz, so the correction goes with offset
+ * tuning, where the hardware is tuned OFFSET_TUNE_DEFAULT away from the
+ * signal and the NCO brings it back to the centre.
+ *
+ * The NCO is a 32-bit phase accumulator. Once every DSP_LANES samples
+ * its phase is looked up in a coarse and a fine sin/cos table (20 bits
+ * of phase, spurs near -120 dBc), and the resulting phasor is spread
+ * over the next DSP_LANES samples by a fixed vector of rotations. No
+ * rounding builds up, and the inner loops are fixed-length float
+ * arithmetic with no lookups or recursion in them, which the compiler
+ * turns into NEON or SSE at -O2. Loops that sum are split into
+ * DSP_LANES partial sums for the same reason.
+ *
+ * sdr_fm's chain is built from the same kind of loops:
+ * - The discriminator takes the phase step between successive samples
+ *   with a polynomial atan2 that uses selects instead of branches.
+ * - De-emphasis is a one-pole filter on top of it.
+ * - The polyphase resampler computes only the outputs it keeps, each
+ *   as a dot product over one branch of the filter.
+ * None of them allocate once running: the resampler's work buffer only
+ * grows to the largest packet it has been given.
+ */
+
+#include "sdr.h"
+
+#define NCO_TABLE_BITS 10
+#define NCO_TABLE_SIZE (1 << NCO_TABLE_BITS)
+#define IQ_CORRECT_SECONDS 0.1        // Time constant of the running estimates
+
+// exp(j 2pi k / 2^10) and exp(j 2pi k / 2^20)
+static float coarse_re[NCO_TABLE_SIZE], coarse_im[NCO_TABLE_SIZE];
+static float fine_re[NCO_TABLE_SIZE], fine_im[NCO_TABLE_SIZE];
+
+__attribute__((constructor))
+static void dsp_init() {
+    for (int k = 0; k < NCO_TABLE_SIZE; k++) {
+        double coarse = 2.0 * M_PI * k / NCO_TABLE_SIZE;
+        double fine = coarse / NCO_TABLE_SIZE;
+        coarse_re[k] = (float)cos(coarse);
+        coarse_im[k] = (float)sin(coarse);
+        fine_re[k] = (float)cos(fine);
+        fine_im[k] = (float)sin(fine);
+    }
+}
+
+// Set the oscillator to freq_hz (negative to shift down) at phase 0
+void nco_init(nco_t *n, double freq_hz, double sample_rate) {
+    // The uint32 wraps where the phase does, so negative steps just work
+    n->step = (uint32_t)llround(freq_hz / sample_rate * 4294967296.0);
+    n->phase = 0;
+    for (int k = 0; k < DSP_LANES; k++) {
+        double ph = 2.0 * M_PI * (uint32_t)(n->step * (uint32_t)k) / 4294967296.0;
+        n->lane_re[k] = (float)cos(ph);
+        n->lane_im[k] = (float)sin(ph);
+    }
+}
+
+// Multiply count samples by the oscillator starting at phase. Inlined
+// with count = DSP_LANES for the vector loop and with the remainder for
+// the tail.
+static inline void nco_chunk(const nco_t *n, uint32_t phase, const float *restrict x,
+                             float *restrict y, int count) {
+    uint32_t hi = phase >> (32 - NCO_TABLE_BITS);
+    uint32_t lo = (phase >> (32 - 2 * NCO_TABLE_BITS)) & (NCO_TABLE_SIZE - 1);
+    float b_re = coarse_re[hi] * fine_re[lo] - coarse_im[hi] * fine_im[lo];
+    float b_im = coarse_re[hi] * fine_im[lo] + coarse_im[hi] * fine_re[lo];
+
+    float ph_re[DSP_LANES], ph_im[DSP_LANES];
+    for (int k = 0; k < count; k++) {
+        ph_re[k] = b_re * n->lane_re[k] - b_im * n->lane_im[k];
+        ph_im[k] = b_re * n->lane_im[k] + b_im * n->lane_re[k];
+    }
+    for (int k = 0; k < count; k++) {
+        float re = x[2*k], im = x[2*k+1];
+        y[2*k] = re * ph_re[k] - im * ph_im[k];
+        y[2*k+1] = re * ph_im[k] + im * ph_re[k];
+    }
+}
+
+// Frequency-shift interleaved complex samples; out must not overlap in
+void nco_mix(nco_t *n, const float *in, float *out, size_t n_samples) {
+    uint32_t phase = n->phase;
+    size_t i = 0;
+    for (; i + DSP_LANES <= n_samples; i += DSP_LANES) {
+        nco_chunk(n, phase, in + 2 * i, out + 2 * i, DSP_LANES);
+        phase += n->step * DSP_LANES;
+    }
+    if (i < n_samples) {
+        int rest = (int)(n_samples - i);
+        nco_chunk(n, phase, in + 2 * i, out + 2 * i, rest);
+        phase += n->step * (uint32_t)rest;
+    }
+    n->phase = phase;
+}
+
+// I' = I + off_i, Q' = q_q * Q + q_i * I + off_q over count samples
+static inline void iq_chunk(const float *restrict x, float *restrict y, int count,
+                            float off_i, float q_q, float q_i, float off_q) {
+    for (int k = 0; k < count; k++) {
+        float re = x[2*k], im = x[2*k+1];
+        y[2*k] = re + off_i;
+        y[2*k+1] = q_q * im + q_i * re + off_q;
+    }
+}
+
+void iq_correct_init(iq_correct_t *c) {
+    memset(c, 0, sizeof(*c));
+    c->gain = 1.0f;
+}
+
+// Remove DC and IQ imbalance from interleaved complex samples; out must
+// not overlap in
+void iq_correct_apply(iq_correct_t *c, const float *in, float *out, size_t n_samples, double sample_rate) {
+    if (n_samples == 0) {
+        return;
+    }
+
+    // Means and covariances of this packet, in per-lane partial sums
+    float s_i[DSP_LANES] = {0}, s_q[DSP_LANES] = {0};
+    float s_ii[DSP_LANES] = {0}, s_qq[DSP_LANES] = {0}, s_iq[DSP_LANES] = {0};
+    size_t i = 0;
+    for (; i + DSP_LANES <= n_samples; i += DSP_LANES) {
+        const float *x = in + 2 * i;
+        for (int k = 0; k < DSP_LANES; k++) {
+            float re = x[2*k], im = x[2*k+1];
+            s_i[k] += re;
+            s_q[k] += im;
+            s_ii[k] += re * re;
+            s_qq[k] += im * im;
+            s_iq[k] += re * im;
+        }
+    }
+    for (size_t k = 0; i + k < n_samples; k++) {
+        float re = in[2*(i+k)], im = in[2*(i+k)+1];
+        s_i[k] += re;
+        s_q[k] += im;
+        s_ii[k] += re * re;
+        s_qq[k] += im * im;
+        s_iq[k] += re * im;
+    }
+    double m_i = 0, m_q = 0, m_ii = 0, m_qq = 0, m_iq = 0;
+    for (int k = 0; k < DSP_LANES; k++) {
+        m_i += s_i[k];
+        m_q += s_q[k];
+        m_ii += s_ii[k];
+        m_qq += s_qq[k];
+        m_iq += s_iq[k];
+    }
+    m_i /= n_samples;
+    m_q /= n_samples;
+    double c_ii = m_ii / n_samples - m_i * m_i;
+    double c_qq = m_qq / n_samples - m_q * m_q;
+    double c_iq = m_iq / n_samples - m_i * m_q;
+
+    // Fold them into the running estimates; the first packet sets them
+    double a = c->primed ? 1.0 - exp(-(double)n_samples / (sample_rate * IQ_CORRECT_SECONDS)) : 1.0;
+    c->primed = 1;
+    c->dc_i += a * (m_i - c->dc_i);
+    c->dc_q += a * (m_q - c->dc_q);
+    c->c_ii += a * (c_ii - c->c_ii);
+    c->c_qq += a * (c_qq - c->c_qq);
+    c->c_iq += a * (c_iq - c->c_iq);
+
+    // Q - phase * I is uncorrelated with I; gain brings it to I's power
+    double phase = c->c_ii > 0 ? c->c_iq / c->c_ii : 0.0;
+    double rest = c->c_qq - phase * c->c_iq;
+    c->phase = (float)phase;
+    c->gain = rest > 0 ? (float)sqrt(c->c_ii / rest) : 1.0f;
+
+    // I' = I - dc_i, Q' = gain * ((Q - dc_q) - phase * (I - dc_i))
+    float off_i = (float)-c->dc_i;
+    float q_q = c->gain;
+    float q_i = -c->gain * c->phase;
+    float off_q = (float)(c->gain * (c->phase * c->dc_i - c->dc_q));
+    for (i = 0; i + DSP_LANES <= n_samples; i += DSP_LANES) {
+        iq_chunk(in + 2 * i, out + 2 * i, DSP_LANES, off_i, q_q, q_i, off_q);
+    }
+    iq_chunk(in + 2 * i, out + 2 * i, (int)(n_samples - i), off_i, q_q, q_i, off_q);
+}
+
+// What the correction found: the DC offset and the imbalance it undid
+void iq_correct_report(const iq_correct_t *c, FILE *out) {
+    if (!c->primed || c->c_ii <= 0 || c->c_qq <= 0) {
+        return;
+    }
+    double gain = sqrt(c->c_qq / c->c_ii);
+    double cos_phi = sqrt(1.0 - fmin(1.0, c->c_iq * c->c_iq / (c->c_ii * c->c_qq)));
+    double phase_deg = asin(c->c_iq / sqrt(c->c_ii * c->c_qq)) * 180.0 / M_PI;
+
+    // Image rejection of the uncorrected front end
+    double irr = (1.0 + 2.0 * gain * cos_phi + gain * gain) / fmax(1.0 - 2.0 * gain * cos_phi + gain * gain, 1e-12);
+    fprintf(out, "Front end: DC offset I %+.4f Q %+.4f, IQ gain %+.2f dB, phase %+.2f deg, "
+                 "image rejection %.1f dB before correction\n",
+            c->dc_i, c->dc_q, 20.0 * log10(gain), phase_deg, 10.0 * log10(irr));
+}
+
+// Complex FIR output over n_taps (a multiple of DSP_LANES) real taps
+void dsp_fir_complex(const float *taps, const float *x, int n_taps, float *re, float *im) {
+    float acc_re[DSP_LANES] = {0}, acc_im[DSP_LANES] = {0};
+    for (int i = 0; i < n_taps; i += DSP_LANES) {
+        const float *t = taps + i;
+        const float *v = x + 2 * i;
+        for (int k = 0; k < DSP_LANES; k++) {
+            acc_re[k] += t[k] * v[2*k];
+            acc_im[k] += t[k] * v[2*k+1];
+        }
+    }
+    float sum_re = 0.0f, sum_im = 0.0f;
+    for (int k = 0; k < DSP_LANES; k++) {
+        sum_re += acc_re[k];
+        sum_im += acc_im[k];
+    }
+    *re = sum_re;
+    *im = sum_im;
+}
+
+// Dot product over n (a multiple of DSP_LANES) floats
+static float dsp_dot(const float *a, const float *b, int n) {
+    float acc[DSP_LANES] = {0};
+    for (int i = 0; i < n; i += DSP_LANES) {
+        for (int k = 0; k < DSP_LANES; k++) {
+            acc[k] += a[i+k] * b[i+k];
+        }
+    }
+    float sum = 0.0f;
+    for (int k = 0; k < DSP_LANES; k++) {
+        sum += acc[k];
+    }
+    return sum;
+}
+
+static inline void s16_chunk(const float *restrict in, int16_t *restrict out, int count) {
+    for (int k = 0; k < count; k++) {
+        float v = in[k] * 32767.0f;
+        v = v > 32767.0f ? 32767.0f : v;
+        v = v < -32767.0f ? -32767.0f : v;
+        out[k] = (int16_t)v;
+    }
+}
+
+// Scale to 16-bit audio, clipping at full scale
+void dsp_float_to_s16(const float *in, int16_t *out, size_t n_samples) {
+    size_t i = 0;
+    for (; i + DSP_LANES <= n_samples; i += DSP_LANES) {
+        s16_chunk(in + i, out + i, DSP_LANES);
+    }
+    s16_chunk(in + i, out + i, (int)(n_samples - i));
+}
+
+// atan2 to about 1e-5 rad: a polynomial on the first octant, unfolded
+// by arithmetic on the comparisons rather than branches or selects, so
+// the loops calling it still vectorize
+static inline float fast_atan2f(float y, float x) {
+    float ax = fabsf(x), ay = fabsf(y);
+    float swap = (float)(ay > ax);
+    float big = ax + swap * (ay - ax);
+    float small = ay + swap * (ax - ay);
+    float a = small / (big + 1e-30f);
+    float s = a * a;
+    float r = ((-0.0464964749f * s + 0.15931422f) * s - 0.327622764f) * s * a + a;
+    r += swap * ((float)M_PI_2 - 2.0f * r);
+    r += (float)(x < 0.0f) * ((float)M_PI - 2.0f * r);
+    return copysignf(r, y);
+}
+
+// Phase step from prev[k] to cur[k] for count samples
+static inline void fm_chunk(const float *restrict cur, const float *restrict prev,
+                            float *restrict out, int count, float gain) {
+    for (int k = 0; k < count; k++) {
+        // cur * conj(prev)
+        float re = cur[2*k] * prev[2*k] + cur[2*k+1] * prev[2*k+1];
+        float im = cur[2*k+1] * prev[2*k] - cur[2*k] * prev[2*k+1];
+        out[k] = gain * fast_atan2f(im, re);
+    }
+}
+
+// deviation_hz of frequency swing comes out as +-1.0; deemphasis_us is
+// the de-emphasis time constant (50 in Europe, 75 in the Americas), 0
+// for none
+void fm_demod_init(fm_demod_t *d, double sample_rate, double deviation_hz, double deemphasis_us) {
+    memset(d, 0, sizeof(*d));
+    d->gain = (float)(sample_rate / (2.0 * M_PI * deviation_hz));
+    d->deemph_alpha = deemphasis_us > 0 ? (float)(1.0 - exp(-1.0 / (sample_rate * deemphasis_us * 1e-6))) : 1.0f;
+}
+
+// Demodulate n_samples of complex baseband into as many audio samples
+void fm_demod_run(fm_demod_t *d, const float *iq, float *out, size_t n_samples) {
+    if (n_samples == 0) {
+        return;
+    }
+
+    // The first chunk needs the last sample of the previous packet in
+    // front of it; after that the previous sample is the one before
+    float first[2 * DSP_LANES];
+    int count = n_samples < DSP_LANES ? (int)n_samples : DSP_LANES;
+    first[0] = d->prev_re;
+    first[1] = d->prev_im;
+    memcpy(first + 2, iq, sizeof(float) * 2 * (count - 1));
+    fm_chunk(iq, first, out, count, d->gain);
+
+    size_t i = count;
+    for (; i + DSP_LANES <= n_samples; i += DSP_LANES) {
+        fm_chunk(iq + 2 * i, iq + 2 * i - 2, out + i, DSP_LANES, d->gain);
+    }
+    if (i < n_samples) {
+        fm_chunk(iq + 2 * i, iq + 2 * i - 2, out + i, (int)(n_samples - i), d->gain);
+    }
+    d->prev_re = iq[2 * (n_samples - 1)];
+    d->prev_im = iq[2 * (n_samples - 1) + 1];
+
+    // One pole, so it runs sample by sample
+    float y = d->deemph;
+    for (i = 0; i < n_samples; i++) {
+        y += d->deemph_alpha * (out[i] - y);
+        out[i] = y;
+    }
+    d->deemph = y;
+}
+
+// Resample by up/down, keeping cutoff_hz and below; the prototype is a
+// Hamming-windowed sinc at the upsampled rate
+int resampler_init(resampler_t *r, int up, int down, double cutoff_hz, double in_rate) {
+    memset(r, 0, sizeof(*r));
+    int n = up * RESAMPLE_PHASE_TAPS;
+    r->up = up;
+    r->down = down;
+    r->taps = malloc(sizeof(float) * n);
+    if (!r->taps) {
+        perror("Failed to allocate resampler");
+        return 0;
+    }
+
+    double fc = cutoff_hz / (in_rate * up);
+    double *h = malloc(sizeof(double) * n);
+    if (!h) {
+        perror("Failed to allocate resampler");
+        free(r->taps);
+        return 0;
+    }
+    double sum = 0.0;
+    double mid = (n - 1) / 2.0;
+    for (int i = 0; i < n; i++) {
+        double k = i - mid;
+        double sinc = k == 0 ? 2.0 * fc : sin(2.0 * M_PI * fc * k) / (M_PI * k);
+        h[i] = sinc * (0.54 - 0.46 * cos(2.0 * M_PI * i / (n - 1)));
+        sum += h[i];
+    }
+
+    // Branch p holds h[p], h[p + up], ... newest-last, with the gain of
+    // the up - 1 zeros upsampling puts between samples made up
+    for (int p = 0; p < up; p++) {
+        for (int j = 0; j < RESAMPLE_PHASE_TAPS; j++) {
+            r->taps[p * RESAMPLE_PHASE_TAPS + RESAMPLE_PHASE_TAPS - 1 - j] = (float)(h[p + j * up] * up / sum);
+        }
+    }
+    free(h);
+
+    // Outputs start once the history holds real samples
+    r->next = (uint64_t)(RESAMPLE_PHASE_TAPS - 1) * up;
+    return 1;
+}
+
+// Resample n_samples; out needs room for n_samples * up / down + 1.
+// Returns the samples written, or 0 with errno set if out of memory.
+size_t resampler_run(resampler_t *r, const float *in, size_t n_samples, float *out) {
+    size_t keep = RESAMPLE_PHASE_TAPS - 1;
+    if (keep + n_samples > r->work_samples) {
+        float *work = realloc(r->work, sizeof(float) * (keep + n_samples));
+        if (!work) {
+            return 0;
+        }
+        if (!r->work) {
+            memset(work, 0, sizeof(float) * keep);
+        }
+        r->work = work;
+        r->work_samples = keep + n_samples;
+    }
+    memcpy(r->work + keep, in, sizeof(float) * n_samples);
+
+    size_t total = keep + n_samples;
+    size_t produced = 0;
+    uint64_t t = r->next;
+    for (; t / r->up < total; t += r->down) {
+        size_t base = t / r->up;
+        int phase = (int)(t - (uint64_t)base * r->up);
+        out[produced++] = dsp_dot(r->taps + phase * RESAMPLE_PHASE_TAPS, r->work + base - keep,
+                                  RESAMPLE_PHASE_TAPS);
+    }
+    r->next = t - (uint64_t)n_samples * r->up;
+    memmove(r->work, r->work + n_samples, sizeof(float) * keep);
+    return produced;
+}
+
+void resampler_free(resampler_t *r) {
+    free(r->taps);
+    free(r->work);
+    r->taps = NULL;
+    r->work = NULL;
+}
@@ -0,0 +1,305 @@
+/**
+ * @file sdr_fm.c
+ * @brief Wideband FM receiver with audio output
+ *
+ * Implements the sdr_fm command, which demodulates a broadcast FM
+ * station to 48 kHz mono audio as a block graph:
+ *
+ *     capture -> convert [-> correct -> mix] -> lowpass -> fm_demod -> resample -> audio
+ *
+ * The lowpass keeps the +-100 kHz channel and decimates 2.048 MS/s by 8
+ * to 256 kHz. The discriminator and de-emphasis run at that rate, and
+ * the polyphase resampler takes it by 3/16 to 48 kHz while cutting off
+ * at 15 kHz, below the 19 kHz stereo pilot. The arithmetic is in
+ * sdr_dsp.c. Each stage runs on the work pool and draws its packets from
+ * the buffer pool, so nothing is allocated once the first packets have
+ * passed through.
+ *
+ * Audio goes to a WAV file, or raw to stdout with `-` for piping into a
+ * player:
+ *
+ *     sdr_fm 99.5M 0 - | aplay -r 48000 -f S16_LE -c 1
+ */
+
+#include "sdr.h"
+#include <errno.h>
+
+#define FM_CHANNEL_CUTOFF 100000      // Hz either side of the carrier
+#define FM_DECIMATION 8               // 2.048 MS/s to 256 kHz
+#define FM_RESAMPLE_UP 3              // 256 kHz * 3 / 16 = 48 kHz
+#define FM_RESAMPLE_DOWN 16
+#define FM_AUDIO_RATE 48000
+#define FM_AUDIO_CUTOFF 15000         // Broadcast audio bandwidth
+#define FM_DEEMPHASIS_US 50           // Europe; 75 in the Americas
+
+#define FM_USAGE "usage: sdr_fm [frequency] [seconds, 0 = until Ctrl+C] [file.wav|-] " \
+                 "[--deemphasis us] [--offset-tune[=Hz]] [--stats]"
+
+static void put_le16(uint8_t *p, uint16_t v) {
+    p[0] = v & 0xff;
+    p[1] = v >> 8;
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    put_le16(p, v & 0xffff);
+    put_le16(p + 2, v >> 16);
+}
+
+// 44-byte header of a 16-bit mono PCM WAV file holding data_bytes
+static void wav_header(uint8_t *h, uint32_t sample_rate, uint32_t data_bytes) {
+    memcpy(h, "RIFF", 4);
+    put_le32(h + 4, 36 + data_bytes);
+    memcpy(h + 8, "WAVEfmt ", 8);
+    put_le32(h + 16, 16);                 // fmt chunk size
+    put_le16(h + 20, 1);                  // PCM
+    put_le16(h + 22, 1);                  // Mono
+    put_le32(h + 24, sample_rate);
+    put_le32(h + 28, sample_rate * 2);    // Bytes per second
+    put_le16(h + 32, 2);                  // Bytes per frame
+    put_le16(h + 34, 16);                 // Bits per sample
+    memcpy(h + 36, "data", 4);
+    put_le32(h + 40, data_bytes);
+}
+
+static int write_all(audio_out_t *a, const void *data, size_t len) {
+    const uint8_t *p = data;
+    while (len > 0) {
+        ssize_t n = write(a->fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EPIPE) {
+                a->reader_gone = 1;
+            } else {
+                perror("Failed to write audio");
+            }
+            return 0;
+        }
+        p += n;
+        len -= n;
+    }
+    return 1;
+}
+
+// Open path as a WAV file, or stdout for raw samples when path is NULL
+int audio_out_open(audio_out_t *a, const char *path, uint32_t sample_rate) {
+    memset(a, 0, sizeof(*a));
+    a->sample_rate = sample_rate;
+    a->buffer = buffer_pool_alloc(AUDIO_OUT_CHUNK * sizeof(int16_t));
+    if (!a->buffer) {
+        perror("Failed to allocate audio buffer");
+        return 0;
+    }
+
+    if (!path) {
+        a->fd = STDOUT_FILENO;
+    } else {
+        a->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (a->fd < 0) {
+            perror("Failed to open audio file");
+            buffer_pool_free(a->buffer, AUDIO_OUT_CHUNK * sizeof(int16_t));
+            return 0;
+        }
+        a->wav = 1;
+
+        // Sizes are filled in on close
+        uint8_t header[44];
+        wav_header(header, sample_rate, 0);
+        if (!write_all(a, header, sizeof(header))) {
+            close(a->fd);
+            buffer_pool_free(a->buffer, AUDIO_OUT_CHUNK * sizeof(int16_t));
+            return 0;
+        }
+    }
+
+    // The player going away shows up as EPIPE rather than killing us
+    struct sigaction ignore;
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ignore, &a->old_sigpipe);
+    return 1;
+}
+
+// Write n samples of +-1.0 audio; returns 0 once a write has failed
+int audio_out_write(audio_out_t *a, const float *samples, size_t n) {
+    while (n > 0) {
+        size_t chunk = n < AUDIO_OUT_CHUNK ? n : AUDIO_OUT_CHUNK;
+        dsp_float_to_s16(samples, a->buffer, chunk);
+        if (!write_all(a, a->buffer, chunk * sizeof(int16_t))) {
+            return 0;
+        }
+        a->samples += chunk;
+        samples += chunk;
+        n -= chunk;
+    }
+    return 1;
+}
+
+void audio_out_close(audio_out_t *a) {
+    if (a->wav) {
+        uint64_t bytes = a->samples * sizeof(int16_t);
+        uint8_t header[44];
+        wav_header(header, a->sample_rate, bytes > UINT32_MAX - 36 ? UINT32_MAX - 36 : (uint32_t)bytes);
+        if (pwrite(a->fd, header, sizeof(header), 0) != sizeof(header)) {
+            perror("Failed to finish WAV header");
+        }
+        close(a->fd);
+    }
+    sigaction(SIGPIPE, &a->old_sigpipe, NULL);
+    buffer_pool_free(a->buffer, AUDIO_OUT_CHUNK * sizeof(int16_t));
+}
+
+// Command to listen to a broadcast FM station
+int cmd_sdr_fm(char **args) {
+    uint32_t freq = DEFAULT_FREQ;
+    uint32_t seconds = 10;
+    const char *path = NULL;
+    int to_stdout = 0;
+    double deemphasis = FM_DEEMPHASIS_US;
+    uint64_t tune_offset = 0;
+    int stats = 0;
+
+    // Parse command arguments
+    int argi = 1;
+    if (args[argi] && isdigit((unsigned char)args[argi][0])) {
+        freq = parse_frequency(args[argi++]);
+        if (args[argi] && isdigit((unsigned char)args[argi][0])) seconds = atoi(args[argi++]);
+    }
+
+    for (; args[argi] != NULL; argi++) {
+        if (strcmp(args[argi], "-") == 0) {
+            to_stdout = 1;
+        } else if (strcmp(args[argi], "--deemphasis") == 0 && args[argi+1]) {
+            deemphasis = atof(args[++argi]);
+        } else if (strcmp(args[argi], "--offset-tune") == 0) {
+            tune_offset = OFFSET_TUNE_DEFAULT;
+        } else if (strncmp(args[argi], "--offset-tune=", 14) == 0) {
+            tune_offset = parse_frequency(args[argi] + 14);
+        } else if (strcmp(args[argi], "--stats") == 0) {
+            stats = 1;
+        } else if (args[argi][0] != '-' && !path) {
+            path = args[argi];
+        } else {
+            fprintf(stderr, "sdr_fm: unknown option %s\n%s\n", args[argi], FM_USAGE);
+            last_exit_status = 1;
+            return 1;
+        }
+    }
+
+    if (to_stdout && path) {
+        fprintf(stderr, "sdr_fm: give a file or -, not both\n");
+        last_exit_status = 1;
+        return 1;
+    }
+    if (to_stdout && isatty(STDOUT_FILENO)) {
+        fprintf(stderr, "sdr_fm: not writing raw audio to a terminal; pipe or redirect it\n");
+        last_exit_status = 1;
+        return 1;
+    }
+    if (deemphasis < 0) {
+        fprintf(stderr, "sdr_fm: de-emphasis must be 0 (off) or a time constant in microseconds\n");
+        last_exit_status = 1;
+        return 1;
+    }
+    // The channel has to stay inside the capture after the shift
+    if (tune_offset + FM_CHANNEL_CUTOFF > DEFAULT_SAMPLE_RATE / 2 || tune_offset > freq) {
+        fprintf(stderr, "sdr_fm: the tuning offset must be below %u Hz and the frequency\n",
+                DEFAULT_SAMPLE_RATE / 2 - FM_CHANNEL_CUTOFF);
+        last_exit_status = 1;
+        return 1;
+    }
+
+    // Messages go to stderr when stdout carries the audio
+    FILE *msg = to_stdout ? stderr : stdout;
+
+    char filename[PATH_MAX];
+    if (!to_stdout && !path) {
+        if (!create_data_directories()) {
+            return 1;
+        }
+        char *timestamp = get_timestamp_string();
+        snprintf(filename, sizeof(filename), "%s/fm_%s.wav", AUDIO_DIR, timestamp);
+        free(timestamp);
+        path = filename;
+    }
+
+    // Open device
+    rtlsdr_dev_t *dev;
+    if (!open_sdr_device(&dev)) {
+        return 1;
+    }
+
+    // Set frequency, below the station when offset tuning
+    uint32_t tuned = freq - tune_offset;
+    rtlsdr_set_center_freq(dev, tuned);
+
+    audio_out_t audio;
+    if (!audio_out_open(&audio, to_stdout ? NULL : path, FM_AUDIO_RATE)) {
+        close_sdr_device(dev);
+        return 1;
+    }
+
+    sample_capture_t capture;
+    if (!sample_capture_start(&capture, dev)) {
+        audio_out_close(&audio);
+        close_sdr_device(dev);
+        return 1;
+    }
+
+    if (seconds > 0) {
+        fprintf(msg, "FM at %.2f MHz for %u seconds...\n", freq/1e6, seconds);
+    } else {
+        fprintf(msg, "FM at %.2f MHz. Press Ctrl+C to stop...\n", freq/1e6);
+    }
+    if (tune_offset) {
+        fprintf(msg, "Offset tuning: receiver at %.4f MHz\n", tuned / 1e6);
+    }
+    fflush(msg);
+
+    sdr_graph_t *graph = sdr_graph_create(0);
+    sdr_block_t *source = graph ? block_capture(graph, &capture, tuned, (uint64_t)seconds * DEFAULT_SAMPLE_RATE) : NULL;
+    sdr_block_t *last = graph ? block_convert(graph) : NULL;
+    int ok = sdr_graph_connect(source, last);
+    sdr_block_t *correct = NULL;
+    if (ok && tune_offset) {
+        correct = block_correct(graph);
+        sdr_block_t *mix = block_mix(graph, tune_offset);
+        ok = sdr_graph_connect(last, correct) && sdr_graph_connect(correct, mix);
+        last = mix;
+    }
+    sdr_block_t *stages[] = {
+        ok ? block_lowpass(graph, FM_CHANNEL_CUTOFF, FM_DECIMATION) : NULL,
+        ok ? block_fm_demod(graph, deemphasis) : NULL,
+        ok ? block_resample(graph, FM_RESAMPLE_UP, FM_RESAMPLE_DOWN, FM_AUDIO_CUTOFF) : NULL,
+        ok ? block_audio(graph, &audio) : NULL,
+    };
+    for (size_t i = 0; ok && i < sizeof(stages) / sizeof(stages[0]); i++) {
+        ok = sdr_graph_connect(last, stages[i]);
+        last = stages[i];
+    }
+
+    sdr_install_stop_handler();
+    if (!ok || !sdr_graph_run(graph)) {
+        fprintf(stderr, "\nsdr_fm: receiver did not complete\n");
+        last_exit_status = 1;
+    }
+    sdr_restore_stop_handler();
+    sample_capture_stop(&capture);
+
+    fprintf(msg, "\nFM stopped. %.1f seconds of audio %s%s\n", (double)audio.samples / FM_AUDIO_RATE,
+            to_stdout ? "streamed to stdout" : "saved to ", to_stdout ? "" : path);
+    if (audio.reader_gone) {
+        fprintf(msg, "The player closed the stream\n");
+    }
+    sample_capture_report(&capture, msg);
+    if (correct) block_correct_report(correct, msg);
+    if (graph) {
+        sdr_graph_report_latency(graph, msg);
+        if (stats) sdr_graph_report(graph, msg);
+    }
+    sdr_graph_destroy(graph);
+
+    audio_out_close(&audio);
+    close_sdr_device(dev);
+
+    return 1;
+}
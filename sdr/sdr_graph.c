@@ -0,0 +1,371 @@
+/**
+ * @file sdr_graph.c
+ * @brief Streaming block graph scheduled on the work pool
+ *
+ * A graph is a tree of blocks rooted at a source. Every block has one
+ * input queue and can feed any number of downstream blocks; a packet
+ * sent to several of them is shared by reference, not copied. Queues are
+ * bounded at SDR_GRAPH_QUEUE packets, and a block only runs when its
+ * input has a packet and every output queue has room, so a slow block
+ * holds back its producer instead of letting memory grow. Held-back
+ * sources stop taking blocks from the capture ring, where the loss shows
+ * up as overruns.
+ *
+ * Sources are driven by the thread that calls sdr_graph_run, which is
+ * also the consumer of the capture ring and the thread that sees Ctrl+C.
+ * Every other block runs as a task on the work pool. A block is never
+ * queued twice, so blocks keep their state without locks and see their
+ * packets in order, while different blocks run on different cores. One
+ * mutex guards the queues and the scheduling flags; the signal
+ * processing itself runs outside it.
+ */
+
+#include "sdr.h"
+
+#define GRAPH_POLL_MS 100             // How often sdr_graph_run looks for Ctrl+C
+
+sdr_graph_t *sdr_graph_create(int n_workers) {
+    sdr_graph_t *g = calloc(1, sizeof(sdr_graph_t));
+    if (!g) {
+        perror("Failed to allocate graph");
+        return NULL;
+    }
+    g->pool = work_pool_create(n_workers);
+    if (!g->pool) {
+        free(g);
+        return NULL;
+    }
+    pthread_mutex_init(&g->lock, NULL);
+    pthread_cond_init(&g->cond, NULL);
+    return g;
+}
+
+// Add a block; cleanup(state) runs when the graph is destroyed
+sdr_block_t *sdr_graph_add(sdr_graph_t *g, const char *name, sdr_block_fn work,
+                           void *state, void (*cleanup)(void *state)) {
+    sdr_block_t *b = calloc(1, sizeof(sdr_block_t));
+    if (!b) {
+        perror("Failed to allocate block");
+        if (cleanup) cleanup(state);
+        return NULL;
+    }
+    snprintf(b->name, sizeof(b->name), "%s", name);
+    b->graph = g;
+    b->work = work;
+    b->state = state;
+    b->cleanup = cleanup;
+
+    if (g->last) {
+        g->last->next = b;
+    } else {
+        g->blocks = b;
+    }
+    g->last = b;
+    g->live++;
+    return b;
+}
+
+// Feed from's output into to; a block has at most one input
+int sdr_graph_connect(sdr_block_t *from, sdr_block_t *to) {
+    if (!from || !to) {
+        return 0;
+    }
+    if (to->upstream || from->n_outputs == SDR_GRAPH_MAX_OUTPUTS) {
+        fprintf(stderr, "Cannot connect %s to %s\n", from->name, to->name);
+        return 0;
+    }
+    from->outputs[from->n_outputs++] = to;
+    to->upstream = from;
+    return 1;
+}
+
+// A packet of at least capacity bytes with one reference. The data
+// comes from the buffer pool, the packet itself from the graph's list.
+sdr_packet_t *sdr_packet_get(sdr_graph_t *g, size_t capacity) {
+    pthread_mutex_lock(&g->lock);
+    sdr_packet_t *p = g->free_packets;
+    if (p) {
+        g->free_packets = p->next;
+    }
+    pthread_mutex_unlock(&g->lock);
+
+    if (!p) {
+        p = malloc(sizeof(sdr_packet_t));
+        if (!p) {
+            perror("Failed to allocate packet");
+            return NULL;
+        }
+    }
+    memset(p, 0, sizeof(*p));
+    p->data = buffer_pool_alloc(capacity);
+    if (!p->data) {
+        perror("Failed to allocate packet");
+        pthread_mutex_lock(&g->lock);
+        p->next = g->free_packets;
+        g->free_packets = p;
+        pthread_mutex_unlock(&g->lock);
+        return NULL;
+    }
+    p->capacity = capacity;
+    p->refs = 1;
+    return p;
+}
+
+// Drop a reference; the last one returns the packet to the graph and
+// its data to the pool
+void sdr_packet_put(sdr_graph_t *g, sdr_packet_t *p) {
+    if (!p || __atomic_sub_fetch(&p->refs, 1, __ATOMIC_ACQ_REL) > 0) {
+        return;
+    }
+    buffer_pool_free(p->data, p->capacity);
+    pthread_mutex_lock(&g->lock);
+    p->next = g->free_packets;
+    g->free_packets = p;
+    pthread_mutex_unlock(&g->lock);
+}
+
+// Whether every running output of b has room; graph lock held
+static int block_has_room(sdr_block_t *b) {
+    for (int i = 0; i < b->n_outputs; i++) {
+        if (!b->outputs[i]->finished && b->outputs[i]->input.count == SDR_GRAPH_QUEUE) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Whether b can run now; graph lock held
+static int block_runnable(sdr_block_t *b) {
+    if (b->finished || b->scheduled || !b->upstream) {
+        return 0;
+    }
+    if (b->input.count == 0 && !b->input.closed) {
+        return 0;
+    }
+    return block_has_room(b);
+}
+
+static void block_task(void *arg);
+
+// Queue b on the pool if it has work; graph lock held
+static void block_kick(sdr_block_t *b) {
+    if (block_runnable(b)) {
+        b->scheduled = 1;
+        if (!work_pool_submit(b->graph->pool, block_task, b)) {
+            b->scheduled = 0;
+        }
+    }
+}
+
+// Mark b finished and close its outputs; graph lock held
+static void block_finish(sdr_block_t *b) {
+    b->finished = 1;
+    b->graph->live--;
+    for (int i = 0; i < b->n_outputs; i++) {
+        b->outputs[i]->input.closed = 1;
+        block_kick(b->outputs[i]);
+    }
+    pthread_cond_broadcast(&b->graph->cond);
+}
+
+// Send p to every downstream block that is still running, taking over
+// the caller's reference. Only one packet per call of the work function.
+void sdr_block_emit(sdr_block_t *b, sdr_packet_t *p) {
+    sdr_graph_t *g = b->graph;
+
+    pthread_mutex_lock(&g->lock);
+    int live = 0;
+    for (int i = 0; i < b->n_outputs; i++) {
+        if (!b->outputs[i]->finished) live++;
+    }
+    if (live == 0) {
+        pthread_mutex_unlock(&g->lock);
+        sdr_packet_put(g, p);
+        return;
+    }
+    __atomic_add_fetch(&p->refs, live - 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < b->n_outputs; i++) {
+        sdr_block_t *out = b->outputs[i];
+        if (out->finished) {
+            continue;
+        }
+        out->input.items[(out->input.head + out->input.count) % SDR_GRAPH_QUEUE] = p;
+        out->input.count++;
+        block_kick(out);
+    }
+    pthread_mutex_unlock(&g->lock);
+}
+
+// A sink has produced output from p: record how long ago its newest
+// samples came off the USB bus
+void sdr_block_latency(sdr_block_t *b, const sdr_packet_t *p) {
+    if (!p->arrival_ns) {
+        return;
+    }
+    uint64_t latency = sdr_monotonic_ns() - p->arrival_ns;
+    b->latency_count++;
+    b->latency_sum_ns += latency;
+    if (latency > b->latency_max_ns) b->latency_max_ns = latency;
+}
+
+// Run one step of a non-source block on a pool worker
+static void block_task(void *arg) {
+    sdr_block_t *b = arg;
+    sdr_graph_t *g = b->graph;
+
+    pthread_mutex_lock(&g->lock);
+    sdr_packet_t *in = NULL;
+    if (b->input.count > 0) {
+        in = b->input.items[b->input.head];
+        b->input.head = (b->input.head + 1) % SDR_GRAPH_QUEUE;
+        b->input.count--;
+    }
+    pthread_mutex_unlock(&g->lock);
+
+    // A NULL packet tells the block its input has ended
+    uint64_t start = sdr_monotonic_ns();
+    int status = b->work(b, in);
+    b->busy_ns += sdr_monotonic_ns() - start;
+    b->runs++;
+    sdr_packet_put(g, in);
+
+    sdr_packet_t *dropped[SDR_GRAPH_QUEUE];
+    int n_dropped = 0;
+
+    pthread_mutex_lock(&g->lock);
+    b->scheduled = 0;
+    if (status == SDR_BLOCK_DONE || !in) {
+        // Whatever is still queued for a finished block is dropped
+        while (b->input.count > 0) {
+            dropped[n_dropped++] = b->input.items[b->input.head];
+            b->input.head = (b->input.head + 1) % SDR_GRAPH_QUEUE;
+            b->input.count--;
+        }
+        block_finish(b);
+    } else {
+        block_kick(b);
+    }
+    // Taking a packet made room for the producer
+    if (b->upstream) {
+        pthread_cond_broadcast(&g->cond);
+        block_kick(b->upstream);
+    }
+    pthread_mutex_unlock(&g->lock);
+
+    for (int i = 0; i < n_dropped; i++) {
+        sdr_packet_put(g, dropped[i]);
+    }
+}
+
+// Run the graph until every block has finished. Sources are stepped on
+// this thread; Ctrl+C (sdr_stop_requested) ends them early, after which
+// the packets already in flight are still processed. Returns 0 if a
+// block failed.
+int sdr_graph_run(sdr_graph_t *g) {
+    pthread_mutex_lock(&g->lock);
+    while (g->live > 0) {
+        if (sdr_stop_requested()) {
+            g->stopping = 1;
+        }
+
+        int stepped = 0;
+        for (sdr_block_t *b = g->blocks; b; b = b->next) {
+            if (b->upstream || b->finished || !block_has_room(b)) {
+                continue;
+            }
+            pthread_mutex_unlock(&g->lock);
+            uint64_t start = sdr_monotonic_ns();
+            int status = b->work(b, NULL);
+            b->busy_ns += sdr_monotonic_ns() - start;
+            b->runs++;
+            pthread_mutex_lock(&g->lock);
+            if (status == SDR_BLOCK_DONE) {
+                block_finish(b);
+            }
+            stepped = 1;
+        }
+
+        // Sources wait inside their work function; otherwise wait for
+        // room downstream or for the last blocks to finish
+        if (!stepped && g->live > 0) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += GRAPH_POLL_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&g->cond, &g->lock, &deadline);
+        }
+    }
+    int failed = g->failed;
+    pthread_mutex_unlock(&g->lock);
+
+    work_pool_wait(g->pool);
+    return !failed;
+}
+
+// Ask the sources to end, as Ctrl+C would; any thread
+void sdr_graph_stop(sdr_graph_t *g) {
+    __atomic_store_n(&g->stopping, 1, __ATOMIC_RELEASE);
+}
+
+int sdr_graph_stopping(sdr_graph_t *g) {
+    return __atomic_load_n(&g->stopping, __ATOMIC_ACQUIRE);
+}
+
+// A block hit an error: stop the sources and make sdr_graph_run fail
+void sdr_graph_fail(sdr_graph_t *g) {
+    __atomic_store_n(&g->failed, 1, __ATOMIC_RELEASE);
+    sdr_graph_stop(g);
+}
+
+// Per-block run counts and busy time, for --stats style summaries
+void sdr_graph_report(sdr_graph_t *g, FILE *out) {
+    fprintf(out, "%-16s %10s %10s\n", "Block", "Runs", "Busy ms");
+    for (sdr_block_t *b = g->blocks; b; b = b->next) {
+        fprintf(out, "%-16s %10llu %10.1f\n", b->name, (unsigned long long)b->runs, b->busy_ns / 1e6);
+    }
+    fprintf(out, "%d workers, %llu steals\n", g->pool->n_workers, (unsigned long long)g->pool->steals);
+}
+
+// End-to-end latency of every sink that recorded some
+void sdr_graph_report_latency(sdr_graph_t *g, FILE *out) {
+    for (sdr_block_t *b = g->blocks; b; b = b->next) {
+        if (b->latency_count > 0) {
+            fprintf(out, "Latency to %s: mean %.2f ms, max %.2f ms over %llu outputs\n", b->name,
+                    b->latency_sum_ns / 1e6 / b->latency_count, b->latency_max_ns / 1e6,
+                    (unsigned long long)b->latency_count);
+        }
+    }
+}
+
+void sdr_graph_destroy(sdr_graph_t *g) {
+    if (!g) {
+        return;
+    }
+    work_pool_destroy(g->pool);
+
+    sdr_block_t *b = g->blocks;
+    while (b) {
+        sdr_block_t *next = b->next;
+        while (b->input.count > 0) {
+            sdr_packet_put(g, b->input.items[b->input.head]);
+            b->input.head = (b->input.head + 1) % SDR_GRAPH_QUEUE;
+            b->input.count--;
+        }
+        if (b->cleanup) b->cleanup(b->state);
+        free(b);
+        b = next;
+    }
+
+    sdr_packet_t *p = g->free_packets;
+    while (p) {
+        sdr_packet_t *next = p->next;
+        free(p);
+        p = next;
+    }
+    pthread_cond_destroy(&g->cond);
+    pthread_mutex_destroy(&g->lock);
+    free(g);
+}
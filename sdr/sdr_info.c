@@ -7,7 +7,7 @@
  * sample rate, frequency, and available gain values.
  */
 
-#include "shell.h"
+#include "sdr.h"
 
 // Command to display RTL-SDR device information
 int cmd_sdr_info(char **args) {
@@ -15,6 +15,7 @@ int cmd_sdr_info(char **args) {
 
     if (device_count == 0) {
         printf("No RTL-SDR devices found\n");
+        last_exit_status = 1;
         return 1;
     }
 
@@ -31,9 +32,10 @@ int cmd_sdr_info(char **args) {
         printf("  Serial:  %s\n", serial);
         printf("  Name:    %s\n", rtlsdr_get_device_name(i));
 
-        // Try to open the device to get more info
+        // Try to open the device to get more info; device 0 is the one
+        // the other commands share, and may be held open by sdr_schedule
         rtlsdr_dev_t *dev;
-        if (rtlsdr_open(&dev, i) == 0) {
+        if (i == 0 ? open_sdr_device(&dev) : rtlsdr_open(&dev, i) == 0) {
             uint32_t rate = rtlsdr_get_sample_rate(dev);
             uint32_t freq = rtlsdr_get_center_freq(dev);
             int gains_count = rtlsdr_get_tuner_gains(dev, NULL);
@@ -59,7 +61,11 @@ int cmd_sdr_info(char **args) {
                 free(gains);
             }
 
-            rtlsdr_close(dev);
+            if (i == 0) {
+                close_sdr_device(dev);
+            } else {
+                rtlsdr_close(dev);
+            }
         }
     }
 
@@ -0,0 +1,677 @@
+/**
+ * @file sdr_iowriter.c
+ * @brief Low-copy writer backend for IQ recordings
+ *
+ * Moves IQ buffers from the capture loop to disk on a dedicated writer
+ * thread. Samples are read straight into page-aligned buffers from a
+ * fixed pool and written from there without passing through stdio.
+ * Where the kernel allows it the files are opened with O_DIRECT and
+ * writes are queued through io_uring; otherwise contiguous buffers are
+ * gathered into pwritev calls and the written range is dropped from the
+ * page cache so long captures don't evict everything else.
+ */
+
+#define _GNU_SOURCE
+#include "sdr.h"
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#if defined(__NR_io_uring_setup) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#define HAVE_IO_URING 1
+#endif
+#endif
+
+#define IQ_IO_BATCH 16                         // Buffers gathered per pwritev
+#define IQ_IO_QUEUE_DEPTH 64                   // io_uring submission slots
+#define IQ_IO_DROP_CHUNK (4 * 1024 * 1024)     // Page cache dropped in 4 MB steps
+#define IQ_WRITER_BATCH 8                      // Buffers collected before waking the writer
+#define IQ_WRITER_MAX_WAIT_MS 100              // Upper bound on how long data sits queued
+
+// One write that is in flight through io_uring
+typedef struct {
+    struct iovec iov;
+    iq_buffer_t *buf;
+    int fd;
+    off_t off;
+} iq_io_req_t;
+
+struct iq_io {
+    int kind;                  // IQ_IO_URING or IQ_IO_PWRITEV
+    int direct;                // Files are opened with O_DIRECT
+    int error;                 // Sticky write error
+
+    // pwritev batching
+    int batch_fd;
+    off_t batch_off;
+    size_t batch_len;
+    int batch_count;
+    struct iovec batch_iov[IQ_IO_BATCH];
+    iq_buffer_t *batch_buf[IQ_IO_BATCH];
+
+    // Page cache dropping for buffered writes
+    int cache_fd;
+    off_t cache_written;
+    off_t cache_dropped;
+
+    // Statistics
+    uint64_t syscalls;
+    uint64_t bytes;
+
+#ifdef HAVE_IO_URING
+    int ring_fd;
+    void *sq_ptr, *cq_ptr;
+    size_t sq_len, cq_len;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+    unsigned to_submit;
+    int inflight;
+    iq_io_req_t reqs[IQ_IO_QUEUE_DEPTH];
+    int free_reqs[IQ_IO_QUEUE_DEPTH];
+    int n_free_reqs;
+#endif
+};
+
+// Give a buffer back to the writer pool once its last write is done
+static void iq_buffer_release(iq_buffer_t *buf) {
+    if (--buf->refs > 0) {
+        return;
+    }
+
+    iq_writer_t *w = buf->owner;
+    pthread_mutex_lock(&w->lock);
+    buf->next = w->free_list;
+    w->free_list = buf;
+    pthread_cond_signal(&w->free_cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+// Blocking pwrite of a whole range, retrying on short writes
+static int pwrite_all(iq_io_t *io, int fd, const uint8_t *data, size_t len, off_t off) {
+    while (len > 0) {
+        ssize_t n = pwrite(fd, data, len, off);
+        io->syscalls++;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return 0;
+        }
+        data += n;
+        len -= n;
+        off += n;
+    }
+    return 1;
+}
+
+// Push written pages out and drop them from the page cache
+static void iq_io_drop_cache(iq_io_t *io, int fd, off_t end, int force) {
+    if (io->direct) {
+        return;
+    }
+
+    if (fd != io->cache_fd) {
+        io->cache_fd = fd;
+        io->cache_written = 0;
+        io->cache_dropped = 0;
+    }
+    if (end > io->cache_written) {
+        io->cache_written = end;
+    }
+
+    off_t pending = io->cache_written - io->cache_dropped;
+    if (pending <= 0 || (!force && pending < IQ_IO_DROP_CHUNK)) {
+        return;
+    }
+
+    // DONTNEED ignores dirty pages, so wait for writeback of the range first
+    sync_file_range(fd, io->cache_dropped, pending,
+                    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    posix_fadvise(fd, io->cache_dropped, pending, POSIX_FADV_DONTNEED);
+    io->syscalls += 2;
+    io->cache_dropped = io->cache_written;
+}
+
+// Write out the gathered pwritev batch
+static void iq_io_flush_batch(iq_io_t *io) {
+    if (io->batch_count == 0) {
+        return;
+    }
+
+    struct iovec *iov = io->batch_iov;
+    int iovcnt = io->batch_count;
+    off_t off = io->batch_off;
+    size_t left = io->batch_len;
+
+    while (left > 0 && !io->error) {
+        ssize_t n = pwritev(io->batch_fd, iov, iovcnt, off);
+        io->syscalls++;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("Failed to write IQ data");
+            io->error = 1;
+            break;
+        }
+
+        // Skip past whatever was written and retry the rest
+        off += n;
+        left -= n;
+        while (iovcnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    io->bytes += io->batch_len - left;
+    iq_io_drop_cache(io, io->batch_fd, io->batch_off + io->batch_len, 0);
+
+    for (int i = 0; i < io->batch_count; i++) {
+        iq_buffer_release(io->batch_buf[i]);
+    }
+    io->batch_count = 0;
+    io->batch_len = 0;
+}
+
+#ifdef HAVE_IO_URING
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+// Map the submission and completion rings; returns 0 if io_uring is unavailable
+static int iq_io_uring_init(iq_io_t *io) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    io->ring_fd = sys_io_uring_setup(IQ_IO_QUEUE_DEPTH, &p);
+    if (io->ring_fd < 0) {
+        return 0;
+    }
+
+    io->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    io->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (io->cq_len > io->sq_len) io->sq_len = io->cq_len;
+        io->cq_len = io->sq_len;
+    }
+
+    io->sq_ptr = mmap(NULL, io->sq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      io->ring_fd, IORING_OFF_SQ_RING);
+    if (io->sq_ptr == MAP_FAILED) {
+        close(io->ring_fd);
+        return 0;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        io->cq_ptr = io->sq_ptr;
+    } else {
+        io->cq_ptr = mmap(NULL, io->cq_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          io->ring_fd, IORING_OFF_CQ_RING);
+        if (io->cq_ptr == MAP_FAILED) {
+            munmap(io->sq_ptr, io->sq_len);
+            close(io->ring_fd);
+            return 0;
+        }
+    }
+
+    io->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    io->sqes = mmap(NULL, io->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                    io->ring_fd, IORING_OFF_SQES);
+    if (io->sqes == MAP_FAILED) {
+        if (io->cq_ptr != io->sq_ptr) munmap(io->cq_ptr, io->cq_len);
+        munmap(io->sq_ptr, io->sq_len);
+        close(io->ring_fd);
+        return 0;
+    }
+
+    uint8_t *sq = io->sq_ptr;
+    uint8_t *cq = io->cq_ptr;
+    io->sq_head = (unsigned *)(sq + p.sq_off.head);
+    io->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    io->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    io->sq_array = (unsigned *)(sq + p.sq_off.array);
+    io->cq_head = (unsigned *)(cq + p.cq_off.head);
+    io->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    io->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    io->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+    for (int i = 0; i < IQ_IO_QUEUE_DEPTH; i++) {
+        io->free_reqs[i] = i;
+    }
+    io->n_free_reqs = IQ_IO_QUEUE_DEPTH;
+    return 1;
+}
+
+static void iq_io_uring_destroy(iq_io_t *io) {
+    munmap(io->sqes, io->sqes_len);
+    if (io->cq_ptr != io->sq_ptr) munmap(io->cq_ptr, io->cq_len);
+    munmap(io->sq_ptr, io->sq_len);
+    close(io->ring_fd);
+}
+
+// Handle every completion currently in the CQ ring
+static void iq_io_uring_reap(iq_io_t *io) {
+    unsigned head = *io->cq_head;
+    unsigned tail = __atomic_load_n(io->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &io->cqes[head & *io->cq_mask];
+        int slot = (int)cqe->user_data;
+        iq_io_req_t *req = &io->reqs[slot];
+
+        if (cqe->res < 0) {
+            errno = -cqe->res;
+            perror("Failed to write IQ data");
+            io->error = 1;
+        } else {
+            // Finish a short write synchronously, without O_DIRECT constraints
+            size_t done = (size_t)cqe->res;
+            if (done < req->iov.iov_len) {
+                fcntl(req->fd, F_SETFL, fcntl(req->fd, F_GETFL) & ~O_DIRECT);
+                if (!pwrite_all(io, req->fd, (uint8_t *)req->iov.iov_base + done,
+                                req->iov.iov_len - done, req->off + done)) {
+                    perror("Failed to write IQ data");
+                    io->error = 1;
+                }
+            }
+            io->bytes += req->iov.iov_len;
+            iq_io_drop_cache(io, req->fd, req->off + req->iov.iov_len, 0);
+        }
+
+        iq_buffer_release(req->buf);
+        io->free_reqs[io->n_free_reqs++] = slot;
+        io->inflight--;
+        head++;
+    }
+
+    __atomic_store_n(io->cq_head, head, __ATOMIC_RELEASE);
+}
+
+// Submit queued entries and optionally wait for some completions
+static void iq_io_uring_enter(iq_io_t *io, unsigned min_complete) {
+    unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+
+    if (io->to_submit == 0 && min_complete == 0) {
+        iq_io_uring_reap(io);
+        return;
+    }
+
+    int ret;
+    do {
+        ret = sys_io_uring_enter(io->ring_fd, io->to_submit, min_complete, flags);
+    } while (ret < 0 && errno == EINTR);
+    io->syscalls++;
+
+    if (ret < 0) {
+        perror("io_uring_enter failed");
+        io->error = 1;
+    } else {
+        io->to_submit -= ret < (int)io->to_submit ? ret : io->to_submit;
+    }
+    iq_io_uring_reap(io);
+}
+
+static void iq_io_uring_write(iq_io_t *io, int fd, iq_buffer_t *buf, size_t data_off,
+                              size_t len, off_t file_off) {
+    while (io->n_free_reqs == 0 && !io->error) {
+        iq_io_uring_enter(io, 1);
+    }
+    if (io->error) {
+        iq_buffer_release(buf);
+        return;
+    }
+
+    int slot = io->free_reqs[--io->n_free_reqs];
+    iq_io_req_t *req = &io->reqs[slot];
+    req->iov.iov_base = buf->data + data_off;
+    req->iov.iov_len = len;
+    req->buf = buf;
+    req->fd = fd;
+    req->off = file_off;
+
+    unsigned tail = *io->sq_tail;
+    unsigned index = tail & *io->sq_mask;
+    struct io_uring_sqe *sqe = &io->sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITEV;
+    sqe->fd = fd;
+    sqe->off = file_off;
+    sqe->addr = (uint64_t)(uintptr_t)&req->iov;
+    sqe->len = 1;
+    sqe->user_data = slot;
+
+    io->sq_array[index] = index;
+    __atomic_store_n(io->sq_tail, tail + 1, __ATOMIC_RELEASE);
+    io->to_submit++;
+    io->inflight++;
+}
+#endif
+
+// Pick the best backend the kernel offers; want is IQ_IO_AUTO, IQ_IO_URING or IQ_IO_PWRITEV
+iq_io_t *iq_io_create(int want) {
+    iq_io_t *io = calloc(1, sizeof(iq_io_t));
+    if (!io) {
+        perror("Failed to allocate IQ writer");
+        return NULL;
+    }
+
+    io->kind = IQ_IO_PWRITEV;
+    io->cache_fd = -1;
+
+#ifdef HAVE_IO_URING
+    if (want != IQ_IO_PWRITEV && iq_io_uring_init(io)) {
+        io->kind = IQ_IO_URING;
+        io->direct = 1;
+    }
+#endif
+
+    if (want == IQ_IO_URING && io->kind != IQ_IO_URING) {
+        fprintf(stderr, "io_uring is not available, using pwritev\n");
+    }
+    return io;
+}
+
+const char *iq_io_describe(iq_io_t *io) {
+    if (io->kind == IQ_IO_URING) {
+        return io->direct ? "io_uring + O_DIRECT" : "io_uring";
+    }
+    return "pwritev + fadvise";
+}
+
+// Queue a range of a pool buffer for writing at file_off
+void iq_io_write(iq_io_t *io, int fd, iq_buffer_t *buf, size_t data_off, size_t len, off_t file_off) {
+    buf->refs++;
+
+    if (io->error) {
+        iq_buffer_release(buf);
+        return;
+    }
+
+    // O_DIRECT needs block-aligned offsets and lengths; the odd tail of a
+    // recording is written through the page cache instead
+    if (io->direct && ((file_off | len | data_off) & (IQ_IO_ALIGN - 1))) {
+        iq_io_drain(io);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+        if (!pwrite_all(io, fd, buf->data + data_off, len, file_off)) {
+            perror("Failed to write IQ data");
+            io->error = 1;
+        }
+        io->bytes += len;
+        iq_buffer_release(buf);
+        return;
+    }
+
+#ifdef HAVE_IO_URING
+    if (io->kind == IQ_IO_URING) {
+        iq_io_uring_write(io, fd, buf, data_off, len, file_off);
+        return;
+    }
+#endif
+
+    if (io->batch_count > 0 &&
+        (fd != io->batch_fd || file_off != io->batch_off + (off_t)io->batch_len ||
+         io->batch_count == IQ_IO_BATCH)) {
+        iq_io_flush_batch(io);
+    }
+
+    if (io->batch_count == 0) {
+        io->batch_fd = fd;
+        io->batch_off = file_off;
+    }
+    io->batch_iov[io->batch_count].iov_base = buf->data + data_off;
+    io->batch_iov[io->batch_count].iov_len = len;
+    io->batch_buf[io->batch_count] = buf;
+    io->batch_count++;
+    io->batch_len += len;
+}
+
+// Start everything that has been queued without waiting for it
+void iq_io_flush(iq_io_t *io) {
+#ifdef HAVE_IO_URING
+    if (io->kind == IQ_IO_URING) {
+        iq_io_uring_enter(io, 0);
+        return;
+    }
+#endif
+    iq_io_flush_batch(io);
+}
+
+// Wait until every queued write has completed
+void iq_io_drain(iq_io_t *io) {
+#ifdef HAVE_IO_URING
+    if (io->kind == IQ_IO_URING) {
+        iq_io_uring_enter(io, 0);
+        while (io->inflight > 0 && !io->error) {
+            iq_io_uring_enter(io, 1);
+        }
+        return;
+    }
+#endif
+    iq_io_flush_batch(io);
+}
+
+int iq_io_failed(iq_io_t *io) {
+    return io->error;
+}
+
+// Open an output file the way the backend wants to write it
+int iq_io_open_file(iq_io_t *io, const char *path) {
+    int flags = O_WRONLY | O_CREAT | O_TRUNC;
+    int fd = open(path, flags | (io->direct ? O_DIRECT : 0), 0600);
+
+    // Some filesystems (tmpfs, some FUSE mounts) refuse O_DIRECT
+    if (fd == -1 && io->direct && errno == EINVAL) {
+        io->direct = 0;
+        fd = open(path, flags, 0600);
+    }
+    return fd;
+}
+
+// Finish all writes to a file, trim it to length and close it
+void iq_io_close_file(iq_io_t *io, int fd, uint64_t length) {
+    iq_io_drain(io);
+
+    if (ftruncate(fd, length) == -1) {
+        perror("Failed to trim segment");
+    }
+    iq_io_drop_cache(io, fd, length, 1);
+    if (io->cache_fd == fd) {
+        io->cache_fd = -1;
+    }
+    close(fd);
+}
+
+void iq_io_destroy(iq_io_t *io) {
+    if (!io) {
+        return;
+    }
+    iq_io_drain(io);
+#ifdef HAVE_IO_URING
+    if (io->kind == IQ_IO_URING) {
+        iq_io_uring_destroy(io);
+    }
+#endif
+    free(io);
+}
+
+// Writer thread: move queued buffers through the segment writer to disk
+static void *iq_writer_thread(void *arg) {
+    iq_writer_t *w = arg;
+
+    while (1) {
+        // Let a few buffers pile up so they go out in one submission,
+        // but never sit on data for long
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += IQ_WRITER_MAX_WAIT_MS * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        pthread_mutex_lock(&w->lock);
+        // A timeout with nothing queued still goes round once, so that
+        // finished writes are reaped and their buffers freed for a
+        // capture loop that may be waiting on them
+        while (w->queued < IQ_WRITER_BATCH && !w->stopping) {
+            if (pthread_cond_timedwait(&w->queue_cond, &w->lock, &deadline) != 0) {
+                break;
+            }
+        }
+        iq_buffer_t *list = w->queue_head;
+        w->queue_head = w->queue_tail = NULL;
+        w->queued = 0;
+        int stopping = w->stopping;
+        pthread_mutex_unlock(&w->lock);
+
+        while (list) {
+            iq_buffer_t *buf = list;
+            list = list->next;
+
+            // Hold a reference while the segment writer splits the buffer
+            buf->refs = 1;
+            if (!iq_io_failed(w->io) && !segment_writer_write(&w->segments, buf)) {
+                w->failed = 1;
+            }
+            iq_buffer_release(buf);
+        }
+
+        iq_io_flush(w->io);
+        if (iq_io_failed(w->io)) {
+            w->failed = 1;
+        }
+
+        if (stopping) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+// Set up the buffer pool, backend and writer thread for a recording
+int iq_writer_open(iq_writer_t *w, const char *base, uint64_t segment_bytes,
+                   uint64_t quota_bytes, uint64_t expected_bytes, int backend,
+                   uint32_t center_freq, uint32_t sample_rate) {
+    memset(w, 0, sizeof(*w));
+
+    w->io = iq_io_create(backend);
+    if (!w->io) {
+        return 0;
+    }
+
+    // Pool buffers of this size are page aligned, as O_DIRECT needs
+    for (int i = 0; i < IQ_WRITER_BUFFERS; i++) {
+        void *data = buffer_pool_alloc(DEFAULT_BUFFER_SIZE);
+        if (!data) {
+            perror("Failed to allocate sample buffer");
+            for (int j = 0; j < i; j++) buffer_pool_free(w->buffers[j].data, DEFAULT_BUFFER_SIZE);
+            iq_io_destroy(w->io);
+            return 0;
+        }
+        w->buffers[i].data = data;
+        w->buffers[i].owner = w;
+        w->buffers[i].next = w->free_list;
+        w->free_list = &w->buffers[i];
+    }
+
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->queue_cond, NULL);
+    pthread_cond_init(&w->free_cond, NULL);
+
+    if (!segment_writer_open(&w->segments, w->io, base, segment_bytes, quota_bytes, expected_bytes,
+                             center_freq, sample_rate)) {
+        iq_writer_close(w);
+        return 0;
+    }
+
+    if (pthread_create(&w->thread, NULL, iq_writer_thread, w) != 0) {
+        perror("Failed to start writer thread");
+        segment_writer_close(&w->segments);
+        iq_writer_close(w);
+        return 0;
+    }
+    w->running = 1;
+    return 1;
+}
+
+// Take an empty buffer, waiting for the writer if the pool is exhausted
+iq_buffer_t *iq_writer_get_buffer(iq_writer_t *w) {
+    pthread_mutex_lock(&w->lock);
+    if (!w->free_list) {
+        w->stalls++;
+    }
+    while (!w->free_list) {
+        pthread_cond_wait(&w->free_cond, &w->lock);
+    }
+    iq_buffer_t *buf = w->free_list;
+    w->free_list = buf->next;
+    pthread_mutex_unlock(&w->lock);
+
+    buf->next = NULL;
+    buf->len = 0;
+    buf->refs = 0;
+    return buf;
+}
+
+// Hand a filled buffer to the writer thread
+void iq_writer_submit(iq_writer_t *w, iq_buffer_t *buf) {
+    pthread_mutex_lock(&w->lock);
+    buf->next = NULL;
+    if (w->queue_tail) {
+        w->queue_tail->next = buf;
+    } else {
+        w->queue_head = buf;
+    }
+    w->queue_tail = buf;
+    if (++w->queued >= IQ_WRITER_BATCH) {
+        pthread_cond_signal(&w->queue_cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+}
+
+// Flush everything, stop the writer thread and close the last segment
+void iq_writer_close(iq_writer_t *w) {
+    if (w->running) {
+        pthread_mutex_lock(&w->lock);
+        w->stopping = 1;
+        pthread_cond_signal(&w->queue_cond);
+        pthread_mutex_unlock(&w->lock);
+        pthread_join(w->thread, NULL);
+        w->running = 0;
+
+        iq_io_drain(w->io);
+        segment_writer_close(&w->segments);
+    }
+
+    // Keep the numbers around for the caller's summary
+    if (w->io) {
+        w->backend_name = iq_io_describe(w->io);
+        w->syscalls = w->io->syscalls;
+        w->bytes_written = w->io->bytes;
+    }
+    iq_io_destroy(w->io);
+    w->io = NULL;
+
+    for (int i = 0; i < IQ_WRITER_BUFFERS; i++) {
+        buffer_pool_free(w->buffers[i].data, DEFAULT_BUFFER_SIZE);
+        w->buffers[i].data = NULL;
+    }
+
+    pthread_cond_destroy(&w->free_cond);
+    pthread_cond_destroy(&w->queue_cond);
+    pthread_mutex_destroy(&w->lock);
+}
@@ -4,17 +4,25 @@
  *
  * Implements the sdr_monitor command which continuously measures and
  * displays the signal power at a specific frequency. Provides a
- * real-time terminal-based power meter visualization.
+ * real-time terminal-based power meter visualization. Each reading is
+ * published to the remote control server (sdr_remote.c), and retunes
+ * requested by its clients are handed to the capture thread.
+ *
+ * The monitor is a block graph: capture -> power -> meter.
  */
 
-#include "shell.h"
+#include "sdr.h"
 
 // Command to monitor a frequency (simplified version)
 int cmd_sdr_monitor(char **args) {
     uint32_t freq = DEFAULT_FREQ;
+    int seconds = 10;             // 0 = until Ctrl+C
 
     // Parse command arguments
-    if (args[1]) freq = atoi(args[1]);
+    if (args[1]) {
+        freq = parse_frequency(args[1]);
+        if (args[2]) seconds = atoi(args[2]);
+    }
 
     // Open device
     rtlsdr_dev_t *dev;
@@ -25,59 +33,41 @@ int cmd_sdr_monitor(char **args) {
     // Set frequency
     rtlsdr_set_center_freq(dev, freq);
 
-    // Reset buffer
-    rtlsdr_reset_buffer(dev);
-
     printf("Monitoring %.2f MHz. Press Ctrl+C to stop...\n", freq/1e6);
+    fflush(stdout);
 
-    // Allocate buffer
-    uint32_t buffer_size = DEFAULT_BUFFER_SIZE;
-    uint8_t *buffer = malloc(buffer_size);
-
-    if (!buffer) {
-        perror("Failed to allocate sample buffer");
+    sample_capture_t capture;
+    if (!sample_capture_start(&capture, dev)) {
         close_sdr_device(dev);
         return 1;
     }
 
-    // Simple monitoring loop
-    while (1) {
-        int n_read = 0;
-        rtlsdr_read_sync(dev, buffer, buffer_size, &n_read);
-
-        if (n_read > 0) {
-            // Calculate simple power level
-            double power = 0.0;
-            for (int i = 0; i < n_read; i++) {
-                double sample = (buffer[i] - 127.5) / 127.5;
-                power += sample * sample;
-            }
-            power /= n_read;
-
-            // Display power meter
-            int meter_width = 50;
-            int bars = (int)(power * meter_width * 10.0);
-            if (bars > meter_width) bars = meter_width;
-
-            printf("\rSignal: [");
-            for (int i = 0; i < meter_width; i++) {
-                printf("%c", i < bars ? '#' : ' ');
-            }
-            printf("] %.2f dB", 10.0 * log10(power));
-            fflush(stdout);
-        }
-
-        // Check for Ctrl+C (would need signal handling for real implementation)
-        // For this demo, we just do a small number of iterations
-        static int count = 0;
-        if (++count >= 100) break;
-
-        usleep(100000); // 100ms
+    // capture -> power -> meter: ten readings a second, each the mean
+    // power over 100 ms of samples
+    sdr_graph_t *graph = sdr_graph_create(0);
+    uint64_t total_samples = seconds > 0 ? (uint64_t)seconds * DEFAULT_SAMPLE_RATE : 0;
+    sdr_block_t *source = graph ? block_capture(graph, &capture, freq, total_samples) : NULL;
+    sdr_block_t *power = graph ? block_power(graph, DEFAULT_SAMPLE_RATE / 10) : NULL;
+    sdr_block_t *meter = source ? block_meter(graph, source) : NULL;
+
+    remote_publish_frequency(freq);
+    remote_set_active(1);
+    sdr_install_stop_handler();
+
+    if (!sdr_graph_connect(source, power) || !sdr_graph_connect(power, meter) || !sdr_graph_run(graph)) {
+        fprintf(stderr, "\nsdr_monitor: monitoring failed\n");
+        last_exit_status = 1;
     }
 
+    sdr_restore_stop_handler();
+    remote_set_active(0);
+
+    sample_capture_stop(&capture);
     printf("\nMonitoring stopped.\n");
+    sample_capture_report(&capture, stdout);
+    if (graph) sdr_graph_report_latency(graph, stdout);
+    sdr_graph_destroy(graph);
 
-    free(buffer);
     close_sdr_device(dev);
 
     return 1;
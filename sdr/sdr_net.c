@@ -0,0 +1,95 @@
+/**
+ * @file sdr_net.c
+ * @brief Listening sockets for the SDR network servers
+ *
+ * sdr_remote and sdr_serve accept the same endpoint syntax: a port
+ * (bound to loopback), addr:port, or unix:path for a Unix socket.
+ */
+
+#include "sdr.h"
+#include <errno.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// Listen on host:port, port or unix:path; returns a non-blocking socket
+// or -1. For a Unix socket the path is copied to unix_path so the caller
+// can remove it when done; otherwise unix_path is set to "".
+int sdr_listen(const char *endpoint, const char *who, char *unix_path, size_t unix_path_len) {
+    int fd;
+    unix_path[0] = '\0';
+    if (strncmp(endpoint, "unix:", 5) == 0 || strchr(endpoint, '/')) {
+        const char *path = strncmp(endpoint, "unix:", 5) == 0 ? endpoint + 5 : endpoint;
+        struct sockaddr_un addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(addr.sun_path)) {
+            fprintf(stderr, "%s: socket path too long\n", who);
+            return -1;
+        }
+        strcpy(addr.sun_path, path);
+
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            fprintf(stderr, "%s: socket: %s\n", who, strerror(errno));
+            return -1;
+        }
+        // A socket file left by an earlier run would make bind fail
+        struct stat st;
+        if (stat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+            unlink(path);
+        }
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            fprintf(stderr, "%s: %s: %s\n", who, path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        snprintf(unix_path, unix_path_len, "%s", path);
+    } else {
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        // Only loopback unless an address is given, as gqrx and rtl_tcp do
+        const char *port = endpoint;
+        const char *colon = strrchr(endpoint, ':');
+        if (colon) {
+            char host[64];
+            snprintf(host, sizeof(host), "%.*s", (int)(colon - endpoint), endpoint);
+            if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+                fprintf(stderr, "%s: bad address %s\n", who, host);
+                return -1;
+            }
+            port = colon + 1;
+        }
+        int port_num = atoi(port);
+        if (port_num <= 0 || port_num > 65535) {
+            fprintf(stderr, "%s: bad port %s\n", who, port);
+            return -1;
+        }
+        addr.sin_port = htons(port_num);
+
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            fprintf(stderr, "%s: socket: %s\n", who, strerror(errno));
+            return -1;
+        }
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+            fprintf(stderr, "%s: %s: %s\n", who, endpoint, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (listen(fd, 64) != 0) {
+        fprintf(stderr, "%s: listen: %s\n", who, strerror(errno));
+        if (unix_path[0]) unlink(unix_path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
@@ -0,0 +1,244 @@
+/**
+ * @file sdr_pipeline.c
+ * @brief Several measurements from one capture
+ *
+ * Implements the sdr_pipeline command, which builds one block graph
+ * around a single capture so recording, SNR logging, signal detection
+ * and the power meter can run side by side on the same samples instead
+ * of each command claiming the dongle in turn:
+ *
+ *     capture -+-> iq_writer                                  (record)
+ *              +-> convert [-> mix -> lowpass] -> fft -+-> snr_log (snr)
+ *              |                                       +-> detector (detect)
+ *              +-> power -> meter                             (monitor)
+ *
+ * Every stage runs on the work pool, so the stages use separate cores.
+ *
+ * --offset-tune tunes the dongle below the frequency, out of the way of
+ * its DC spike, and puts a correct stage (sdr_dsp.c) after convert;
+ * --offset is then still relative to the frequency asked for.
+ */
+
+#include "sdr.h"
+
+#define PIPELINE_USAGE "usage: sdr_pipeline [frequency] [seconds, 0 = until Ctrl+C] " \
+                       "<record|snr|detect[=dB]|monitor>... [--offset Hz] [--bandwidth Hz] [--offset-tune[=Hz]] " \
+                       "[--threads N] [--stats]"
+
+// Command to run several measurements on one capture
+int cmd_sdr_pipeline(char **args) {
+    uint32_t freq = DEFAULT_FREQ;
+    uint32_t seconds = 10;
+    int record = 0, snr = 0, detect = 0, monitor = 0;
+    float threshold_db = 10.0f;
+    double offset = 0.0;
+    double bandwidth = 0.0;
+    uint64_t tune_offset = 0;
+    int threads = 0;
+    int stats = 0;
+
+    // Parse command arguments
+    int argi = 1;
+    if (args[argi] && isdigit((unsigned char)args[argi][0])) {
+        freq = parse_frequency(args[argi++]);
+        if (args[argi] && isdigit((unsigned char)args[argi][0])) seconds = atoi(args[argi++]);
+    }
+
+    for (; args[argi] != NULL; argi++) {
+        if (strcmp(args[argi], "record") == 0) {
+            record = 1;
+        } else if (strcmp(args[argi], "snr") == 0) {
+            snr = 1;
+        } else if (strcmp(args[argi], "detect") == 0) {
+            detect = 1;
+        } else if (strncmp(args[argi], "detect=", 7) == 0) {
+            detect = 1;
+            threshold_db = atof(args[argi] + 7);
+        } else if (strcmp(args[argi], "monitor") == 0) {
+            monitor = 1;
+        } else if (strcmp(args[argi], "--offset") == 0 && args[argi+1]) {
+            offset = atof(args[++argi]);
+        } else if (strcmp(args[argi], "--bandwidth") == 0 && args[argi+1]) {
+            bandwidth = atof(args[++argi]);
+        } else if (strcmp(args[argi], "--offset-tune") == 0) {
+            tune_offset = OFFSET_TUNE_DEFAULT;
+        } else if (strncmp(args[argi], "--offset-tune=", 14) == 0) {
+            tune_offset = parse_frequency(args[argi] + 14);
+        } else if (strcmp(args[argi], "--threads") == 0 && args[argi+1]) {
+            threads = atoi(args[++argi]);
+        } else if (strcmp(args[argi], "--stats") == 0) {
+            stats = 1;
+        } else {
+            fprintf(stderr, "sdr_pipeline: unknown option %s\n", args[argi]);
+            last_exit_status = 1;
+            return 1;
+        }
+    }
+
+    if (!record && !snr && !detect && !monitor) {
+        fprintf(stderr, "%s\n", PIPELINE_USAGE);
+        last_exit_status = 1;
+        return 1;
+    }
+    if (tune_offset >= DEFAULT_SAMPLE_RATE / 2 || tune_offset > freq) {
+        fprintf(stderr, "sdr_pipeline: the tuning offset must be below %u Hz and the frequency\n",
+                DEFAULT_SAMPLE_RATE / 2);
+        last_exit_status = 1;
+        return 1;
+    }
+    if (bandwidth < 0 || bandwidth > DEFAULT_SAMPLE_RATE ||
+        fabs(offset + tune_offset) + bandwidth / 2 > DEFAULT_SAMPLE_RATE / 2) {
+        fprintf(stderr, "sdr_pipeline: offset and bandwidth must stay within the %u Hz capture\n",
+                DEFAULT_SAMPLE_RATE);
+        last_exit_status = 1;
+        return 1;
+    }
+    if ((offset != 0.0 || bandwidth > 0) && !snr && !detect) {
+        fprintf(stderr, "sdr_pipeline: --offset and --bandwidth only apply to snr and detect\n");
+        last_exit_status = 1;
+        return 1;
+    }
+    if ((record || snr) && !create_data_directories()) {
+        return 1;
+    }
+
+    // Open device
+    rtlsdr_dev_t *dev;
+    if (!open_sdr_device(&dev)) {
+        return 1;
+    }
+
+    // Set frequency, below the signal when offset tuning
+    uint32_t tuned = freq - tune_offset;
+    rtlsdr_set_center_freq(dev, tuned);
+
+    uint64_t total_samples = (uint64_t)seconds * DEFAULT_SAMPLE_RATE;
+
+    char base[PATH_MAX];
+    iq_writer_t writer;
+    if (record) {
+        record_base_path(base, sizeof(base));
+        if (!iq_writer_open(&writer, base, 0, 0, total_samples * 2, IQ_IO_AUTO, tuned, DEFAULT_SAMPLE_RATE)) {
+            close_sdr_device(dev);
+            return 1;
+        }
+    }
+
+    char filename[PATH_MAX];
+    FILE *file = NULL;
+    if (snr) {
+        char* timestamp = get_timestamp_string();
+        snprintf(filename, sizeof(filename), "%s/snr_%s.csv", SNR_DIR, timestamp);
+        free(timestamp);
+
+        file = fopen(filename, "w");
+        if (!file) {
+            perror("Failed to open output file");
+            if (record) iq_writer_close(&writer);
+            close_sdr_device(dev);
+            return 1;
+        }
+    }
+
+    sample_capture_t capture;
+    if (!sample_capture_start(&capture, dev)) {
+        if (file) fclose(file);
+        if (record) iq_writer_close(&writer);
+        close_sdr_device(dev);
+        return 1;
+    }
+
+    if (seconds > 0) {
+        printf("Pipeline at %.2f MHz for %u seconds...\n", freq/1e6, seconds);
+    } else {
+        printf("Pipeline at %.2f MHz. Press Ctrl+C to stop...\n", freq/1e6);
+    }
+    if (tune_offset) {
+        printf("Offset tuning: receiver at %.4f MHz\n", tuned / 1e6);
+    }
+    fflush(stdout);
+
+    sdr_graph_t *graph = sdr_graph_create(threads);
+    sdr_block_t *source = graph ? block_capture(graph, &capture, tuned, total_samples) : NULL;
+    int ok = source != NULL;
+
+    if (ok && record) {
+        ok = sdr_graph_connect(source, block_iq_writer(graph, &writer, 0, total_samples));
+    }
+
+    // snr and detect share one channel filter and one FFT
+    sdr_block_t *correct = NULL;
+    if (ok && (snr || detect)) {
+        sdr_block_t *last = block_convert(graph);
+        ok = sdr_graph_connect(source, last);
+        if (ok && tune_offset) {
+            correct = block_correct(graph);
+            ok = sdr_graph_connect(last, correct);
+            last = correct;
+        }
+        if (ok && offset + tune_offset != 0.0) {
+            sdr_block_t *mix = block_mix(graph, offset + tune_offset);
+            ok = sdr_graph_connect(last, mix);
+            last = mix;
+        }
+        if (ok && bandwidth > 0) {
+            sdr_block_t *lowpass = block_lowpass(graph, bandwidth / 2, (int)(DEFAULT_SAMPLE_RATE / bandwidth));
+            ok = sdr_graph_connect(last, lowpass);
+            last = lowpass;
+        }
+        sdr_block_t *fft = ok ? block_fft(graph, 1024) : NULL;
+        ok = ok && sdr_graph_connect(last, fft);
+        if (ok && snr) {
+            // The meter owns the terminal line when both are shown
+            ok = sdr_graph_connect(fft, block_snr_log(graph, file, !monitor));
+        }
+        if (ok && detect) {
+            ok = sdr_graph_connect(fft, block_detector(graph, threshold_db));
+        }
+    }
+
+    if (ok && monitor) {
+        sdr_block_t *power = block_power(graph, DEFAULT_SAMPLE_RATE / 10);
+        ok = sdr_graph_connect(source, power) && sdr_graph_connect(power, block_meter(graph, source));
+        remote_publish_frequency(freq);
+        remote_set_active(1);
+    }
+
+    time_t start_time = time(NULL);
+    sdr_install_stop_handler();
+    if (!ok || !sdr_graph_run(graph)) {
+        fprintf(stderr, "\nsdr_pipeline: pipeline did not complete\n");
+        last_exit_status = 1;
+    }
+    sdr_restore_stop_handler();
+    if (monitor) remote_set_active(0);
+
+    sample_capture_stop(&capture);
+    printf("\nPipeline stopped.\n");
+    sample_capture_report(&capture, stdout);
+    if (correct) block_correct_report(correct, stdout);
+    if (graph) {
+        sdr_graph_report_latency(graph, stdout);
+        if (stats) sdr_graph_report(graph, stdout);
+    }
+    sdr_graph_destroy(graph);
+
+    if (record) {
+        iq_writer_close(&writer);
+        printf("IQ data saved to %s.dat\n", base);
+        record_save_info(base, tuned, &writer);
+    }
+    if (file) {
+        fclose(file);
+        printf("SNR results saved to %s\n", filename);
+
+        double center = freq + offset;
+        double width = bandwidth > 0 ? bandwidth : DEFAULT_SAMPLE_RATE;
+        catalog_add(CATALOG_SNR, filename, center - width / 2, center + width / 2,
+                    (uint32_t)width, start_time, time(NULL));
+    }
+
+    close_sdr_device(dev);
+
+    return 1;
+}
@@ -0,0 +1,359 @@
+/**
+ * @file sdr_pool.c
+ * @brief Process-wide pool of aligned sample buffers
+ *
+ * Packets, FFT buffers, writer and capture buffers all come from here
+ * instead of malloc. Requests are rounded up to a power-of-two size
+ * class between 64 bytes and 2 MiB and carved out of 2 MiB slabs, which
+ * are mapped with explicit huge pages when the system has them reserved
+ * and aligned for transparent huge pages otherwise, so even large FFTs
+ * touch only a handful of TLB entries. A buffer is aligned to its size
+ * class up to a 4 KiB page: every buffer is cache-line (and so SIMD)
+ * aligned, and buffers of a page or more are fit for O_DIRECT.
+ *
+ * Each thread keeps a small cache of free buffers per class and only
+ * takes the pool lock to trade half a cache with the shared free lists.
+ * Buffers are never returned to the system, so once the commands in use
+ * have warmed up the pool they allocate nothing more; sdr_pool shows
+ * how far that holds. Requests above 2 MiB are mapped one by one.
+ */
+
+#include "sdr.h"
+#include <errno.h>
+
+#define POOL_MIN_SHIFT 6              // 64 bytes, one cache line
+#define POOL_MAX_SHIFT 21             // 2 MiB, one slab
+#define POOL_CLASSES (POOL_MAX_SHIFT - POOL_MIN_SHIFT + 1)
+#define POOL_SLAB (1ul << POOL_MAX_SHIFT)
+#define POOL_PAGE 4096
+#define POOL_CACHE_BYTES (1ul << 20)  // Per class in each thread's cache
+#define POOL_CACHE_MAX 64             // Buffers per class in each thread's cache
+
+typedef struct pool_buffer {
+    struct pool_buffer *next;     // Free list link, in the free buffer itself
+} pool_buffer_t;
+
+typedef struct {
+    pool_buffer_t *free;          // Shared free list
+    uint64_t n_free;
+    uint64_t carved;              // Buffers ever cut from slabs
+    uint64_t refills;             // Thread caches refilled from the shared list
+    uint64_t allocs, frees;       // Updated without the lock
+    uint64_t cache_hits;
+} pool_class_t;
+
+typedef struct {
+    pool_buffer_t *free[POOL_CLASSES];
+    uint32_t count[POOL_CLASSES];
+} pool_cache_t;
+
+static struct {
+    pthread_mutex_t lock;
+    pool_class_t classes[POOL_CLASSES];
+    uint8_t *slab;                // Slab being carved
+    size_t slab_used;
+    uint64_t slabs[3];            // By backing: normal, SAMPLE_RING_HUGETLB, SAMPLE_RING_THP
+    int no_hugetlb;               // Explicit huge pages failed once; stop asking
+    uint64_t large_allocs, large_bytes;
+} pool = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+static pthread_key_t cache_key;
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
+static __thread pool_cache_t *cache;
+
+static int pool_class(size_t size) {
+    int k = 0;
+    while (((size_t)1 << (k + POOL_MIN_SHIFT)) < size) {
+        k++;
+    }
+    return k;
+}
+
+static size_t class_size(int k) {
+    return (size_t)1 << (k + POOL_MIN_SHIFT);
+}
+
+// Buffers a thread may hold for class k before giving some back
+static uint32_t cache_limit(int k) {
+    size_t limit = POOL_CACHE_BYTES / class_size(k);
+    if (limit < 2) limit = 2;
+    if (limit > POOL_CACHE_MAX) limit = POOL_CACHE_MAX;
+    return limit;
+}
+
+// Map one slab, preferring huge pages; pool lock held
+static uint8_t *pool_map_slab() {
+    void *map = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if (!pool.no_hugetlb) {
+        map = mmap(NULL, POOL_SLAB, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (map != MAP_FAILED) {
+            pool.slabs[SAMPLE_RING_HUGETLB]++;
+            return map;
+        }
+        pool.no_hugetlb = 1;
+    }
+#endif
+
+    // Over-map and trim so the slab starts on a huge page boundary
+    uint8_t *raw = mmap(NULL, 2 * POOL_SLAB, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) {
+        return NULL;
+    }
+    uint8_t *slab = (uint8_t *)(((uintptr_t)raw + POOL_SLAB - 1) & ~(uintptr_t)(POOL_SLAB - 1));
+    if (slab > raw) munmap(raw, slab - raw);
+    if (slab + POOL_SLAB < raw + 2 * POOL_SLAB) munmap(slab + POOL_SLAB, raw + 2 * POOL_SLAB - (slab + POOL_SLAB));
+
+    int backing = 0;
+#ifdef MADV_HUGEPAGE
+    if (madvise(slab, POOL_SLAB, MADV_HUGEPAGE) == 0) {
+        backing = SAMPLE_RING_THP;
+    }
+#endif
+    pool.slabs[backing]++;
+    return slab;
+}
+
+// Cut up to n buffers of class k onto the shared list; pool lock held
+static void pool_carve(int k, uint32_t n) {
+    size_t size = class_size(k);
+    size_t align = size < POOL_PAGE ? size : POOL_PAGE;
+    pool_class_t *c = &pool.classes[k];
+
+    for (uint32_t i = 0; i < n; i++) {
+        size_t offset = (pool.slab_used + align - 1) & ~(align - 1);
+        if (!pool.slab || offset + size > POOL_SLAB) {
+            // Whatever is left of the old slab stays unused
+            uint8_t *slab = pool_map_slab();
+            if (!slab) {
+                return;
+            }
+            pool.slab = slab;
+            offset = 0;
+        }
+        pool_buffer_t *b = (pool_buffer_t *)(pool.slab + offset);
+        pool.slab_used = offset + size;
+        b->next = c->free;
+        c->free = b;
+        c->n_free++;
+        c->carved++;
+    }
+}
+
+// A thread's cache goes back to the shared lists when the thread exits
+static void cache_release(void *arg) {
+    pool_cache_t *tc = arg;
+    pthread_mutex_lock(&pool.lock);
+    for (int k = 0; k < POOL_CLASSES; k++) {
+        while (tc->free[k]) {
+            pool_buffer_t *b = tc->free[k];
+            tc->free[k] = b->next;
+            b->next = pool.classes[k].free;
+            pool.classes[k].free = b;
+            pool.classes[k].n_free++;
+        }
+    }
+    pthread_mutex_unlock(&pool.lock);
+    free(tc);
+}
+
+static void cache_key_create() {
+    pthread_key_create(&cache_key, cache_release);
+}
+
+// This thread's cache, or NULL if it cannot have one
+static pool_cache_t *thread_cache() {
+    if (!cache) {
+        pthread_once(&cache_once, cache_key_create);
+        cache = calloc(1, sizeof(pool_cache_t));
+        if (cache && pthread_setspecific(cache_key, cache) != 0) {
+            free(cache);
+            cache = NULL;
+        }
+    }
+    return cache;
+}
+
+// A built-in forked as a pipeline stage allocates from the pool; make
+// sure it does not inherit the lock from a graph or scheduler thread
+static void pool_prepare_fork() {
+    pthread_mutex_lock(&pool.lock);
+}
+
+static void pool_release_fork() {
+    pthread_mutex_unlock(&pool.lock);
+}
+
+__attribute__((constructor))
+static void pool_init() {
+    pthread_atfork(pool_prepare_fork, pool_release_fork, pool_release_fork);
+}
+
+static void *large_alloc(size_t size) {
+    size = (size + POOL_PAGE - 1) & ~(size_t)(POOL_PAGE - 1);
+    void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+#ifdef MADV_HUGEPAGE
+    madvise(p, size, MADV_HUGEPAGE);
+#endif
+    __atomic_add_fetch(&pool.large_allocs, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&pool.large_bytes, size, __ATOMIC_RELAXED);
+    return p;
+}
+
+// A buffer of at least size bytes, aligned to its size class up to a
+// page; NULL (with errno ENOMEM) if memory ran out. Give it back with
+// buffer_pool_free and the same size.
+void *buffer_pool_alloc(size_t size) {
+    if (size > POOL_SLAB) {
+        void *p = large_alloc(size);
+        if (!p) errno = ENOMEM;
+        return p;
+    }
+
+    int k = pool_class(size);
+    pool_class_t *c = &pool.classes[k];
+    __atomic_add_fetch(&c->allocs, 1, __ATOMIC_RELAXED);
+
+    pool_cache_t *tc = thread_cache();
+    if (tc && tc->free[k]) {
+        pool_buffer_t *b = tc->free[k];
+        tc->free[k] = b->next;
+        tc->count[k]--;
+        __atomic_add_fetch(&c->cache_hits, 1, __ATOMIC_RELAXED);
+        return b;
+    }
+
+    // Take half a cache's worth from the shared list, cutting new
+    // buffers only when it is empty
+    uint32_t batch = tc ? cache_limit(k) / 2 : 1;
+    pthread_mutex_lock(&pool.lock);
+    if (c->n_free == 0) {
+        pool_carve(k, batch);
+    }
+    pool_buffer_t *b = c->free;
+    if (b) {
+        c->free = b->next;
+        c->n_free--;
+        c->refills++;
+        for (uint32_t i = 1; i < batch && c->free; i++) {
+            pool_buffer_t *extra = c->free;
+            c->free = extra->next;
+            c->n_free--;
+            extra->next = tc->free[k];
+            tc->free[k] = extra;
+            tc->count[k]++;
+        }
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    if (!b) {
+        __atomic_sub_fetch(&c->allocs, 1, __ATOMIC_RELAXED);
+        errno = ENOMEM;
+    }
+    return b;
+}
+
+void buffer_pool_free(void *p, size_t size) {
+    if (!p) {
+        return;
+    }
+    if (size > POOL_SLAB) {
+        size = (size + POOL_PAGE - 1) & ~(size_t)(POOL_PAGE - 1);
+        munmap(p, size);
+        __atomic_sub_fetch(&pool.large_allocs, 1, __ATOMIC_RELAXED);
+        __atomic_sub_fetch(&pool.large_bytes, size, __ATOMIC_RELAXED);
+        return;
+    }
+
+    int k = pool_class(size);
+    pool_class_t *c = &pool.classes[k];
+    __atomic_add_fetch(&c->frees, 1, __ATOMIC_RELAXED);
+
+    pool_buffer_t *b = p;
+    pool_cache_t *tc = thread_cache();
+    if (!tc) {
+        pthread_mutex_lock(&pool.lock);
+        b->next = c->free;
+        c->free = b;
+        c->n_free++;
+        pthread_mutex_unlock(&pool.lock);
+        return;
+    }
+
+    b->next = tc->free[k];
+    tc->free[k] = b;
+    if (++tc->count[k] <= cache_limit(k)) {
+        return;
+    }
+
+    // Buffers freed on another thread than they came from pile up here;
+    // hand half back so the allocating thread can have them
+    uint32_t keep = cache_limit(k) / 2;
+    pthread_mutex_lock(&pool.lock);
+    while (tc->count[k] > keep) {
+        b = tc->free[k];
+        tc->free[k] = b->next;
+        tc->count[k]--;
+        b->next = c->free;
+        c->free = b;
+        c->n_free++;
+    }
+    pthread_mutex_unlock(&pool.lock);
+}
+
+// Per-class usage, for tuning the cache sizes and checking that steady
+// state allocates nothing new
+void buffer_pool_report(FILE *out) {
+    pthread_mutex_lock(&pool.lock);
+    uint64_t total_slabs = pool.slabs[0] + pool.slabs[SAMPLE_RING_HUGETLB] + pool.slabs[SAMPLE_RING_THP];
+    fprintf(out, "Buffer pool: %llu slabs, %.1f MiB (%llu huge pages, %llu transparent huge pages, %llu normal pages)\n",
+            (unsigned long long)total_slabs, total_slabs * (POOL_SLAB / 1048576.0),
+            (unsigned long long)pool.slabs[SAMPLE_RING_HUGETLB], (unsigned long long)pool.slabs[SAMPLE_RING_THP],
+            (unsigned long long)pool.slabs[0]);
+    fprintf(out, "%10s %10s %10s %10s %12s %10s %10s\n",
+            "Size", "Buffers", "In use", "Shared", "Allocs", "Cached", "Refills");
+    for (int k = 0; k < POOL_CLASSES; k++) {
+        pool_class_t *c = &pool.classes[k];
+        if (c->carved == 0) {
+            continue;
+        }
+        uint64_t allocs = __atomic_load_n(&c->allocs, __ATOMIC_RELAXED);
+        uint64_t frees = __atomic_load_n(&c->frees, __ATOMIC_RELAXED);
+        uint64_t hits = __atomic_load_n(&c->cache_hits, __ATOMIC_RELAXED);
+        size_t size = class_size(k);
+        char label[32];
+        if (size >= 1048576) {
+            snprintf(label, sizeof(label), "%zu MiB", size / 1048576);
+        } else if (size >= 1024) {
+            snprintf(label, sizeof(label), "%zu KiB", size / 1024);
+        } else {
+            snprintf(label, sizeof(label), "%zu B", size);
+        }
+        fprintf(out, "%10s %10llu %10lld %10llu %12llu %9.1f%% %10llu\n", label,
+                (unsigned long long)c->carved, (long long)(allocs - frees), (unsigned long long)c->n_free,
+                (unsigned long long)allocs, allocs ? 100.0 * hits / allocs : 0.0,
+                (unsigned long long)c->refills);
+    }
+    pthread_mutex_unlock(&pool.lock);
+
+    uint64_t large = __atomic_load_n(&pool.large_allocs, __ATOMIC_RELAXED);
+    if (large > 0) {
+        fprintf(out, "Large buffers: %llu in use, %.1f MiB mapped separately\n", (unsigned long long)large,
+                __atomic_load_n(&pool.large_bytes, __ATOMIC_RELAXED) / 1048576.0);
+    }
+}
+
+// Command to show buffer pool statistics
+int cmd_sdr_pool(char **args) {
+    if (args[1]) {
+        fprintf(stderr, "usage: sdr_pool\n");
+        last_exit_status = 1;
+        return 1;
+    }
+    buffer_pool_report(stdout);
+    return 1;
+}
@@ -0,0 +1,272 @@
+/**
+ * @file sdr_pyramid.c
+ * @brief Multi-resolution min/max/mean pyramid over spectrum scans
+ *
+ * A scan produces one power value per frequency step. The pyramid keeps
+ * those bins at level 0 and, at level k, one min/max/sum node for every
+ * aligned run of 2^k bins. Appending a bin updates one node per level,
+ * and any bin range can be summarised from at most two nodes per level,
+ * so drawing a window of any size costs a few node reads per column
+ * instead of a pass over every bin. The pyramid is saved next to the
+ * scan log as a .pyr file so viewers never have to re-read the CSV.
+ */
+
+#include "sdr.h"
+#include <float.h>
+
+#define PYRAMID_MAGIC "SDRPYR1"
+#define PYRAMID_MIN_CAPACITY 1024
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t n_levels;
+    double start_freq;
+    double step;
+    uint64_t n_bins;
+    uint64_t capacity;
+} pyramid_header_t;
+
+static const pyramid_node_t empty_node = {FLT_MAX, -FLT_MAX, 0.0};
+
+static void node_merge(pyramid_node_t *into, const pyramid_node_t *from) {
+    if (from->min < into->min) into->min = from->min;
+    if (from->max > into->max) into->max = from->max;
+    into->sum += from->sum;
+}
+
+// Allocate storage for a power-of-two capacity, keeping existing data
+static int pyramid_alloc_levels(spectrum_pyramid_t *p, uint64_t capacity) {
+    int n_levels = 1;
+    while ((1ULL << (n_levels - 1)) < capacity) {
+        n_levels++;
+    }
+
+    float *bins = realloc(p->bins, sizeof(float) * capacity);
+    if (!bins) {
+        return 0;
+    }
+    p->bins = bins;
+
+    pyramid_node_t **levels = calloc(n_levels, sizeof(pyramid_node_t *));
+    if (!levels) {
+        return 0;
+    }
+
+    for (int k = 1; k < n_levels; k++) {
+        uint64_t nodes = capacity >> k;
+        levels[k] = malloc(sizeof(pyramid_node_t) * nodes);
+        if (!levels[k]) {
+            for (int j = 1; j < k; j++) free(levels[j]);
+            free(levels);
+            return 0;
+        }
+
+        // Keep whatever was already aggregated at this level
+        uint64_t kept = 0;
+        if (p->levels && k < p->n_levels) {
+            kept = p->capacity >> k;
+            memcpy(levels[k], p->levels[k], sizeof(pyramid_node_t) * kept);
+        }
+        for (uint64_t i = kept; i < nodes; i++) {
+            levels[k][i] = empty_node;
+        }
+    }
+
+    // Growing adds one level whose first node summarises the old top
+    if (p->n_bins > 0) {
+        for (int k = p->n_levels; k < n_levels; k++) {
+            if (k == 1) {
+                pyramid_node_t bin = {p->bins[0], p->bins[0], p->bins[0]};
+                node_merge(&levels[1][0], &bin);
+            } else {
+                node_merge(&levels[k][0], &levels[k - 1][0]);
+            }
+        }
+    }
+
+    if (p->levels) {
+        for (int k = 1; k < p->n_levels; k++) free(p->levels[k]);
+        free(p->levels);
+    }
+    p->levels = levels;
+    p->n_levels = n_levels;
+    p->capacity = capacity;
+    return 1;
+}
+
+// Create an empty pyramid for bins at start_freq + i * step
+spectrum_pyramid_t *pyramid_create(double start_freq, double step, uint64_t expected_bins) {
+    spectrum_pyramid_t *p = calloc(1, sizeof(spectrum_pyramid_t));
+    if (!p) {
+        perror("Failed to allocate spectrum pyramid");
+        return NULL;
+    }
+    p->start_freq = start_freq;
+    p->step = step > 0 ? step : 1;
+
+    uint64_t capacity = PYRAMID_MIN_CAPACITY;
+    while (capacity < expected_bins) {
+        capacity *= 2;
+    }
+    if (!pyramid_alloc_levels(p, capacity)) {
+        perror("Failed to allocate spectrum pyramid");
+        pyramid_free(p);
+        return NULL;
+    }
+    return p;
+}
+
+// Add the next bin and update its parent node on every level
+int pyramid_append(spectrum_pyramid_t *p, double power) {
+    if (p->n_bins == p->capacity && !pyramid_alloc_levels(p, p->capacity * 2)) {
+        perror("Failed to grow spectrum pyramid");
+        return 0;
+    }
+
+    pyramid_node_t bin = {power, power, power};
+    uint64_t index = p->n_bins++;
+    p->bins[index] = power;
+    for (int k = 1; k < p->n_levels; k++) {
+        node_merge(&p->levels[k][index >> k], &bin);
+    }
+    return 1;
+}
+
+// Summarise bins [first, end) from the largest aligned nodes that fit;
+// returns the number of bins covered
+uint64_t pyramid_query(const spectrum_pyramid_t *p, uint64_t first, uint64_t end, pyramid_node_t *out) {
+    *out = empty_node;
+    if (end > p->n_bins) end = p->n_bins;
+    if (first >= end) {
+        return 0;
+    }
+    uint64_t count = end - first;
+
+    while (first < end) {
+        int k = 0;
+        while (k + 1 < p->n_levels && (first & ((2ULL << k) - 1)) == 0 && first + (2ULL << k) <= end) {
+            k++;
+        }
+        if (k == 0) {
+            pyramid_node_t bin = {p->bins[first], p->bins[first], p->bins[first]};
+            node_merge(out, &bin);
+        } else {
+            node_merge(out, &p->levels[k][first >> k]);
+        }
+        first += 1ULL << k;
+    }
+    return count;
+}
+
+// Bin index of a frequency, clamped to the bins present
+uint64_t pyramid_bin(const spectrum_pyramid_t *p, double freq) {
+    if (freq <= p->start_freq || p->n_bins == 0) {
+        return 0;
+    }
+    uint64_t bin = (uint64_t)((freq - p->start_freq) / p->step + 0.5);
+    return bin < p->n_bins ? bin : p->n_bins - 1;
+}
+
+// Write the pyramid next to its scan log
+int pyramid_save(const spectrum_pyramid_t *p, const char *path) {
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    FILE *file = fopen(tmp_path, "wb");
+    if (!file) {
+        perror("Failed to save spectrum pyramid");
+        return 0;
+    }
+
+    pyramid_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, PYRAMID_MAGIC, sizeof(PYRAMID_MAGIC));
+    header.version = 1;
+    header.n_levels = p->n_levels;
+    header.start_freq = p->start_freq;
+    header.step = p->step;
+    header.n_bins = p->n_bins;
+    header.capacity = p->capacity;
+
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+             fwrite(p->bins, sizeof(float), p->capacity, file) == p->capacity;
+    for (int k = 1; ok && k < p->n_levels; k++) {
+        uint64_t nodes = p->capacity >> k;
+        ok = fwrite(p->levels[k], sizeof(pyramid_node_t), nodes, file) == nodes;
+    }
+
+    if (fclose(file) != 0 || !ok || rename(tmp_path, path) != 0) {
+        perror("Failed to save spectrum pyramid");
+        unlink(tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+// Read a pyramid written by pyramid_save
+spectrum_pyramid_t *pyramid_load(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return NULL;
+    }
+
+    pyramid_header_t header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, PYRAMID_MAGIC, sizeof(PYRAMID_MAGIC)) != 0 ||
+        header.capacity == 0 || (header.capacity & (header.capacity - 1)) != 0 ||
+        header.n_bins > header.capacity) {
+        fprintf(stderr, "%s is not a spectrum pyramid\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    spectrum_pyramid_t *p = calloc(1, sizeof(spectrum_pyramid_t));
+    if (!p || !pyramid_alloc_levels(p, header.capacity) || p->n_levels != (int)header.n_levels) {
+        fprintf(stderr, "Failed to load spectrum pyramid %s\n", path);
+        pyramid_free(p);
+        fclose(file);
+        return NULL;
+    }
+    p->start_freq = header.start_freq;
+    p->step = header.step;
+    p->n_bins = header.n_bins;
+
+    int ok = fread(p->bins, sizeof(float), p->capacity, file) == p->capacity;
+    for (int k = 1; ok && k < p->n_levels; k++) {
+        uint64_t nodes = p->capacity >> k;
+        ok = fread(p->levels[k], sizeof(pyramid_node_t), nodes, file) == nodes;
+    }
+    if (!ok) {
+        fprintf(stderr, "Spectrum pyramid %s is truncated\n", path);
+        pyramid_free(p);
+        fclose(file);
+        return NULL;
+    }
+
+    fclose(file);
+    return p;
+}
+
+void pyramid_free(spectrum_pyramid_t *p) {
+    if (!p) {
+        return;
+    }
+    for (int k = 1; p->levels && k < p->n_levels; k++) {
+        free(p->levels[k]);
+    }
+    free(p->levels);
+    free(p->bins);
+    free(p);
+}
+
+// Pyramid path for a scan log: spectrum_<ts>.csv -> spectrum_<ts>.pyr
+void pyramid_path(const char *csv_path, char *out, size_t out_len) {
+    snprintf(out, out_len, "%s", csv_path);
+    char *dot = strrchr(out, '.');
+    char *slash = strrchr(out, '/');
+    if (dot && (!slash || dot > slash)) {
+        *dot = '\0';
+    }
+    strncat(out, ".pyr", out_len - strlen(out) - 1);
+}
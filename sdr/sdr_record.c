@@ -4,10 +4,115 @@
  *
  * Implements the sdr_record command which captures raw IQ samples
  * from the SDR device at a specified frequency. Saves data to binary
- * files along with metadata about the recording parameters.
+ * files along with metadata about the recording parameters. Long
+ * captures can be split into rolling segments with a disk quota, or
+ * streamed raw to stdout with `-` for piping into another program.
+ * The metadata gives the real time of the first sample and lists any
+ * samples the capture dropped, so every sample's time is known.
+ *
+ * Both are block graphs: capture -> iq_writer or capture -> iq_stream.
  */
 
-#include "shell.h"
+#include "sdr.h"
+
+// Output path, without extension, for a new recording
+void record_base_path(char *base, size_t len) {
+    char* timestamp = get_timestamp_string();
+
+    // Sanitize the timestamp to ensure it only contains safe characters
+    for (int i = 0; timestamp[i] != '\0'; i++) {
+        // Replace any non-alphanumeric characters with underscores
+        if (!isalnum(timestamp[i]) && timestamp[i] != '-' && timestamp[i] != '_') {
+            timestamp[i] = '_';
+        }
+    }
+
+    snprintf(base, len, "%s/iq_%s", IQ_DIR, timestamp);
+    free(timestamp);
+}
+
+// Write the .txt metadata next to a finished recording
+void record_save_info(const char *base, uint32_t freq, const iq_writer_t *writer) {
+    char info_filename[PATH_MAX];
+    snprintf(info_filename, sizeof(info_filename), "%s.txt", base);
+
+    FILE *info_file = fopen(info_filename, "w");
+    if (info_file) {
+        fprintf(info_file, "Sample Rate: %u Hz\n", DEFAULT_SAMPLE_RATE);
+        fprintf(info_file, "Center Frequency: %u Hz\n", freq);
+        fprintf(info_file, "Duration: %.3f seconds\n", (double)writer->segments.total_samples / DEFAULT_SAMPLE_RATE);
+        fprintf(info_file, "Samples: %llu\n", (unsigned long long)writer->segments.total_samples);
+        fprintf(info_file, "Sample Format: 8-bit unsigned IQ\n");
+        if (writer->start_ns > 0) {
+            // Sample n was taken at Start Time + (n + samples dropped before it) / rate
+            char when[40];
+            format_utc_time(writer->start_ns, when, sizeof(when));
+            fprintf(info_file, "Start Time: %llu.%09llu (%s)\n",
+                    (unsigned long long)(writer->start_ns / 1000000000ull),
+                    (unsigned long long)(writer->start_ns % 1000000000ull), when);
+            fprintf(info_file, "Dropped Samples: %llu\n", (unsigned long long)writer->dropped_samples);
+            for (int i = 0; i < writer->n_gaps && i < IQ_WRITER_GAPS; i++) {
+                fprintf(info_file, "Gap: %llu samples dropped before sample %llu\n",
+                        (unsigned long long)writer->gaps[i][1], (unsigned long long)writer->gaps[i][0]);
+            }
+            if (writer->n_gaps > IQ_WRITER_GAPS) {
+                fprintf(info_file, "Gaps Not Listed: %d\n", writer->n_gaps - IQ_WRITER_GAPS);
+            }
+        }
+        if (writer->segments.segment_bytes > 0) {
+            fprintf(info_file, "Segment Size: %llu bytes\n", (unsigned long long)writer->segments.segment_bytes);
+            fprintf(info_file, "Manifest: %s.manifest\n", base);
+        }
+        fclose(info_file);
+    }
+}
+
+// Run source -> sink until the source has delivered its samples or
+// Ctrl+C
+static int record_run(sdr_graph_t *graph, sdr_block_t *source, sdr_block_t *sink) {
+    sdr_install_stop_handler();
+    int ok = sdr_graph_connect(source, sink) && sdr_graph_run(graph);
+    sdr_restore_stop_handler();
+    return ok;
+}
+
+// Capture straight to stdout; messages go to stderr so the stream stays
+// pure 8-bit IQ
+static void record_to_stdout(rtlsdr_dev_t *dev, uint32_t freq, uint32_t duration, int zero_copy) {
+    iq_stream_t stream;
+    if (!iq_stream_open(&stream, STDOUT_FILENO, DEFAULT_BUFFER_SIZE, zero_copy)) {
+        return;
+    }
+
+    uint64_t total_samples = (uint64_t)duration * DEFAULT_SAMPLE_RATE;
+    if (duration > 0) {
+        fprintf(stderr, "Streaming IQ data at %.2f MHz for %u seconds...\n", freq/1e6, duration);
+    } else {
+        fprintf(stderr, "Streaming IQ data at %.2f MHz. Press Ctrl+C to stop...\n", freq/1e6);
+    }
+
+    sample_capture_t capture;
+    if (!sample_capture_start(&capture, dev)) {
+        iq_stream_close(&stream);
+        return;
+    }
+    sdr_graph_t *graph = sdr_graph_create(0);
+    sdr_block_t *source = graph ? block_capture(graph, &capture, freq, total_samples) : NULL;
+    sdr_block_t *sink = source ? block_iq_stream(graph, &stream) : NULL;
+    if (!record_run(graph, source, sink)) {
+        fprintf(stderr, "\nsdr_record: streaming stopped early\n");
+        last_exit_status = 1;
+    }
+
+    sample_capture_stop(&capture);
+    fprintf(stderr, "Streamed %.1f MB (%s) in %llu syscalls%s\n", stream.bytes / 1e6,
+            stream.splice ? "vmsplice" : "write", (unsigned long long)stream.syscalls,
+            stream.failed ? ", reader closed the stream" : "");
+    sample_capture_report(&capture, stderr);
+    if (graph) sdr_graph_report_latency(graph, stderr);
+    sdr_graph_destroy(graph);
+    iq_stream_close(&stream);
+}
 
 // Command to record IQ data samples
 int cmd_sdr_record(char **args) {
@@ -16,11 +121,68 @@ int cmd_sdr_record(char **args) {
     }
 
     uint32_t freq = DEFAULT_FREQ;
-    uint32_t duration = 10; // Default 10 seconds
+    uint32_t duration = 10; // Default 10 seconds, 0 = until Ctrl+C
+    uint64_t segment_bytes = 0;
+    uint64_t quota_bytes = 0;
+    int backend = IQ_IO_AUTO;
+    int to_stdout = 0;
+    int zero_copy = 0;
 
     // Parse command arguments
-    if (args[1]) freq = atoi(args[1]);
-    if (args[2]) duration = atoi(args[2]);
+    int argi = 1;
+    if (args[argi] && args[argi][0] != '-') freq = atoi(args[argi++]);
+    if (args[argi] && args[argi][0] != '-') duration = atoi(args[argi++]);
+
+    for (; args[argi] != NULL; argi++) {
+        if (strcmp(args[argi], "-") == 0) {
+            to_stdout = 1;
+        } else if (strcmp(args[argi], "--splice") == 0) {
+            zero_copy = 1;
+        } else if (strcmp(args[argi], "--segment-size") == 0 && args[argi+1]) {
+            segment_bytes = parse_size(args[++argi]);
+        } else if (strcmp(args[argi], "--segment-secs") == 0 && args[argi+1]) {
+            segment_bytes = (uint64_t)atoi(args[++argi]) * DEFAULT_SAMPLE_RATE * 2;
+        } else if (strcmp(args[argi], "--quota") == 0 && args[argi+1]) {
+            quota_bytes = parse_size(args[++argi]);
+        } else if (strcmp(args[argi], "--io") == 0 && args[argi+1]) {
+            argi++;
+            if (strcmp(args[argi], "uring") == 0) {
+                backend = IQ_IO_URING;
+            } else if (strcmp(args[argi], "pwritev") == 0) {
+                backend = IQ_IO_PWRITEV;
+            } else if (strcmp(args[argi], "auto") != 0) {
+                fprintf(stderr, "sdr_record: unknown I/O backend %s\n", args[argi]);
+                last_exit_status = 1;
+                return 1;
+            }
+        } else {
+            fprintf(stderr, "sdr_record: unknown option %s\n", args[argi]);
+            last_exit_status = 1;
+            return 1;
+        }
+    }
+
+    if (segment_bytes == 0 && quota_bytes > 0) {
+        fprintf(stderr, "sdr_record: --quota needs --segment-size or --segment-secs\n");
+        last_exit_status = 1;
+        return 1;
+    }
+
+    if (to_stdout && (segment_bytes > 0 || quota_bytes > 0)) {
+        fprintf(stderr, "sdr_record: segments and quotas only apply to recordings on disk\n");
+        last_exit_status = 1;
+        return 1;
+    }
+    if (zero_copy && !to_stdout) {
+        fprintf(stderr, "sdr_record: --splice only applies when streaming to stdout with -\n");
+        last_exit_status = 1;
+        return 1;
+    }
+    if (to_stdout && isatty(STDOUT_FILENO)) {
+        fprintf(stderr, "sdr_record: not writing raw IQ to a terminal; pipe or redirect it\n");
+        last_exit_status = 1;
+        return 1;
+    }
 
     // Open device
     rtlsdr_dev_t *dev;
@@ -31,88 +193,71 @@ int cmd_sdr_record(char **args) {
     // Set frequency
     rtlsdr_set_center_freq(dev, freq);
 
-    // Create output file
-    char* timestamp = get_timestamp_string();
-    char filename[PATH_MAX];
-
-    // Sanitize the timestamp to ensure it only contains safe characters
-    for (int i = 0; timestamp[i] != '\0'; i++) {
-        // Replace any non-alphanumeric characters with underscores
-        if (!isalnum(timestamp[i]) && timestamp[i] != '-' && timestamp[i] != '_') {
-            timestamp[i] = '_';
-        }
-    }
-
-    sprintf(filename, "%s/iq_%s.dat", IQ_DIR, timestamp);
-    free(timestamp);
-
-    FILE *file = fopen(filename, "wb");
-    if (!file) {
-        perror("Failed to open output file");
+    if (to_stdout) {
+        fflush(stdout);
+        record_to_stdout(dev, freq, duration, zero_copy);
         close_sdr_device(dev);
         return 1;
     }
 
-    // Reset buffer
-    rtlsdr_reset_buffer(dev);
-
-    printf("Recording IQ data at %.2f MHz for %u seconds...\n", freq/1e6, duration);
+    // Create output file
+    char base[PATH_MAX];
+    record_base_path(base, sizeof(base));
 
     // Calculate number of samples based on duration and sample rate
-    uint32_t total_samples = duration * DEFAULT_SAMPLE_RATE;
-    uint32_t buffer_size = DEFAULT_BUFFER_SIZE;
-    uint8_t *buffer = malloc(buffer_size);
+    uint64_t total_samples = (uint64_t)duration * DEFAULT_SAMPLE_RATE;
 
-    if (!buffer) {
-        perror("Failed to allocate sample buffer");
-        fclose(file);
+    // Packets from the capture are copied into the writer's aligned
+    // buffers, so a disk stall shows up as ring overruns instead of
+    // holding up the USB reads
+    iq_writer_t writer;
+    if (!iq_writer_open(&writer, base, segment_bytes, quota_bytes, total_samples * 2, backend,
+                        freq, DEFAULT_SAMPLE_RATE)) {
         close_sdr_device(dev);
         return 1;
     }
 
-    // Record data
-    uint32_t samples_collected = 0;
-    time_t start_time = time(NULL);
+    sample_capture_t capture;
+    if (!sample_capture_start(&capture, dev)) {
+        iq_writer_close(&writer);
+        close_sdr_device(dev);
+        return 1;
+    }
 
-    while (samples_collected < total_samples) {
-        int n_read = 0;
-        rtlsdr_read_sync(dev, buffer, buffer_size, &n_read);
+    if (duration > 0) {
+        printf("Recording IQ data at %.2f MHz for %u seconds...\n", freq/1e6, duration);
+    } else {
+        printf("Recording IQ data at %.2f MHz. Press Ctrl+C to stop...\n", freq/1e6);
+    }
 
-        if (n_read > 0) {
-            fwrite(buffer, 1, n_read, file);
-            samples_collected += n_read / 2; // Two bytes per sample (I & Q)
+    // Record data
+    sdr_graph_t *graph = sdr_graph_create(0);
+    sdr_block_t *source = graph ? block_capture(graph, &capture, freq, total_samples) : NULL;
+    sdr_block_t *sink = source ? block_iq_writer(graph, &writer, 1, total_samples) : NULL;
+    if (!record_run(graph, source, sink)) {
+        fprintf(stderr, "\nsdr_record: recording stopped early\n");
+        last_exit_status = 1;
+    }
 
-            // Update progress
-            double progress = (double)samples_collected / total_samples * 100.0;
-            printf("\rProgress: %.1f%%", progress);
-            fflush(stdout);
-        }
+    sample_capture_stop(&capture);
+    iq_writer_close(&writer);
 
-        // Check for timeout
-        if (time(NULL) - start_time > duration + 5) {
-            printf("\nRecording timed out\n");
-            break;
-        }
+    if (segment_bytes > 0) {
+        printf("\nRecording complete. %d segment(s) listed in %s.manifest\n", writer.segments.index, base);
+    } else {
+        printf("\nRecording complete. IQ data saved to %s.dat\n", base);
     }
-
-    printf("\nRecording complete. IQ data saved to %s\n", filename);
+    printf("Writer: %s, %.1f MB in %llu syscalls, %llu capture stalls\n", writer.backend_name,
+           writer.bytes_written / 1e6, (unsigned long long)writer.syscalls,
+           (unsigned long long)writer.stalls);
+    sample_capture_report(&capture, stdout);
+    if (graph) sdr_graph_report_latency(graph, stdout);
+    sdr_graph_destroy(graph);
 
     // Save info file with metadata
-    char info_filename[PATH_MAX];
-    sprintf(info_filename, "%s/iq_%s.txt", IQ_DIR, timestamp);
-
-    FILE *info_file = fopen(info_filename, "w");
-    if (info_file) {
-        fprintf(info_file, "Sample Rate: %u Hz\n", DEFAULT_SAMPLE_RATE);
-        fprintf(info_file, "Center Frequency: %u Hz\n", freq);
-        fprintf(info_file, "Duration: %u seconds\n", duration);
-        fprintf(info_file, "Sample Format: 8-bit unsigned IQ\n");
-        fclose(info_file);
-    }
+    record_save_info(base, freq, &writer);
 
-    free(buffer);
-    fclose(file);
     close_sdr_device(dev);
 
     return 1;
-}
\ No newline at end of file
+}
@@ -0,0 +1,514 @@
+/**
+ * @file sdr_remote.c
+ * @brief gqrx-compatible remote control server
+ *
+ * Implements the sdr_remote command, which serves the gqrx remote
+ * control protocol (the one the default congq alias talks to) on a TCP
+ * port or Unix socket. One thread runs an epoll loop over the listening
+ * socket and every client, with non-blocking reads and writes, so a
+ * room full of dashboards polling `l STRENGTH` costs buffer space, not
+ * threads.
+ *
+ * Clients never touch the device. sdr_monitor publishes each power
+ * reading into the shared state here, and `F` only records a retune
+ * that the monitor applies on its next buffer, so any number of clients
+ * cost no extra device reads.
+ */
+
+#define _GNU_SOURCE
+#include "sdr.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#define REMOTE_DEFAULT_PORT 7356
+#define REMOTE_MAX_CLIENTS 256
+#define REMOTE_MAX_EVENTS 64
+#define REMOTE_LINE_MAX 256       // Longest command line accepted
+#define REMOTE_OUT_MAX 4096       // Replies buffered for a slow client
+#define REMOTE_NO_SIGNAL -150.0   // STRENGTH reported before any reading
+
+#define REMOTE_MODES "OFF RAW AM AMS LSB USB CWL CWU FM WFM WFM_ST WFM_ST_OIRT"
+
+// Tuning and levels shared between the server, the monitor and sdr_remote
+static struct {
+    pthread_mutex_t lock;
+    uint32_t freq;                // Frequency reported by f
+    uint32_t retune;              // Requested by F for the monitor, 0 = none
+    char mode[16];
+    int passband;
+    double squelch;
+    double af_gain;
+    double power;                 // Last published level in dBFS
+    int active;                   // A monitor is publishing
+} state = {PTHREAD_MUTEX_INITIALIZER, DEFAULT_FREQ, 0, "WFM", 160000, -150.0, 0.0, REMOTE_NO_SIGNAL, 0};
+
+typedef struct {
+    int fd;
+    int slot;                     // Index in server.clients
+    char in[REMOTE_LINE_MAX];
+    size_t in_len;
+    char out[REMOTE_OUT_MAX];
+    size_t out_len, out_off;
+    int want_out;                 // Registered for EPOLLOUT
+    int closing;                  // Drop once the replies are sent
+} remote_client_t;
+
+static struct {
+    int running;
+    int listen_fd, epoll_fd, wake_fd;
+    char endpoint[PATH_MAX];      // As given to start, for status
+    char unix_path[PATH_MAX];     // Socket file to remove on stop
+    pthread_t thread;
+    volatile int stopping;
+    remote_client_t *clients[REMOTE_MAX_CLIENTS];
+    int n_clients;
+    uint64_t accepted, commands, dropped;
+    int exit_hook;
+} server;
+
+// Markers for the two descriptors in the epoll set that are not clients
+static int listen_tag, wake_tag;
+
+// Called by the monitor: tuning it is using
+void remote_publish_frequency(uint32_t freq) {
+    pthread_mutex_lock(&state.lock);
+    state.freq = freq;
+    pthread_mutex_unlock(&state.lock);
+}
+
+// Called by the monitor for every reading
+void remote_publish_power(double dbfs) {
+    pthread_mutex_lock(&state.lock);
+    state.power = dbfs;
+    pthread_mutex_unlock(&state.lock);
+}
+
+// Called by the monitor when it starts and stops publishing
+void remote_set_active(int active) {
+    pthread_mutex_lock(&state.lock);
+    state.active = active;
+    state.retune = 0;
+    if (!active) state.power = REMOTE_NO_SIGNAL;
+    pthread_mutex_unlock(&state.lock);
+}
+
+// Retune requested by a client since the last call; returns 0 if none
+int remote_take_retune(uint32_t *freq) {
+    pthread_mutex_lock(&state.lock);
+    int pending = state.retune != 0;
+    if (pending) {
+        *freq = state.retune;
+        state.retune = 0;
+    }
+    pthread_mutex_unlock(&state.lock);
+    return pending;
+}
+
+static void remote_reply(remote_client_t *c, const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    size_t room = REMOTE_OUT_MAX - c->out_len;
+    int n = vsnprintf(c->out + c->out_len, room, fmt, ap);
+    va_end(ap);
+
+    // A client that sends commands but never reads the replies is cut off
+    if (n < 0 || (size_t)n >= room) {
+        c->closing = 1;
+        server.dropped++;
+        return;
+    }
+    c->out_len += n;
+}
+
+static int remote_known_mode(const char *mode) {
+    char padded[32];
+    if (strlen(mode) + 3 > sizeof(padded)) {
+        return 0;
+    }
+    snprintf(padded, sizeof(padded), " %s ", mode);
+    return strstr(" " REMOTE_MODES " ", padded) != NULL;
+}
+
+// Execute one command line, in short (F, l) or long (\set_freq) form
+static void remote_command(remote_client_t *c, char *line) {
+    char *argv[4] = {NULL};
+    int argc = 0;
+    char *save;
+    for (char *tok = strtok_r(line, " \t", &save); tok && argc < 4; tok = strtok_r(NULL, " \t", &save)) {
+        argv[argc++] = tok;
+    }
+    if (argc == 0) {
+        return;
+    }
+    server.commands++;
+
+    const char *cmd = argv[0];
+    pthread_mutex_lock(&state.lock);
+
+    if (strcmp(cmd, "f") == 0 || strcmp(cmd, "\\get_freq") == 0) {
+        remote_reply(c, "%u\n", state.freq);
+    } else if (strcmp(cmd, "F") == 0 || strcmp(cmd, "\\set_freq") == 0) {
+        double freq = argc > 1 ? strtod(argv[1], NULL) : 0;
+        if (freq >= 1 && freq <= UINT32_MAX) {
+            state.freq = state.retune = (uint32_t)(freq + 0.5);
+            remote_reply(c, "RPRT 0\n");
+        } else {
+            remote_reply(c, "RPRT 1\n");
+        }
+    } else if (strcmp(cmd, "m") == 0 || strcmp(cmd, "\\get_mode") == 0) {
+        remote_reply(c, "%s\n%d\n", state.mode, state.passband);
+    } else if (strcmp(cmd, "M") == 0 || strcmp(cmd, "\\set_mode") == 0) {
+        if (argc > 1 && strcmp(argv[1], "?") == 0) {
+            remote_reply(c, "%s\n", REMOTE_MODES);
+        } else if (argc > 1 && remote_known_mode(argv[1])) {
+            snprintf(state.mode, sizeof(state.mode), "%s", argv[1]);
+            if (argc > 2 && atoi(argv[2]) > 0) state.passband = atoi(argv[2]);
+            remote_reply(c, "RPRT 0\n");
+        } else {
+            remote_reply(c, "RPRT 1\n");
+        }
+    } else if (strcmp(cmd, "l") == 0 || strcmp(cmd, "\\get_level") == 0) {
+        const char *level = argc > 1 ? argv[1] : "";
+        if (strcmp(level, "?") == 0) {
+            remote_reply(c, "AF SQL STRENGTH\n");
+        } else if (strcmp(level, "STRENGTH") == 0) {
+            remote_reply(c, "%.1f\n", state.power);
+        } else if (strcmp(level, "SQL") == 0) {
+            remote_reply(c, "%.1f\n", state.squelch);
+        } else if (strcmp(level, "AF") == 0) {
+            remote_reply(c, "%.1f\n", state.af_gain);
+        } else {
+            remote_reply(c, "RPRT 1\n");
+        }
+    } else if (strcmp(cmd, "L") == 0 || strcmp(cmd, "\\set_level") == 0) {
+        if (argc > 2 && strcmp(argv[1], "SQL") == 0) {
+            state.squelch = strtod(argv[2], NULL);
+            remote_reply(c, "RPRT 0\n");
+        } else if (argc > 2 && strcmp(argv[1], "AF") == 0) {
+            state.af_gain = strtod(argv[2], NULL);
+            remote_reply(c, "RPRT 0\n");
+        } else {
+            remote_reply(c, "RPRT 1\n");
+        }
+    } else if (strcmp(cmd, "\\get_powerstat") == 0) {
+        remote_reply(c, "%d\n", state.active);
+    } else if (strcmp(cmd, "u") == 0 || strcmp(cmd, "\\get_func") == 0) {
+        if (argc > 1 && strcmp(argv[1], "DSP") == 0) {
+            remote_reply(c, "%d\n", state.active);
+        } else {
+            remote_reply(c, "RPRT 1\n");
+        }
+    } else if (strcmp(cmd, "v") == 0 || strcmp(cmd, "\\get_vfo") == 0) {
+        remote_reply(c, "VFOA\n");
+    } else if (strcmp(cmd, "V") == 0 || strcmp(cmd, "\\set_vfo") == 0) {
+        remote_reply(c, "RPRT 0\n");
+    } else if (strcmp(cmd, "\\chk_vfo") == 0) {
+        remote_reply(c, "0\n");
+    } else if (strcmp(cmd, "_") == 0 || strcmp(cmd, "\\get_info") == 0) {
+        remote_reply(c, "MyShell SDR\n");
+    } else if (strcmp(cmd, "AOS") == 0 || strcmp(cmd, "LOS") == 0) {
+        remote_reply(c, "RPRT 0\n");
+    } else if (strcmp(cmd, "q") == 0 || strcmp(cmd, "Q") == 0 || strcmp(cmd, "\\quit") == 0) {
+        c->closing = 1;
+    } else {
+        remote_reply(c, "RPRT 1\n");
+    }
+
+    pthread_mutex_unlock(&state.lock);
+}
+
+static void remote_close(remote_client_t *c) {
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    remote_client_t *last = server.clients[--server.n_clients];
+    server.clients[c->slot] = last;
+    last->slot = c->slot;
+    free(c);
+}
+
+// Send what the kernel will take; returns 0 if the client is gone
+static int remote_flush(remote_client_t *c) {
+    while (c->out_off < c->out_len) {
+        ssize_t n = send(c->fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return 0;
+        }
+        c->out_off += n;
+    }
+    if (c->out_off == c->out_len) {
+        c->out_off = c->out_len = 0;
+    }
+
+    // Only ask for EPOLLOUT while replies are waiting
+    int want_out = c->out_len > 0;
+    if (want_out != c->want_out) {
+        struct epoll_event ev = {EPOLLIN | EPOLLRDHUP | (want_out ? EPOLLOUT : 0), {.ptr = c}};
+        epoll_ctl(server.epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->want_out = want_out;
+    }
+    return 1;
+}
+
+// Read everything available and answer each complete line
+static int remote_read(remote_client_t *c) {
+    for (;;) {
+        ssize_t n = read(c->fd, c->in + c->in_len, sizeof(c->in) - c->in_len);
+        if (n == 0) {
+            return 0;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        c->in_len += n;
+
+        char *start = c->in;
+        char *newline;
+        while (!c->closing && (newline = memchr(start, '\n', c->in + c->in_len - start))) {
+            *newline = '\0';
+            if (newline > start && newline[-1] == '\r') newline[-1] = '\0';
+            remote_command(c, start);
+            start = newline + 1;
+        }
+        c->in_len -= start - c->in;
+        memmove(c->in, start, c->in_len);
+
+        if (c->closing) {
+            return 1;
+        }
+        if (c->in_len == sizeof(c->in)) {
+            // No newline in a full buffer; not a gqrx client
+            return 0;
+        }
+    }
+}
+
+static void remote_accept() {
+    for (;;) {
+        int fd = accept4(server.listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        if (server.n_clients >= REMOTE_MAX_CLIENTS) {
+            close(fd);
+            server.dropped++;
+            continue;
+        }
+
+        // Replies are small and polled for; don't let Nagle hold them back
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        remote_client_t *c = calloc(1, sizeof(remote_client_t));
+        if (!c) {
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        struct epoll_event ev = {EPOLLIN | EPOLLRDHUP, {.ptr = c}};
+        if (epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            close(fd);
+            free(c);
+            continue;
+        }
+        c->slot = server.n_clients;
+        server.clients[server.n_clients++] = c;
+        server.accepted++;
+    }
+}
+
+static void *remote_thread(void *arg) {
+    struct epoll_event events[REMOTE_MAX_EVENTS];
+
+    while (!server.stopping) {
+        int n = epoll_wait(server.epoll_fd, events, REMOTE_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("sdr_remote: epoll_wait");
+            break;
+        }
+
+        for (int i = 0; i < n; i++) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == &wake_tag) {
+                uint64_t value;
+                if (read(server.wake_fd, &value, sizeof(value)) < 0) {
+                    // Nothing to do; stopping is checked below
+                }
+                continue;
+            }
+            if (ptr == &listen_tag) {
+                remote_accept();
+                continue;
+            }
+
+            remote_client_t *c = ptr;
+            int alive = 1;
+            if (events[i].events & EPOLLIN) {
+                alive = remote_read(c);
+            }
+            if (alive && (events[i].events & (EPOLLERR | EPOLLHUP))) {
+                alive = 0;
+            }
+            if (alive) {
+                alive = remote_flush(c);
+            }
+            // A closing client goes once its replies are out
+            if (!alive || (c->closing && c->out_len == 0) ||
+                ((events[i].events & EPOLLRDHUP) && c->out_len == 0)) {
+                remote_close(c);
+            }
+        }
+    }
+    return NULL;
+}
+
+static void remote_stop() {
+    if (!server.running) {
+        return;
+    }
+    server.stopping = 1;
+    uint64_t one = 1;
+    if (write(server.wake_fd, &one, sizeof(one)) < 0) {
+        perror("sdr_remote: wake");
+    }
+    pthread_join(server.thread, NULL);
+
+    // Whatever clients are left go with the loop
+    while (server.n_clients > 0) {
+        remote_close(server.clients[0]);
+    }
+
+    close(server.listen_fd);
+    close(server.epoll_fd);
+    close(server.wake_fd);
+    if (server.unix_path[0]) {
+        unlink(server.unix_path);
+        server.unix_path[0] = '\0';
+    }
+    server.running = 0;
+}
+
+static int remote_start(const char *endpoint) {
+    if (server.running) {
+        fprintf(stderr, "sdr_remote: already serving on %s\n", server.endpoint);
+        return 0;
+    }
+
+    int listen_fd = sdr_listen(endpoint, "sdr_remote", server.unix_path, sizeof(server.unix_path));
+    if (listen_fd < 0) {
+        return 0;
+    }
+    server.listen_fd = listen_fd;
+    server.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    server.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (server.epoll_fd < 0 || server.wake_fd < 0) {
+        perror("sdr_remote: epoll");
+        close(listen_fd);
+        if (server.epoll_fd >= 0) close(server.epoll_fd);
+        if (server.wake_fd >= 0) close(server.wake_fd);
+        return 0;
+    }
+
+    struct epoll_event ev = {EPOLLIN, {.ptr = &listen_tag}};
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    ev.data.ptr = &wake_tag;
+    epoll_ctl(server.epoll_fd, EPOLL_CTL_ADD, server.wake_fd, &ev);
+
+    snprintf(server.endpoint, sizeof(server.endpoint), "%s", endpoint);
+    server.stopping = 0;
+    server.n_clients = 0;
+    server.accepted = server.commands = server.dropped = 0;
+
+    // Signals belong to the shell; the server thread blocks all of them
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int err = pthread_create(&server.thread, NULL, remote_thread, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0) {
+        fprintf(stderr, "sdr_remote: cannot start server: %s\n", strerror(err));
+        close(listen_fd);
+        close(server.epoll_fd);
+        close(server.wake_fd);
+        return 0;
+    }
+    server.running = 1;
+
+    if (!server.exit_hook) {
+        atexit(remote_stop);
+        server.exit_hook = 1;
+    }
+    printf("Serving gqrx remote control on %s\n", endpoint);
+    return 1;
+}
+
+static void remote_status() {
+    if (!server.running) {
+        printf("Remote control is not running\n");
+        return;
+    }
+
+    pthread_mutex_lock(&state.lock);
+    printf("Serving gqrx remote control on %s\n", server.endpoint);
+    printf("  Clients:   %d connected, %llu accepted, %llu dropped\n", server.n_clients,
+           (unsigned long long)server.accepted, (unsigned long long)server.dropped);
+    printf("  Commands:  %llu\n", (unsigned long long)server.commands);
+    printf("  Frequency: %.6f MHz, %s %d Hz\n", state.freq / 1e6, state.mode, state.passband);
+    if (state.active) {
+        printf("  Monitor:   running, %.1f dBFS\n", state.power);
+    } else {
+        printf("  Monitor:   not running\n");
+    }
+    pthread_mutex_unlock(&state.lock);
+}
+
+// A forked pipeline stage may publish from its own monitor; make sure it
+// does not inherit the state lock mid-update
+static void state_prepare_fork() {
+    pthread_mutex_lock(&state.lock);
+}
+
+static void state_release_fork() {
+    pthread_mutex_unlock(&state.lock);
+}
+
+__attribute__((constructor))
+static void remote_init() {
+    pthread_atfork(state_prepare_fork, state_release_fork, state_release_fork);
+}
+
+// Command to serve the gqrx remote control protocol
+int cmd_sdr_remote(char **args) {
+    int ok = 1;
+
+    if (!args[1] || strcmp(args[1], "status") == 0) {
+        remote_status();
+    } else if (strcmp(args[1], "start") == 0) {
+        char port[16];
+        snprintf(port, sizeof(port), "%d", REMOTE_DEFAULT_PORT);
+        ok = remote_start(args[2] ? args[2] : port);
+    } else if (strcmp(args[1], "stop") == 0) {
+        if (server.running) {
+            remote_stop();
+            printf("Remote control stopped\n");
+        }
+    } else {
+        fprintf(stderr, "sdr_remote: usage: sdr_remote [status] | start [port|addr:port|unix:path] | stop\n");
+        ok = 0;
+    }
+
+    if (!ok) {
+        last_exit_status = 1;
+    }
+    return 1;
+}
@@ -0,0 +1,295 @@
+/**
+ * @file sdr_ring.c
+ * @brief Lock-free sample ring and the capture thread that fills it
+ *
+ * The ring is a single-producer/single-consumer queue of fixed-size
+ * sample blocks. The producer acquires the next free block, reads USB
+ * samples straight into it and commits it; the consumer peeks at the
+ * oldest committed block, works on it in place and releases it. head
+ * and tail are only ever written by one side each and live on separate
+ * cache lines, and each side keeps a private copy of the other's index,
+ * so the hot path is a few plain loads and one release store per block.
+ *
+ * A full ring is never waited on: the capture thread reads the block
+ * into a scratch buffer instead and counts an overrun, so a slow
+ * consumer loses whole blocks, visibly, rather than the dongle losing
+ * samples somewhere in the USB stack. Retunes go through the capture
+ * thread too, and every block carries the generation of the tuning it
+ * was read at so consumers can skip what was captured before a retune.
+ *
+ * Each block is also stamped with both clocks the moment its USB read
+ * returns, and with a running count of the samples read before it.
+ * Blocks lost to overruns still advance the count, so a consumer can
+ * tell exactly how many samples went missing and where.
+ */
+
+#include "sdr.h"
+#include <errno.h>
+
+#define SAMPLE_HUGE_PAGE (2 * 1024 * 1024)
+#define CAPTURE_WAIT_MS 100           // Longest a consumer sleeps between checks
+
+// Map n_blocks blocks of block_size bytes. With SAMPLE_RING_HUGEPAGES
+// explicit huge pages are tried first, then transparent huge pages are
+// asked for; both quietly fall back to normal pages.
+int sample_ring_init(sample_ring_t *r, uint32_t n_blocks, uint32_t block_size, int flags) {
+    memset(r, 0, sizeof(*r));
+    if (n_blocks == 0 || (n_blocks & (n_blocks - 1)) != 0 || block_size % 64 != 0) {
+        fprintf(stderr, "sample ring: %u blocks of %u bytes is not a valid layout\n", n_blocks, block_size);
+        return 0;
+    }
+
+    r->map_size = (size_t)n_blocks * block_size;
+    r->data = MAP_FAILED;
+#ifdef MAP_HUGETLB
+    if ((flags & SAMPLE_RING_HUGEPAGES) && r->map_size % SAMPLE_HUGE_PAGE == 0) {
+        r->data = mmap(NULL, r->map_size, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (r->data != MAP_FAILED) {
+            r->hugepages = SAMPLE_RING_HUGETLB;
+        }
+    }
+#endif
+    if (r->data == MAP_FAILED) {
+        r->data = mmap(NULL, r->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (r->data == MAP_FAILED) {
+            perror("Failed to map sample ring");
+            return 0;
+        }
+#ifdef MADV_HUGEPAGE
+        if ((flags & SAMPLE_RING_HUGEPAGES) && madvise(r->data, r->map_size, MADV_HUGEPAGE) == 0) {
+            r->hugepages = SAMPLE_RING_THP;
+        }
+#endif
+    }
+
+    r->info = calloc(n_blocks, sizeof(sample_block_info_t));
+    if (!r->info) {
+        perror("Failed to allocate sample ring");
+        munmap(r->data, r->map_size);
+        r->data = NULL;
+        return 0;
+    }
+    r->n_blocks = n_blocks;
+    r->block_size = block_size;
+    return 1;
+}
+
+void sample_ring_destroy(sample_ring_t *r) {
+    if (r->data) {
+        munmap(r->data, r->map_size);
+        r->data = NULL;
+    }
+    free(r->info);
+    r->info = NULL;
+}
+
+// Empty the ring; only while neither side is using it
+void sample_ring_reset(sample_ring_t *r) {
+    r->head = r->tail = 0;
+    r->cached_head = r->cached_tail = 0;
+    r->overruns = 0;
+}
+
+// Producer: the next free block to fill, or NULL (an overrun) if full
+uint8_t *sample_ring_acquire(sample_ring_t *r) {
+    if (r->head - r->cached_tail == r->n_blocks) {
+        r->cached_tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+        if (r->head - r->cached_tail == r->n_blocks) {
+            r->overruns++;
+            return NULL;
+        }
+    }
+    return r->data + (size_t)(r->head & (r->n_blocks - 1)) * r->block_size;
+}
+
+// Producer: the description of the acquired block, to fill in
+sample_block_info_t *sample_ring_info(sample_ring_t *r) {
+    return &r->info[r->head & (r->n_blocks - 1)];
+}
+
+// Producer: hand the acquired block and its filled-in info over
+void sample_ring_commit(sample_ring_t *r) {
+    __atomic_store_n(&r->head, r->head + 1, __ATOMIC_RELEASE);
+}
+
+// Consumer: the oldest committed block, in place, or NULL if empty;
+// info (if given) receives a copy of its description
+const uint8_t *sample_ring_peek(sample_ring_t *r, sample_block_info_t *info) {
+    if (r->tail == r->cached_head) {
+        r->cached_head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+        if (r->tail == r->cached_head) {
+            return NULL;
+        }
+    }
+    uint32_t index = r->tail & (r->n_blocks - 1);
+    if (info) *info = r->info[index];
+    return r->data + (size_t)index * r->block_size;
+}
+
+// Consumer: give the peeked block back to the producer
+void sample_ring_release(sample_ring_t *r) {
+    __atomic_store_n(&r->tail, r->tail + 1, __ATOMIC_RELEASE);
+}
+
+static void *capture_thread(void *arg) {
+    sample_capture_t *c = arg;
+    sample_ring_t *r = c->ring;
+
+    while (!__atomic_load_n(&c->stopping, __ATOMIC_ACQUIRE)) {
+        // Retunes are applied here so only this thread touches the device
+        uint32_t requested = __atomic_load_n(&c->requested_generation, __ATOMIC_ACQUIRE);
+        if (requested != c->generation) {
+            rtlsdr_set_center_freq(c->dev, __atomic_load_n(&c->requested_freq, __ATOMIC_RELAXED));
+            rtlsdr_reset_buffer(c->dev);
+            c->generation = requested;
+        }
+
+        uint8_t *block = sample_ring_acquire(r);
+        int n_read = 0;
+        if (rtlsdr_read_sync(c->dev, block ? block : c->scratch, r->block_size, &n_read) < 0) {
+            fprintf(stderr, "Sample capture: device read failed\n");
+            __atomic_store_n(&c->failed, 1, __ATOMIC_RELEASE);
+            break;
+        }
+        uint64_t arrival_ns = sdr_monotonic_ns();
+        uint64_t realtime_ns = sdr_realtime_ns();
+        uint64_t first_sample = c->samples_read;
+        if (n_read > 0) {
+            c->samples_read += n_read / 2;
+        }
+        if (!block || n_read <= 0) {
+            continue;
+        }
+
+        sample_block_info_t *info = sample_ring_info(r);
+        info->len = n_read;
+        info->generation = c->generation;
+        info->first_sample = first_sample;
+        info->arrival_ns = arrival_ns;
+        info->realtime_ns = realtime_ns;
+        sample_ring_commit(r);
+
+        // Only take the lock when the consumer has gone to sleep
+        if (__atomic_load_n(&c->waiting, __ATOMIC_SEQ_CST)) {
+            pthread_mutex_lock(&c->lock);
+            pthread_cond_signal(&c->cond);
+            pthread_mutex_unlock(&c->lock);
+        }
+    }
+
+    pthread_mutex_lock(&c->lock);
+    c->finished = 1;
+    pthread_cond_signal(&c->cond);
+    pthread_mutex_unlock(&c->lock);
+    return NULL;
+}
+
+// Start reading dev into the device's sample ring at its current tuning
+int sample_capture_start(sample_capture_t *c, rtlsdr_dev_t *dev) {
+    memset(c, 0, sizeof(*c));
+    c->ring = sdr_sample_ring();
+    c->scratch = buffer_pool_alloc(DEFAULT_BUFFER_SIZE);
+    if (!c->ring || !c->scratch) {
+        if (c->ring && !c->scratch) perror("Failed to allocate capture buffer");
+        buffer_pool_free(c->scratch, DEFAULT_BUFFER_SIZE);
+        return 0;
+    }
+    sample_ring_reset(c->ring);
+    c->dev = dev;
+    pthread_mutex_init(&c->lock, NULL);
+    pthread_cond_init(&c->cond, NULL);
+    rtlsdr_reset_buffer(dev);
+
+    // Signals stay with the command's thread
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int err = pthread_create(&c->thread, NULL, capture_thread, c);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0) {
+        fprintf(stderr, "Failed to start capture thread: %s\n", strerror(err));
+        pthread_mutex_destroy(&c->lock);
+        pthread_cond_destroy(&c->cond);
+        buffer_pool_free(c->scratch, DEFAULT_BUFFER_SIZE);
+        return 0;
+    }
+    return 1;
+}
+
+// Stop capturing; the device is idle again once this returns
+void sample_capture_stop(sample_capture_t *c) {
+    __atomic_store_n(&c->stopping, 1, __ATOMIC_RELEASE);
+    pthread_join(c->thread, NULL);
+    c->overruns = c->ring->overruns;
+    pthread_mutex_destroy(&c->lock);
+    pthread_cond_destroy(&c->cond);
+    buffer_pool_free(c->scratch, DEFAULT_BUFFER_SIZE);
+    c->scratch = NULL;
+}
+
+// Ask for a new frequency; blocks from generations before the returned
+// one were captured at the old tuning
+uint32_t sample_capture_retune(sample_capture_t *c, uint32_t freq) {
+    __atomic_store_n(&c->requested_freq, freq, __ATOMIC_RELAXED);
+    return __atomic_add_fetch(&c->requested_generation, 1, __ATOMIC_RELEASE);
+}
+
+// The next block from generation min_generation or later, in place,
+// with its description in info. Older blocks are released unseen.
+// Returns NULL after CAPTURE_WAIT_MS without data, or when capture has
+// ended, so the caller can check for Ctrl+C; c->failed tells the two
+// apart. Pass the block back with sample_capture_release.
+const uint8_t *sample_capture_next(sample_capture_t *c, uint32_t min_generation, sample_block_info_t *info) {
+    sample_ring_t *r = c->ring;
+    for (int slept = 0;; slept = 1) {
+        const uint8_t *block;
+        while ((block = sample_ring_peek(r, info)) != NULL) {
+            if ((int32_t)(info->generation - min_generation) >= 0) {
+                // Within one tuning the counter only jumps over overruns
+                if (c->blocks > 0 && info->generation == c->last_generation &&
+                    info->first_sample > c->next_sample) {
+                    c->dropped_samples += info->first_sample - c->next_sample;
+                }
+                c->next_sample = info->first_sample + info->len / 2;
+                c->last_generation = info->generation;
+                c->blocks++;
+                return block;
+            }
+            sample_ring_release(r);
+        }
+        if (slept || __atomic_load_n(&c->failed, __ATOMIC_ACQUIRE)) {
+            return NULL;
+        }
+
+        // Announce the sleep before the last look so a commit racing
+        // with it either sees waiting or is seen by the peek
+        __atomic_store_n(&c->waiting, 1, __ATOMIC_SEQ_CST);
+        pthread_mutex_lock(&c->lock);
+        if (!c->finished && !sample_ring_peek(r, NULL)) {
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += CAPTURE_WAIT_MS * 1000000L;
+            if (deadline.tv_nsec >= 1000000000L) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&c->cond, &c->lock, &deadline);
+        }
+        pthread_mutex_unlock(&c->lock);
+        __atomic_store_n(&c->waiting, 0, __ATOMIC_RELAXED);
+    }
+}
+
+void sample_capture_release(sample_capture_t *c) {
+    sample_ring_release(c->ring);
+}
+
+// Ring usage for the end-of-command summary
+void sample_capture_report(sample_capture_t *c, FILE *out) {
+    const char *pages = c->ring->hugepages == SAMPLE_RING_HUGETLB ? "huge pages" :
+                        c->ring->hugepages == SAMPLE_RING_THP ? "transparent huge pages" : "normal pages";
+    fprintf(out, "Capture: %llu blocks, %llu overruns, %llu samples dropped (ring of %u x %u bytes on %s)\n",
+            (unsigned long long)c->blocks, (unsigned long long)c->overruns,
+            (unsigned long long)c->dropped_samples, c->ring->n_blocks, c->ring->block_size, pages);
+}
@@ -5,9 +5,55 @@
  * Implements the sdr_scan command which performs a frequency sweep
  * over a specified range and measures signal power. Can display results
  * as a real-time terminal visualization and saves data to CSV files.
+ * A min/max/mean pyramid of the sweep is built as bins arrive and saved
+ * next to the CSV for sdr_view. Each finished sweep is also published to
+ * the shared-memory spectrum ring (sdr_shm.h).
+ *
+ * The sweep runs as a block graph: sweep source -> power -> scan log.
  */
 
-#include "shell.h"
+#include "sdr.h"
+
+typedef struct {
+    FILE *file;
+    spectrum_pyramid_t *pyramid;
+    uint32_t start_freq, end_freq;
+    int terminal_viz;
+    uint64_t first_ns;            // When the first step's samples were taken
+} scan_log_t;
+
+// One averaged reading per frequency step
+static int scan_log_work(sdr_block_t *b, sdr_packet_t *in) {
+    scan_log_t *s = b->state;
+    if (!in) {
+        return SDR_BLOCK_DONE;
+    }
+    uint32_t freq = (uint32_t)in->center_freq;
+    double avg_power = in->value;
+
+    pyramid_append(s->pyramid, avg_power);
+
+    if (s->terminal_viz) {
+        // Update visualization every few steps
+        if (s->pyramid->n_bins % 5 == 0 || freq >= s->end_freq) {
+            display_terminal_spectrum(s->pyramid, s->start_freq, s->end_freq, freq);
+        }
+    } else {
+        // Original progress output
+        printf("\rScanning %.2f MHz...", freq/1e6);
+        fflush(stdout);
+    }
+
+    // Write to CSV, stamped with when the step's samples were taken
+    if (s->first_ns == 0) {
+        s->first_ns = in->timestamp_ns;
+    }
+    fprintf(s->file, "%u,%.6f,%llu.%06llu\n", freq, avg_power,
+            (unsigned long long)(in->timestamp_ns / 1000000000ull),
+            (unsigned long long)(in->timestamp_ns % 1000000000ull / 1000));
+    sdr_block_latency(b, in);
+    return SDR_BLOCK_CONTINUE;
+}
 
 // Command to scan frequency range and log spectrum data
 int cmd_sdr_scan(char **args) {
@@ -23,38 +69,34 @@ int cmd_sdr_scan(char **args) {
     // Add visualization flag
     int terminal_viz = 0;
 
-    // Parse command arguments
-    if (args[1]) start_freq = atoi(args[1]);
-    if (args[2]) end_freq = atoi(args[2]);
-    if (args[3]) step = atoi(args[3]);
-    if (args[4]) samples = atoi(args[4]);
-    if (args[5] && strcmp(args[5], "--viz") == 0) {
+    // Parse command arguments; args ends at the first NULL
+    int argc = 0;
+    while (args[argc]) argc++;
+
+    if (argc > 1) start_freq = parse_frequency(args[1]);
+    if (argc > 2) end_freq = parse_frequency(args[2]);
+    if (argc > 3) step = parse_frequency(args[3]);
+    if (argc > 4) samples = atoi(args[4]);
+    if (argc > 5 && strcmp(args[5], "--viz") == 0) {
         terminal_viz = 1;
     }
 
-    // Prepare arrays for visualization
-    int n_points = (end_freq - start_freq) / step + 1;
-    uint32_t *freq_array = NULL;
-    double *power_array = NULL;
+    if (step == 0 || end_freq < start_freq) {
+        fprintf(stderr, "sdr_scan: invalid frequency range or step\n");
+        return 1;
+    }
 
-    if (terminal_viz) {
-        freq_array = malloc(sizeof(uint32_t) * n_points);
-        power_array = malloc(sizeof(double) * n_points);
-        if (!freq_array || !power_array) {
-            perror("Failed to allocate memory for visualization");
-            if (freq_array) free(freq_array);
-            if (power_array) free(power_array);
-            terminal_viz = 0;
-        }
+    // Pyramid of the sweep, used for visualization and saved with the log
+    uint64_t n_points = (end_freq - start_freq) / step + 1;
+    spectrum_pyramid_t *pyramid = pyramid_create(start_freq, step, n_points);
+    if (!pyramid) {
+        return 1;
     }
 
     // Open device
     rtlsdr_dev_t *dev;
     if (!open_sdr_device(&dev)) {
-        if (terminal_viz) {
-            free(freq_array);
-            free(power_array);
-        }
+        pyramid_free(pyramid);
         return 1;
     }
 
@@ -67,102 +109,71 @@ int cmd_sdr_scan(char **args) {
     FILE *file = fopen(filename, "w");
     if (!file) {
         perror("Failed to open output file");
-        if (terminal_viz) {
-            free(freq_array);
-            free(power_array);
-        }
+        pyramid_free(pyramid);
         close_sdr_device(dev);
         return 1;
     }
 
     // Write CSV header
-    fprintf(file, "Frequency,Power\n");
+    fprintf(file, "Frequency,Power,Timestamp\n");
 
     if (!terminal_viz) {
         printf("Scanning from %.2f MHz to %.2f MHz with %.2f kHz steps...\n",
                start_freq/1e6, end_freq/1e6, step/1e3);
     }
 
-    // Allocate buffer for samples
-    uint8_t *buffer = malloc(DEFAULT_BUFFER_SIZE);
-    if (!buffer) {
-        perror("Failed to allocate sample buffer");
-        if (terminal_viz) {
-            free(freq_array);
-            free(power_array);
-        }
+    // Samples arrive through the capture thread; the sweep source retunes
+    // it every step and only passes on blocks captured at the new frequency
+    rtlsdr_set_center_freq(dev, start_freq);
+    sample_capture_t capture;
+    if (!sample_capture_start(&capture, dev)) {
+        pyramid_free(pyramid);
         fclose(file);
         close_sdr_device(dev);
         return 1;
     }
 
-    // Scan frequencies
-    int point_index = 0;
-    for (uint32_t freq = start_freq; freq <= end_freq; freq += step) {
-        // Set frequency
-        rtlsdr_set_center_freq(dev, freq);
-
-        // Reset buffer
-        rtlsdr_reset_buffer(dev);
-
-        // Calculate average power
-        double power_sum = 0.0;
-
-        for (int i = 0; i < samples; i++) {
-            int n_read = 0;
-            rtlsdr_read_sync(dev, buffer, DEFAULT_BUFFER_SIZE, &n_read);
-
-            // Calculate power (simple method)
-            double power = 0.0;
-            for (int j = 0; j < n_read; j++) {
-                // Convert to signed value
-                double sample = (buffer[j] - 127.5) / 127.5;
-                power += sample * sample;
-            }
-
-            power /= n_read;
-            power_sum += power;
-        }
-
-        double avg_power = power_sum / samples;
-
-        // Store data for visualization
-        if (terminal_viz && point_index < n_points) {
-            freq_array[point_index] = freq;
-            power_array[point_index] = avg_power;
-            point_index++;
-
-            // Update visualization every few steps
-            if (point_index % 5 == 0 || freq >= end_freq) {
-                display_terminal_spectrum(freq_array, power_array, point_index, freq);
-            }
-        } else {
-            // Original progress output
-            printf("\rScanning %.2f MHz...", freq/1e6);
-            fflush(stdout);
-        }
-
-        // Write to CSV
-        fprintf(file, "%u,%.6f\n", freq, avg_power);
+    scan_log_t log = {file, pyramid, start_freq, end_freq, terminal_viz, 0};
+    sdr_graph_t *graph = sdr_graph_create(0);
+    sdr_block_t *sweep = graph ? block_sweep(graph, &capture, start_freq, end_freq, step, samples) : NULL;
+    sdr_block_t *power = graph ? block_power(graph, (uint64_t)samples * (DEFAULT_BUFFER_SIZE / 2)) : NULL;
+    sdr_block_t *sink = graph ? sdr_graph_add(graph, "scan_log", scan_log_work, &log, NULL) : NULL;
+
+    // Scan frequencies; Ctrl+C ends the sweep early
+    time_t scan_start = time(NULL);
+    sdr_install_stop_handler();
+    if (!sdr_graph_connect(sweep, power) || !sdr_graph_connect(power, sink) || !sdr_graph_run(graph)) {
+        fprintf(stderr, "\nsdr_scan: sweep did not complete\n");
+        last_exit_status = 1;
     }
+    sdr_restore_stop_handler();
+    sample_capture_stop(&capture);
 
     // Cleanup
     if (terminal_viz) {
         // Show final visualization
-        display_terminal_spectrum(freq_array, power_array, point_index, end_freq);
-
-        // Clean up visualization arrays
-        free(freq_array);
-        free(power_array);
-
-        printf("\nScan complete. Results saved to %s\n", filename);
-    } else {
-        printf("\nScan complete. Results saved to %s\n", filename);
+        display_terminal_spectrum(pyramid, start_freq, end_freq, end_freq);
+    }
+    printf("\nScan complete. Results saved to %s\n", filename);
+    sample_capture_report(&capture, stdout);
+    if (graph) sdr_graph_report_latency(graph, stdout);
+    sdr_graph_destroy(graph);
+
+    // Local dashboards pick the sweep up from shared memory
+    if (pyramid->n_bins > 0) {
+        spectrum_shm_publish(SDR_SHM_SOURCE_SCAN, log.first_ns, start_freq + step * (pyramid->n_bins - 1) / 2.0,
+                             start_freq, step, pyramid->bins, pyramid->n_bins);
     }
 
-    free(buffer);
+    char pyramid_name[PATH_MAX];
+    pyramid_path(filename, pyramid_name, sizeof(pyramid_name));
+    pyramid_save(pyramid, pyramid_name);
+    pyramid_free(pyramid);
+
     fclose(file);
     close_sdr_device(dev);
 
+    catalog_add(CATALOG_SPECTRUM, filename, start_freq, end_freq, DEFAULT_SAMPLE_RATE, scan_start, time(NULL));
+
     return 1;
 }
\ No newline at end of file
@@ -0,0 +1,548 @@
+/**
+ * @file sdr_schedule.c
+ * @brief Recurring SDR jobs run inside the shell
+ *
+ * Implements the sdr_schedule command. Jobs are SDR commands repeated
+ * at a fixed interval, kept on a hashed timer wheel of one-second ticks:
+ * a job due at tick t sits in slot t % SCHED_WHEEL_SLOTS, so each tick
+ * only looks at the jobs in one slot however many are registered.
+ *
+ * A worker thread advances the wheel and runs due jobs one at a time.
+ * While it has jobs it keeps a reference on the shared device, so the
+ * dongle, sample buffer and FFT plans stay warm between runs, and
+ * commands typed at the prompt wait for a running job rather than
+ * failing to open the device. A job that starts more than a tick late,
+ * or whose deadlines pass while the worker is busy, is reported.
+ *
+ * Only commands that use the device can be scheduled. The device lock
+ * is what keeps a job and the prompt apart; the file-only commands
+ * (sdr_find, sdr_batch, ...) keep state that no lock guards.
+ *
+ * A built-in run as a pipeline stage is a forked child, which cannot
+ * share the parent's USB handle. While there are jobs the scheduler
+ * holds the dongle, so such a stage (sdr_record ... - | decoder) reports
+ * the device busy; run it when no jobs are registered.
+ *
+ * Ctrl+C at the prompt belongs to the command typed there. A running
+ * job watches its own cancel flag, set by `sdr_schedule cancel`.
+ */
+
+#include "sdr.h"
+#include <errno.h>
+
+#define SCHED_TICK_MS 1000
+#define SCHED_WHEEL_SLOTS 256
+
+// Commands a job may run: those that work through the shared device, so
+// the device lock keeps them apart from whatever runs at the prompt
+static const char *const sched_commands[] = {
+    "sdr_info", "sdr_scan", "sdr_monitor", "sdr_pipeline", "sdr_record",
+    "sdr_snr", "sdr_fm", "sdr_adsb", "sdr_serve", NULL
+};
+
+typedef struct sched_job {
+    int id;
+    char **argv;                  // The command and its arguments
+    char *text;                   // The command as typed, for listings
+    uint64_t period;              // Ticks between runs
+    uint64_t due;                 // Tick of the next run
+    int in_wheel;                 // Linked into a wheel slot
+    int running;
+    int removed;                  // Freed by the worker once it is done with it
+    uint64_t runs;
+    uint64_t late;                // Runs that started over a tick late
+    uint64_t missed;              // Runs skipped because the worker was busy
+    double last_seconds;          // Duration of the last run
+    int last_status;
+    struct sched_job *next;       // Next job in the same wheel slot or due list
+    struct sched_job *next_job;   // Next job in registration order
+} sched_job_t;
+
+static struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;          // Signalled when jobs are added or the shell exits
+    sched_job_t *wheel[SCHED_WHEEL_SLOTS];
+    sched_job_t *jobs;            // Every job, in registration order
+    int next_id;
+    struct timespec epoch;        // Time of tick 0
+    uint64_t last_tick;           // Last tick the worker has processed
+    pthread_t thread;
+    int thread_started;           // thread needs joining
+    int thread_active;            // The worker loop is running
+    int cancel;                   // Stop the job that is running now
+    int stopping;
+    int exit_hook;
+} sched = {PTHREAD_MUTEX_INITIALIZER, PTHREAD_COND_INITIALIZER};
+
+static uint64_t sched_elapsed_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)(now.tv_sec - sched.epoch.tv_sec) * 1000 +
+           (now.tv_nsec - sched.epoch.tv_nsec) / 1000000;
+}
+
+static uint64_t sched_now_tick() {
+    return sched_elapsed_ms() / SCHED_TICK_MS;
+}
+
+// Parse an interval such as 300, 30s, 5m, 2h or 1d into seconds
+static uint64_t parse_interval(const char *text) {
+    char *end;
+    double value = strtod(text, &end);
+
+    switch (*end) {
+        case '\0':
+        case 's': break;
+        case 'm': value *= 60; break;
+        case 'h': value *= 3600; break;
+        case 'd': value *= 86400; break;
+        default: return 0;
+    }
+    if (*end && end[1]) {
+        return 0;
+    }
+    return value >= 1 ? (uint64_t)(value + 0.5) : 0;
+}
+
+static void sched_insert(sched_job_t *job) {
+    sched_job_t **slot = &sched.wheel[job->due % SCHED_WHEEL_SLOTS];
+    job->next = *slot;
+    *slot = job;
+    job->in_wheel = 1;
+}
+
+static void sched_unlink_slot(sched_job_t *job) {
+    sched_job_t **link = &sched.wheel[job->due % SCHED_WHEEL_SLOTS];
+    while (*link != job) {
+        link = &(*link)->next;
+    }
+    *link = job->next;
+    job->in_wheel = 0;
+}
+
+static void sched_free_job(sched_job_t *job) {
+    sched_job_t **link = &sched.jobs;
+    while (*link && *link != job) {
+        link = &(*link)->next_job;
+    }
+    if (*link) {
+        *link = job->next_job;
+    }
+    for (int i = 0; job->argv[i]; i++) {
+        free(job->argv[i]);
+    }
+    free(job->argv);
+    free(job->text);
+    free(job);
+}
+
+// Run one job on the worker thread
+static void sched_run(sched_job_t *job) {
+    shell_command *command = find_command(job->argv[0]);
+    struct timespec t_start, t_end;
+
+    fprintf(stderr, "\n[sdr_schedule] job %d: %s\n", job->id, job->text);
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+    last_exit_status = 0;
+    command->func(job->argv);
+    fflush(stdout);
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+
+    job->last_status = last_exit_status;
+    job->last_seconds = (t_end.tv_sec - t_start.tv_sec) + (t_end.tv_nsec - t_start.tv_nsec) / 1e9;
+    job->runs++;
+}
+
+// Put a job that has just run back on the wheel at its next deadline
+// still ahead, counting the deadlines that passed while it was waiting
+static void sched_reschedule(sched_job_t *job) {
+    uint64_t now = sched_now_tick();
+    uint64_t skipped = now >= job->due ? (now - job->due) / job->period : 0;
+
+    if (skipped > 0) {
+        job->missed += skipped;
+        fprintf(stderr, "[sdr_schedule] job %d missed %llu deadline(s) while the worker was busy\n",
+                job->id, (unsigned long long)skipped);
+    }
+    job->due += (skipped + 1) * job->period;
+    sched_insert(job);
+}
+
+static void *sched_worker(void *arg) {
+    sdr_device_retain();
+    sdr_set_thread_cancel(&sched.cancel);
+
+    pthread_mutex_lock(&sched.lock);
+    while (!sched.stopping && sched.jobs) {
+        uint64_t now = sched_now_tick();
+
+        // Collect the jobs due in the ticks since the last pass; after a
+        // long stall one turn of the wheel visits every slot
+        sched_job_t *due = NULL, **due_tail = &due;
+        uint64_t first = sched.last_tick + 1;
+        if (now >= SCHED_WHEEL_SLOTS && first < now - SCHED_WHEEL_SLOTS + 1) {
+            first = now - SCHED_WHEEL_SLOTS + 1;
+        }
+        for (uint64_t t = first; t <= now; t++) {
+            sched_job_t **link = &sched.wheel[t % SCHED_WHEEL_SLOTS];
+            while (*link) {
+                sched_job_t *job = *link;
+                if (job->due > now) {
+                    link = &job->next;
+                    continue;
+                }
+                *link = job->next;
+                job->in_wheel = 0;
+                job->next = NULL;
+                *due_tail = job;
+                due_tail = &job->next;
+            }
+        }
+        if (now > sched.last_tick) {
+            sched.last_tick = now;
+        }
+
+        // Run them in deadline order of their ticks, one at a time
+        while (due) {
+            sched_job_t *job = due;
+            due = job->next;
+            if (job->removed || sched.stopping) {
+                if (job->removed) sched_free_job(job);
+                else sched_insert(job);
+                continue;
+            }
+
+            uint64_t late_ms = sched_elapsed_ms() - job->due * SCHED_TICK_MS;
+            if (late_ms >= SCHED_TICK_MS) {
+                job->late++;
+                fprintf(stderr, "[sdr_schedule] job %d is starting %.1f s late\n", job->id, late_ms / 1000.0);
+            }
+
+            job->running = 1;
+            __atomic_store_n(&sched.cancel, 0, __ATOMIC_RELAXED);
+            pthread_mutex_unlock(&sched.lock);
+            sched_run(job);
+            pthread_mutex_lock(&sched.lock);
+            job->running = 0;
+
+            if (job->removed) {
+                sched_free_job(job);
+            } else {
+                sched_reschedule(job);
+            }
+        }
+
+        if (sched.stopping || !sched.jobs) {
+            break;
+        }
+
+        // Sleep until the next tick
+        uint64_t wake_ms = (sched.last_tick + 1) * SCHED_TICK_MS;
+        struct timespec wake = sched.epoch;
+        wake.tv_sec += wake_ms / 1000;
+        wake.tv_nsec += (wake_ms % 1000) * 1000000;
+        if (wake.tv_nsec >= 1000000000) {
+            wake.tv_sec++;
+            wake.tv_nsec -= 1000000000;
+        }
+        pthread_cond_timedwait(&sched.cond, &sched.lock, &wake);
+    }
+    sched.thread_active = 0;
+    pthread_mutex_unlock(&sched.lock);
+
+    sdr_device_release();
+    return NULL;
+}
+
+// Stop the worker when the shell exits, letting a running job finish
+static void sched_shutdown() {
+    pthread_mutex_lock(&sched.lock);
+    if (!sched.thread_started) {
+        pthread_mutex_unlock(&sched.lock);
+        return;
+    }
+    sched.stopping = 1;
+    for (sched_job_t *job = sched.jobs; job; job = job->next_job) {
+        if (job->running) {
+            fprintf(stderr, "Waiting for scheduled job %d to finish...\n", job->id);
+        }
+    }
+    pthread_cond_signal(&sched.cond);
+    pthread_mutex_unlock(&sched.lock);
+
+    pthread_join(sched.thread, NULL);
+    sched.thread_started = 0;
+}
+
+// Start the worker if it is not running; called with the lock held
+static int sched_start_worker() {
+    if (sched.thread_active) {
+        pthread_cond_signal(&sched.cond);
+        return 1;
+    }
+    if (sched.thread_started) {
+        // The last worker ran out of jobs and is exiting or gone
+        pthread_mutex_unlock(&sched.lock);
+        pthread_join(sched.thread, NULL);
+        pthread_mutex_lock(&sched.lock);
+        sched.thread_started = 0;
+    }
+
+    // Signals belong to the shell; the worker blocks all of them
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    int err = pthread_create(&sched.thread, NULL, sched_worker, NULL);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (err != 0) {
+        fprintf(stderr, "sdr_schedule: cannot start worker: %s\n", strerror(err));
+        return 0;
+    }
+    sched.thread_started = 1;
+    sched.thread_active = 1;
+
+    if (!sched.exit_hook) {
+        atexit(sched_shutdown);
+        sched.exit_hook = 1;
+    }
+    return 1;
+}
+
+static int sched_add(char **args) {
+    uint64_t seconds = args[2] ? parse_interval(args[2]) : 0;
+    if (seconds == 0 || !args[3]) {
+        fprintf(stderr, "sdr_schedule: usage: sdr_schedule add <interval[s|m|h|d]> <sdr command> [args...]\n");
+        return 0;
+    }
+    int allowed = 0;
+    for (int i = 0; sched_commands[i]; i++) {
+        if (strcmp(args[3], sched_commands[i]) == 0) {
+            allowed = 1;
+            break;
+        }
+    }
+    if (!allowed || !find_command(args[3])) {
+        fprintf(stderr, "sdr_schedule: %s: only commands that use the device can be scheduled\n", args[3]);
+        return 0;
+    }
+
+    int argc = 0;
+    size_t text_len = 1;
+    while (args[3 + argc]) {
+        text_len += strlen(args[3 + argc]) + 1;
+        argc++;
+    }
+
+    sched_job_t *job = calloc(1, sizeof(sched_job_t));
+    char **argv = job ? calloc(argc + 1, sizeof(char *)) : NULL;
+    char *text = argv ? malloc(text_len) : NULL;
+    if (!text) {
+        perror("malloc error");
+        free(argv);
+        free(job);
+        return 0;
+    }
+    text[0] = '\0';
+    for (int i = 0; i < argc; i++) {
+        argv[i] = strdup(args[3 + i]);
+        if (i > 0) strcat(text, " ");
+        strcat(text, args[3 + i]);
+    }
+    job->argv = argv;
+    job->text = text;
+    job->period = (seconds * 1000 + SCHED_TICK_MS - 1) / SCHED_TICK_MS;
+
+    pthread_mutex_lock(&sched.lock);
+    if (!sched.jobs && !sched.thread_active) {
+        // A fresh wheel: tick 0 is now
+        clock_gettime(CLOCK_MONOTONIC, &sched.epoch);
+        sched.last_tick = 0;
+    }
+    job->id = ++sched.next_id;
+    job->due = sched_now_tick() + job->period;
+
+    sched_job_t **tail = &sched.jobs;
+    while (*tail) tail = &(*tail)->next_job;
+    *tail = job;
+    sched_insert(job);
+
+    if (!sched_start_worker()) {
+        sched_unlink_slot(job);
+        sched_free_job(job);
+        pthread_mutex_unlock(&sched.lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&sched.lock);
+
+    printf("Job %d: every %llu s: %s\n", job->id, (unsigned long long)seconds, text);
+    return 1;
+}
+
+static int sched_remove(const char *which) {
+    int all = strcmp(which, "all") == 0;
+    int id = all ? 0 : atoi(which);
+    int found = 0;
+
+    pthread_mutex_lock(&sched.lock);
+    sched_job_t *job = sched.jobs;
+    while (job) {
+        sched_job_t *next = job->next_job;
+        if (!job->removed && (all || job->id == id)) {
+            found++;
+            if (job->in_wheel) {
+                sched_unlink_slot(job);
+                sched_free_job(job);
+            } else {
+                // Running or about to run; the worker frees it
+                job->removed = 1;
+            }
+        }
+        job = next;
+    }
+    pthread_cond_signal(&sched.cond);
+    pthread_mutex_unlock(&sched.lock);
+
+    if (!found && !all) {
+        fprintf(stderr, "sdr_schedule: no job %s\n", which);
+        return 0;
+    }
+    return 1;
+}
+
+// Stop the current run of a job; it runs again at its next deadline
+static int sched_cancel(const char *which) {
+    int all = strcmp(which, "all") == 0;
+    int id = all ? 0 : atoi(which);
+    int found = 0;
+
+    pthread_mutex_lock(&sched.lock);
+    for (sched_job_t *job = sched.jobs; job; job = job->next_job) {
+        if (!job->removed && (all || job->id == id)) {
+            found++;
+            if (job->running) {
+                __atomic_store_n(&sched.cancel, 1, __ATOMIC_RELAXED);
+                fprintf(stderr, "sdr_schedule: stopping the current run of job %d\n", job->id);
+            }
+        }
+    }
+    pthread_mutex_unlock(&sched.lock);
+
+    if (!found && !all) {
+        fprintf(stderr, "sdr_schedule: no job %s\n", which);
+        return 0;
+    }
+    return 1;
+}
+
+static void sched_list() {
+    pthread_mutex_lock(&sched.lock);
+    uint64_t now_ms = sched_elapsed_ms();
+    int shown = 0;
+    for (sched_job_t *job = sched.jobs; job; job = job->next_job) {
+        if (job->removed) {
+            continue;
+        }
+        if (!shown++) {
+            printf("%-4s %-9s %-10s %6s %5s %6s %6s  %s\n",
+                   "ID", "Every", "Next", "Runs", "Late", "Missed", "Status", "Command");
+        }
+
+        char next[24];
+        if (job->running) {
+            snprintf(next, sizeof(next), "running");
+        } else {
+            uint64_t due_ms = job->due * SCHED_TICK_MS;
+            snprintf(next, sizeof(next), "%llus",
+                     (unsigned long long)(due_ms > now_ms ? (due_ms - now_ms + 999) / 1000 : 0));
+        }
+        char status[16];
+        if (job->runs) {
+            snprintf(status, sizeof(status), "%d", job->last_status);
+        } else {
+            snprintf(status, sizeof(status), "-");
+        }
+
+        printf("%-4d %-9llu %-10s %6llu %5llu %6llu %6s  %s\n", job->id,
+               (unsigned long long)(job->period * SCHED_TICK_MS / 1000), next,
+               (unsigned long long)job->runs, (unsigned long long)job->late,
+               (unsigned long long)job->missed, status, job->text);
+        if (job->runs) {
+            printf("     last run took %.1f s\n", job->last_seconds);
+        }
+    }
+    pthread_mutex_unlock(&sched.lock);
+
+    if (!shown) {
+        printf("No scheduled jobs\n");
+    }
+}
+
+// Block until every job has been removed or Ctrl+C, so a script can
+// register jobs and then leave the shell running them
+static void sched_wait() {
+    sdr_install_stop_handler();
+    printf("Running scheduled jobs. Press Ctrl+C to return...\n");
+    fflush(stdout);
+
+    pthread_mutex_lock(&sched.lock);
+    while (sched.jobs && !sdr_stop_requested()) {
+        pthread_mutex_unlock(&sched.lock);
+        usleep(200000);
+        pthread_mutex_lock(&sched.lock);
+    }
+    pthread_mutex_unlock(&sched.lock);
+
+    sdr_restore_stop_handler();
+}
+
+// Forked pipeline stages get a consistent copy of the job list but
+// none of the worker; they can list jobs, not run them
+static void sched_prepare_fork() {
+    pthread_mutex_lock(&sched.lock);
+}
+
+static void sched_parent_fork() {
+    pthread_mutex_unlock(&sched.lock);
+}
+
+static void sched_child_fork() {
+    sched.thread_started = 0;
+    sched.thread_active = 0;
+    pthread_mutex_unlock(&sched.lock);
+}
+
+__attribute__((constructor))
+static void sched_init() {
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&sched.cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_atfork(sched_prepare_fork, sched_parent_fork, sched_child_fork);
+}
+
+// Command to run SDR commands periodically in the background
+int cmd_sdr_schedule(char **args) {
+    int ok = 1;
+
+    if (!args[1] || strcmp(args[1], "list") == 0) {
+        sched_list();
+    } else if (strcmp(args[1], "add") == 0) {
+        ok = sched_add(args);
+    } else if (strcmp(args[1], "remove") == 0 && args[2]) {
+        ok = sched_remove(args[2]);
+    } else if (strcmp(args[1], "cancel") == 0 && args[2]) {
+        ok = sched_cancel(args[2]);
+    } else if (strcmp(args[1], "wait") == 0) {
+        sched_wait();
+    } else {
+        fprintf(stderr, "sdr_schedule: usage: sdr_schedule [list] | add <interval> <command...> | remove <id|all> | cancel <id|all> | wait\n");
+        ok = 0;
+    }
+
+    if (!ok) {
+        last_exit_status = 1;
+    }
+    return 1;
+}
@@ -0,0 +1,203 @@
+/**
+ * @file sdr_segment.c
+ * @brief Segmented IQ file writer
+ *
+ * Splits a continuous IQ stream into fixed-size segment files so that
+ * recordings can run indefinitely. Each segment is preallocated with
+ * fallocate, the oldest segments are deleted once a disk quota is
+ * reached, and a manifest records the exact sample range of every
+ * segment so the stream can be stitched back together later. The
+ * actual writes go through the backend in sdr_iowriter.c.
+ */
+
+#define _GNU_SOURCE
+#include "sdr.h"
+#include <fcntl.h>
+#include <errno.h>
+
+// Build the file name of a segment (or the single file when not
+// segmented); returns 0 if it does not fit in out
+static int segment_filename(segment_writer_t *w, int index, char *out, size_t out_len) {
+    int len;
+    if (w->segment_bytes == 0) {
+        len = snprintf(out, out_len, "%s.dat", w->base);
+    } else {
+        len = snprintf(out, out_len, "%s_%05d.dat", w->base, index);
+    }
+    return len >= 0 && (size_t)len < out_len;
+}
+
+// Delete the oldest segments until a new one fits inside the quota
+static void segment_enforce_quota(segment_writer_t *w) {
+    if (w->quota_bytes == 0 || w->segment_bytes == 0) {
+        return;
+    }
+
+    while (w->oldest < w->index &&
+           (uint64_t)(w->index - w->oldest + 1) * w->segment_bytes > w->quota_bytes) {
+        char path[PATH_MAX];
+        if (!segment_filename(w, w->oldest, path, sizeof(path))) {
+            return;     // Never opened either; see segment_open_next
+        }
+
+        if (unlink(path) == -1 && errno != ENOENT) {
+            perror("Failed to evict old segment");
+            return;
+        }
+
+        if (w->manifest) {
+            const char *name = strrchr(path, '/');
+            fprintf(w->manifest, "%d,%s,,,evicted\n", w->oldest, name ? name + 1 : path);
+            fflush(w->manifest);
+        }
+        catalog_remove(path);
+        w->oldest++;
+    }
+}
+
+// Open the next segment file and preallocate its space
+static int segment_open_next(segment_writer_t *w) {
+    segment_enforce_quota(w);
+
+    char path[PATH_MAX];
+    if (!segment_filename(w, w->index, path, sizeof(path))) {
+        fprintf(stderr, "Output path %s is too long\n", w->base);
+        return 0;
+    }
+
+    w->fd = iq_io_open_file(w->io, path);
+    if (w->fd == -1) {
+        perror("Failed to open output file");
+        return 0;
+    }
+
+    // Reserve the blocks up front so the filesystem doesn't fragment the
+    // file while it grows. KEEP_SIZE means a crash never leaves a tail of
+    // zero "samples" behind; the reservation is trimmed on close.
+    uint64_t reserve = w->segment_bytes ? w->segment_bytes : w->expected_bytes;
+    if (reserve > 0) {
+        fallocate(w->fd, FALLOC_FL_KEEP_SIZE, 0, reserve);
+    }
+
+    w->seg_written = 0;
+    w->seg_first_sample = w->total_samples;
+    return 1;
+}
+
+// Finish the current segment and log it in the manifest
+static void segment_close_current(segment_writer_t *w) {
+    if (w->fd == -1) {
+        return;
+    }
+
+    // Wait for outstanding writes and release preallocated space that
+    // was never written
+    iq_io_close_file(w->io, w->fd, w->seg_written);
+    w->fd = -1;
+
+    char path[PATH_MAX];
+    if (!segment_filename(w, w->index, path, sizeof(path))) {
+        w->index++;     // Cannot happen: the name fitted when it was opened
+        return;
+    }
+
+    uint64_t samples = w->total_samples - w->seg_first_sample;
+    time_t first = w->start_time + w->seg_first_sample / w->sample_rate;
+    catalog_add(CATALOG_IQ, path, w->center_freq - w->sample_rate / 2, w->center_freq + w->sample_rate / 2,
+                w->sample_rate, first, first + samples / w->sample_rate);
+
+    if (w->manifest) {
+        const char *name = strrchr(path, '/');
+        fprintf(w->manifest, "%d,%s,%llu,%llu,closed\n", w->index, name ? name + 1 : path,
+                (unsigned long long)w->seg_first_sample,
+                (unsigned long long)samples);
+        fflush(w->manifest);
+    }
+    w->index++;
+}
+
+// Start a new recording; base is the path without the .dat extension
+int segment_writer_open(segment_writer_t *w, iq_io_t *io, const char *base, uint64_t segment_bytes,
+                        uint64_t quota_bytes, uint64_t expected_bytes,
+                        uint32_t center_freq, uint32_t sample_rate) {
+    memset(w, 0, sizeof(*w));
+    w->fd = -1;
+    w->io = io;
+    w->center_freq = center_freq;
+    w->sample_rate = sample_rate ? sample_rate : DEFAULT_SAMPLE_RATE;
+    w->start_time = time(NULL);
+
+    // Segments hold whole IQ pairs so boundaries fall on a sample, and
+    // whole blocks so every write can stay O_DIRECT aligned
+    w->segment_bytes = segment_bytes - segment_bytes % IQ_IO_ALIGN;
+    if (segment_bytes > 0 && w->segment_bytes == 0) {
+        w->segment_bytes = IQ_IO_ALIGN;
+    }
+    w->quota_bytes = quota_bytes;
+    w->expected_bytes = expected_bytes;
+    snprintf(w->base, sizeof(w->base), "%s", base);
+
+    if (w->segment_bytes > 0 && quota_bytes > 0 && quota_bytes < 2 * w->segment_bytes) {
+        fprintf(stderr, "Disk quota must hold at least two segments\n");
+        return 0;
+    }
+
+    if (w->segment_bytes > 0) {
+        char manifest_path[PATH_MAX];
+        snprintf(manifest_path, sizeof(manifest_path), "%s.manifest", base);
+        w->manifest = fopen(manifest_path, "w");
+        if (!w->manifest) {
+            perror("Failed to open manifest file");
+            return 0;
+        }
+        fprintf(w->manifest, "Segment,File,FirstSample,Samples,Status\n");
+        fflush(w->manifest);
+    }
+
+    if (!segment_open_next(w)) {
+        if (w->manifest) fclose(w->manifest);
+        w->manifest = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+// Queue a buffer of raw IQ bytes, splitting it across segment boundaries
+int segment_writer_write(segment_writer_t *w, iq_buffer_t *buf) {
+    size_t offset = 0;
+    size_t len = buf->len;
+
+    while (len > 0) {
+        size_t chunk = len;
+
+        if (w->segment_bytes > 0) {
+            uint64_t room = w->segment_bytes - w->seg_written;
+            if (room == 0) {
+                segment_close_current(w);
+                if (!segment_open_next(w)) {
+                    return 0;
+                }
+                room = w->segment_bytes;
+            }
+            if (chunk > room) chunk = room;
+        }
+
+        iq_io_write(w->io, w->fd, buf, offset, chunk, w->seg_written);
+
+        w->seg_written += chunk;
+        w->total_bytes += chunk;
+        w->total_samples = w->total_bytes / 2; // Two bytes per sample (I & Q)
+        offset += chunk;
+        len -= chunk;
+    }
+    return !iq_io_failed(w->io);
+}
+
+// Close the last segment and the manifest
+void segment_writer_close(segment_writer_t *w) {
+    segment_close_current(w);
+    if (w->manifest) {
+        fclose(w->manifest);
+        w->manifest = NULL;
+    }
+}
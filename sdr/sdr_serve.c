@@ -0,0 +1,556 @@
+/**
+ * @file sdr_serve.c
+ * @brief rtl_tcp compatible IQ server with fan-out to many clients
+ *
+ * Implements the sdr_serve command, which lets several rtl_tcp clients
+ * (gqrx, SDR++, rtl_tcp based decoders) share one dongle. The capture
+ * thread runs rtlsdr_read_async and copies each USB buffer once into a
+ * reference-counted buffer, which is queued on every connected client
+ * with one reference each. A single epoll thread sends from each
+ * client's queue and drops the reference when the buffer has gone out;
+ * the last reference puts the buffer back on the free list.
+ *
+ * Every client's queue is bounded. When a slow client's queue is full
+ * the capture thread applies that client's policy, either skipping the
+ * buffer for it alone or disconnecting it, and never waits, so neither
+ * the dongle nor the other clients notice.
+ */
+
+#define _GNU_SOURCE
+#include "sdr.h"
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+
+#define SERVE_DEFAULT_PORT "1234"
+#define SERVE_BUF_LEN (16 * 16384)    // Bytes per USB transfer, as rtl_tcp
+#define SERVE_USB_BUFFERS 15
+#define SERVE_QUEUE_DEFAULT 16        // Buffers a client may fall behind
+#define SERVE_MAX_CLIENTS 32
+#define SERVE_MAX_EVENTS 64
+#define SERVE_IOV_MAX 8               // Queued buffers sent per writev
+
+#define SERVE_POLICY_DROP 0           // Skip buffers for a full client
+#define SERVE_POLICY_CLOSE 1          // Disconnect a full client
+
+typedef struct serve_buffer {
+    uint8_t *data;                // SERVE_BUF_LEN bytes
+    uint32_t len;
+    int refs;                     // Clients still to send it
+    struct serve_buffer *next;    // Free list link
+} serve_buffer_t;
+
+typedef struct {
+    int fd;
+    int slot;                     // Index in serve.clients
+    char name[64];                // Peer address, for messages
+    uint8_t header[12];           // "RTL0", tuner type, gain count
+    int header_sent;
+    serve_buffer_t **queue;       // Ring of queue_len buffers
+    int head, count;
+    uint32_t offset;              // Bytes of the head buffer already sent
+    uint8_t command[5];           // Partial 5-byte command
+    int command_len;
+    int want_out;                 // Registered for EPOLLOUT
+    int overflowed;               // Full under SERVE_POLICY_CLOSE
+    uint64_t sent_bytes;
+    uint64_t dropped;             // Buffers skipped for this client
+} serve_client_t;
+
+static struct {
+    rtlsdr_dev_t *dev;
+    pthread_mutex_t lock;         // Client queues, buffer refs and the free list
+    serve_client_t *clients[SERVE_MAX_CLIENTS];
+    int n_clients;
+    serve_buffer_t *free_list;
+    int n_buffers;                // Buffers allocated
+    int queue_len;
+    int policy;
+    int listen_fd, epoll_fd, wake_fd;
+    volatile int stopping;
+    int capture_done;             // rtlsdr_read_async has returned
+    int capture_status;           // and what it returned
+    uint64_t captured;            // USB buffers received
+    uint64_t fanned_out;          // Buffer references handed to clients
+    uint64_t alloc_failures;
+} serve;
+
+static int listen_tag, wake_tag;
+
+static void serve_put(serve_buffer_t *buf) {
+    if (--buf->refs == 0) {
+        buf->next = serve.free_list;
+        serve.free_list = buf;
+    }
+}
+
+// Called by librtlsdr on the capture thread for every USB transfer
+static void serve_capture(unsigned char *data, uint32_t len, void *ctx) {
+    pthread_mutex_lock(&serve.lock);
+    serve.captured++;
+    if (serve.n_clients == 0 || len == 0) {
+        pthread_mutex_unlock(&serve.lock);
+        return;
+    }
+
+    // A free buffer always exists unless every client is holding a full
+    // queue, so this only allocates while the clients settle in
+    serve_buffer_t *buf = serve.free_list;
+    if (buf) {
+        serve.free_list = buf->next;
+    } else {
+        buf = malloc(sizeof(serve_buffer_t));
+        uint8_t *mem = buf ? buffer_pool_alloc(SERVE_BUF_LEN) : NULL;
+        if (!mem) {
+            free(buf);
+            serve.alloc_failures++;
+            pthread_mutex_unlock(&serve.lock);
+            return;
+        }
+        buf->data = mem;
+        serve.n_buffers++;
+    }
+    if (len > SERVE_BUF_LEN) len = SERVE_BUF_LEN;
+    memcpy(buf->data, data, len);
+    buf->len = len;
+    buf->refs = 1;                // Held while fanning out
+
+    for (int i = 0; i < serve.n_clients; i++) {
+        serve_client_t *c = serve.clients[i];
+        if (c->overflowed) {
+            continue;
+        }
+        if (c->count == serve.queue_len) {
+            c->dropped++;
+            if (serve.policy == SERVE_POLICY_CLOSE) {
+                c->overflowed = 1;
+            }
+            continue;
+        }
+        c->queue[(c->head + c->count) % serve.queue_len] = buf;
+        c->count++;
+        buf->refs++;
+        serve.fanned_out++;
+    }
+    serve_put(buf);
+    pthread_mutex_unlock(&serve.lock);
+
+    uint64_t one = 1;
+    if (write(serve.wake_fd, &one, sizeof(one)) < 0) {
+        // The counter is saturated; the network thread is already awake
+    }
+}
+
+// Runs until cancelled, or until the dongle fails or is unplugged
+static void *serve_capture_thread(void *arg) {
+    rtlsdr_reset_buffer(serve.dev);
+    serve.capture_status = rtlsdr_read_async(serve.dev, serve_capture, NULL, SERVE_USB_BUFFERS, SERVE_BUF_LEN);
+    __atomic_store_n(&serve.capture_done, 1, __ATOMIC_RELEASE);
+    return NULL;
+}
+
+// Apply one 5-byte rtl_tcp command: a code and a big-endian parameter
+static void serve_command(serve_client_t *c) {
+    uint8_t code = c->command[0];
+    uint32_t param = (uint32_t)c->command[1] << 24 | c->command[2] << 16 | c->command[3] << 8 | c->command[4];
+    rtlsdr_dev_t *dev = serve.dev;
+
+    switch (code) {
+        case 0x01: rtlsdr_set_center_freq(dev, param); break;
+        case 0x02: rtlsdr_set_sample_rate(dev, param); break;
+        case 0x03: rtlsdr_set_tuner_gain_mode(dev, param); break;
+        case 0x04: rtlsdr_set_tuner_gain(dev, (int)param); break;
+        case 0x05: rtlsdr_set_freq_correction(dev, (int)param); break;
+        case 0x06: rtlsdr_set_tuner_if_gain(dev, param >> 16, (int16_t)(param & 0xffff)); break;
+        case 0x07: rtlsdr_set_testmode(dev, param); break;
+        case 0x08: rtlsdr_set_agc_mode(dev, param); break;
+        case 0x09: rtlsdr_set_direct_sampling(dev, param); break;
+        case 0x0a: rtlsdr_set_offset_tuning(dev, param); break;
+        case 0x0d: {
+            // Gain by index into the tuner's gain table
+            int n_gains = rtlsdr_get_tuner_gains(dev, NULL);
+            if (n_gains > 0 && param < (uint32_t)n_gains) {
+                int gains[n_gains];
+                rtlsdr_get_tuner_gains(dev, gains);
+                rtlsdr_set_tuner_gain(dev, gains[param]);
+            }
+            break;
+        }
+        case 0x0e: rtlsdr_set_bias_tee(dev, param); break;
+        default:
+            // Crystal corrections and anything newer are not supported
+            fprintf(stderr, "sdr_serve: %s: ignoring command 0x%02x\n", c->name, code);
+            break;
+    }
+}
+
+static void serve_close(serve_client_t *c, const char *why) {
+    epoll_ctl(serve.epoll_fd, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+
+    pthread_mutex_lock(&serve.lock);
+    while (c->count > 0) {
+        serve_put(c->queue[c->head]);
+        c->head = (c->head + 1) % serve.queue_len;
+        c->count--;
+    }
+    serve_client_t *last = serve.clients[--serve.n_clients];
+    serve.clients[c->slot] = last;
+    last->slot = c->slot;
+    pthread_mutex_unlock(&serve.lock);
+
+    fprintf(stderr, "sdr_serve: %s disconnected (%s): %.1f MB sent, %llu buffers dropped\n",
+            c->name, why, c->sent_bytes / 1e6, (unsigned long long)c->dropped);
+    free(c->queue);
+    free(c);
+}
+
+// Send the header and as much queued IQ as the socket takes; returns 0
+// if the client has gone
+static int serve_flush(serve_client_t *c) {
+    if (!c->header_sent) {
+        ssize_t n = send(c->fd, c->header, sizeof(c->header), MSG_NOSIGNAL);
+        if (n != sizeof(c->header)) {
+            return 0;
+        }
+        c->header_sent = 1;
+    }
+
+    for (;;) {
+        // Buffers already queued stay put while unlocked: the capture
+        // thread only appends, and only this thread removes
+        struct iovec iov[SERVE_IOV_MAX];
+        int n_iov = 0;
+        pthread_mutex_lock(&serve.lock);
+        for (int i = 0; i < c->count && i < SERVE_IOV_MAX; i++) {
+            serve_buffer_t *buf = c->queue[(c->head + i) % serve.queue_len];
+            uint32_t skip = i == 0 ? c->offset : 0;
+            iov[n_iov].iov_base = buf->data + skip;
+            iov[n_iov].iov_len = buf->len - skip;
+            n_iov++;
+        }
+        pthread_mutex_unlock(&serve.lock);
+        if (n_iov == 0) {
+            break;
+        }
+
+        struct msghdr msg = {.msg_iov = iov, .msg_iovlen = n_iov};
+        ssize_t n = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+            return 0;
+        }
+        c->sent_bytes += n;
+
+        // Release every buffer that went out completely
+        pthread_mutex_lock(&serve.lock);
+        size_t left = n;
+        while (left > 0) {
+            serve_buffer_t *buf = c->queue[c->head];
+            size_t rest = buf->len - c->offset;
+            if (left < rest) {
+                c->offset += left;
+                break;
+            }
+            left -= rest;
+            c->offset = 0;
+            c->head = (c->head + 1) % serve.queue_len;
+            c->count--;
+            serve_put(buf);
+        }
+        pthread_mutex_unlock(&serve.lock);
+    }
+
+    pthread_mutex_lock(&serve.lock);
+    int want_out = c->count > 0;
+    pthread_mutex_unlock(&serve.lock);
+    if (want_out != c->want_out) {
+        struct epoll_event ev = {EPOLLIN | EPOLLRDHUP | (want_out ? EPOLLOUT : 0), {.ptr = c}};
+        epoll_ctl(serve.epoll_fd, EPOLL_CTL_MOD, c->fd, &ev);
+        c->want_out = want_out;
+    }
+    return 1;
+}
+
+// Read and apply commands; returns 0 once the client has gone
+static int serve_read(serve_client_t *c) {
+    for (;;) {
+        ssize_t n = read(c->fd, c->command + c->command_len, sizeof(c->command) - c->command_len);
+        if (n == 0) {
+            return 0;
+        }
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return errno == EAGAIN || errno == EWOULDBLOCK;
+        }
+        c->command_len += n;
+        if (c->command_len == sizeof(c->command)) {
+            serve_command(c);
+            c->command_len = 0;
+        }
+    }
+}
+
+static void serve_accept() {
+    for (;;) {
+        struct sockaddr_storage peer;
+        socklen_t peer_len = sizeof(peer);
+        int fd = accept4(serve.listen_fd, (struct sockaddr *)&peer, &peer_len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+
+        serve_client_t *c = calloc(1, sizeof(serve_client_t));
+        serve_buffer_t **queue = c ? calloc(serve.queue_len, sizeof(serve_buffer_t *)) : NULL;
+        if (!queue || serve.n_clients >= SERVE_MAX_CLIENTS) {
+            fprintf(stderr, "sdr_serve: refusing connection, %d clients already\n", serve.n_clients);
+            free(c);
+            free(queue);
+            close(fd);
+            continue;
+        }
+        c->fd = fd;
+        c->queue = queue;
+        if (peer.ss_family == AF_INET) {
+            struct sockaddr_in *in = (struct sockaddr_in *)&peer;
+            char addr[INET_ADDRSTRLEN];
+            inet_ntop(AF_INET, &in->sin_addr, addr, sizeof(addr));
+            snprintf(c->name, sizeof(c->name), "%s:%d", addr, ntohs(in->sin_port));
+        } else {
+            snprintf(c->name, sizeof(c->name), "local client %d", fd);
+        }
+
+        // rtl_tcp greeting: magic, tuner type and gain count, big-endian
+        uint32_t tuner = htonl(rtlsdr_get_tuner_type(serve.dev));
+        int n_gains = rtlsdr_get_tuner_gains(serve.dev, NULL);
+        uint32_t gains = htonl(n_gains > 0 ? n_gains : 0);
+        memcpy(c->header, "RTL0", 4);
+        memcpy(c->header + 4, &tuner, 4);
+        memcpy(c->header + 8, &gains, 4);
+
+        struct epoll_event ev = {EPOLLIN | EPOLLRDHUP | EPOLLOUT, {.ptr = c}};
+        c->want_out = 1;
+        if (epoll_ctl(serve.epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0) {
+            free(c->queue);
+            free(c);
+            close(fd);
+            continue;
+        }
+
+        pthread_mutex_lock(&serve.lock);
+        c->slot = serve.n_clients;
+        serve.clients[serve.n_clients++] = c;
+        pthread_mutex_unlock(&serve.lock);
+        fprintf(stderr, "sdr_serve: %s connected\n", c->name);
+    }
+}
+
+static void *serve_network_thread(void *arg) {
+    struct epoll_event events[SERVE_MAX_EVENTS];
+
+    while (!serve.stopping) {
+        int n = epoll_wait(serve.epoll_fd, events, SERVE_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("sdr_serve: epoll_wait");
+            break;
+        }
+
+        int woken = 0;
+        for (int i = 0; i < n; i++) {
+            void *ptr = events[i].data.ptr;
+            if (ptr == &listen_tag) {
+                serve_accept();
+            } else if (ptr == &wake_tag) {
+                uint64_t value;
+                if (read(serve.wake_fd, &value, sizeof(value)) > 0) woken = 1;
+            } else {
+                serve_client_t *c = ptr;
+                int alive = 1;
+                if (events[i].events & EPOLLIN) alive = serve_read(c);
+                if (events[i].events & (EPOLLERR | EPOLLHUP | EPOLLRDHUP)) alive = 0;
+                if (alive && (events[i].events & EPOLLOUT)) alive = serve_flush(c);
+                if (!alive) serve_close(c, "closed by peer");
+            }
+        }
+
+        // New buffers: push to every client that was idle, and let go of
+        // any the capture thread gave up on
+        if (woken) {
+            for (int i = serve.n_clients - 1; i >= 0; i--) {
+                serve_client_t *c = serve.clients[i];
+                if (c->overflowed) {
+                    serve_close(c, "too slow");
+                } else if (!c->want_out && !serve_flush(c)) {
+                    serve_close(c, "send failed");
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+// Command to share the device with rtl_tcp clients
+int cmd_sdr_serve(char **args) {
+    const char *endpoint = SERVE_DEFAULT_PORT;
+    uint32_t freq = DEFAULT_FREQ;
+    uint32_t rate = DEFAULT_SAMPLE_RATE;
+    int queue_len = SERVE_QUEUE_DEFAULT;
+    int policy = SERVE_POLICY_DROP;
+    int positional = 0;
+
+    for (int i = 1; args[i]; i++) {
+        if (strcmp(args[i], "--rate") == 0 && args[i + 1]) {
+            rate = parse_frequency(args[++i]);
+        } else if (strcmp(args[i], "--queue") == 0 && args[i + 1]) {
+            queue_len = atoi(args[++i]);
+        } else if (strcmp(args[i], "--slow") == 0 && args[i + 1]) {
+            i++;
+            if (strcmp(args[i], "drop") == 0) {
+                policy = SERVE_POLICY_DROP;
+            } else if (strcmp(args[i], "close") == 0) {
+                policy = SERVE_POLICY_CLOSE;
+            } else {
+                fprintf(stderr, "sdr_serve: --slow takes drop or close\n");
+                last_exit_status = 1;
+                return 1;
+            }
+        } else if (args[i][0] != '-' && positional == 0) {
+            endpoint = args[i];
+            positional++;
+        } else if (args[i][0] != '-' && positional == 1) {
+            freq = parse_frequency(args[i]);
+            positional++;
+        } else {
+            fprintf(stderr, "sdr_serve: unknown option %s\n", args[i]);
+            last_exit_status = 1;
+            return 1;
+        }
+    }
+    if (queue_len < 1 || rate == 0 || freq == 0) {
+        fprintf(stderr, "sdr_serve: invalid queue length, rate or frequency\n");
+        last_exit_status = 1;
+        return 1;
+    }
+
+    char unix_path[PATH_MAX];
+    int listen_fd = sdr_listen(endpoint, "sdr_serve", unix_path, sizeof(unix_path));
+    if (listen_fd < 0) {
+        last_exit_status = 1;
+        return 1;
+    }
+
+    rtlsdr_dev_t *dev;
+    if (!open_sdr_device(&dev)) {
+        close(listen_fd);
+        if (unix_path[0]) unlink(unix_path);
+        return 1;
+    }
+    rtlsdr_set_sample_rate(dev, rate);
+    rtlsdr_set_center_freq(dev, freq);
+
+    memset(&serve, 0, sizeof(serve));
+    pthread_mutex_init(&serve.lock, NULL);
+    serve.dev = dev;
+    serve.queue_len = queue_len;
+    serve.policy = policy;
+    serve.listen_fd = listen_fd;
+    serve.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    serve.wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    int ok = serve.epoll_fd >= 0 && serve.wake_fd >= 0;
+    if (ok) {
+        struct epoll_event ev = {EPOLLIN, {.ptr = &listen_tag}};
+        ok = epoll_ctl(serve.epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev) == 0;
+        ev.data.ptr = &wake_tag;
+        ok = ok && epoll_ctl(serve.epoll_fd, EPOLL_CTL_ADD, serve.wake_fd, &ev) == 0;
+    }
+    if (!ok) {
+        perror("sdr_serve: cannot set up the event loop");
+    }
+
+    // Both threads leave signals to this one
+    pthread_t capture_thread, network_thread;
+    int network_started = 0, capture_started = 0;
+    if (ok) {
+        sigset_t all, old;
+        sigfillset(&all);
+        pthread_sigmask(SIG_SETMASK, &all, &old);
+        int err = pthread_create(&network_thread, NULL, serve_network_thread, NULL);
+        network_started = err == 0;
+        if (network_started) {
+            err = pthread_create(&capture_thread, NULL, serve_capture_thread, NULL);
+            capture_started = err == 0;
+        }
+        pthread_sigmask(SIG_SETMASK, &old, NULL);
+        if (err != 0) {
+            fprintf(stderr, "sdr_serve: cannot start server threads: %s\n", strerror(err));
+            ok = 0;
+        }
+    }
+
+    // Serve until Ctrl+C, or until the capture gives up on its own
+    int capture_lost = 0;
+    if (ok) {
+        printf("Serving rtl_tcp on %s at %.3f MHz, %.3f MS/s. Press Ctrl+C to stop...\n",
+               endpoint, freq / 1e6, rate / 1e6);
+        fflush(stdout);
+
+        sdr_install_stop_handler();
+        while (!sdr_stop_requested() && !__atomic_load_n(&serve.capture_done, __ATOMIC_ACQUIRE)) {
+            usleep(100000);
+        }
+        sdr_restore_stop_handler();
+        capture_lost = __atomic_load_n(&serve.capture_done, __ATOMIC_ACQUIRE);
+    }
+
+    if (capture_started) {
+        rtlsdr_cancel_async(dev);
+        pthread_join(capture_thread, NULL);
+    }
+    if (network_started) {
+        serve.stopping = 1;
+        uint64_t one = 1;
+        if (write(serve.wake_fd, &one, sizeof(one)) < 0) {
+            perror("sdr_serve: wake");
+        }
+        pthread_join(network_thread, NULL);
+    }
+
+    while (serve.n_clients > 0) {
+        serve_close(serve.clients[0], "server stopping");
+    }
+    while (serve.free_list) {
+        serve_buffer_t *buf = serve.free_list;
+        serve.free_list = buf->next;
+        buffer_pool_free(buf->data, SERVE_BUF_LEN);
+        free(buf);
+    }
+
+    if (capture_lost) {
+        fprintf(stderr, "\nsdr_serve: capture ended on its own (rtlsdr_read_async returned %d); "
+                "was the dongle unplugged?\n", serve.capture_status);
+    }
+    if (!ok || capture_lost) {
+        last_exit_status = 1;
+    }
+    printf("\nServer stopped: %llu buffers captured, %llu sent to clients, %d buffers in the ring",
+           (unsigned long long)serve.captured, (unsigned long long)serve.fanned_out, serve.n_buffers);
+    if (serve.alloc_failures) {
+        printf(", %llu lost to allocation failures", (unsigned long long)serve.alloc_failures);
+    }
+    printf("\n");
+
+    if (serve.wake_fd >= 0) close(serve.wake_fd);
+    if (serve.epoll_fd >= 0) close(serve.epoll_fd);
+    close(listen_fd);
+    if (unix_path[0]) unlink(unix_path);
+    pthread_mutex_destroy(&serve.lock);
+    close_sdr_device(dev);
+    return 1;
+}
@@ -0,0 +1,135 @@
+/**
+ * @file sdr_shm.c
+ * @brief Publishing spectra into the shared-memory ring
+ *
+ * Writer side of include/sdr_shm.h. The object is created or mapped on
+ * the first publish and stays mapped for the life of the shell. Writers
+ * in different processes take turns through writer_pid in the header; a
+ * lock left by a process that died is taken over.
+ */
+
+#include "sdr.h"
+#include <errno.h>
+#include <sched.h>
+
+_Static_assert(sizeof(sdr_shm_header_t) == 64, "frames start 64 bytes into the object");
+
+static sdr_shm_header_t *shm = NULL;
+static int shm_unavailable = 0;
+
+// Create or attach to the ring; returns 0 if shared memory is unusable
+static int shm_map() {
+    if (shm) {
+        return 1;
+    }
+    if (shm_unavailable) {
+        return 0;
+    }
+
+    size_t size = sdr_shm_total_size(SDR_SHM_SLOTS, SDR_SHM_MAX_BINS);
+    int fd = shm_open(SDR_SHM_NAME, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 ||
+        ((size_t)st.st_size != size && ftruncate(fd, size) != 0)) {
+        fprintf(stderr, "Spectrum sharing disabled: %s: %s\n", SDR_SHM_NAME, strerror(errno));
+        if (fd >= 0) close(fd);
+        shm_unavailable = 1;
+        return 0;
+    }
+    void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "Spectrum sharing disabled: %s\n", strerror(errno));
+        shm_unavailable = 1;
+        return 0;
+    }
+
+    // A new object, or one left by a different layout, is set up afresh;
+    // the magic goes in last so readers never see a half-made header
+    sdr_shm_header_t *h = map;
+    if (h->magic != SDR_SHM_MAGIC || h->version != SDR_SHM_VERSION ||
+        h->n_slots != SDR_SHM_SLOTS || h->max_bins != SDR_SHM_MAX_BINS) {
+        __atomic_store_n(&h->magic, 0, __ATOMIC_RELAXED);
+        memset(map, 0, size);
+        h->version = SDR_SHM_VERSION;
+        h->n_slots = SDR_SHM_SLOTS;
+        h->max_bins = SDR_SHM_MAX_BINS;
+        h->frame_size = sdr_shm_frame_size(SDR_SHM_MAX_BINS);
+        __atomic_store_n(&h->magic, SDR_SHM_MAGIC, __ATOMIC_RELEASE);
+    }
+    shm = h;
+    return 1;
+}
+
+static void shm_writer_lock() {
+    uint32_t me = getpid();
+    for (;;) {
+        uint32_t owner = 0;
+        if (__atomic_compare_exchange_n(&shm->writer_pid, &owner, me, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return;
+        }
+        // The owner died mid-publish; its frame is left odd and skipped
+        if (owner != me && kill(owner, 0) != 0 && errno == ESRCH &&
+            __atomic_compare_exchange_n(&shm->writer_pid, &owner, me, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return;
+        }
+        sched_yield();
+    }
+}
+
+static void shm_writer_unlock() {
+    __atomic_store_n(&shm->writer_pid, 0, __ATOMIC_RELEASE);
+}
+
+// Publish one spectrum of samples taken at timestamp_ns (CLOCK_REALTIME,
+// 0 = now); power[i] is at first_freq + i * bin_width. Spectra wider than
+// the ring's frames keep the peak of each group of bins. Returns 0 if
+// shared memory is unavailable.
+int spectrum_shm_publish(int source, uint64_t timestamp_ns, double center_freq, double first_freq,
+                         double bin_width, const float *power, uint32_t n_bins) {
+    if (!shm_map()) {
+        return 0;
+    }
+
+    uint32_t group = (n_bins + SDR_SHM_MAX_BINS - 1) / SDR_SHM_MAX_BINS;
+    if (group == 0) group = 1;
+
+    if (timestamp_ns == 0) {
+        timestamp_ns = sdr_realtime_ns();
+    }
+
+    shm_writer_lock();
+    uint64_t index = shm->write_index;
+    sdr_shm_frame_t *f = (sdr_shm_frame_t *)sdr_shm_slot(shm, index);
+
+    uint32_t seq = f->seq;
+    if (seq & 1) seq++;           // Left odd by a writer that died
+    __atomic_store_n(&f->seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    f->source = source;
+    f->frame = index;
+    f->timestamp_ns = timestamp_ns;
+    f->center_freq = center_freq;
+    f->first_freq = first_freq;
+    f->bin_width = bin_width * group;
+    if (group == 1) {
+        memcpy(f->power, power, sizeof(float) * n_bins);
+        f->n_bins = n_bins;
+    } else {
+        uint32_t out = 0;
+        for (uint32_t i = 0; i < n_bins; i += group, out++) {
+            float peak = power[i];
+            for (uint32_t j = i + 1; j < i + group && j < n_bins; j++) {
+                if (power[j] > peak) peak = power[j];
+            }
+            f->power[out] = peak;
+        }
+        f->n_bins = out;
+    }
+
+    __atomic_store_n(&f->seq, seq + 2, __ATOMIC_RELEASE);
+    __atomic_store_n(&shm->write_index, index + 1, __ATOMIC_RELEASE);
+    shm_writer_unlock();
+    return 1;
+}
@@ -4,23 +4,55 @@
  *
  * Implements the sdr_snr command which measures and logs the signal-to-noise
  * ratio at a specific frequency. Performs FFT analysis to separate signal
- * from noise and calculates SNR in dB. Results are saved to CSV files.
+ * from noise and calculates SNR in dB. Results are saved to CSV files
+ * with the capture time of every spectrum to the microsecond,
+ * and every power spectrum is published to the shared-memory ring
+ * (sdr_shm.h) as it is computed.
+ *
+ * The measurement is a block graph: capture -> convert -> fft -> snr_log.
+ *
+ * The signal is read from the bins around the centre of the spectrum,
+ * which on an RTL-SDR is also where the LO leakage spike sits. With
+ * --offset-tune the dongle is tuned below the frequency instead, and
+ * correct -> mix stages between convert and fft remove the spike and the
+ * IQ image and bring the signal back to the centre (see sdr_dsp.c).
  */
 
-#include "shell.h"
+#include "sdr.h"
 
 // Command to monitor a specific frequency and measure SNR
 int cmd_sdr_snr(char **args) {
-    if (!create_data_directories()) {
-        return 1;
-    }
-
     uint32_t freq = DEFAULT_FREQ;
     uint32_t duration = 10; // Default 10 seconds
+    uint64_t tune_offset = 0;
+
+    // Parse command arguments; args ends at the first NULL
+    int argi = 1;
+    if (args[argi] && isdigit((unsigned char)args[argi][0])) {
+        freq = parse_frequency(args[argi++]);
+        if (args[argi] && isdigit((unsigned char)args[argi][0])) duration = atoi(args[argi++]);
+    }
+    for (; args[argi] != NULL; argi++) {
+        if (strcmp(args[argi], "--offset-tune") == 0) {
+            tune_offset = OFFSET_TUNE_DEFAULT;
+        } else if (strncmp(args[argi], "--offset-tune=", 14) == 0) {
+            tune_offset = parse_frequency(args[argi] + 14);
+        } else {
+            fprintf(stderr, "sdr_snr: unknown option %s\n", args[argi]);
+            last_exit_status = 1;
+            return 1;
+        }
+    }
+    if (tune_offset >= DEFAULT_SAMPLE_RATE / 2 || tune_offset > freq) {
+        fprintf(stderr, "sdr_snr: the tuning offset must be below %u Hz and the frequency\n",
+                DEFAULT_SAMPLE_RATE / 2);
+        last_exit_status = 1;
+        return 1;
+    }
 
-    // Parse command arguments
-    if (args[1]) freq = atoi(args[1]);
-    if (args[2]) duration = atoi(args[2]);
+    if (!create_data_directories()) {
+        return 1;
+    }
 
     // Open device
     rtlsdr_dev_t *dev;
@@ -28,8 +60,8 @@ int cmd_sdr_snr(char **args) {
         return 1;
     }
 
-    // Set frequency
-    rtlsdr_set_center_freq(dev, freq);
+    // Set frequency, below the signal when offset tuning
+    rtlsdr_set_center_freq(dev, freq - tune_offset);
 
     // Create output file
     char* timestamp = get_timestamp_string();
@@ -44,123 +76,62 @@ int cmd_sdr_snr(char **args) {
         return 1;
     }
 
-    // Write CSV header
-    fprintf(file, "Time,SignalPower,NoisePower,SNR\n");
-
-    // Reset buffer
-    rtlsdr_reset_buffer(dev);
-
     printf("Measuring SNR at %.2f MHz for %u seconds...\n", freq/1e6, duration);
-
-    // Calculate number of samples based on duration and sample rate
-    uint32_t buffer_size = DEFAULT_BUFFER_SIZE;
-    uint8_t *buffer = malloc(buffer_size);
-
-    if (!buffer) {
-        perror("Failed to allocate sample buffer");
-        fclose(file);
-        close_sdr_device(dev);
-        return 1;
+    if (tune_offset) {
+        printf("Offset tuning: receiver at %.4f MHz\n", (freq - tune_offset) / 1e6);
     }
 
     // Calculate FFT size (must be power of 2)
     int fft_size = 1024;
 
-    // Allocate FFT buffers
-    fftwf_complex *fft_in = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * fft_size);
-    fftwf_complex *fft_out = (fftwf_complex*) fftwf_malloc(sizeof(fftwf_complex) * fft_size);
-    fftwf_plan fft_plan = fftwf_plan_dft_1d(fft_size, fft_in, fft_out, FFTW_FORWARD, FFTW_ESTIMATE);
-
-    if (!fft_in || !fft_out || !fft_plan) {
-        fprintf(stderr, "Failed to allocate FFT resources\n");
-        if (fft_in) fftwf_free(fft_in);
-        if (fft_out) fftwf_free(fft_out);
-        free(buffer);
+    sample_capture_t capture;
+    if (!sample_capture_start(&capture, dev)) {
         fclose(file);
         close_sdr_device(dev);
         return 1;
     }
 
-    // Record and process data
-    time_t start_time = time(NULL);
-    time_t current_time = start_time;
-
-    while (current_time - start_time < duration) {
-        int n_read = 0;
-        rtlsdr_read_sync(dev, buffer, buffer_size, &n_read);
-
-        if (n_read > 0) {
-            // Process buffer in FFT-sized chunks
-            for (int offset = 0; offset + (fft_size * 2) <= n_read; offset += (fft_size * 2)) {
-                // Convert samples to complex format for FFT
-                for (int i = 0; i < fft_size; i++) {
-                    // Convert 8-bit unsigned to float
-                    float I = (buffer[offset + (i * 2)] - 127.5f) / 127.5f;
-                    float Q = (buffer[offset + (i * 2) + 1] - 127.5f) / 127.5f;
-
-                    fft_in[i][0] = I;
-                    fft_in[i][1] = Q;
-                }
-
-                // Perform FFT
-                fftwf_execute(fft_plan);
-
-                // Calculate power spectrum
-                float power_spectrum[fft_size];
-                for (int i = 0; i < fft_size; i++) {
-                    float re = fft_out[i][0];
-                    float im = fft_out[i][1];
-                    power_spectrum[i] = re*re + im*im;
-                }
-
-                // Center bin (DC)
-                int center_bin = 0;
-
-                // Signal power (center and adjacent bins)
-                float signal_power = 0.0f;
-                for (int i = center_bin - 2; i <= center_bin + 2; i++) {
-                    int idx = (i + fft_size) % fft_size; // Wrap around
-                    signal_power += power_spectrum[idx];
-                }
-                signal_power /= 5.0f;
-
-                // Noise power (all other bins)
-                float noise_power = 0.0f;
-                int noise_bins = 0;
-                for (int i = 0; i < fft_size; i++) {
-                    if (i < center_bin - 2 || i > center_bin + 2) {
-                        noise_power += power_spectrum[i];
-                        noise_bins++;
-                    }
-                }
-                noise_power /= noise_bins;
-
-                // Calculate SNR
-                float snr = signal_power / noise_power;
-                float snr_db = 10.0f * log10f(snr);
-
-                // Write to CSV
-                fprintf(file, "%ld,%.6f,%.6f,%.2f\n",
-                        time(NULL) - start_time, signal_power, noise_power, snr_db);
-
-                // Print update
-                printf("\rSNR: %.2f dB", snr_db);
-                fflush(stdout);
-            }
-        }
+    // capture -> convert [-> correct -> mix] -> fft -> snr_log, each
+    // stage on its own core
+    sdr_graph_t *graph = sdr_graph_create(0);
+    sdr_block_t *source = graph ? block_capture(graph, &capture, freq - tune_offset,
+                                                (uint64_t)duration * DEFAULT_SAMPLE_RATE) : NULL;
+    sdr_block_t *convert = graph ? block_convert(graph) : NULL;
+    int ok = sdr_graph_connect(source, convert);
+    sdr_block_t *last = convert;
+    sdr_block_t *correct = NULL;
+    if (ok && tune_offset) {
+        correct = block_correct(graph);
+        sdr_block_t *mix = block_mix(graph, tune_offset);
+        ok = sdr_graph_connect(last, correct) && sdr_graph_connect(correct, mix);
+        last = mix;
+    }
+    sdr_block_t *fft = graph ? block_fft(graph, fft_size) : NULL;
+    sdr_block_t *sink = graph ? block_snr_log(graph, file, 1) : NULL;
 
-        current_time = time(NULL);
+    // Record and process data; Ctrl+C ends the measurement early
+    time_t start_time = time(NULL);
+    sdr_install_stop_handler();
+    if (!ok || !sdr_graph_connect(last, fft) ||
+        !sdr_graph_connect(fft, sink) || !sdr_graph_run(graph)) {
+        fprintf(stderr, "\nsdr_snr: measurement did not complete\n");
+        last_exit_status = 1;
     }
+    sdr_restore_stop_handler();
+    sample_capture_stop(&capture);
 
     printf("\nSNR measurement complete. Results saved to %s\n", filename);
+    sample_capture_report(&capture, stdout);
+    if (correct) block_correct_report(correct, stdout);
+    if (graph) sdr_graph_report_latency(graph, stdout);
+    sdr_graph_destroy(graph);
 
     // Clean up
-    fftwf_destroy_plan(fft_plan);
-    fftwf_free(fft_in);
-    fftwf_free(fft_out);
-    free(buffer);
     fclose(file);
     close_sdr_device(dev);
 
+    catalog_add(CATALOG_SNR, filename, freq - DEFAULT_SAMPLE_RATE / 2, freq + DEFAULT_SAMPLE_RATE / 2,
+                DEFAULT_SAMPLE_RATE, start_time, time(NULL));
+
     return 1;
 }
\ No newline at end of file
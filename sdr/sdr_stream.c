@@ -0,0 +1,127 @@
+/**
+ * @file sdr_stream.c
+ * @brief Raw IQ output to a pipe or file descriptor
+ *
+ * Used by `sdr_record ... -` to hand samples to another program. By
+ * default every chunk goes out with plain write() calls from a single
+ * buffer.
+ *
+ * With `--splice` and stdout a pipe, the capture buffers are vmspliced
+ * into it instead, so the kernel references the sample pages rather than
+ * copying them. Those pages must not be refilled while the reader may
+ * still see them, so the buffers form a ring holding more than a full
+ * pipe: a slot is only reused once at least a pipe's worth of later data
+ * has been pushed. That only proves the pages have been read if the
+ * reader copies them out with read(2). A reader that splices them onward
+ * (`sdr_record - | pv > file`, tee, a splicing proxy) keeps referencing
+ * our pages after the pipe has drained, and sees them overwritten. This
+ * is why zero-copy is opt-in and only for readers known to read(2).
+ */
+
+#define _GNU_SOURCE
+#include "sdr.h"
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+
+#define IQ_STREAM_PIPE_SIZE (1024 * 1024)     // Pipe capacity asked for
+
+// Prepare to stream chunk-sized buffers to fd; with zero_copy, vmsplice
+// them if fd is a pipe (the reader must consume it with read(2))
+int iq_stream_open(iq_stream_t *s, int fd, size_t chunk, int zero_copy) {
+    memset(s, 0, sizeof(*s));
+    s->fd = fd;
+    s->chunk = (chunk + IQ_IO_ALIGN - 1) / IQ_IO_ALIGN * IQ_IO_ALIGN;
+    s->current = -1;
+
+    struct stat st;
+    if (zero_copy && fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        // A bigger pipe means fewer wakeups for both ends; fall back to
+        // whatever size the pipe already has
+        fcntl(fd, F_SETPIPE_SZ, IQ_STREAM_PIPE_SIZE);
+        int pipe_size = fcntl(fd, F_GETPIPE_SZ);
+        if (pipe_size > 0) {
+            s->splice = 1;
+            s->pipe_size = pipe_size;
+        }
+    }
+
+    s->n_slots = s->splice ? (int)(s->pipe_size / s->chunk) + 2 : 1;
+    s->ring_size = s->chunk * (s->n_slots + 1);  // Plus a bounce buffer
+    s->ring = mmap(NULL, s->ring_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    s->slot_end = calloc(s->n_slots, sizeof(uint64_t));
+    if (s->ring == MAP_FAILED || !s->slot_end) {
+        perror("Failed to allocate stream buffers");
+        if (s->ring != MAP_FAILED) munmap(s->ring, s->ring_size);
+        free(s->slot_end);
+        return 0;
+    }
+
+    // The reader going away shows up as EPIPE rather than killing us
+    struct sigaction ignore;
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigaction(SIGPIPE, &ignore, &s->old_sigpipe);
+    return 1;
+}
+
+// Buffer to fill with the next chunk of samples
+uint8_t *iq_stream_buffer(iq_stream_t *s) {
+    if (!s->splice) {
+        s->current = 0;
+        return s->ring;
+    }
+
+    int slot = s->next_slot;
+    if (s->slot_end[slot] != 0 && s->bytes - s->slot_end[slot] < s->pipe_size) {
+        // The reader might still see this slot's pages; copy this chunk
+        // through the bounce buffer instead
+        s->current = -1;
+        s->bounced++;
+        return s->ring + s->chunk * s->n_slots;
+    }
+    s->current = slot;
+    s->next_slot = (slot + 1) % s->n_slots;
+    return s->ring + s->chunk * slot;
+}
+
+// Push len bytes of the buffer from iq_stream_buffer; returns 0 once the
+// reader has gone or a write failed
+int iq_stream_write(iq_stream_t *s, const uint8_t *data, size_t len) {
+    if (s->failed) {
+        return 0;
+    }
+
+    int by_reference = s->splice && s->current >= 0;
+    while (len > 0) {
+        ssize_t n;
+        if (by_reference) {
+            struct iovec iov = {(void *)data, len};
+            n = vmsplice(s->fd, &iov, 1, 0);
+        } else {
+            n = write(s->fd, data, len);
+        }
+        s->syscalls++;
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            if (errno != EPIPE) perror("Failed to write IQ stream");
+            s->failed = 1;
+            return 0;
+        }
+        data += n;
+        len -= n;
+        s->bytes += n;
+    }
+
+    if (by_reference) {
+        s->slot_end[s->current] = s->bytes;
+    }
+    return 1;
+}
+
+void iq_stream_close(iq_stream_t *s) {
+    sigaction(SIGPIPE, &s->old_sigpipe, NULL);
+    munmap(s->ring, s->ring_size);
+    free(s->slot_end);
+}
@@ -5,12 +5,12 @@
  * Provides common utility functions for the SDR components, including:
  * - Directory creation for data storage
  * - Timestamp generation for filenames
- * - Device opening/closing helpers
  * - Terminal-based spectrum visualization
- * - Signal power calculation
+ * - Signal power and SNR calculation shared by live and offline analysis
+ * - Ctrl+C handling and size parsing for long captures
  */
 
-#include "shell.h"
+#include "sdr.h"
 
 // Callback function for async reads
 static void rtlsdr_callback(unsigned char *buf, uint32_t len, void *ctx) {
@@ -20,6 +20,87 @@ static void rtlsdr_callback(unsigned char *buf, uint32_t len, void *ctx) {
     }
 }
 
+// Set by SIGINT while a long-running SDR command at the prompt is active.
+// Only commands run by the shell's own thread install the handler and
+// read this flag; Ctrl+C is the user's way to stop what they typed.
+static volatile sig_atomic_t stop_requested = 0;
+static struct sigaction previous_sigint;
+
+// Commands run by a background thread (scheduled jobs) are stopped
+// through this flag instead, and leave the process-wide SIGINT handler
+// alone so that Ctrl+C at the prompt never reaches them
+static __thread int *thread_cancel;
+
+static void sdr_stop_handler(int sig) {
+    stop_requested = 1;
+}
+
+// Make commands on the calling thread stop when *flag becomes nonzero
+// rather than on Ctrl+C
+void sdr_set_thread_cancel(int *flag) {
+    thread_cancel = flag;
+}
+
+// Catch Ctrl+C so a capture can stop cleanly instead of killing the shell
+void sdr_install_stop_handler() {
+    if (thread_cancel) {
+        return;
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sdr_stop_handler;
+    sigemptyset(&sa.sa_mask);
+
+    stop_requested = 0;
+    sigaction(SIGINT, &sa, &previous_sigint);
+}
+
+// Put back whatever SIGINT handler was active before the capture
+void sdr_restore_stop_handler() {
+    if (thread_cancel) {
+        return;
+    }
+    sigaction(SIGINT, &previous_sigint, NULL);
+}
+
+int sdr_stop_requested() {
+    if (thread_cancel) {
+        return __atomic_load_n(thread_cancel, __ATOMIC_RELAXED);
+    }
+    return stop_requested;
+}
+
+// Parse a byte count with an optional K/M/G suffix (powers of 1024)
+uint64_t parse_size(const char *text) {
+    char *end;
+    double value = strtod(text, &end);
+
+    switch (toupper((unsigned char)*end)) {
+        case 'K': value *= 1024.0; break;
+        case 'M': value *= 1024.0 * 1024.0; break;
+        case 'G': value *= 1024.0 * 1024.0 * 1024.0; break;
+        default: break;
+    }
+
+    return value > 0 ? (uint64_t)value : 0;
+}
+
+// Parse a frequency in Hz with an optional k/M/G suffix (powers of 1000)
+uint64_t parse_frequency(const char *text) {
+    char *end;
+    double value = strtod(text, &end);
+
+    switch (toupper((unsigned char)*end)) {
+        case 'K': value *= 1e3; break;
+        case 'M': value *= 1e6; break;
+        case 'G': value *= 1e9; break;
+        default: break;
+    }
+
+    return value > 0 ? (uint64_t)(value + 0.5) : 0;
+}
+
 // Create data directories if they don't exist
 int create_data_directories() {
     struct stat st = {0};
@@ -56,6 +137,14 @@ int create_data_directories() {
         }
     }
 
+    // Create audio directory
+    if (stat(AUDIO_DIR, &st) == -1) {
+        if (mkdir(AUDIO_DIR, 0700) == -1) {
+            perror("Failed to create audio directory");
+            return 0;
+        }
+    }
+
     return 1;
 }
 
@@ -79,54 +168,94 @@ char* get_timestamp_string() {
     return timestamp;
 }
 
-// Open SDR device with default settings
-int open_sdr_device(rtlsdr_dev_t **dev) {
-    int device_count = rtlsdr_get_device_count();
-    if (device_count == 0) {
-        fprintf(stderr, "No RTL-SDR devices found\n");
-        return 0;
+// Clock readings in nanoseconds: monotonic for latencies, real time for
+// stamping samples
+uint64_t sdr_monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+uint64_t sdr_realtime_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+// A CLOCK_REALTIME stamp as ISO 8601 UTC with microseconds
+void format_utc_time(uint64_t ns, char *buf, size_t len) {
+    time_t seconds = ns / 1000000000ull;
+    struct tm t;
+    gmtime_r(&seconds, &t);
+    snprintf(buf, len, "%04d-%02d-%02dT%02d:%02d:%02d.%06uZ",
+             t.tm_year + 1900, t.tm_mon + 1, t.tm_mday, t.tm_hour, t.tm_min, t.tm_sec,
+             (unsigned)(ns % 1000000000ull / 1000));
+}
+
+// Mean power of a buffer of 8-bit unsigned IQ bytes
+double compute_buffer_power(const uint8_t *buffer, int n) {
+    if (n <= 0) {
+        return 0.0;
     }
 
-    // Open first device
-    if (rtlsdr_open(dev, 0) < 0) {
-        fprintf(stderr, "Failed to open RTL-SDR device\n");
-        return 0;
+    double power = 0.0;
+    for (int i = 0; i < n; i++) {
+        // Convert to signed value
+        double sample = (buffer[i] - 127.5) / 127.5;
+        power += sample * sample;
     }
+    return power / n;
+}
 
-    // Set default settings
-    rtlsdr_set_sample_rate(*dev, DEFAULT_SAMPLE_RATE);
-    rtlsdr_set_center_freq(*dev, DEFAULT_FREQ);
-    rtlsdr_set_tuner_gain_mode(*dev, 0); // Auto gain
+// Split a power spectrum into signal (DC bin and its neighbours) and noise
+float compute_snr(const float *power_spectrum, int fft_size, float *signal_power, float *noise_power) {
+    // Center bin (DC)
+    int center_bin = 0;
 
-    return 1;
-}
+    // Signal power (center and adjacent bins)
+    float signal = 0.0f;
+    for (int i = center_bin - 2; i <= center_bin + 2; i++) {
+        int idx = (i + fft_size) % fft_size; // Wrap around
+        signal += power_spectrum[idx];
+    }
+    signal /= 5.0f;
 
-// Close SDR device
-void close_sdr_device(rtlsdr_dev_t *dev) {
-    if (dev) {
-        rtlsdr_close(dev);
+    // Noise power (all other bins)
+    float noise = 0.0f;
+    int noise_bins = 0;
+    for (int i = 0; i < fft_size; i++) {
+        if (i < center_bin - 2 || i > center_bin + 2) {
+            noise += power_spectrum[i];
+            noise_bins++;
+        }
     }
+    noise /= noise_bins;
+
+    *signal_power = signal;
+    *noise_power = noise;
+
+    // SNR in dB
+    return 10.0f * log10f(signal / noise);
 }
 
-// Helper function to find maximum power
-double find_max_power(double* powers, int n_points) {
-    double max = 0;
-    for (int i = 0; i < n_points; i++) {
-        if (powers[i] > max) max = powers[i];
-    }
-    return max;
+// Map a power to a bar height on the fixed -30..0 dB plot scale
+static int power_to_height(double power, int viz_height) {
+    double power_db = 10 * log10(power + 1e-10); // Avoid log(0)
+    double min_db = -30; // Adjust based on your typical noise floor
+    double normalized_power = (power_db - min_db) / (-min_db);
+    if (normalized_power < 0) normalized_power = 0;
+    if (normalized_power > 1) normalized_power = 1;
+    return (int)(normalized_power * viz_height) + 1;
 }
 
-// Function to display spectrum in terminal
-int display_terminal_spectrum(uint32_t* freqs, double* powers, int n_points, uint32_t current_freq) {
+// Function to display spectrum in terminal. Each column is summarised
+// from the pyramid, so a redraw costs the same for ten bins or millions.
+// current_freq is the frequency being scanned, or 0 when just viewing.
+int display_terminal_spectrum(const spectrum_pyramid_t *pyr, double lo_freq, double hi_freq, uint32_t current_freq) {
     int viz_width = 80;
     int viz_height = 20;
     char spectrum_viz[20][81]; // +1 for null terminator
 
-    // Find max power for scaling
-    double max_power = find_max_power(powers, n_points);
-    if (max_power <= 0) max_power = 1.0; // Avoid division by zero
-
     // Initialize visualization grid
     for (int y = 0; y < viz_height; y++) {
         for (int x = 0; x < viz_width; x++) {
@@ -135,38 +264,39 @@ int display_terminal_spectrum(uint32_t* freqs, double* powers, int n_points, uin
         spectrum_viz[y][viz_width] = '\0';
     }
 
-    // Plot spectrum data
-    for (int i = 0; i < n_points; i++) {
-        int x = (int)(((double)i / n_points) * viz_width);
-        if (x >= viz_width) x = viz_width - 1;
+    // Columns split the window evenly; with fewer bins than columns a
+    // bin spans several columns
+    uint64_t first_bin = lo_freq > pyr->start_freq ? (uint64_t)((lo_freq - pyr->start_freq) / pyr->step + 0.5) : 0;
+    uint64_t end_bin = hi_freq > pyr->start_freq ? (uint64_t)((hi_freq - pyr->start_freq) / pyr->step + 0.5) + 1 : 1;
+    if (end_bin <= first_bin) end_bin = first_bin + 1;
+    uint64_t span = end_bin - first_bin;
 
-        // Convert power to dB for better visualization
-        double power_db = 10 * log10(powers[i] + 1e-10); // Avoid log(0)
-        double min_db = -30; // Adjust based on your typical noise floor
-        double normalized_power = (power_db - min_db) / (-min_db);
-        if (normalized_power < 0) normalized_power = 0;
-        if (normalized_power > 1) normalized_power = 1;
+    // Plot spectrum data: '#' up to the mean, ':' on up to the peak
+    for (int x = 0; x < viz_width; x++) {
+        uint64_t b0 = first_bin + span * x / viz_width;
+        uint64_t b1 = first_bin + span * (x + 1) / viz_width;
+        if (b1 <= b0) b1 = b0 + 1;
 
-        int y = viz_height - (int)(normalized_power * viz_height) - 1;
-        if (y < 0) y = 0;
+        pyramid_node_t column;
+        uint64_t count = pyramid_query(pyr, b0, b1, &column);
+        if (count == 0) {
+            continue;
+        }
 
-        // Draw the bar
-        for (int j = viz_height - 1; j >= y; j--) {
-            spectrum_viz[j][x] = '#';
+        int peak = power_to_height(column.max, viz_height);
+        int mean = power_to_height(column.sum / count, viz_height);
+        for (int h = 0; h < peak && h < viz_height; h++) {
+            spectrum_viz[viz_height - 1 - h][x] = h < mean ? '#' : ':';
         }
     }
 
     // Clear screen and position cursor at top
     printf("\033[2J\033[H");
 
-    // Draw frequency scale
-    printf("Frequency (MHz): %.1f", freqs[0]/1e6);
-    for (int i = 1; i < 8; i++) {
-        int idx = (i * n_points) / 8;
-        if (idx < n_points) {
-            int pos = (int)(((double)idx / n_points) * (viz_width - 12));
-            printf("%*s%.1f", pos, "", freqs[idx]/1e6);
-        }
+    // Draw frequency scale, eight labels across the plot
+    printf("Frequency (MHz):\n");
+    for (int x = 0; x < viz_width; x += viz_width / 8) {
+        printf("%-*.3f", viz_width / 8, (lo_freq + (hi_freq - lo_freq) * x / viz_width) / 1e6);
     }
     printf("\n");
 
@@ -176,8 +306,16 @@ int display_terminal_spectrum(uint32_t* freqs, double* powers, int n_points, uin
     }
 
     // Draw status line
-    printf("Scanning: Currently at %.2f MHz | Progress: %.1f%%\n",
-           current_freq/1e6, ((current_freq - freqs[0]) / (double)(freqs[n_points-1] - freqs[0])) * 100);
+    if (current_freq > 0) {
+        printf("Scanning: Currently at %.2f MHz | Progress: %.1f%%\n", current_freq/1e6,
+               hi_freq > lo_freq ? (current_freq - lo_freq) / (hi_freq - lo_freq) * 100 : 100.0);
+    } else {
+        pyramid_node_t all;
+        uint64_t count = pyramid_query(pyr, first_bin, end_bin, &all);
+        printf("%.3f-%.3f MHz, %llu bin(s) | '#' mean, ':' peak | Peak %.1f dB\n",
+               lo_freq/1e6, hi_freq/1e6, (unsigned long long)count,
+               count ? 10 * log10(all.max + 1e-10) : 0.0);
+    }
 
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,194 @@
+/**
+ * @file sdr_view.c
+ * @brief Zoomable viewer for spectrum scans
+ *
+ * Implements the sdr_view command which draws any frequency window of a
+ * spectrum log in the terminal, or exports it at a chosen width, using
+ * the min/max/mean pyramid saved by sdr_scan. Logs without a pyramid
+ * (older scans, sdr_analyze spectra) get one built from the CSV on
+ * first view.
+ */
+
+#include "sdr.h"
+
+// Build a pyramid from a Frequency,Power CSV, assuming uniform spacing
+static spectrum_pyramid_t *pyramid_from_csv(const char *path) {
+    FILE *file = fopen(path, "r");
+    if (!file) {
+        perror("Failed to open spectrum log");
+        return NULL;
+    }
+
+    spectrum_pyramid_t *pyr = NULL;
+    char line[256];
+    double first_freq = 0, first_power = 0, last_freq = 0, freq, power;
+    uint64_t rows = 0;
+    int ok = 1;
+
+    while (ok && fgets(line, sizeof(line), file)) {
+        if (sscanf(line, "%lf,%lf", &freq, &power) != 2) {
+            continue; // Header
+        }
+        if (rows == 0) {
+            // The step is only known once the second row arrives
+            first_freq = freq;
+            first_power = power;
+        } else {
+            if (rows == 1) {
+                pyr = pyramid_create(first_freq, freq - first_freq, 0);
+                ok = pyr && pyramid_append(pyr, first_power);
+            }
+            ok = ok && pyramid_append(pyr, power);
+        }
+        last_freq = freq;
+        rows++;
+    }
+    fclose(file);
+
+    if (rows == 1) {
+        pyr = pyramid_create(first_freq, 1, 0);
+        ok = pyr && pyramid_append(pyr, first_power);
+    }
+    if (!ok || rows == 0) {
+        if (rows == 0) fprintf(stderr, "sdr_view: %s has no spectrum rows\n", path);
+        pyramid_free(pyr);
+        return NULL;
+    }
+
+    // Spacing from the whole span; per-row frequencies may be rounded
+    if (rows > 2) {
+        pyr->step = (last_freq - first_freq) / (rows - 1);
+    }
+    return pyr;
+}
+
+// Load the saved pyramid of a log, building and saving it if missing or stale
+static spectrum_pyramid_t *open_pyramid(const char *path) {
+    size_t len = strlen(path);
+    if (len > 4 && strcmp(path + len - 4, ".pyr") == 0) {
+        spectrum_pyramid_t *pyr = pyramid_load(path);
+        if (!pyr) fprintf(stderr, "sdr_view: cannot read %s\n", path);
+        return pyr;
+    }
+
+    char pyr_path[PATH_MAX];
+    pyramid_path(path, pyr_path, sizeof(pyr_path));
+
+    struct stat csv_st, pyr_st;
+    if (stat(path, &csv_st) != 0) {
+        perror("Failed to open spectrum log");
+        return NULL;
+    }
+    if (stat(pyr_path, &pyr_st) == 0 && pyr_st.st_mtime >= csv_st.st_mtime) {
+        spectrum_pyramid_t *pyr = pyramid_load(pyr_path);
+        if (pyr) return pyr;
+    }
+
+    spectrum_pyramid_t *pyr = pyramid_from_csv(path);
+    if (pyr) {
+        pyramid_save(pyr, pyr_path);
+    }
+    return pyr;
+}
+
+// Write the window as width rows of min/max/mean
+static int export_window(const spectrum_pyramid_t *pyr, double lo, double hi, int width, const char *out_path) {
+    FILE *out = fopen(out_path, "w");
+    if (!out) {
+        perror("Failed to open export file");
+        return 0;
+    }
+
+    uint64_t first = pyramid_bin(pyr, lo);
+    uint64_t end = pyramid_bin(pyr, hi) + 1;
+    uint64_t span = end - first;
+
+    fprintf(out, "FrequencyStart,FrequencyEnd,Min,Max,Mean,Bins\n");
+    for (int x = 0; x < width; x++) {
+        uint64_t b0 = first + span * x / width;
+        uint64_t b1 = first + span * (x + 1) / width;
+        if (b1 <= b0) b1 = b0 + 1;
+
+        pyramid_node_t column;
+        uint64_t count = pyramid_query(pyr, b0, b1, &column);
+        if (count == 0) {
+            continue;
+        }
+        fprintf(out, "%.0f,%.0f,%.6f,%.6f,%.6f,%llu\n",
+                pyr->start_freq + b0 * pyr->step, pyr->start_freq + (b1 - 1) * pyr->step,
+                column.min, column.max, column.sum / count, (unsigned long long)count);
+    }
+
+    fclose(out);
+    return 1;
+}
+
+// Command to view or export a window of a spectrum scan
+int cmd_sdr_view(char **args) {
+    if (args[1] == NULL) {
+        fprintf(stderr, "Usage: sdr_view <spectrum log> [start_freq end_freq] [--export file] [--width N]\n");
+        last_exit_status = 1;
+        return 1;
+    }
+
+    const char *path = args[1];
+    double lo = 0, hi = 0;
+    const char *export_path = NULL;
+    int width = 80;
+    int n_freqs = 0;
+
+    for (int i = 2; args[i] != NULL; i++) {
+        if (strcmp(args[i], "--export") == 0 && args[i+1]) {
+            export_path = args[++i];
+        } else if (strcmp(args[i], "--width") == 0 && args[i+1]) {
+            width = atoi(args[++i]);
+        } else if (args[i][0] != '-' && n_freqs < 2) {
+            double f = parse_frequency(args[i]);
+            if (n_freqs++ == 0) lo = f; else hi = f;
+        } else {
+            fprintf(stderr, "sdr_view: unknown option %s\n", args[i]);
+            last_exit_status = 1;
+            return 1;
+        }
+    }
+    if (width < 1) {
+        fprintf(stderr, "sdr_view: width must be positive\n");
+        return 1;
+    }
+
+    spectrum_pyramid_t *pyr = open_pyramid(path);
+    if (!pyr) {
+        return 1;
+    }
+
+    // Default to, and clamp to, the scanned range
+    double first_freq = pyr->start_freq;
+    double last_freq = pyr->start_freq + (pyr->n_bins - 1) * pyr->step;
+    if (n_freqs < 2) {
+        lo = first_freq;
+        hi = last_freq;
+    }
+    if (lo > hi) {
+        double t = lo; lo = hi; hi = t;
+    }
+    if (lo < first_freq) lo = first_freq;
+    if (hi > last_freq) hi = last_freq;
+
+    struct timespec t_start, t_end;
+    clock_gettime(CLOCK_MONOTONIC, &t_start);
+
+    if (export_path) {
+        if (export_window(pyr, lo, hi, width, export_path)) {
+            printf("Exported %.3f-%.3f MHz as %d column(s) to %s\n", lo/1e6, hi/1e6, width, export_path);
+        }
+    } else {
+        display_terminal_spectrum(pyr, lo, hi, 0);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t_end);
+    printf("Rendered from %llu bin(s) in %.0f us\n", (unsigned long long)pyr->n_bins,
+           (t_end.tv_sec - t_start.tv_sec) * 1e6 + (t_end.tv_nsec - t_start.tv_nsec) / 1e3);
+
+    pyramid_free(pyr);
+    return 1;
+}
@@ -0,0 +1,258 @@
+/**
+ * @file sdr_workers.c
+ * @brief Work-stealing thread pool
+ *
+ * A small fixed-size pool for fanning independent tasks out across all
+ * cores. Every worker owns a deque: it pops its own newest task first
+ * and, when it runs dry, steals the oldest task from another worker.
+ * Tasks submitted from outside the pool are dealt round-robin.
+ */
+
+#include "sdr.h"
+
+// Index of the pool worker running on this thread, -1 elsewhere
+static __thread int worker_index = -1;
+static __thread work_pool_t *worker_pool = NULL;
+
+// Push onto the owner's end of a deque, growing it as needed
+static int deque_push(work_deque_t *dq, work_fn fn, void *arg) {
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count == dq->capacity) {
+        int capacity = dq->capacity ? dq->capacity * 2 : 64;
+        work_item_t *items = malloc(sizeof(work_item_t) * capacity);
+        if (!items) {
+            pthread_mutex_unlock(&dq->lock);
+            return 0;
+        }
+        // Unwrap the ring into the new array
+        for (int i = 0; i < dq->count; i++) {
+            items[i] = dq->items[(dq->head + i) % dq->capacity];
+        }
+        free(dq->items);
+        dq->items = items;
+        dq->capacity = capacity;
+        dq->head = 0;
+    }
+    dq->items[(dq->head + dq->count) % dq->capacity] = (work_item_t){fn, arg};
+    dq->count++;
+    pthread_mutex_unlock(&dq->lock);
+    return 1;
+}
+
+// Take from the owner's end (newest first, best cache locality)
+static int deque_pop(work_deque_t *dq, work_item_t *out) {
+    int found = 0;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0) {
+        dq->count--;
+        *out = dq->items[(dq->head + dq->count) % dq->capacity];
+        found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+// Take from the far end (oldest first) on behalf of another worker
+static int deque_steal(work_deque_t *dq, work_item_t *out) {
+    int found = 0;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0) {
+        *out = dq->items[dq->head];
+        dq->head = (dq->head + 1) % dq->capacity;
+        dq->count--;
+        found = 1;
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return found;
+}
+
+// Find the next task for worker self: own deque first, then steal
+static int pool_find_work(work_pool_t *pool, int self, work_item_t *out) {
+    if (deque_pop(&pool->deques[self], out)) {
+        return 1;
+    }
+    for (int i = 1; i < pool->n_workers; i++) {
+        int victim = (self + i) % pool->n_workers;
+        if (deque_steal(&pool->deques[victim], out)) {
+            __atomic_fetch_add(&pool->steals, 1, __ATOMIC_RELAXED);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+// Run one task and account for its completion
+static void pool_run(work_pool_t *pool, work_item_t *item) {
+    item->fn(item->arg);
+
+    pthread_mutex_lock(&pool->lock);
+    if (--pool->pending == 0) {
+        pthread_cond_broadcast(&pool->done_cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void *worker_main(void *arg) {
+    work_pool_t *pool = ((work_worker_arg_t *)arg)->pool;
+    int self = ((work_worker_arg_t *)arg)->index;
+    worker_index = self;
+    worker_pool = pool;
+
+    while (1) {
+        // Note the submission count before looking, so a task queued
+        // while we search is never slept through
+        pthread_mutex_lock(&pool->lock);
+        uint64_t seen = pool->queued;
+        pthread_mutex_unlock(&pool->lock);
+
+        work_item_t item;
+        if (pool_find_work(pool, self, &item)) {
+            pool_run(pool, &item);
+            continue;
+        }
+
+        // Nothing anywhere; sleep until something is submitted
+        pthread_mutex_lock(&pool->lock);
+        while (pool->queued == seen && !pool->stopping) {
+            pthread_cond_wait(&pool->work_cond, &pool->lock);
+        }
+        int stopping = pool->stopping && pool->queued == seen;
+        pthread_mutex_unlock(&pool->lock);
+
+        if (stopping) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+// Start a pool; n_workers <= 0 means one worker per online core
+work_pool_t *work_pool_create(int n_workers) {
+    if (n_workers <= 0) {
+        n_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+        if (n_workers < 1) n_workers = 1;
+    }
+
+    work_pool_t *pool = calloc(1, sizeof(work_pool_t));
+    if (!pool) {
+        perror("Failed to allocate thread pool");
+        return NULL;
+    }
+
+    pool->n_workers = n_workers;
+    pool->deques = calloc(n_workers, sizeof(work_deque_t));
+    pool->threads = calloc(n_workers, sizeof(pthread_t));
+    pool->args = calloc(n_workers, sizeof(work_worker_arg_t));
+    if (!pool->deques || !pool->threads || !pool->args) {
+        perror("Failed to allocate thread pool");
+        free(pool->deques);
+        free(pool->threads);
+        free(pool->args);
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work_cond, NULL);
+    pthread_cond_init(&pool->done_cond, NULL);
+
+    for (int i = 0; i < n_workers; i++) {
+        pthread_mutex_init(&pool->deques[i].lock, NULL);
+        pool->args[i].pool = pool;
+        pool->args[i].index = i;
+    }
+    for (int i = 0; i < n_workers; i++) {
+        int err = pthread_create(&pool->threads[i], NULL, worker_main, &pool->args[i]);
+        if (err != 0) {
+            // Tasks queued to a worker that never started would never finish
+            fprintf(stderr, "Failed to start worker thread: %s\n", strerror(err));
+            pthread_mutex_lock(&pool->lock);
+            pool->stopping = 1;
+            pthread_cond_broadcast(&pool->work_cond);
+            pthread_mutex_unlock(&pool->lock);
+            for (int j = 0; j < i; j++) {
+                pthread_join(pool->threads[j], NULL);
+            }
+            for (int j = 0; j < n_workers; j++) {
+                pthread_mutex_destroy(&pool->deques[j].lock);
+            }
+            pthread_cond_destroy(&pool->done_cond);
+            pthread_cond_destroy(&pool->work_cond);
+            pthread_mutex_destroy(&pool->lock);
+            free(pool->args);
+            free(pool->threads);
+            free(pool->deques);
+            free(pool);
+            return NULL;
+        }
+    }
+
+    return pool;
+}
+
+// Queue a task; safe to call from inside a task
+int work_pool_submit(work_pool_t *pool, work_fn fn, void *arg) {
+    int target;
+    if (worker_pool == pool && worker_index >= 0) {
+        target = worker_index;
+    } else {
+        target = pool->next_target;
+        pool->next_target = (pool->next_target + 1) % pool->n_workers;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->pending++;
+    pthread_mutex_unlock(&pool->lock);
+
+    if (!deque_push(&pool->deques[target], fn, arg)) {
+        perror("Failed to queue task");
+        pthread_mutex_lock(&pool->lock);
+        pool->pending--;
+        pthread_mutex_unlock(&pool->lock);
+        return 0;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    pool->queued++;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+    return 1;
+}
+
+// Block until every submitted task has finished
+void work_pool_wait(work_pool_t *pool) {
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->done_cond, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+// Finish outstanding work, stop the workers and free the pool
+void work_pool_destroy(work_pool_t *pool) {
+    if (!pool) {
+        return;
+    }
+
+    work_pool_wait(pool);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->work_cond);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->n_workers; i++) {
+        pthread_join(pool->threads[i], NULL);
+        pthread_mutex_destroy(&pool->deques[i].lock);
+        free(pool->deques[i].items);
+    }
+
+    pthread_cond_destroy(&pool->done_cond);
+    pthread_cond_destroy(&pool->work_cond);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool->args);
+    free(pool->threads);
+    free(pool->deques);
+    free(pool);
+}
@@ -0,0 +1,186 @@
+/**
+ * @file alias.c
+ * @brief Alias table
+ *
+ * Aliases are kept in a dense array in definition order, which is what
+ * `alias` lists and what the config file stores, plus an open-addressing
+ * hash index over that array. Lookups, additions and removals are
+ * constant time however many aliases are loaded; removed entries leave
+ * a hole that is squeezed out once holes outnumber live aliases.
+ */
+
+#include "shell.h"
+
+#define ALIAS_INDEX_EMPTY 0
+#define ALIAS_INDEX_DELETED -1
+
+alias_table_t aliases = {0};
+
+static uint64_t alias_hash(const char *name) {
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Slot of name in the index, or the slot where it would be inserted
+static int alias_slot(const char *name, int *found) {
+    int mask = aliases.index_size - 1;
+    int slot = alias_hash(name) & mask;
+    int insert_at = -1;
+
+    *found = 0;
+    while (1) {
+        int32_t entry = aliases.index[slot];
+        if (entry == ALIAS_INDEX_EMPTY) {
+            return insert_at >= 0 ? insert_at : slot;
+        }
+        if (entry == ALIAS_INDEX_DELETED) {
+            if (insert_at < 0) insert_at = slot;
+        } else if (strcmp(aliases.entries[entry - 1].name, name) == 0) {
+            *found = 1;
+            return slot;
+        }
+        slot = (slot + 1) & mask;
+    }
+}
+
+// Rebuild the index (and squeeze out removed entries) at a new size
+static int alias_rehash(int index_size) {
+    int32_t *index = calloc(index_size, sizeof(int32_t));
+    if (!index) {
+        perror("malloc error");
+        return 0;
+    }
+
+    int live = 0;
+    for (int i = 0; i < aliases.count; i++) {
+        if (aliases.entries[i].name) {
+            aliases.entries[live++] = aliases.entries[i];
+        }
+    }
+    aliases.count = live;
+
+    free(aliases.index);
+    aliases.index = index;
+    aliases.index_size = index_size;
+    aliases.index_used = live;
+
+    int mask = index_size - 1;
+    for (int i = 0; i < live; i++) {
+        int slot = alias_hash(aliases.entries[i].name) & mask;
+        while (index[slot] != ALIAS_INDEX_EMPTY) {
+            slot = (slot + 1) & mask;
+        }
+        index[slot] = i + 1;
+    }
+    return 1;
+}
+
+// Find an alias by name
+alias_t *alias_find(const char *name) {
+    if (aliases.live == 0) {
+        return NULL;
+    }
+    int found;
+    int slot = alias_slot(name, &found);
+    return found ? &aliases.entries[aliases.index[slot] - 1] : NULL;
+}
+
+int alias_exists(const char *name) {
+    return alias_find(name) != NULL;
+}
+
+// Define or redefine an alias; returns 0 on allocation failure
+int alias_set(const char *name, const char *value) {
+    alias_t *existing = alias_find(name);
+    if (existing) {
+        char *copy = strdup(value);
+        if (!copy) {
+            perror("malloc error");
+            return 0;
+        }
+        free(existing->value);
+        existing->value = copy;
+        return 1;
+    }
+
+    // Keep the index at most half full, counting deleted slots
+    if (aliases.index_size == 0 || (aliases.index_used + 1) * 2 > aliases.index_size) {
+        int size = aliases.index_size ? aliases.index_size : 64;
+        while ((aliases.live + 1) * 2 > size) {
+            size *= 2;
+        }
+        if (!alias_rehash(size)) {
+            return 0;
+        }
+    }
+
+    if (aliases.count == aliases.capacity) {
+        int capacity = aliases.capacity ? aliases.capacity * 2 : 32;
+        alias_t *entries = realloc(aliases.entries, capacity * sizeof(alias_t));
+        if (!entries) {
+            perror("malloc error");
+            return 0;
+        }
+        aliases.entries = entries;
+        aliases.capacity = capacity;
+    }
+
+    alias_t *entry = &aliases.entries[aliases.count];
+    entry->name = strdup(name);
+    entry->value = strdup(value);
+    if (!entry->name || !entry->value) {
+        perror("malloc error");
+        free(entry->name);
+        free(entry->value);
+        return 0;
+    }
+
+    int found;
+    int slot = alias_slot(name, &found);
+    if (aliases.index[slot] == ALIAS_INDEX_EMPTY) {
+        aliases.index_used++;
+    }
+    aliases.index[slot] = ++aliases.count;
+    aliases.live++;
+    return 1;
+}
+
+// Remove an alias; returns 0 if there was none
+int alias_remove(const char *name) {
+    if (aliases.live == 0) {
+        return 0;
+    }
+    int found;
+    int slot = alias_slot(name, &found);
+    if (!found) {
+        return 0;
+    }
+
+    alias_t *entry = &aliases.entries[aliases.index[slot] - 1];
+    free(entry->name);
+    free(entry->value);
+    entry->name = entry->value = NULL;
+    aliases.index[slot] = ALIAS_INDEX_DELETED;
+    aliases.live--;
+
+    // Compact once holes outnumber the live entries
+    if (aliases.count - aliases.live > aliases.live) {
+        alias_rehash(aliases.index_size);
+    }
+    return 1;
+}
+
+// Remove every alias and release the table
+void alias_clear() {
+    for (int i = 0; i < aliases.count; i++) {
+        free(aliases.entries[i].name);
+        free(aliases.entries[i].value);
+    }
+    free(aliases.entries);
+    free(aliases.index);
+    memset(&aliases, 0, sizeof(aliases));
+}
@@ -5,12 +5,28 @@
  * Manages the shell's configuration file (.myshell_config) in the user's
  * home directory. Handles loading and saving aliases, creating default
  * configurations.
+ *
+ * Alias changes are not written to the config file directly. Each one is
+ * appended as a single line to .myshell_config.journal, and the journal
+ * is folded back into the config file once it outgrows the alias table
+ * (or at exit) by writing a temporary file and renaming it into place.
+ * A crash therefore leaves either the old or the new config file, plus
+ * at most a torn last journal line, which is ignored when replaying.
  */
 
 #include "shell.h"
+#include <fcntl.h>
+#include <errno.h>
 
 // Configuration file path (in user's home directory)
 #define CONFIG_FILE_NAME ".myshell_config"
+#define CONFIG_JOURNAL_SUFFIX ".journal"
+
+// Journal records tolerated before compaction, on top of the alias count
+#define CONFIG_JOURNAL_SLACK 64
+
+static int journal_records = 0;
+static int config_loaded = 0;
 
 // Get path to config file
 char* get_config_file_path() {
@@ -30,16 +46,6 @@ char* get_config_file_path() {
     return config_path;
 }
 
-// Check if an alias already exists
-int alias_exists(const char* name) {
-    for (int i = 0; i < alias_count; i++) {
-        if (strcmp(aliases[i].name, name) == 0) {
-            return 1; // Alias exists
-        }
-    }
-    return 0; // Alias doesn't exist
-}
-
 // Initialize the config file
 int initialize_config_file() {
     char* config_path = get_config_file_path();
@@ -81,99 +87,224 @@ int initialize_config_file() {
     return 1;
 }
 
-// Load aliases from config file
-int load_aliases_from_config() {
-    char* config_path = get_config_file_path();
-    if (!config_path) {
-        return 0;
+// Path of the journal next to the config file; caller frees
+static char* get_journal_file_path(const char* config_path) {
+    char* journal_path = malloc(strlen(config_path) + sizeof(CONFIG_JOURNAL_SUFFIX));
+    if (!journal_path) {
+        perror("malloc error");
+        return NULL;
     }
+    sprintf(journal_path, "%s%s", config_path, CONFIG_JOURNAL_SUFFIX);
+    return journal_path;
+}
 
-    FILE* config_file = fopen(config_path, "r");
-    if (!config_file) {
-        // It's okay if the file doesn't exist yet
-        free(config_path);
+// Read a whole file with one read; returns a NUL terminated buffer or
+// NULL if the file does not exist
+static char* read_whole_file(const char* path, size_t* length) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return NULL;
+    }
+
+    char* buffer = malloc(st.st_size + 1);
+    if (!buffer) {
+        perror("malloc error");
+        close(fd);
+        return NULL;
+    }
+
+    // Short reads only happen if the file is changing underneath us
+    size_t total = 0;
+    while (total < (size_t)st.st_size) {
+        ssize_t n = read(fd, buffer + total, st.st_size - total);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) break;
+        total += n;
+    }
+    close(fd);
+
+    buffer[total] = '\0';
+    *length = total;
+    return buffer;
+}
+
+// Apply one config or journal line: "alias name='value'" or "unalias name"
+static int apply_config_line(char* line) {
+    // Skip empty lines and comments
+    if (line[0] == '\0' || line[0] == '#') {
         return 1;
     }
 
-    char line[MAX_COMMAND_LENGTH];
-    while (fgets(line, sizeof(line), config_file)) {
-        // Remove newline
-        size_t len = strlen(line);
-        if (len > 0 && line[len-1] == '\n') {
-            line[len-1] = '\0';
-        }
+    if (strncmp(line, "unalias ", 8) == 0) {
+        alias_remove(line + 8);
+        return 1;
+    }
 
-        // Skip empty lines and comments
-        if (line[0] == '\0' || line[0] == '#') {
-            continue;
-        }
+    // Check if line starts with "alias "
+    if (strncmp(line, "alias ", 6) != 0) {
+        return 1;
+    }
 
-        // Check if line starts with "alias "
-        if (strncmp(line, "alias ", 6) == 0) {
-            // We have an alias definition
-            char* alias_def = line + 6; // Skip "alias " prefix
+    // We have an alias definition
+    char* alias_def = line + 6; // Skip "alias " prefix
 
-            // Look for the first '=' character
-            char* equals = strchr(alias_def, '=');
-            if (!equals) {
-                continue; // Invalid format, skip line
-            }
+    // Look for the first '=' character
+    char* equals = strchr(alias_def, '=');
+    if (!equals) {
+        return 1; // Invalid format, skip line
+    }
 
-            // Split the string at '='
-            *equals = '\0';
-            char* name = alias_def;
-            char* value = equals + 1;
+    // Split the string at '='
+    *equals = '\0';
+    char* name = alias_def;
+    char* value = equals + 1;
 
-            // Remove quotes from value if present
-            if (value[0] == '\'' || value[0] == '"') {
-                value++;
+    // Remove quotes from value if present
+    if (value[0] == '\'' || value[0] == '"') {
+        value++;
 
-                // Find the closing quote
-                char* end = value + strlen(value) - 1;
-                if (*end == '\'' || *end == '"') {
-                    *end = '\0';
-                }
-            }
+        // Find the closing quote
+        size_t len = strlen(value);
+        if (len > 0 && (value[len - 1] == '\'' || value[len - 1] == '"')) {
+            value[len - 1] = '\0';
+        }
+    }
 
-            // Check if this alias already exists
-            int exists = 0;
-            for (int i = 0; i < alias_count; i++) {
-                if (strcmp(aliases[i].name, name) == 0) {
-                    // Update existing alias
-                    free(aliases[i].value);
-                    aliases[i].value = strdup(value);
-                    exists = 1;
-                    break;
-                }
-            }
+    // Add the alias, or update it if it already exists
+    return alias_set(name, value);
+}
+
+// Apply every line of a file read in one go. A journal's last line is
+// only complete if it ends in a newline; anything after it was torn by
+// a crash mid-append and is dropped.
+static int apply_config_file(const char* path, int is_journal) {
+    size_t length;
+    char* buffer = read_whole_file(path, &length);
+    if (!buffer) {
+        // It's okay if the file doesn't exist yet
+        return 0;
+    }
 
-            // Add alias to the list if it doesn't exist
-            if (!exists && alias_count < MAX_ALIASES) {
-                aliases[alias_count].name = strdup(name);
-                aliases[alias_count].value = strdup(value);
-                alias_count++;
-            } else if (!exists) {
-                fprintf(stderr, "Maximum number of aliases reached\n");
+    int records = 0;
+    char* line = buffer;
+    char* end = buffer + length;
+    while (line < end) {
+        char* newline = memchr(line, '\n', end - line);
+        if (!newline) {
+            if (is_journal) {
                 break;
             }
+            newline = end;
         }
+        *newline = '\0';
+        if (!apply_config_line(line)) {
+            break;
+        }
+        records++;
+        line = newline + 1;
+    }
+
+    free(buffer);
+    return records;
+}
+
+// Load aliases from the config file, then replay the journal over them
+int load_aliases_from_config() {
+    char* config_path = get_config_file_path();
+    if (!config_path) {
+        return 0;
+    }
+
+    apply_config_file(config_path, 0);
+
+    char* journal_path = get_journal_file_path(config_path);
+    if (journal_path) {
+        journal_records = apply_config_file(journal_path, 1);
+        free(journal_path);
     }
 
-    fclose(config_file);
     free(config_path);
     return 1;
 }
 
-// Save aliases to config file
+// Append one record to the journal with a single O_APPEND write
+static int journal_append(const char* record, size_t length) {
+    char* config_path = get_config_file_path();
+    if (!config_path) {
+        return 0;
+    }
+    char* journal_path = get_journal_file_path(config_path);
+    free(config_path);
+    if (!journal_path) {
+        return 0;
+    }
+
+    int fd = open(journal_path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    free(journal_path);
+    if (fd < 0) {
+        perror("Error opening alias journal");
+        return 0;
+    }
+
+    ssize_t written;
+    do {
+        written = write(fd, record, length);
+    } while (written < 0 && errno == EINTR);
+    close(fd);
+
+    if (written != (ssize_t)length) {
+        perror("Error writing alias journal");
+        return 0;
+    }
+
+    // Fold the journal back in once replaying it would cost more than
+    // rewriting the config, so appends stay amortised O(1)
+    if (++journal_records > aliases.live + CONFIG_JOURNAL_SLACK) {
+        return save_aliases_to_config();
+    }
+    return 1;
+}
+
+// Record a new or changed alias
+int journal_alias_set(const char* name, const char* value) {
+    size_t length = strlen(name) + strlen(value) + sizeof("alias =''\n");
+    char record[length];
+    snprintf(record, length, "alias %s='%s'\n", name, value);
+    return journal_append(record, length - 1);
+}
+
+// Record a removed alias
+int journal_alias_remove(const char* name) {
+    size_t length = strlen(name) + sizeof("unalias \n");
+    char record[length];
+    snprintf(record, length, "unalias %s\n", name);
+    return journal_append(record, length - 1);
+}
+
+// Compact the aliases into the config file: write a temporary file,
+// fsync it, rename it over the config and only then drop the journal.
+// Replaying a stale journal over the new config gives the same aliases,
+// so a crash between the two steps is harmless.
 int save_aliases_to_config() {
     char* config_path = get_config_file_path();
     if (!config_path) {
         return 0;
     }
 
-    FILE* config_file = fopen(config_path, "w");
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", config_path);
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    FILE* config_file = fd >= 0 ? fdopen(fd, "w") : NULL;
     if (!config_file) {
         perror("Error opening config file for writing");
+        if (fd >= 0) close(fd);
         free(config_path);
         return 0;
     }
@@ -184,13 +315,50 @@ int save_aliases_to_config() {
 
     // Write aliases section
     fprintf(config_file, "# Aliases\n");
-    for (int i = 0; i < alias_count; i++) {
-        fprintf(config_file, "alias %s='%s'\n", aliases[i].name, aliases[i].value);
+    for (int i = 0; i < aliases.count; i++) {
+        if (aliases.entries[i].name) {
+            fprintf(config_file, "alias %s='%s'\n", aliases.entries[i].name, aliases.entries[i].value);
+        }
     }
 
     // Future config sections can be added here
 
-    fclose(config_file);
+    int ok = fflush(config_file) == 0 && fsync(fileno(config_file)) == 0;
+    if (fclose(config_file) != 0 || !ok || rename(tmp_path, config_path) != 0) {
+        perror("Error saving config file");
+        unlink(tmp_path);
+        free(config_path);
+        return 0;
+    }
+
+    char* journal_path = get_journal_file_path(config_path);
+    if (journal_path) {
+        unlink(journal_path);
+        free(journal_path);
+    }
+    journal_records = 0;
+
     free(config_path);
     return 1;
-}
\ No newline at end of file
+}
+
+// Compact at exit only if something was journaled
+int flush_alias_journal() {
+    return journal_records > 0 ? save_aliases_to_config() : 1;
+}
+
+// Set up the default aliases and load the config file and journal, once,
+// at startup
+void load_shell_config() {
+    if (config_loaded) {
+        return;
+    }
+    config_loaded = 1;
+
+    // Initialize default aliases
+    alias_set("ls", "ls --color=auto");
+    alias_set("congq", "nc localhost 7356");
+
+    // Load config file
+    load_aliases_from_config();
+}
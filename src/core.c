@@ -7,7 +7,7 @@
  * - Parsing commands into arguments
  * - Executing commands with fork/exec
  * - Environment variable expansion
- * - Alias substitution
+ * - Alias substitution and built-in dispatch
  */
 
 #include "shell.h"
@@ -30,10 +30,10 @@ char* read_command() {
             username, cwd);
     char* command = readline(prompt);
 
-    // If EOF, handle it
+    // On EOF the caller leaves the loop and exits normally
     if (!command) {
         printf("\n");
-        exit(EXIT_SUCCESS);
+        return NULL;
     }
 
     // Add non-empty commands to history
@@ -44,155 +44,430 @@ char* read_command() {
     return command;
 }
 
-// Parse the command into arguments
-char** parse_command(char* command) {
-    char** args = malloc((MAX_ARGS + 1) * sizeof(char*));
-    if (!args) {
+// Every argument vector lives in one block: the token text, NUL separated,
+// followed by the argv array. args[-1] points back at the block so
+// free_args is a single free, and the last block is kept for reuse.
+typedef struct {
+    size_t capacity;              // Bytes available after the header
+} arg_block_t;
+
+// Operator tokens are these exact strings, so a quoted "|" or ">" on the
+// command line stays an ordinary word
+char shell_op_pipe[] = "|";
+char shell_op_input[] = "<";
+char shell_op_output[] = ">";
+char shell_op_append[] = ">>";
+
+// While parsing, each token's text starts with one of these tags
+enum { TOKEN_WORD = 1, TOKEN_PIPE, TOKEN_INPUT, TOKEN_OUTPUT, TOKEN_APPEND };
+
+static char *const operator_tokens[] = {
+    [TOKEN_PIPE] = shell_op_pipe,
+    [TOKEN_INPUT] = shell_op_input,
+    [TOKEN_OUTPUT] = shell_op_output,
+    [TOKEN_APPEND] = shell_op_append,
+};
+
+// Worst-case text for n bytes of line: a one-character word costs a tag,
+// the character and a NUL
+#define TOKEN_TEXT_BOUND(n) (3 * (n) + 1)
+
+// Open a word token once something has been produced for it, so an
+// unquoted expansion that comes out empty leaves no argument behind
+static inline void word_begin(char *text, size_t *used, int *in_token) {
+    if (!*in_token) {
+        text[(*used)++] = TOKEN_WORD;
+        *in_token = 1;
+    }
+}
+
+int is_shell_operator(const char *token) {
+    return token == shell_op_pipe || token == shell_op_input ||
+           token == shell_op_output || token == shell_op_append;
+}
+
+static arg_block_t *spare_block = NULL;
+
+// Exit status of the last command, as $? and the shell's own exit status
+__thread int last_exit_status = 0;
+
+// Make room for n more bytes after used, moving the block if needed
+static arg_block_t *arg_block_reserve(arg_block_t *block, size_t used, size_t n) {
+    if (used + n <= block->capacity) {
+        return block;
+    }
+    size_t capacity = block->capacity * 2;
+    while (capacity < used + n) {
+        capacity *= 2;
+    }
+    arg_block_t *grown = realloc(block, sizeof(arg_block_t) + capacity);
+    if (!grown) {
         perror("malloc error");
         exit(EXIT_FAILURE);
     }
+    grown->capacity = capacity;
+    return grown;
+}
+
+// Length of the variable name at s: NAME or {NAME}; 0 if none
+static size_t var_name_length(const char *s, int braced) {
+    size_t n = 0;
+    if (isalpha((unsigned char)s[0]) || s[0] == '_') {
+        while (isalnum((unsigned char)s[n]) || s[n] == '_') n++;
+    }
+    if (braced && (n == 0 || s[n] != '}')) {
+        return 0;
+    }
+    return n;
+}
 
-    int position = 0;
-    int i = 0;
-    int in_quotes = 0;
-    char current_arg[MAX_COMMAND_LENGTH] = {0};
-    int arg_pos = 0;
+// Parse the command into arguments in a single pass. Handles double and
+// single quotes, backslash escapes, $NAME / ${NAME} / $? expansion and the
+// unquoted operators | < > >>, which come back as the shell_op_* strings;
+// there is no limit on the number or length of arguments.
+char** parse_command(const char* command) {
+    size_t len = strlen(command);
 
-    while (command[i] != '\0' && position < MAX_ARGS) {
-        // Handle quotes
-        if (command[i] == '"') {
-            in_quotes = !in_quotes;
-            i++;
+    arg_block_t *block = spare_block;
+    spare_block = NULL;
+    if (!block) {
+        block = malloc(sizeof(arg_block_t) + 256);
+        if (!block) {
+            perror("malloc error");
+            exit(EXIT_FAILURE);
+        }
+        block->capacity = 256;
+    }
+    // Text never needs more than the bound for the line plus expansions
+    block = arg_block_reserve(block, 0, TOKEN_TEXT_BOUND(len));
+
+    size_t used = 0;      // Bytes of token text written
+    int argc = 0;
+    int in_token = 0;     // Word tag written; quotes start a token even if it stays empty
+    char quote = 0;       // Active quote character, if any
+    char *text = (char *)(block + 1);
+
+    for (size_t i = 0; i < len; i++) {
+        char c = command[i];
+
+        if (!quote && (c == ' ' || c == '\t' || c == '\n')) {
+            if (in_token) {
+                text[used++] = '\0';
+                argc++;
+                in_token = 0;
+            }
             continue;
         }
 
-        // If space and not in quotes, end current argument
-        if (command[i] == ' ' && !in_quotes) {
-            if (arg_pos > 0) {
-                current_arg[arg_pos] = '\0';
-                args[position] = strdup(current_arg);
-                position++;
-                arg_pos = 0;
+        if (!quote && (c == '|' || c == '<' || c == '>')) {
+            if (in_token) {
+                text[used++] = '\0';
+                argc++;
+                in_token = 0;
             }
-        } else {
-            // Handle environment variables
-            if (command[i] == '$' && command[i+1] != '\0' && command[i+1] != ' ') {
+            if (c == '|') {
+                text[used++] = TOKEN_PIPE;
+            } else if (c == '<') {
+                text[used++] = TOKEN_INPUT;
+            } else if (i + 1 < len && command[i + 1] == '>') {
+                text[used++] = TOKEN_APPEND;
                 i++;
-                char var_name[MAX_COMMAND_LENGTH];
-                int var_pos = 0;
+            } else {
+                text[used++] = TOKEN_OUTPUT;
+            }
+            text[used++] = '\0';
+            argc++;
+            continue;
+        }
 
-                // Extract variable name
-                while (command[i] != '\0' && command[i] != ' ' && command[i] != '"' && var_pos < MAX_COMMAND_LENGTH - 1) {
-                    var_name[var_pos++] = command[i++];
-                }
-                var_name[var_pos] = '\0';
-
-                // Get environment variable value
-                char* var_value = getenv(var_name);
-                if (var_value) {
-                    // Append variable value to current argument
-                    int j = 0;
-                    while (var_value[j] != '\0' && arg_pos < MAX_COMMAND_LENGTH - 1) {
-                        current_arg[arg_pos++] = var_value[j++];
-                    }
+        if (quote == '\'') {
+            if (c == '\'') {
+                quote = 0;
+            } else {
+                text[used++] = c;
+            }
+            continue;
+        }
+
+        if (c == '"') {
+            word_begin(text, &used, &in_token);
+            quote = quote ? 0 : '"';
+            continue;
+        }
+        if (c == '\'' && !quote) {
+            word_begin(text, &used, &in_token);
+            quote = '\'';
+            continue;
+        }
+
+        if (c == '\\' && i + 1 < len) {
+            // Inside double quotes only \" \\ and \$ are escapes
+            char next = command[i + 1];
+            if (!quote || next == '"' || next == '\\' || next == '$') {
+                word_begin(text, &used, &in_token);
+                text[used++] = next;
+                i++;
+                continue;
+            }
+        }
+
+        if (c == '$' && command[i + 1] == '?') {
+            block = arg_block_reserve(block, used, 13 + TOKEN_TEXT_BOUND(len - i));
+            text = (char *)(block + 1);
+            word_begin(text, &used, &in_token);
+            used += sprintf(text + used, "%d", last_exit_status);
+            i++;
+            continue;
+        }
+
+        if (c == '$') {
+            int braced = command[i + 1] == '{';
+            const char *name = command + i + 1 + braced;
+            size_t name_len = var_name_length(name, braced);
+            if (name_len > 0) {
+                char var_name[name_len + 1];
+                memcpy(var_name, name, name_len);
+                var_name[name_len] = '\0';
+
+                const char *value = getenv(var_name);
+                if (value && *value) {
+                    // Room for the word tag, the value and whatever the
+                    // rest of the line can still produce
+                    size_t value_len = strlen(value);
+                    block = arg_block_reserve(block, used, 1 + value_len + TOKEN_TEXT_BOUND(len - i));
+                    text = (char *)(block + 1);
+                    word_begin(text, &used, &in_token);
+                    memcpy(text + used, value, value_len);
+                    used += value_len;
                 }
+                i += name_len + 2 * braced;
                 continue;
-            } else {
-                // Add character to current argument
-                current_arg[arg_pos++] = command[i];
             }
         }
-        i++;
-    }
 
-    // Add the last argument if there is one
-    if (arg_pos > 0) {
-        current_arg[arg_pos] = '\0';
-        args[position] = strdup(current_arg);
-        position++;
+        word_begin(text, &used, &in_token);
+        text[used++] = c;
+    }
+    if (in_token) {
+        text[used++] = '\0';
+        argc++;
     }
 
-    args[position] = NULL;  // Null-terminate the arguments array
+    // The argv array follows the text, pointer aligned, with the block
+    // address in the slot before args[0]
+    size_t args_offset = (sizeof(arg_block_t) + used + sizeof(char *) - 1) / sizeof(char *) * sizeof(char *)
+                         - sizeof(arg_block_t);
+    block = arg_block_reserve(block, args_offset, (argc + 2) * sizeof(char *));
+    text = (char *)(block + 1);
+
+    char **slots = (char **)(text + args_offset);
+    slots[0] = (char *)block;
+    char **args = slots + 1;
+    char *token = text;
+    for (int a = 0; a < argc; a++) {
+        char tag = *token++;
+        if (tag == TOKEN_WORD) {
+            args[a] = token;
+            token += strlen(token) + 1;
+        } else {
+            args[a] = operator_tokens[(int)tag];
+            token++;
+        }
+    }
+    args[argc] = NULL;
     return args;
 }
 
-// Update free_args to free individual strings
+// Record a wait status from spawn_command / wait_processes as $?:
+// the exit code, 128 + signal, or 127 if nothing could be started
+void set_exit_status(int wait_status) {
+    if (wait_status < 0) {
+        last_exit_status = 127;
+    } else if (WIFEXITED(wait_status)) {
+        last_exit_status = WEXITSTATUS(wait_status);
+    } else if (WIFSIGNALED(wait_status)) {
+        last_exit_status = 128 + WTERMSIG(wait_status);
+    }
+}
+
+// Release an argument vector from parse_command
 void free_args(char** args) {
     if (!args) return;
 
-    for (int i = 0; args[i] != NULL; i++) {
-        free(args[i]);  // Free each string
+    // Keep the larger block around for the next command line
+    arg_block_t *block = (arg_block_t *)args[-1];
+    if (!spare_block || block->capacity > spare_block->capacity) {
+        free(spare_block);
+        spare_block = block;
+    } else {
+        free(block);
     }
-    free(args);  // Free the array
 }
 
-// Execute the command
-int execute_command(char** args) {
+// Build a new argument vector from head followed by tail; operator
+// tokens are carried over as the same shell_op_* pointers
+static char **concat_args(char **head, char **tail) {
+    size_t text = 0;
+    int argc = 0;
+    for (char **a = head; *a; a++, argc++) text += strlen(*a) + 1;
+    for (char **a = tail; *a; a++, argc++) text += strlen(*a) + 1;
+
+    size_t args_offset = (sizeof(arg_block_t) + text + sizeof(char *) - 1) / sizeof(char *) * sizeof(char *)
+                         - sizeof(arg_block_t);
+    size_t needed = args_offset + (argc + 2) * sizeof(char *);
+    arg_block_t *block = malloc(sizeof(arg_block_t) + needed);
+    if (!block) {
+        perror("malloc error");
+        exit(EXIT_FAILURE);
+    }
+    block->capacity = needed;
+
+    char *p = (char *)(block + 1);
+    char **slots = (char **)(p + args_offset);
+    slots[0] = (char *)block;
+    char **args = slots + 1;
+
+    int n = 0;
+    for (char **list = head; list; list = list == head ? tail : NULL) {
+        for (char **a = list; *a; a++) {
+            if (is_shell_operator(*a)) {
+                args[n++] = *a;
+                continue;
+            }
+            size_t len = strlen(*a) + 1;
+            memcpy(p, *a, len);
+            args[n++] = p;
+            p += len;
+        }
+    }
+    args[n] = NULL;
+    return args;
+}
+
+// Aliases being expanded, innermost first
+typedef struct alias_chain {
+    const alias_t *alias;
+    const struct alias_chain *outer;
+} alias_chain_t;
+
+// Expand an alias in the first word, keeping the rest of the line. The
+// expansion's first word is expanded in turn unless it names an alias
+// already being expanded, which stops cycles the way bash does. Returns
+// NULL when args[0] is not an alias.
+static char **expand_alias(char **args, const alias_chain_t *chain) {
+    const alias_t *alias = alias_find(args[0]);
+    if (!alias) {
+        return NULL;
+    }
+    for (const alias_chain_t *c = chain; c; c = c->outer) {
+        if (c->alias == alias) {
+            return NULL;
+        }
+    }
+
+    char **head = parse_command(alias->value);
+    char **expanded = concat_args(head, args + 1);
+    free_args(head);
+
+    alias_chain_t link = {alias, chain};
+    char **deeper = expanded[0] ? expand_alias(expanded, &link) : NULL;
+    if (deeper) {
+        free_args(expanded);
+        return deeper;
+    }
+    return expanded;
+}
+
+// Run a built-in or an external program
+static int run_command(char** args) {
     if (args[0] == NULL) {
         // Empty command
         return 1;
     }
 
-    // Check for aliases
-    for (int i = 0; i < alias_count; i++) {
-        if (strcmp(args[0], aliases[i].name) == 0) {
-            // Parse the alias value into arguments
-            char* alias_cmd = strdup(aliases[i].value);
-            char** alias_args = parse_command(alias_cmd);
+    // Search for built-in command; built-ins set last_exit_status
+    // themselves when they fail
+    shell_command *builtin = find_command(args[0]);
+    if (builtin) {
+        last_exit_status = 0;
+        return builtin->func(args);
+    }
+
+    // Spawn the external program and wait for it
+    set_exit_status(spawn_command(args));
 
-            // Skip built-in checking and go straight to execution
-            pid_t pid = fork();
+    return 1;
+}
 
-            if (pid == 0) {
-                // Child process
-                if (execvp(alias_args[0], alias_args) == -1) {
-                    perror("command execution failed");
-                    exit(EXIT_FAILURE);
-                }
-            } else if (pid < 0) {
-                // Error forking
-                perror("fork failed");
-            } else {
-                // Parent process
-                int status;
-                do {
-                    waitpid(pid, &status, WUNTRACED);
-                } while (!WIFEXITED(status) && !WIFSIGNALED(status));
-            }
+static int count_args(char **args) {
+    int n = 0;
+    while (args[n]) n++;
+    return n;
+}
+
+// Expand aliases in every command position: the first word and each word
+// after a |. Returns args itself when nothing was expanded.
+static char **expand_line_aliases(char **args) {
+    char **line = args;
+    int command_pos = 0;
 
-            // Clean up
-            free(alias_cmd);
-            free_args(alias_args);
-            return 1;
+    for (int i = 0; line[i]; i++) {
+        if (line[i] == shell_op_pipe) {
+            command_pos = i + 1;
+            continue;
+        }
+        if (i != command_pos) {
+            continue;
+        }
+
+        char **expanded = expand_alias(line + i, NULL);
+        if (!expanded) {
+            continue;
         }
-    }
 
-    // Search for built-in command
-    for (int i = 0; commands[i].name != NULL; i++) {
-        if (strcmp(args[0], commands[i].name) == 0) {
-            return commands[i].func(args);
+        // Splice the expansion (which already carries the rest of the
+        // line) in after the words before it
+        int produced = count_args(expanded) - count_args(line + i + 1);
+        char *word = line[i];
+        line[i] = NULL;
+        char **joined = concat_args(line, expanded);
+        line[i] = word;
+        free_args(expanded);
+        if (line != args) {
+            free_args(line);
         }
+        line = joined;
+
+        // Words from the alias are not expanded again; an empty alias
+        // leaves the next word in command position
+        command_pos = produced == 0 ? i : -1;
+        i += produced - 1;
+    }
+    return line;
+}
+
+// Execute the command, expanding aliases first
+int execute_command(char** args) {
+    if (args[0] == NULL) {
+        // Empty command
+        return 1;
     }
 
-    // Fork a child process
-    pid_t pid = fork();
+    char **line = expand_line_aliases(args);
 
-    if (pid == 0) {
-        // Child process
-        if (execvp(args[0], args) == -1) {
-            perror("command execution failed");
-            exit(EXIT_FAILURE);
-        }
-    } else if (pid < 0) {
-        // Error forking
-        perror("fork failed");
+    int status = 1;
+    int has_operators = 0;
+    for (char **a = line; *a; a++) {
+        has_operators |= is_shell_operator(*a);
+    }
+    if (has_operators) {
+        status = run_pipeline(line);
     } else {
-        // Parent process
-        int status;
-        do {
-            waitpid(pid, &status, WUNTRACED);
-        } while (!WIFEXITED(status) && !WIFSIGNALED(status));
+        status = run_command(line);
     }
 
-    return 1;
-}
\ No newline at end of file
+    if (line != args) {
+        free_args(line);
+    }
+    return status;
+}
@@ -0,0 +1,320 @@
+/**
+ * @file exec.c
+ * @brief Launching external programs
+ *
+ * External commands are started with posix_spawn, which glibc implements
+ * with vfork semantics, so launching a program costs the same however
+ * large the shell's resident FFT and sample buffers have grown. Resolved
+ * executable paths are remembered in a bash-style hash table, so PATH is
+ * only walked the first time a name is run. The table is dropped when
+ * PATH changes and can be listed or cleared with the `hash` built-in.
+ */
+
+#include "shell.h"
+#include <spawn.h>
+#include <errno.h>
+
+extern char **environ;
+
+typedef struct {
+    char *name;
+    char *path;
+    int hits;
+} path_entry_t;
+
+static struct {
+    path_entry_t *entries;        // Dense, in the order names were resolved
+    int count;
+    int capacity;
+    int32_t *index;               // Open addressing; 0 = empty, else entry + 1
+    int index_size;
+    char *path_env;               // PATH the table was built from
+} path_cache = {0};
+
+static uint64_t path_hash(const char *name) {
+    uint64_t hash = 14695981039346656037ULL; // FNV-1a
+    while (*name) {
+        hash ^= (unsigned char)*name++;
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Forget every resolved path
+void path_cache_clear() {
+    for (int i = 0; i < path_cache.count; i++) {
+        free(path_cache.entries[i].name);
+        free(path_cache.entries[i].path);
+    }
+    free(path_cache.entries);
+    free(path_cache.index);
+    free(path_cache.path_env);
+    memset(&path_cache, 0, sizeof(path_cache));
+}
+
+// Drop the table if PATH is not what it was built from
+static void path_cache_check_env() {
+    const char *path_env = getenv("PATH");
+    if (!path_env) path_env = "";
+    if (path_cache.path_env && strcmp(path_cache.path_env, path_env) == 0) {
+        return;
+    }
+    path_cache_clear();
+    path_cache.path_env = strdup(path_env);
+}
+
+// Index slot holding name, or the empty slot where it belongs
+static int path_slot(const char *name) {
+    int mask = path_cache.index_size - 1;
+    int slot = path_hash(name) & mask;
+    while (path_cache.index[slot] != 0 &&
+           strcmp(path_cache.entries[path_cache.index[slot] - 1].name, name) != 0) {
+        slot = (slot + 1) & mask;
+    }
+    return slot;
+}
+
+static path_entry_t *path_cache_find(const char *name) {
+    if (path_cache.count == 0) {
+        return NULL;
+    }
+    int32_t entry = path_cache.index[path_slot(name)];
+    return entry ? &path_cache.entries[entry - 1] : NULL;
+}
+
+static path_entry_t *path_cache_insert(const char *name, const char *path) {
+    // Keep the index at most half full
+    if ((path_cache.count + 1) * 2 > path_cache.index_size) {
+        int size = path_cache.index_size ? path_cache.index_size * 2 : 64;
+        int32_t *index = calloc(size, sizeof(int32_t));
+        if (!index) {
+            perror("malloc error");
+            return NULL;
+        }
+        free(path_cache.index);
+        path_cache.index = index;
+        path_cache.index_size = size;
+        for (int i = 0; i < path_cache.count; i++) {
+            index[path_slot(path_cache.entries[i].name)] = i + 1;
+        }
+    }
+
+    if (path_cache.count == path_cache.capacity) {
+        int capacity = path_cache.capacity ? path_cache.capacity * 2 : 32;
+        path_entry_t *entries = realloc(path_cache.entries, capacity * sizeof(path_entry_t));
+        if (!entries) {
+            perror("malloc error");
+            return NULL;
+        }
+        path_cache.entries = entries;
+        path_cache.capacity = capacity;
+    }
+
+    path_entry_t *entry = &path_cache.entries[path_cache.count];
+    entry->name = strdup(name);
+    entry->path = strdup(path);
+    entry->hits = 0;
+    if (!entry->name || !entry->path) {
+        perror("malloc error");
+        free(entry->name);
+        free(entry->path);
+        return NULL;
+    }
+    path_cache.index[path_slot(name)] = ++path_cache.count;
+    return entry;
+}
+
+static int is_executable_file(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode) && access(path, X_OK) == 0;
+}
+
+// Walk PATH for name; writes the full path and returns 1 if found.
+// *cacheable is cleared when the match came from a relative directory,
+// whose meaning changes with the working directory.
+static int search_path(const char *name, char *out, size_t out_len, int *cacheable) {
+    const char *dir = path_cache.path_env;
+    *cacheable = 1;
+    while (dir) {
+        const char *end = strchr(dir, ':');
+        size_t dir_len = end ? (size_t)(end - dir) : strlen(dir);
+
+        // An empty PATH entry means the current directory
+        if (dir_len == 0) {
+            snprintf(out, out_len, "./%s", name);
+        } else {
+            snprintf(out, out_len, "%.*s/%s", (int)dir_len, dir, name);
+        }
+        if (is_executable_file(out)) {
+            *cacheable = dir_len > 0 && dir[0] == '/';
+            return 1;
+        }
+        dir = end ? end + 1 : NULL;
+    }
+    return 0;
+}
+
+// Full path of the program called name, or NULL if there is none.
+// Names containing a slash are used as given; the result stays valid
+// until the next lookup.
+const char *resolve_command(const char *name, int count_hit) {
+    static char resolved[PATH_MAX];
+
+    if (strchr(name, '/')) {
+        return name;
+    }
+
+    path_cache_check_env();
+    path_entry_t *entry = path_cache_find(name);
+    if (entry) {
+        if (count_hit) entry->hits++;
+        return entry->path;
+    }
+
+    int cacheable;
+    if (!search_path(name, resolved, sizeof(resolved), &cacheable)) {
+        return NULL;
+    }
+    if (cacheable) {
+        entry = path_cache_insert(name, resolved);
+        if (entry && count_hit) entry->hits++;
+    }
+    return resolved;
+}
+
+// Re-resolve a cached name whose program has moved or gone
+static const char *path_cache_refresh(const char *name) {
+    path_entry_t *entry = path_cache_find(name);
+    if (!entry) {
+        return NULL;
+    }
+
+    char resolved[PATH_MAX];
+    int cacheable;
+    if (!search_path(name, resolved, sizeof(resolved), &cacheable) || !cacheable) {
+        return NULL;
+    }
+    char *path = strdup(resolved);
+    if (!path) {
+        return NULL;
+    }
+    free(entry->path);
+    entry->path = path;
+    return entry->path;
+}
+
+// Start an external program with stdin/stdout taken from in_fd/out_fd
+// (-1 to inherit the shell's); returns its pid, or -1 if it could not
+// be started. Descriptors the shell opened with O_CLOEXEC stay behind.
+pid_t spawn_process(char **args, int in_fd, int out_fd) {
+    const char *path = resolve_command(args[0], 1);
+    if (!path) {
+        fprintf(stderr, "%s: command not found\n", args[0]);
+        return -1;
+    }
+
+    // The child gets default dispositions for the signals the shell and
+    // the SDR commands may have taken over
+    posix_spawnattr_t attr;
+    sigset_t defaults;
+    posix_spawnattr_init(&attr);
+    sigemptyset(&defaults);
+    sigaddset(&defaults, SIGINT);
+    sigaddset(&defaults, SIGQUIT);
+    sigaddset(&defaults, SIGTERM);
+    sigaddset(&defaults, SIGPIPE);
+    posix_spawnattr_setsigdefault(&attr, &defaults);
+    posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETSIGDEF);
+
+    // What the shell has buffered must come out ahead of the program
+    fflush(stdout);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    if (in_fd >= 0) posix_spawn_file_actions_adddup2(&actions, in_fd, STDIN_FILENO);
+    if (out_fd >= 0) posix_spawn_file_actions_adddup2(&actions, out_fd, STDOUT_FILENO);
+
+    pid_t pid;
+    int err = posix_spawn(&pid, path, &actions, &attr, args, environ);
+    if (err == ENOENT && path != args[0] && (path = path_cache_refresh(args[0])) != NULL) {
+        err = posix_spawn(&pid, path, &actions, &attr, args, environ);
+    }
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+
+    if (err != 0) {
+        fprintf(stderr, "%s: %s\n", args[0], strerror(err));
+        return -1;
+    }
+    return pid;
+}
+
+// Wait for every started process; returns the wait status of the last
+// one. Ctrl+C is left to the children while the shell waits.
+int wait_processes(const pid_t *pids, int n) {
+    struct sigaction ignore, old_int, old_quit;
+    memset(&ignore, 0, sizeof(ignore));
+    ignore.sa_handler = SIG_IGN;
+    sigaction(SIGINT, &ignore, &old_int);
+    sigaction(SIGQUIT, &ignore, &old_quit);
+
+    int last_status = -1;
+    for (int i = 0; i < n; i++) {
+        if (pids[i] <= 0) {
+            last_status = -1;
+            continue;
+        }
+        int status;
+        while (waitpid(pids[i], &status, 0) < 0) {
+            if (errno != EINTR) {
+                perror("waitpid failed");
+                status = -1;
+                break;
+            }
+        }
+        last_status = status;
+    }
+
+    sigaction(SIGINT, &old_int, NULL);
+    sigaction(SIGQUIT, &old_quit, NULL);
+    return last_status;
+}
+
+// Start an external program and wait for it; returns its wait status,
+// or -1 if it could not be started
+int spawn_command(char **args) {
+    pid_t pid = spawn_process(args, -1, -1);
+    if (pid < 0) {
+        return -1;
+    }
+    return wait_processes(&pid, 1);
+}
+
+// hash [-r] [name ...]: show, clear or fill the executable path table
+int cmd_hash(char **args) {
+    int i = 1;
+    if (args[1] && strcmp(args[1], "-r") == 0) {
+        path_cache_clear();
+        i++;
+    }
+
+    if (args[1] == NULL) {
+        path_cache_check_env();
+        if (path_cache.count == 0) {
+            printf("hash: hash table empty\n");
+            return 1;
+        }
+        printf("hits\tcommand\n");
+        for (int e = 0; e < path_cache.count; e++) {
+            printf("%4d\t%s\n", path_cache.entries[e].hits, path_cache.entries[e].path);
+        }
+        return 1;
+    }
+
+    for (; args[i]; i++) {
+        if (strchr(args[i], '/') == NULL && !resolve_command(args[i], 0)) {
+            fprintf(stderr, "hash: %s: not found\n", args[i]);
+        }
+    }
+    return 1;
+}
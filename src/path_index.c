@@ -0,0 +1,223 @@
+/**
+ * @file path_index.c
+ * @brief Index of executable names across $PATH for tab completion
+ *
+ * Every PATH directory is read once into its own list of names, and the
+ * lists are merged into one sorted, de-duplicated array that prefix
+ * lookups binary-search. Before each completion the directories are
+ * re-stat'ed (one stat per PATH entry, not per binary) and only those
+ * whose mtime changed are read again. Names are taken from readdir's
+ * d_type, so a directory of thousands of binaries costs no stat calls
+ * unless the filesystem does not report types.
+ */
+
+#include "shell.h"
+#include <fcntl.h>
+
+typedef struct {
+    char *path;
+    struct timespec mtime;        // Directory mtime when last read
+    int present;                  // Directory existed when last read
+    char **names;
+    int count, capacity;
+} indexed_dir_t;
+
+static struct {
+    char *path_env;               // PATH the directory list was built from
+    indexed_dir_t *dirs;
+    int n_dirs;
+    const char **sorted;          // Merged names, sorted and unique
+    int n_sorted;
+} path_index = {0};
+
+static void indexed_dir_clear(indexed_dir_t *d) {
+    for (int i = 0; i < d->count; i++) {
+        free(d->names[i]);
+    }
+    free(d->names);
+    d->names = NULL;
+    d->count = d->capacity = 0;
+}
+
+static void path_index_clear() {
+    for (int i = 0; i < path_index.n_dirs; i++) {
+        indexed_dir_clear(&path_index.dirs[i]);
+        free(path_index.dirs[i].path);
+    }
+    free(path_index.dirs);
+    free(path_index.sorted);
+    free(path_index.path_env);
+    memset(&path_index, 0, sizeof(path_index));
+}
+
+// Split PATH into directories; relative entries are skipped because
+// their contents change with the working directory
+static int path_index_set_dirs(const char *path_env) {
+    path_index.path_env = strdup(path_env);
+    int max_dirs = 1;
+    for (const char *p = path_env; *p; p++) {
+        if (*p == ':') max_dirs++;
+    }
+    path_index.dirs = calloc(max_dirs, sizeof(indexed_dir_t));
+    if (!path_index.path_env || !path_index.dirs) {
+        perror("malloc error");
+        return 0;
+    }
+
+    const char *dir = path_env;
+    while (dir) {
+        const char *end = strchr(dir, ':');
+        size_t dir_len = end ? (size_t)(end - dir) : strlen(dir);
+        if (dir_len > 0 && dir[0] == '/') {
+            indexed_dir_t *d = &path_index.dirs[path_index.n_dirs++];
+            d->path = strndup(dir, dir_len);
+            if (!d->path) {
+                perror("malloc error");
+                return 0;
+            }
+        }
+        dir = end ? end + 1 : NULL;
+    }
+    return 1;
+}
+
+static int indexed_dir_add(indexed_dir_t *d, const char *name) {
+    if (d->count == d->capacity) {
+        int capacity = d->capacity ? d->capacity * 2 : 256;
+        char **names = realloc(d->names, capacity * sizeof(char *));
+        if (!names) {
+            return 0;
+        }
+        d->names = names;
+        d->capacity = capacity;
+    }
+    d->names[d->count] = strdup(name);
+    return d->names[d->count] ? (d->count++, 1) : 0;
+}
+
+// Read one directory's executables
+static void indexed_dir_read(indexed_dir_t *d) {
+    indexed_dir_clear(d);
+
+    DIR *dir = opendir(d->path);
+    if (!dir) {
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+
+        // Files and links in a PATH directory are taken as commands;
+        // only filesystems without d_type need a stat
+        int is_command = entry->d_type == DT_REG || entry->d_type == DT_LNK;
+        if (entry->d_type == DT_UNKNOWN) {
+            struct stat st;
+            is_command = fstatat(dirfd(dir), entry->d_name, &st, 0) == 0 &&
+                         S_ISREG(st.st_mode) && (st.st_mode & 0111);
+        }
+        if (is_command && !indexed_dir_add(d, entry->d_name)) {
+            perror("malloc error");
+            break;
+        }
+    }
+    closedir(dir);
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+// Rebuild the merged array from the per-directory lists
+static void path_index_merge() {
+    int total = 0;
+    for (int i = 0; i < path_index.n_dirs; i++) {
+        total += path_index.dirs[i].count;
+    }
+
+    free(path_index.sorted);
+    path_index.n_sorted = 0;
+    path_index.sorted = malloc((total ? total : 1) * sizeof(char *));
+    if (!path_index.sorted) {
+        perror("malloc error");
+        return;
+    }
+
+    for (int i = 0; i < path_index.n_dirs; i++) {
+        indexed_dir_t *d = &path_index.dirs[i];
+        memcpy(path_index.sorted + path_index.n_sorted, d->names, d->count * sizeof(char *));
+        path_index.n_sorted += d->count;
+    }
+    qsort(path_index.sorted, path_index.n_sorted, sizeof(char *), compare_names);
+
+    // The same name in several directories completes once
+    int unique = 0;
+    for (int i = 0; i < path_index.n_sorted; i++) {
+        if (unique == 0 || strcmp(path_index.sorted[unique - 1], path_index.sorted[i]) != 0) {
+            path_index.sorted[unique++] = path_index.sorted[i];
+        }
+    }
+    path_index.n_sorted = unique;
+}
+
+// Bring the index up to date with PATH and the directories' mtimes
+void path_index_refresh() {
+    const char *path_env = getenv("PATH");
+    if (!path_env) path_env = "";
+
+    if (!path_index.path_env || strcmp(path_index.path_env, path_env) != 0) {
+        path_index_clear();
+        if (!path_index_set_dirs(path_env)) {
+            path_index_clear();
+            return;
+        }
+    }
+
+    int changed = path_index.sorted == NULL;
+    for (int i = 0; i < path_index.n_dirs; i++) {
+        indexed_dir_t *d = &path_index.dirs[i];
+        struct stat st;
+        int present = stat(d->path, &st) == 0;
+        if (present == d->present && (!present ||
+            (st.st_mtim.tv_sec == d->mtime.tv_sec && st.st_mtim.tv_nsec == d->mtime.tv_nsec))) {
+            continue;
+        }
+
+        d->present = present;
+        if (present) {
+            d->mtime = st.st_mtim;
+            indexed_dir_read(d);
+        } else {
+            indexed_dir_clear(d);
+        }
+        changed = 1;
+    }
+
+    if (changed) {
+        path_index_merge();
+    }
+}
+
+// Names in the index starting with prefix: returns the first and sets
+// *count; valid until the next refresh
+const char **path_index_matches(const char *prefix, int *count) {
+    size_t len = strlen(prefix);
+    int lo = 0, hi = path_index.n_sorted;
+    while (lo < hi) {
+        int mid = lo + (hi - lo) / 2;
+        if (strncmp(path_index.sorted[mid], prefix, len) < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    int end = lo;
+    while (end < path_index.n_sorted && strncmp(path_index.sorted[end], prefix, len) == 0) {
+        end++;
+    }
+    *count = end - lo;
+    return path_index.sorted + lo;
+}
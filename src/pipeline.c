@@ -0,0 +1,269 @@
+/**
+ * @file pipeline.c
+ * @brief Pipelines and redirection
+ *
+ * Runs command lines containing |, <, > and >>. Every command of a
+ * pipeline runs concurrently and the shell waits for all of them.
+ * External programs are started with posix_spawn; built-ins are forked
+ * so they can produce into a pipe, which is what lets `sdr_record ... -`
+ * feed a decoder without a temporary file. A lone built-in with only
+ * redirections runs inside the shell, as in bash, so `cd` and `alias`
+ * keep their effect.
+ */
+
+#define _GNU_SOURCE
+#include "shell.h"
+#include <fcntl.h>
+#include <errno.h>
+
+typedef struct {
+    char **argv;           // Words of this command, NULL terminated in place
+    const char *input;     // File for <, or NULL
+    const char *output;    // File for > or >>, or NULL
+    int append;            // Output was >>
+} pipeline_stage_t;
+
+// Split a command line into stages, compacting each stage's words in
+// place; returns the number of stages, or 0 after a syntax error
+static int split_pipeline(char **line, pipeline_stage_t *stages) {
+    int n_stages = 0;
+    int w = 0;
+    int words = 0;         // Words in the current stage
+    pipeline_stage_t *stage = &stages[0];
+    memset(stage, 0, sizeof(*stage));
+    stage->argv = line;
+
+    for (int i = 0; line[i]; i++) {
+        char *token = line[i];
+
+        if (token == shell_op_pipe) {
+            if (words == 0 && !stage->input && !stage->output) {
+                fprintf(stderr, "syntax error near unexpected token `|'\n");
+                return 0;
+            }
+            line[w++] = NULL;
+            words = 0;
+            stage = &stages[++n_stages];
+            memset(stage, 0, sizeof(*stage));
+            stage->argv = line + w;
+            continue;
+        }
+
+        if (is_shell_operator(token)) {
+            char *file = line[i + 1];
+            if (file == NULL || is_shell_operator(file)) {
+                fprintf(stderr, "syntax error near unexpected token `%s'\n", file ? file : "newline");
+                return 0;
+            }
+            if (token == shell_op_input) {
+                stage->input = file;
+            } else {
+                stage->output = file;
+                stage->append = token == shell_op_append;
+            }
+            i++;
+            continue;
+        }
+
+        line[w++] = token;
+        words++;
+    }
+    line[w] = NULL;
+
+    // A trailing | leaves an empty last stage
+    if (n_stages > 0 && words == 0 && !stage->input && !stage->output) {
+        fprintf(stderr, "syntax error near unexpected token `|'\n");
+        return 0;
+    }
+    return n_stages + 1;
+}
+
+// Open a stage's redirection files; -1 where there is none
+static int open_redirections(pipeline_stage_t *stage, int *in_fd, int *out_fd) {
+    *in_fd = *out_fd = -1;
+    if (stage->input) {
+        *in_fd = open(stage->input, O_RDONLY | O_CLOEXEC);
+        if (*in_fd < 0) {
+            fprintf(stderr, "%s: %s\n", stage->input, strerror(errno));
+            return 0;
+        }
+    }
+    if (stage->output) {
+        int flags = O_WRONLY | O_CREAT | O_CLOEXEC | (stage->append ? O_APPEND : O_TRUNC);
+        *out_fd = open(stage->output, flags, 0644);
+        if (*out_fd < 0) {
+            fprintf(stderr, "%s: %s\n", stage->output, strerror(errno));
+            if (*in_fd >= 0) close(*in_fd);
+            *in_fd = -1;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// Run a built-in inside the shell with its stdin/stdout redirected
+static int run_builtin_redirected(shell_command *builtin, char **argv, int in_fd, int out_fd) {
+    int saved_in = -1, saved_out = -1;
+
+    fflush(stdout);
+    if (in_fd >= 0) {
+        saved_in = fcntl(STDIN_FILENO, F_DUPFD_CLOEXEC, 3);
+        dup2(in_fd, STDIN_FILENO);
+    }
+    if (out_fd >= 0) {
+        saved_out = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 3);
+        dup2(out_fd, STDOUT_FILENO);
+    }
+
+    int status = builtin->func(argv);
+
+    fflush(stdout);
+    if (saved_in >= 0) {
+        dup2(saved_in, STDIN_FILENO);
+        close(saved_in);
+    }
+    if (saved_out >= 0) {
+        dup2(saved_out, STDOUT_FILENO);
+        close(saved_out);
+    }
+    return status;
+}
+
+// Fork a built-in as one stage of a pipeline. The child closes every
+// descriptor the pipeline holds besides its own stdin/stdout.
+static pid_t fork_builtin(shell_command *builtin, char **argv, int in_fd, int out_fd,
+                          const int *open_fds, int n_open) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork failed");
+        return -1;
+    }
+    if (pid > 0) {
+        return pid;
+    }
+
+    signal(SIGINT, SIG_DFL);
+    signal(SIGQUIT, SIG_DFL);
+    signal(SIGPIPE, SIG_DFL);
+    if (in_fd >= 0) dup2(in_fd, STDIN_FILENO);
+    if (out_fd >= 0) dup2(out_fd, STDOUT_FILENO);
+    for (int i = 0; i < n_open; i++) {
+        close(open_fds[i]);
+    }
+
+    last_exit_status = 0;
+    builtin->func(argv);
+    fflush(stdout);
+    _exit(last_exit_status);
+}
+
+// Run a command line containing pipes or redirections
+int run_pipeline(char **line) {
+    int max_stages = 1;
+    for (char **a = line; *a; a++) {
+        if (*a == shell_op_pipe) max_stages++;
+    }
+
+    pipeline_stage_t stages[max_stages];
+    int n_stages = split_pipeline(line, stages);
+    if (n_stages == 0) {
+        last_exit_status = 2;
+        return 1;
+    }
+
+    // A single built-in keeps running inside the shell
+    if (n_stages == 1) {
+        int in_fd, out_fd;
+        if (!open_redirections(&stages[0], &in_fd, &out_fd)) {
+            last_exit_status = 1;
+            return 1;
+        }
+        int status = 1;
+        shell_command *builtin = stages[0].argv[0] ? find_command(stages[0].argv[0]) : NULL;
+        last_exit_status = 0;
+        if (builtin) {
+            status = run_builtin_redirected(builtin, stages[0].argv, in_fd, out_fd);
+        } else if (stages[0].argv[0]) {
+            pid_t pid = spawn_process(stages[0].argv, in_fd, out_fd);
+            set_exit_status(pid > 0 ? wait_processes(&pid, 1) : -1);
+        }
+        if (in_fd >= 0) close(in_fd);
+        if (out_fd >= 0) close(out_fd);
+        return status;
+    }
+
+    // Descriptors the shell holds while starting one stage: the previous
+    // pipe's read end, this stage's pipe and its two redirections
+    int open_fds[5];
+    int n_open = 0;
+    pid_t pids[max_stages];
+    int prev_read = -1;
+    int ok = 1;
+
+    for (int s = 0; s < n_stages; s++) {
+        pids[s] = -1;
+    }
+
+    for (int s = 0; s < n_stages; s++) {
+        int in_fd = -1, out_fd = -1, pipe_fds[2] = {-1, -1};
+
+        if (ok && !open_redirections(&stages[s], &in_fd, &out_fd)) {
+            ok = 0;
+        }
+        if (in_fd >= 0) open_fds[n_open++] = in_fd;
+        if (out_fd >= 0) open_fds[n_open++] = out_fd;
+
+        if (ok && s + 1 < n_stages) {
+            if (pipe2(pipe_fds, O_CLOEXEC) != 0) {
+                perror("pipe failed");
+                ok = 0;
+            } else {
+                open_fds[n_open++] = pipe_fds[0];
+                open_fds[n_open++] = pipe_fds[1];
+            }
+        }
+
+        // Explicit redirections win over the pipe, as in bash
+        if (in_fd < 0) in_fd = prev_read;
+        if (out_fd < 0) out_fd = pipe_fds[1];
+
+        if (ok && stages[s].argv[0]) {
+            shell_command *builtin = find_command(stages[s].argv[0]);
+            if (builtin) {
+                pids[s] = fork_builtin(builtin, stages[s].argv, in_fd, out_fd, open_fds, n_open);
+            } else {
+                pids[s] = spawn_process(stages[s].argv, in_fd, out_fd);
+            }
+        }
+
+        // The shell's copies of this stage's ends are no longer needed;
+        // the read end of the new pipe goes to the next stage
+        for (int i = 0; i < n_open; i++) {
+            if (open_fds[i] != pipe_fds[0]) {
+                close(open_fds[i]);
+            }
+        }
+        n_open = 0;
+        if (pipe_fds[0] >= 0) {
+            open_fds[n_open++] = pipe_fds[0];
+        }
+        prev_read = pipe_fds[0];
+        if (!ok) {
+            break;
+        }
+    }
+    for (int i = 0; i < n_open; i++) {
+        close(open_fds[i]);
+    }
+
+    // Stages that did start before a failure are still waited for; the
+    // pipeline's status is that of its last command
+    int status = wait_processes(pids, n_stages);
+    if (ok) {
+        set_exit_status(status);
+    } else {
+        last_exit_status = 1;
+    }
+    return 1;
+}
@@ -0,0 +1,104 @@
+/**
+ * @file sdr_module.c
+ * @brief On-demand loading of the SDR commands
+ *
+ * The sdr_* entries of commands[] start out pointing at
+ * sdr_module_dispatch. The first time one of them runs, myshell_sdr.so
+ * is dlopened, every SDR entry is re-pointed at its cmd_<name> in the
+ * module, and the call is passed on. From then on SDR commands dispatch
+ * directly, and sessions that never use them never map librtlsdr, FFTW
+ * or libusb at all.
+ */
+
+#include "shell.h"
+#include <dlfcn.h>
+
+#define SDR_MODULE_NAME "myshell_sdr.so"
+
+static void *sdr_module = NULL;
+
+// $MYSHELL_SDR_MODULE, or the module next to the running executable;
+// returns 0 if the path does not fit in out
+static int sdr_module_path(char *out, size_t out_len) {
+    const char *env = getenv("MYSHELL_SDR_MODULE");
+    int len;
+    if (env && *env) {
+        len = snprintf(out, out_len, "%s", env);
+        return len >= 0 && (size_t)len < out_len;
+    }
+
+    char exe[PATH_MAX];
+    ssize_t exe_len = readlink("/proc/self/exe", exe, sizeof(exe) - 1);
+    if (exe_len <= 0) {
+        len = snprintf(out, out_len, "%s", SDR_MODULE_NAME);
+        return len >= 0 && (size_t)len < out_len;
+    }
+    exe[exe_len] = '\0';
+    char *slash = strrchr(exe, '/');
+    *slash = '\0';
+    len = snprintf(out, out_len, "%s/%s", exe, SDR_MODULE_NAME);
+    return len >= 0 && (size_t)len < out_len;
+}
+
+// Load the module and patch the dispatch table; returns 0 on failure
+static int sdr_module_load() {
+    if (sdr_module) {
+        return 1;
+    }
+
+    char path[PATH_MAX];
+    if (!sdr_module_path(path, sizeof(path))) {
+        fprintf(stderr, "Cannot load SDR commands: module path is longer than %d bytes\n", PATH_MAX - 1);
+        return 0;
+    }
+    void *handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        fprintf(stderr, "Cannot load SDR commands: %s\n", dlerror());
+        return 0;
+    }
+
+    // Resolve every command before patching any, so a stale module
+    // leaves the table untouched
+    int n_commands = 0;
+    while (commands[n_commands].name) n_commands++;
+    command_function resolved[n_commands];
+
+    for (int i = 0; i < n_commands; i++) {
+        resolved[i] = NULL;
+        if (commands[i].func != sdr_module_dispatch) {
+            continue;
+        }
+        char symbol[128];
+        snprintf(symbol, sizeof(symbol), "cmd_%s", commands[i].name);
+        resolved[i] = (command_function)dlsym(handle, symbol);
+        if (!resolved[i]) {
+            fprintf(stderr, "Cannot load SDR commands: %s has no %s\n", path, symbol);
+            dlclose(handle);
+            return 0;
+        }
+    }
+
+    for (int i = 0; i < n_commands; i++) {
+        if (resolved[i]) {
+            commands[i].func = resolved[i];
+        }
+    }
+    sdr_module = handle;
+    return 1;
+}
+
+// Stand-in for every SDR command until the module is loaded
+int sdr_module_dispatch(char **args) {
+    if (!sdr_module_load()) {
+        last_exit_status = 1;
+        return 1;
+    }
+
+    shell_command *command = find_command(args[0]);
+    if (!command || command->func == sdr_module_dispatch) {
+        fprintf(stderr, "%s: not provided by the SDR module\n", args[0]);
+        last_exit_status = 1;
+        return 1;
+    }
+    return command->func(args);
+}
@@ -1,70 +1,120 @@
-/**
- * @file shell.c
- * @brief Main shell entry point
- *
- * Contains the main() function and shell loop. Initializes the shell,
- * configures readline, sets up history and aliases, and manages the
- * main command execution loop. Handles cleanup on exit.
- */
-
-// Main shell loop
-
-#include "shell.h"
-
-// After includes, before main()
-alias_t aliases[MAX_ALIASES];
-int alias_count = 0;
-
-int main() {
-    char* command;
-    char** args;
-    int status = 1;
-
-    // Configure readline
-    rl_attempted_completion_function = myshell_completion;
-    // Tell readline to use our custom tab completion
-    rl_bind_key('\t', rl_complete);
-
-    // Initialize history
-    using_history();
-    read_history(".myshell_history");
-
-    // Initialize default aliases
-    aliases[alias_count].name = strdup("ls");
-    aliases[alias_count].value = strdup("ls --color=auto");
-    alias_count++;
-    aliases[alias_count].name = strdup("congq");
-    aliases[alias_count].value = strdup("nc localhost 7356");
-    alias_count++;
-
-    // Initialize and load config file
-    initialize_config_file();
-    load_aliases_from_config();
-
-    printf("Welcome to MyShell! Type 'exit' to quit.\n");
-
-    while(status) {
-        command = read_command();
-        args = parse_command(command);
-        status = execute_command(args);
-
-        // Clean up
-        free(command);
-        free_args(args);
-    }
-
-    // Save history on exit
-    write_history(".myshell_history");
-
-    // Save aliases to config file
-    save_aliases_to_config();
-
-    // Free aliases
-    for (int i = 0; i < alias_count; i++) {
-        free(aliases[i].name);
-        free(aliases[i].value);
-    }
-
-    printf("Goodbye!\n");
-    return 0;
-}
\ No newline at end of file
+/**
+ * @file shell.c
+ * @brief Main shell entry point
+ *
+ * Contains the main() function and shell loop. Initializes the shell,
+ * configures readline, sets up history and aliases, and manages the
+ * main command execution loop. Handles cleanup on exit.
+ *
+ * `myshell -c "command"`, `myshell script.msh` and a non-terminal stdin
+ * run lines through the same parser and dispatcher without readline or
+ * history, and the shell exits with the status of the last command.
+ * Every mode sees the default aliases and those in ~/.myshell_config;
+ * only an interactive shell creates the config file.
+ */
+
+// Main shell loop
+
+#include "shell.h"
+#include <errno.h>
+
+// Run one line; returns 0 once the line asked the shell to exit
+static int run_line(const char *line) {
+    char **args = parse_command(line);
+    int status = execute_command(args);
+    free_args(args);
+    return status;
+}
+
+// Run every line of a script until it ends or runs exit
+static void run_script(FILE *input) {
+    char *line = NULL;
+    size_t capacity = 0;
+    ssize_t len;
+
+    while ((len = getline(&line, &capacity, input)) != -1) {
+        if (len > 0 && line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+        }
+
+        // Comments, including a #! line
+        const char *p = line;
+        while (*p == ' ' || *p == '\t') p++;
+        if (*p == '#') {
+            continue;
+        }
+
+        if (!run_line(line)) {
+            break;
+        }
+    }
+    free(line);
+}
+
+static void run_interactive() {
+    char* command;
+    int status = 1;
+
+    // Configure readline
+    rl_attempted_completion_function = myshell_completion;
+    // Tell readline to use our custom tab completion
+    rl_bind_key('\t', rl_complete);
+
+    // Initialize history
+    using_history();
+    read_history(".myshell_history");
+
+    // Give the user a config file to edit
+    initialize_config_file();
+
+    printf("Welcome to MyShell! Type 'exit' to quit.\n");
+
+    while(status) {
+        command = read_command();
+        if (!command) {
+            break; // EOF
+        }
+        status = run_line(command);
+
+        // Clean up
+        free(command);
+    }
+
+    // Save history on exit
+    write_history(".myshell_history");
+
+    printf("Goodbye!\n");
+}
+
+int main(int argc, char **argv) {
+    // Default aliases and the config file, for every mode
+    load_shell_config();
+
+    if (argc >= 2 && strcmp(argv[1], "-c") == 0) {
+        if (argc < 3) {
+            fprintf(stderr, "myshell: -c: option requires an argument\n");
+            return 2;
+        }
+        run_line(argv[2]);
+    } else if (argc >= 2) {
+        FILE *script = fopen(argv[1], "r");
+        if (!script) {
+            fprintf(stderr, "myshell: %s: %s\n", argv[1], strerror(errno));
+            return 127;
+        }
+        run_script(script);
+        fclose(script);
+    } else if (!isatty(STDIN_FILENO)) {
+        run_script(stdin);
+    } else {
+        run_interactive();
+    }
+
+    // Fold any journaled alias changes into the config file
+    flush_alias_journal();
+
+    // Free aliases
+    alias_clear();
+
+    return last_exit_status;
+}
@@ -2,128 +2,122 @@
  * @file utils.c
  * @brief Utility functions for tab completion and command suggestions
  *
- * This file implements the tab completion functionality for the shell,
- * including completion for both built-in commands and filenames.
+ * This file implements the tab completion functionality for the shell.
+ * In command position it offers built-ins and executables from the PATH
+ * index (path_index.c); everywhere else, and for names containing a
+ * slash, it completes file names.
  */
 
 #include "shell.h"
 
-// Add this function to get built-in commands
-char *builtin_commands[] = {
-    "cd",
-    "exit",
-    NULL
+// Where the generator is in its list of candidates
+enum {
+    COMPLETE_BUILTINS,
+    COMPLETE_PATH,
+    COMPLETE_FILES,
+    COMPLETE_DONE
 };
 
+// Set by myshell_completion for the word being completed
+static int completing_command = 0;
+
 // Generate completion matches
-// Update your generator function to handle both commands and filenames
-// Update your generator function to use the new commands structure
 char* myshell_generator(const char* text, int state) {
-    static int list_index, len;
-    static int is_command_completion;
+    static int phase, list_index;
+    static size_t len;
+    static const char **path_matches;
+    static int path_count;
     static DIR *dir;
-    static struct dirent *entry;
-    static char *directory;
+    static char directory[PATH_MAX];   // Directory part of text, "" for cwd
+    static const char *file_part;
 
     // First time called for this completion
     if (!state) {
         list_index = 0;
         len = strlen(text);
-        is_command_completion = (rl_line_buffer[0] == '\0' ||
-                               strchr(rl_line_buffer, ' ') == NULL);
-
-        // If we're completing a command (first word)
-        if (is_command_completion) {
-            // We'll start with built-in commands
-            return NULL;  // Will trigger next state
+        phase = completing_command && !strchr(text, '/') ? COMPLETE_BUILTINS : COMPLETE_FILES;
+        if (phase == COMPLETE_BUILTINS) {
+            path_index_refresh();
+            path_matches = path_index_matches(text, &path_count);
         }
 
-        // For file completion, determine if we're dealing with a path
-        directory = ".";  // Default to current directory
-        char *last_slash = strrchr(text, '/');
-
+        // For file completion, split off the directory part of the path
+        const char *last_slash = strrchr(text, '/');
         if (last_slash) {
-            // We have a path - extract the directory part
-            int dir_len = last_slash - text + 1;
-            directory = malloc(dir_len + 1);
-            strncpy(directory, text, dir_len);
-            directory[dir_len] = '\0';
-
-            // Adjust text to point just to the filename part
-            text = last_slash + 1;
-            len = strlen(text);
+            snprintf(directory, sizeof(directory), "%.*s", (int)(last_slash - text + 1), text);
+            file_part = last_slash + 1;
+        } else {
+            directory[0] = '\0';
+            file_part = text;
         }
-
-        // Open directory
-        dir = opendir(directory);
-        if (!dir) {
-            if (directory != ".") free(directory);
-            return NULL;
+        if (dir) {
+            closedir(dir);
+            dir = NULL;
         }
     }
 
-    // Check built-in commands first
-    if (is_command_completion) {
+    if (phase == COMPLETE_BUILTINS) {
         while (commands[list_index].name != NULL) {
             char *name = commands[list_index++].name;
             if (strncmp(name, text, len) == 0) {
                 return strdup(name);
             }
         }
-
-        // Switch to checking PATH for executables
-        is_command_completion = 0;
-        directory = ".";
-        dir = opendir(directory);
-        if (!dir) return NULL;
-
-        // Fall through to filename completion
+        phase = COMPLETE_PATH;
+        list_index = 0;
     }
 
-    // Rest of the function remains the same...
-    // Return the next match from files
-    while ((entry = readdir(dir)) != NULL) {
-        // Skip . and .. if at the start of completion
-        if (text[0] == '\0' &&
-            (strcmp(entry->d_name, ".") == 0 ||
-             strcmp(entry->d_name, "..") == 0)) {
-            continue;
+    if (phase == COMPLETE_PATH) {
+        if (list_index < path_count) {
+            return strdup(path_matches[list_index++]);
         }
+        // Programs in the current directory complete like files
+        phase = COMPLETE_FILES;
+    }
 
-        if (strncmp(entry->d_name, text, len) == 0) {
-            char *name;
-
-            if (directory != ".") {
-                // Need to prepend the directory path
-                name = malloc(strlen(directory) + strlen(entry->d_name) + 1);
-                strcpy(name, directory);
-                strcat(name, entry->d_name);
-            } else {
-                name = strdup(entry->d_name);
+    if (phase == COMPLETE_FILES) {
+        if (!dir) {
+            dir = opendir(directory[0] ? directory : ".");
+            if (!dir) {
+                phase = COMPLETE_DONE;
+                return NULL;
             }
+        }
 
-            // If it's a directory, add a slash
-            char full_path[PATH_MAX];
-            snprintf(full_path, sizeof(full_path), "%s%s",
-                     directory, entry->d_name);
+        size_t part_len = strlen(file_part);
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL) {
+            // Skip . and .. if at the start of completion
+            if (file_part[0] == '\0' &&
+                (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0)) {
+                continue;
+            }
+            if (strncmp(entry->d_name, file_part, part_len) != 0) {
+                continue;
+            }
 
-            struct stat st;
-            if (stat(full_path, &st) == 0 && S_ISDIR(st.st_mode)) {
-                char *with_slash = malloc(strlen(name) + 2);
-                strcpy(with_slash, name);
-                strcat(with_slash, "/");
-                free(name);
-                name = with_slash;
+            // If it's a directory, add a slash; d_type saves the stat
+            // except on filesystems that don't report it
+            int is_dir = entry->d_type == DT_DIR;
+            if (entry->d_type == DT_UNKNOWN || entry->d_type == DT_LNK) {
+                struct stat st;
+                is_dir = fstatat(dirfd(dir), entry->d_name, &st, 0) == 0 && S_ISDIR(st.st_mode);
             }
 
+            size_t name_len = strlen(directory) + strlen(entry->d_name) + 2;
+            char *name = malloc(name_len);
+            if (!name) {
+                perror("malloc error");
+                break;
+            }
+            snprintf(name, name_len, "%s%s%s", directory, entry->d_name, is_dir ? "/" : "");
             return name;
         }
-    }
 
-    // No more matches
-    closedir(dir);
-    if (directory != "." && directory != NULL) {
-        free(directory);
+        // No more matches
+        closedir(dir);
+        dir = NULL;
+        phase = COMPLETE_DONE;
     }
     return NULL;
 }
@@ -131,5 +125,12 @@ char* myshell_generator(const char* text, int state) {
 // Custom completion function
 char** myshell_completion(const char* text, int start, int end) {
     rl_attempted_completion_over = 1;
+
+    // Command position is the start of the line or just after a pipe
+    int i = start - 1;
+    while (i >= 0 && (rl_line_buffer[i] == ' ' || rl_line_buffer[i] == '\t')) {
+        i--;
+    }
+    completing_command = i < 0 || rl_line_buffer[i] == '|';
     return rl_completion_matches(text, myshell_generator);
-}
\ No newline at end of file
+}
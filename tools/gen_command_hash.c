@@ -0,0 +1,69 @@
+/**
+ * @file gen_command_hash.c
+ * @brief Build-time generator for the built-in command hash table
+ *
+ * Reads the command names from include/commands.def and searches for a
+ * seed under which command_hash() sends every name to a distinct slot of
+ * a small power-of-two table. Prints a header with the seed and the
+ * slot -> commands[] index table; the makefile writes it to
+ * $(OBJ_DIR)/command_table.h. Dispatch is then one hash and one strcmp.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include "command_hash.h"
+
+static const char *names[] = {
+#define COMMAND(name, help) #name,
+#include "commands.def"
+#undef COMMAND
+};
+
+#define N_NAMES ((int)(sizeof(names) / sizeof(names[0])))
+#define MAX_SEEDS 1000000
+#define MAX_BITS 12
+
+int main() {
+    int slots[1 << MAX_BITS];
+
+    // Smallest table first; each doubling makes a seed far easier to find
+    int bits = 0;
+    while ((1 << bits) < N_NAMES) {
+        bits++;
+    }
+
+    for (; bits <= MAX_BITS; bits++) {
+        int size = 1 << bits;
+        for (uint32_t seed = 0; seed < MAX_SEEDS; seed++) {
+            for (int i = 0; i < size; i++) {
+                slots[i] = -1;
+            }
+
+            int ok = 1;
+            for (int n = 0; n < N_NAMES && ok; n++) {
+                uint32_t slot = command_hash(names[n], seed) & (size - 1);
+                if (slots[slot] != -1) {
+                    ok = 0;
+                } else {
+                    slots[slot] = n;
+                }
+            }
+            if (!ok) {
+                continue;
+            }
+
+            printf("// Generated by tools/gen_command_hash.c from include/commands.def; do not edit\n");
+            printf("#define COMMAND_HASH_SEED 0x%08xu\n", seed);
+            printf("#define COMMAND_HASH_BITS %d\n\n", bits);
+            printf("static const int16_t command_slots[1 << COMMAND_HASH_BITS] = {");
+            for (int i = 0; i < size; i++) {
+                printf("%s%d,", i % 16 == 0 ? "\n    " : " ", slots[i]);
+            }
+            printf("\n};\n");
+            return 0;
+        }
+    }
+
+    fprintf(stderr, "gen_command_hash: no perfect hash found for %d commands\n", N_NAMES);
+    return 1;
+}